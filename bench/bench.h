@@ -0,0 +1,54 @@
+/*
+ * bench.h
+ *
+ * Supporto comune ai microbenchmark: misura del tempo, ripetizioni e
+ * stampa dei risultati in un formato stabile e confrontabile tra
+ * revisioni diverse.
+ *
+ * Ogni benchmark esegue un riscaldamento e poi BENCH_RUNS misure da
+ * `iters` iterazioni; viene riportata la mediana in ns/op, meno
+ * sensibile della media ai disturbi occasionali (interrupt, cambi di
+ * contesto). Una riga per benchmark:
+ *   <nome> <ns/op mediana> ns/op (min <ns/op minimo>)
+ */
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_RUNS 7
+
+static inline double bench_now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static int bench_cmp_double(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+// Impedisce al compilatore di eliminare il calcolo misurato
+static inline void bench_consume(const void *p) {
+	__asm__ __volatile__("" : : "r"(p) : "memory");
+}
+
+// Esegue `body` (funzione con indice di iterazione) e stampa il risultato
+static inline void bench_run(const char *name, long iters, void (*body)(long i)) {
+	double samples[BENCH_RUNS];
+	for (long i = 0; i < iters / 10; i++) body(i); // riscaldamento
+	for (int r = 0; r < BENCH_RUNS; r++) {
+		double t0 = bench_now_ns();
+		for (long i = 0; i < iters; i++) body(i);
+		samples[r] = (bench_now_ns() - t0) / (double)iters;
+	}
+	qsort(samples, BENCH_RUNS, sizeof(samples[0]), bench_cmp_double);
+	printf("%-32s %9.2f ns/op (min %.2f)\n", name, samples[BENCH_RUNS / 2], samples[0]);
+	fflush(stdout);
+}
+
+#endif /* BENCH_H_ */
@@ -0,0 +1,86 @@
+/*
+ * bench_citycheck.c
+ *
+ * Microbenchmark: ricerca della città con la scansione lineare originale
+ * di citycheck() (tolower carattere per carattere su valid_cities[])
+ * contro la tabella hash perfetta di city_lookup().
+ *
+ * Compilazione ed esecuzione (dalla cartella bench):
+ *   gcc -O2 -I../server-project/src -o bench_citycheck bench_citycheck.c \
+ *       ../server-project/src/cities.c && ./bench_citycheck
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "cities.h"
+
+#define ITERATIONS 10000000
+
+// Copia della citycheck() originale, come riferimento
+static char citycheck_linear(const char *city) {
+	static const char *valid_cities[] = {
+		"Bari","Roma","Milano","Napoli","Torino",
+		"Palermo","Genova","Bologna","Firenze","Venezia"
+	};
+	for (size_t i = 0; i < sizeof(valid_cities)/sizeof(valid_cities[0]); ++i) {
+		const char *a = city;
+		const char *b = valid_cities[i];
+		while (*a && *b) {
+			if (tolower((unsigned char)*a) != tolower((unsigned char)*b)) {
+				break;
+			}
+			a++; b++;
+		}
+		if (*a == '\0' && *b == '\0') {
+			return 0;
+		}
+	}
+	return 2;
+}
+
+// Miscela di richieste: città presenti (con maiuscole/minuscole diverse),
+// l'ultima della tabella (caso peggiore per la scansione) e città assenti
+static const char *inputs[] = {
+	"bari", "ROMA", "Milano", "napoli", "Venezia", "venezia",
+	"parigi", "Reggio Calabria", "firenze", "Bolzano", "genova", "x"
+};
+#define NINPUTS (sizeof(inputs) / sizeof(inputs[0]))
+
+static double now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+int main(void) {
+	size_t lens[NINPUTS];
+	for (size_t i = 0; i < NINPUTS; i++) lens[i] = strlen(inputs[i]);
+
+	// verifica di coerenza prima di misurare
+	for (size_t i = 0; i < NINPUTS; i++) {
+		int a = citycheck_linear(inputs[i]) == 0;
+		int b = city_lookup(inputs[i], lens[i]) != CITY_ID_NONE;
+		if (a != b) {
+			printf("risultato diverso per '%s'\n", inputs[i]);
+			return 1;
+		}
+	}
+
+	volatile int sink = 0;
+	double t0 = now_ns();
+	for (long i = 0; i < ITERATIONS; i++) {
+		sink += citycheck_linear(inputs[i % NINPUTS]);
+	}
+	double t1 = now_ns();
+	for (long i = 0; i < ITERATIONS; i++) {
+		sink += city_lookup(inputs[i % NINPUTS], lens[i % NINPUTS]);
+	}
+	double t2 = now_ns();
+
+	printf("citycheck lineare : %6.2f ns/op\n", (t1 - t0) / ITERATIONS);
+	printf("city_lookup hash  : %6.2f ns/op\n", (t2 - t1) / ITERATIONS);
+	return 0;
+}
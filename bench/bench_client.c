@@ -0,0 +1,110 @@
+/*
+ * bench_client.c
+ *
+ * Microbenchmark delle funzioni del client che elaborano una risposta:
+ *  - wc_decode_response()   parsing dei 9 byte ricevuti
+ *  - wc_encode_request()    codifica dei 65 byte della richiesta
+ *  - formato v2: le stesse operazioni sui frame compatti, con le
+ *    dimensioni medie sul filo di richiesta e risposta v1/v2
+ *  - wc_format_result()     costruzione del messaggio (snprintf)
+ *  - wc_parse_request()     parsing della stringa "type city"
+ *
+ * Si compila con run_bench.sh, oppure (dalla cartella bench):
+ *   gcc -std=gnu11 -O3 -I../client-project/src -o bench_client \
+ *       bench_client.c ../client-project/src/wclient.c
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+
+#include "bench.h"
+#include "wclient.h"
+
+#define ITERATIONS 5000000
+
+static unsigned char frames[4][RESPONSE_SIZE];
+static unsigned char frames_v2[4][V2_RESPONSE_SIZE];
+static const char types[] = { 't', 'h', 't', 'p' };
+static weather_request_t parsed[4];
+static const char *cities[] = { "bari", "milano", "reggio calabria", "roma" };
+static const char *requests[] = { "t bari", "h milano", "w reggio calabria", "p roma" };
+static weather_response_t responses[4];
+static volatile int sink;
+
+static void encode(unsigned char *out, uint32_t status, char type, float value) {
+	uint32_t s = htonl(status);
+	uint32_t bits;
+	memcpy(out, &s, 4);
+	out[4] = (unsigned char)type;
+	memcpy(&bits, &value, 4);
+	bits = htonl(bits);
+	memcpy(&out[5], &bits, 4);
+}
+
+static void body_decode(long i) {
+	weather_response_t r;
+	wc_decode_response(frames[i & 3], &r);
+	bench_consume(&r);
+}
+
+static void body_decode_v2(long i) {
+	weather_response_t r;
+	wc_decode_response_v2(frames_v2[i & 3], types[i & 3], &r);
+	bench_consume(&r);
+}
+
+static void body_encode(long i) {
+	unsigned char out[REQUEST_SIZE];
+	wc_encode_request(&parsed[i & 3], out);
+	bench_consume(out);
+}
+
+static void body_encode_v2(long i) {
+	unsigned char out[V2_REQUEST_MAX];
+	sink += (int)wc_encode_request_v2(&parsed[i & 3], out);
+	bench_consume(out);
+}
+
+static void body_format(long i) {
+	char message[256];
+	wc_format_result(cities[i & 3], &responses[i & 3], message, sizeof(message));
+	bench_consume(message);
+}
+
+static void body_parse(long i) {
+	weather_request_t req;
+	sink += wc_parse_request(requests[i & 3], &req);
+}
+
+int main(void) {
+	encode(frames[0], STATUS_SUCCESS, 't', 21.5f);
+	encode(frames[1], STATUS_SUCCESS, 'h', 63.2f);
+	encode(frames[2], STATUS_CITY_NOT_AVAILABLE, '\0', 0.0f);
+	encode(frames[3], STATUS_SUCCESS, 'p', 1013.4f);
+	size_t req_v2 = 0, resp_v2 = 0;
+	for (int i = 0; i < 4; i++) {
+		wc_decode_response(frames[i], &responses[i]);
+		wc_parse_request(requests[i], &parsed[i]);
+		unsigned char tmp[V2_REQUEST_MAX];
+		req_v2 += wc_encode_request_v2(&parsed[i], tmp);
+		// risposta v2 equivalente a quella v1
+		frames_v2[i][0] = (unsigned char)responses[i].status;
+		int16_t tenths = (int16_t)(responses[i].value * V2_VALUE_SCALE + 0.5f);
+		frames_v2[i][1] = (unsigned char)((uint16_t)tenths >> 8);
+		frames_v2[i][2] = (unsigned char)tenths;
+		resp_v2 += wc_response_v2_length(frames_v2[i][0]);
+	}
+	printf("client/wire_size v1: richiesta %d B, risposta %d B\n", REQUEST_SIZE, RESPONSE_SIZE);
+	printf("client/wire_size v2: richiesta %.2f B, risposta %.2f B (media sulle voci di prova)\n",
+			req_v2 / 4.0, resp_v2 / 4.0);
+
+	bench_run("client/decode_response", ITERATIONS, body_decode);
+	bench_run("client/decode_response_v2", ITERATIONS, body_decode_v2);
+	bench_run("client/encode_request", ITERATIONS, body_encode);
+	bench_run("client/encode_request_v2", ITERATIONS, body_encode_v2);
+	bench_run("client/format_result", ITERATIONS / 5, body_format);
+	bench_run("client/parse_request", ITERATIONS, body_parse);
+	return 0;
+}
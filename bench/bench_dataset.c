@@ -0,0 +1,128 @@
+/*
+ * bench_dataset.c
+ *
+ * Microbenchmark dell'indice delle città di un dataset (dataset.h) al
+ * crescere del numero di città: per ogni file indicato misura
+ *  - dataset_city_lookup() su nomi presenti (maiuscole/minuscole miste)
+ *    e assenti, con la scansione lineare di citycheck() come riferimento
+ *  - dataset_city_prefix() con prefissi di 4 caratteri e 10 risultati
+ * e riporta l'occupazione in memoria delle strutture del file.
+ *
+ * I file sono generati da run_bench.sh con tools/mkdataset.c; i
+ * sorgenti del server sono linkati come per bench_server.c.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "bench.h"
+#include "dataset.h"
+#include "cities.h"
+#include "protocol.h"
+#include "rng.h"
+
+#define ITERATIONS 2000000
+#define NQUERIES   4096 // potenza di due
+
+static const dataset_t *ds;
+static char hits[NQUERIES][BATCH_CITY_MAX + 1];
+static char misses[NQUERIES][BATCH_CITY_MAX + 1];
+static char prefixes[NQUERIES][5];
+static size_t hit_lens[NQUERIES], miss_lens[NQUERIES], prefix_lens[NQUERIES];
+static volatile int sink;
+
+static void body_lookup_hit(long i) {
+	size_t q = (size_t)i & (NQUERIES - 1);
+	sink += dataset_city_lookup(ds, hits[q], hit_lens[q]);
+}
+
+static void body_lookup_miss(long i) {
+	size_t q = (size_t)i & (NQUERIES - 1);
+	sink += dataset_city_lookup(ds, misses[q], miss_lens[q]);
+}
+
+static void body_prefix(long i) {
+	size_t q = (size_t)i & (NQUERIES - 1);
+	int ids[10];
+	sink += dataset_city_prefix(ds, prefixes[q], prefix_lens[q], ids, 10);
+}
+
+// Scansione lineare con tolower carattere per carattere, come la
+// citycheck() originale, estesa a tutte le città del dataset
+static void body_linear(long i) {
+	size_t q = (size_t)i & (NQUERIES - 1);
+	int n = dataset_city_count(ds);
+	for (int id = 0; id < n; id++) {
+		size_t len;
+		const char *name = dataset_city_name(ds, id, &len);
+		if (len != hit_lens[q]) continue;
+		size_t k = 0;
+		while (k < len && tolower((unsigned char)name[k]) == tolower((unsigned char)hits[q][k])) k++;
+		if (k == len) {
+			sink += id;
+			return;
+		}
+	}
+}
+
+static void prepare_queries(void) {
+	rng_t *r = rng_thread();
+	int n = dataset_city_count(ds);
+	for (size_t q = 0; q < NQUERIES; q++) {
+		size_t len;
+		const char *name = dataset_city_name(ds, (int)rng_range(r, (uint32_t)n), &len);
+		for (size_t k = 0; k < len; k++) {
+			char c = name[k];
+			hits[q][k] = (char)(rng_range(r, 2) ? toupper((unsigned char)c) : tolower((unsigned char)c));
+		}
+		hits[q][len] = '\0';
+		hit_lens[q] = len;
+		memcpy(misses[q], hits[q], len + 1);
+		misses[q][len - 1] = '#'; // stessa lunghezza, ultimo carattere diverso
+		miss_lens[q] = len;
+		prefix_lens[q] = len < 4 ? len : 4;
+		memcpy(prefixes[q], hits[q], prefix_lens[q]);
+		prefixes[q][prefix_lens[q]] = '\0';
+	}
+}
+
+// Occupazione delle sezioni lette dall'intestazione del file
+static void report_memory(const char *path, int count) {
+	dataset_header_t h;
+	FILE *f = fopen(path, "rb");
+	if (!f || fread(&h, sizeof(h), 1, f) != 1) {
+		if (f) fclose(f);
+		return;
+	}
+	fseek(f, 0, SEEK_END);
+	long file_size = ftell(f);
+	fclose(f);
+	size_t hash = (size_t)h.hash_buckets * sizeof(uint32_t) + (size_t)h.hash_size * sizeof(int32_t);
+	size_t sorted = (size_t)h.city_count * (sizeof(uint32_t) + sizeof(uint64_t));
+	size_t records = (size_t)h.city_count * sizeof(dataset_city_t);
+	printf("dataset/%-7d memoria: hash %zu B, indice ordinato %zu B, nomi %u B, record %zu B, file %ld B (%.1f B/citta')\n",
+			count, hash, sorted, h.names_size, records, file_size, (double)file_size / (count ? count : 1));
+}
+
+int main(int argc, char *argv[]) {
+	rng_seed_thread(1);
+	for (int a = 1; a < argc; a++) {
+		if (dataset_open(argv[a]) != 0) return 1;
+		ds = dataset_current();
+		int n = dataset_city_count(ds);
+		prepare_queries();
+
+		char name[64];
+		snprintf(name, sizeof(name), "dataset/%d/lookup", n);
+		bench_run(name, ITERATIONS, body_lookup_hit);
+		snprintf(name, sizeof(name), "dataset/%d/lookup_miss", n);
+		bench_run(name, ITERATIONS, body_lookup_miss);
+		snprintf(name, sizeof(name), "dataset/%d/prefix10", n);
+		bench_run(name, ITERATIONS, body_prefix);
+		snprintf(name, sizeof(name), "dataset/%d/lineare", n);
+		bench_run(name, n > 0 ? 2000000L / n + 10 : 10, body_linear);
+		report_memory(argv[a], n);
+	}
+	return 0;
+}
@@ -0,0 +1,72 @@
+/*
+ * bench_server.c
+ *
+ * Microbenchmark delle funzioni del percorso di richiesta del server,
+ * misurate in isolamento (senza socket né log):
+ *  - citycheck()                  validazione della città
+ *  - build_weather_response()     validazione + generazione del valore
+ *  - serialize_response()         i 9 byte della risposta sul filo
+ *  - frame_length()               riconoscimento del frame ricevuto
+ *
+ * I sorgenti del server vengono compilati con -Dmain=server_main per
+ * poterli linkare così come sono: si veda run_bench.sh.
+ */
+
+#include <string.h>
+#include <stdint.h>
+
+#include "bench.h"
+#include "protocol.h"
+#include "rng.h"
+
+#define ITERATIONS 5000000
+
+// Città presenti (con maiuscole/minuscole diverse) e assenti
+static const char *cities[] = {
+	"bari", "ROMA", "Milano", "napoli", "Venezia", "torino",
+	"parigi", "Reggio Calabria", "firenze", "Bolzano", "genova", "x"
+};
+#define NCITIES (sizeof(cities) / sizeof(cities[0]))
+
+static const char types[] = { 't', 'h', 'w', 'p', 'x' };
+#define NTYPES (sizeof(types) / sizeof(types[0]))
+
+static volatile int sink;
+static weather_response_t responses[64];
+static unsigned char frame[REQUEST_SIZE];
+
+static void body_citycheck(long i) {
+	sink += citycheck(cities[i % NCITIES]);
+}
+
+static void body_build_response(long i) {
+	weather_response_t r = build_weather_response(types[i % NTYPES], cities[i % NCITIES]);
+	sink += (int)r.status;
+}
+
+static void body_serialize(long i) {
+	unsigned char out[RESPONSE_SIZE];
+	serialize_response(&responses[i & 63], out);
+	bench_consume(out);
+}
+
+static void body_frame_length(long i) {
+	(void)i;
+	sink += (int)frame_length(frame, sizeof(frame));
+}
+
+int main(void) {
+	rng_seed_thread(1);
+
+	for (size_t i = 0; i < 64; i++) {
+		responses[i] = build_weather_response(types[i % NTYPES], cities[i % NCITIES]);
+	}
+	frame[0] = 't';
+	strcpy((char *)&frame[1], "bari");
+
+	bench_run("server/citycheck", ITERATIONS, body_citycheck);
+	bench_run("server/build_weather_response", ITERATIONS, body_build_response);
+	bench_run("server/serialize_response", ITERATIONS, body_serialize);
+	bench_run("server/frame_length", ITERATIONS, body_frame_length);
+	return 0;
+}
@@ -0,0 +1,106 @@
+#!/bin/sh
+#
+# run_bench.sh
+#
+# Compila in configurazione Release (-O3) server, client e microbenchmark
+# nella cartella bench/build, esegue i microbenchmark (compreso l'indice
+# delle città su dataset sintetici da 1k, 10k e 100k città) e poi un
+# benchmark end-to-end su loopback: avvia il server e lo satura con il
+# generatore di carico del client (-n/-c/-j), con i diversi backend di
+# I/O del server (ciclo bloccante, epoll, io_uring) e con il trasporto UDP.
+#
+# Uso (da qualsiasi cartella):
+#   bench/run_bench.sh
+# Variabili d'ambiente opzionali:
+#   CC, CFLAGS   compilatore e opzioni (default gcc, -O3)
+#   PORT         prima porta del server di prova (default casuale, una
+#                porta diversa per scenario)
+#   REQUESTS     richieste per scenario end-to-end (default 200000)
+#   CONC         connessioni concorrenti (default 4)
+#
+# Per confrontare due revisioni conviene eseguirlo più volte sulla stessa
+# macchina a riposo e confrontare le mediane riportate.
+
+set -e
+
+cd "$(dirname "$0")"
+ROOT=..
+OUT=build
+CC=${CC:-gcc}
+CFLAGS=${CFLAGS:-"-std=gnu11 -O3 -DNDEBUG -pthread"}
+PORT=${PORT:-$((20000 + $$ % 30000))}
+REQUESTS=${REQUESTS:-200000}
+CONC=${CONC:-4}
+
+mkdir -p "$OUT"
+$CC $CFLAGS -o "$OUT/server" $ROOT/server-project/src/*.c -lm
+$CC $CFLAGS -o "$OUT/client" $ROOT/client-project/src/*.c
+# Sorgenti del server con main rinominato, linkati nel microbenchmark
+mkdir -p "$OUT/server-obj"
+for src in $ROOT/server-project/src/*.c; do
+	$CC $CFLAGS -Dmain=server_main -c -o "$OUT/server-obj/$(basename "$src" .c).o" "$src"
+done
+$CC $CFLAGS -I$ROOT/server-project/src \
+	-o "$OUT/bench_server" bench_server.c "$OUT"/server-obj/*.o -lm
+$CC $CFLAGS -I$ROOT/client-project/src \
+	-o "$OUT/bench_client" bench_client.c $ROOT/client-project/src/wclient.c
+$CC $CFLAGS -I$ROOT/server-project/src \
+	-o "$OUT/bench_citycheck" bench_citycheck.c $ROOT/server-project/src/cities.c
+$CC $CFLAGS -I$ROOT/server-project/src \
+	-o "$OUT/bench_dataset" bench_dataset.c "$OUT"/server-obj/*.o -lm
+$CC $CFLAGS -I$ROOT/server-project/src -o "$OUT/mkdataset" $ROOT/server-project/tools/mkdataset.c -lm
+
+# Dataset sintetici da 1k, 10k e 100k città con nomi di più parole
+for n in 1000 10000 100000; do
+	awk -v n="$n" 'BEGIN {
+		split("San Santa Reggio Castel Monte Villa Borgo Porto", a, " ")
+		split("Calabria Emilia Marina Alto Basso Vecchio Nuovo Terme", b, " ")
+		for (i = 0; i < n; i++) printf "%s %s %d,,,,\n", a[i % 8 + 1], b[int(i / 8) % 8 + 1], i
+	}' > "$OUT/cities-$n.csv"
+	"$OUT/mkdataset" "$OUT/cities-$n.csv" "$OUT/cities-$n.wxd" > /dev/null
+done
+
+echo "== microbenchmark"
+"$OUT/bench_server"
+"$OUT/bench_client"
+"$OUT/bench_citycheck"
+"$OUT/bench_dataset" "$OUT/cities-1000.wxd" "$OUT/cities-10000.wxd" "$OUT/cities-100000.wxd"
+
+# Scenario end-to-end: $1 nome, $2 opzioni server, $3 opzioni client
+e2e() {
+	"$OUT/server" -p "$PORT" $2 > /dev/null 2>&1 &
+	spid=$!
+	sleep 0.3
+	if ! kill -0 "$spid" 2>/dev/null; then
+		echo "e2e/$1: avvio del server fallito sulla porta $PORT" >&2
+		PORT=$((PORT + 1))
+		return
+	fi
+	json=$("$OUT/client" -p "$PORT" -n "$REQUESTS" -c "$CONC" -j $3) || true
+	kill "$spid" 2>/dev/null || true
+	wait "$spid" 2>/dev/null || true
+	PORT=$((PORT + 1))
+	rps=$(echo "$json" | sed -n 's/.*"throughput_rps":\([0-9.]*\).*/\1/p')
+	p50=$(echo "$json" | sed -n 's/.*"p50":\([0-9.]*\).*/\1/p')
+	p99=$(echo "$json" | sed -n 's/.*"p99":\([0-9.]*\).*/\1/p')
+	err=$(echo "$json" | sed -n 's/.*"errors":\([0-9]*\).*/\1/p')
+	bpr=$(echo "$json" | sed -n 's/.*"bytes_per_request":\([0-9.]*\).*/\1/p')
+	printf "%-32s %9s req/s (p50 %s us, p99 %s us, %s B/req, errori %s)\n" "e2e/$1" "$rps" "$p50" "$p99" "$bpr" "$err"
+}
+
+echo "== end-to-end (loopback, $REQUESTS richieste, $CONC connessioni)"
+e2e oneshot "" ""
+e2e keepalive "-k" "-k"
+# un datagramma per richiesta, da confrontare con oneshot e keepalive
+e2e udp "--udp" "--udp"
+# formato compatto v2 sulla stessa porta, a confronto con i casi v1
+e2e oneshot-v2 "" "--v2"
+e2e keepalive-v2 "-k" "-k --v2"
+e2e udp-v2 "--udp" "--udp --v2"
+if [ "$(uname)" = "Linux" ]; then
+	e2e epoll-keepalive "-e -k" "-k"
+	# backend io_uring a confronto con i percorsi a socket (se il kernel non
+	# lo supporta il server ripiega sui socket e i numeri coincidono)
+	e2e uring-oneshot "-u" ""
+	e2e uring-keepalive "-u -k" "-k"
+fi
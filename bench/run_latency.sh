@@ -0,0 +1,105 @@
+#!/bin/sh
+#
+# run_latency.sh
+#
+# Confronta la latenza di andata e ritorno di una richiesta su una nuova
+# connessione (client -n/-c 1, una connessione per richiesta) con e senza
+# le opzioni di latenza dei socket: TCP Fast Open, TCP_NODELAY,
+# TCP_DEFER_ACCEPT e SO_BUSY_POLL, singolarmente e come profilo
+# --low-latency su server e client.
+#
+# Sul loopback l'handshake non costa quasi nulla: se lo script e' eseguito
+# da root e tc e' disponibile, l'interfaccia lo riceve un ritardo netem di
+# DELAY_MS per pacchetto (un giro completo costa 2 * DELAY_MS), cosi' il
+# giro risparmiato da Fast Open e' visibile. Per la durata della prova
+# net.ipv4.tcp_fastopen vale 3 (client e server); entrambe le modifiche
+# vengono annullate all'uscita. Senza root la prova gira senza ritardo e
+# con l'impostazione di Fast Open del sistema.
+#
+# SO_BUSY_POLL agisce solo sulle schede con NAPI: sul loopback non cambia
+# i numeri ed e' incluso per completezza del profilo.
+#
+# Uso (da qualsiasi cartella):
+#   bench/run_latency.sh
+# Variabili d'ambiente opzionali:
+#   CC, CFLAGS   compilatore e opzioni (default gcc, -O3)
+#   PORT         prima porta del server di prova (default casuale)
+#   REQUESTS     richieste per scenario (default 200)
+#   DELAY_MS     ritardo netem per pacchetto su lo (default 5, 0 = nessuno)
+
+set -e
+
+cd "$(dirname "$0")"
+ROOT=..
+OUT=build
+CC=${CC:-gcc}
+CFLAGS=${CFLAGS:-"-std=gnu11 -O3 -DNDEBUG -pthread"}
+PORT=${PORT:-$((20000 + $$ % 30000))}
+REQUESTS=${REQUESTS:-200}
+DELAY_MS=${DELAY_MS:-5}
+TFO_SYSCTL=/proc/sys/net/ipv4/tcp_fastopen
+
+mkdir -p "$OUT"
+$CC $CFLAGS -o "$OUT/server" $ROOT/server-project/src/*.c -lm
+$CC $CFLAGS -o "$OUT/client" $ROOT/client-project/src/*.c
+
+netem=0
+tfo_saved=
+cleanup() {
+	if [ "$netem" = 1 ]; then
+		tc qdisc del dev lo root 2>/dev/null || true
+	fi
+	if [ -n "$tfo_saved" ]; then
+		echo "$tfo_saved" > "$TFO_SYSCTL" 2>/dev/null || true
+	fi
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+if [ "$(id -u)" = 0 ] && [ "$(uname)" = "Linux" ]; then
+	if [ -w "$TFO_SYSCTL" ]; then
+		tfo_saved=$(cat "$TFO_SYSCTL")
+		echo 3 > "$TFO_SYSCTL"
+	fi
+	if [ "$DELAY_MS" -gt 0 ] && command -v tc > /dev/null 2>&1 &&
+			tc qdisc add dev lo root netem delay "${DELAY_MS}ms" 2>/dev/null; then
+		netem=1
+	fi
+fi
+if [ "$netem" = 1 ]; then
+	echo "== latenza (lo con netem ${DELAY_MS} ms per pacchetto, $REQUESTS richieste, 1 connessione per richiesta)"
+else
+	echo "== latenza (loopback senza ritardo: netem richiede root, tc e il modulo sch_netem; $REQUESTS richieste)"
+fi
+if [ -r "$TFO_SYSCTL" ]; then
+	echo "net.ipv4.tcp_fastopen = $(cat "$TFO_SYSCTL")"
+fi
+
+# Scenario: $1 nome, $2 opzioni server, $3 opzioni client
+rtt() {
+	"$OUT/server" -p "$PORT" -e $2 > /dev/null 2>&1 &
+	spid=$!
+	sleep 0.3
+	if ! kill -0 "$spid" 2>/dev/null; then
+		echo "lat/$1: avvio del server fallito sulla porta $PORT" >&2
+		PORT=$((PORT + 1))
+		return
+	fi
+	json=$("$OUT/client" -p "$PORT" -n "$REQUESTS" -c 1 -j $3) || true
+	kill "$spid" 2>/dev/null || true
+	wait "$spid" 2>/dev/null || true
+	PORT=$((PORT + 1))
+	p50=$(echo "$json" | sed -n 's/.*"p50":\([0-9.]*\).*/\1/p')
+	p99=$(echo "$json" | sed -n 's/.*"p99":\([0-9.]*\).*/\1/p')
+	err=$(echo "$json" | sed -n 's/.*"errors":\([0-9]*\).*/\1/p')
+	printf "%-28s p50 %10s us  p99 %10s us  (errori %s)\n" "lat/$1" "$p50" "$p99" "$err"
+}
+
+rtt base "" ""
+rtt nodelay "--nodelay" "--nodelay"
+rtt defer-accept "--defer-accept 1" ""
+# la prima connessione ottiene il cookie, le successive portano la
+# richiesta nel SYN: un giro in meno per richiesta
+rtt fastopen "--fastopen 256" "--fastopen"
+rtt busy-poll "--busy-poll 50" "--busy-poll 50"
+rtt low-latency "--low-latency" "--low-latency"
@@ -0,0 +1,66 @@
+/*
+ * hist.c
+ *
+ * Istogramma logaritmico per le latenze del generatore di carico.
+ */
+
+#include "hist.h"
+
+#include <string.h>
+
+// Indice del bucket: i valori < HIST_SUB_BUCKETS hanno un bucket ciascuno,
+// gli altri sono raggruppati per magnitudine (bit piu' significativo) e
+// poi per i HIST_SUB_BITS bit successivi.
+static int bucket_index(uint64_t v) {
+	if (v < HIST_SUB_BUCKETS) return (int)v;
+	int msb = 63 - __builtin_clzll(v);
+	int mag = msb - HIST_SUB_BITS + 1;
+	if (mag >= HIST_MAGNITUDES) return HIST_BUCKETS - 1;
+	int sub = (int)((v >> (msb - HIST_SUB_BITS)) & (HIST_SUB_BUCKETS - 1));
+	return mag * HIST_SUB_BUCKETS + sub;
+}
+
+// Limite superiore (incluso) dei valori del bucket
+static uint64_t bucket_upper(int idx) {
+	int mag = idx / HIST_SUB_BUCKETS;
+	int sub = idx % HIST_SUB_BUCKETS;
+	if (mag == 0) return (uint64_t)sub;
+	int shift = mag - 1;
+	return (((uint64_t)(HIST_SUB_BUCKETS + sub + 1)) << shift) - 1;
+}
+
+void hist_init(hist_t *h) {
+	memset(h, 0, sizeof(*h));
+	h->min = UINT64_MAX;
+}
+
+void hist_record(hist_t *h, uint64_t value) {
+	h->counts[bucket_index(value)]++;
+	h->total++;
+	h->sum += (double)value;
+	if (value < h->min) h->min = value;
+	if (value > h->max) h->max = value;
+}
+
+void hist_merge(hist_t *dst, const hist_t *src) {
+	for (int i = 0; i < HIST_BUCKETS; i++) dst->counts[i] += src->counts[i];
+	dst->total += src->total;
+	dst->sum += src->sum;
+	if (src->min < dst->min) dst->min = src->min;
+	if (src->max > dst->max) dst->max = src->max;
+}
+
+uint64_t hist_percentile(const hist_t *h, double q) {
+	if (h->total == 0) return 0;
+	uint64_t rank = (uint64_t)((q / 100.0) * (double)h->total + 0.5);
+	if (rank < 1) rank = 1;
+	uint64_t seen = 0;
+	for (int i = 0; i < HIST_BUCKETS; i++) {
+		seen += h->counts[i];
+		if (seen >= rank) {
+			uint64_t up = bucket_upper(i);
+			return up < h->max ? up : h->max;
+		}
+	}
+	return h->max;
+}
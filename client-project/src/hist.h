@@ -0,0 +1,36 @@
+/*
+ * hist.h
+ *
+ * Istogramma di latenza con bucket logaritmici: per ogni potenza di due
+ * HIST_SUB_BUCKETS sotto-bucket lineari, quindi errore relativo massimo
+ * 1/HIST_SUB_BUCKETS su qualunque valore, con memoria fissa e
+ * registrazione O(1) senza allocazioni.
+ */
+
+#ifndef HIST_H_
+#define HIST_H_
+
+#include <stdint.h>
+
+#define HIST_SUB_BITS    5
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_MAGNITUDES  40                  // valori fino a 2^40 ns (~18 minuti)
+#define HIST_BUCKETS     (HIST_MAGNITUDES * HIST_SUB_BUCKETS)
+
+typedef struct {
+	uint64_t counts[HIST_BUCKETS];
+	uint64_t total;
+	uint64_t min;
+	uint64_t max;
+	double sum;
+} hist_t;
+
+void hist_init(hist_t *h);
+void hist_record(hist_t *h, uint64_t value);
+void hist_merge(hist_t *dst, const hist_t *src);
+
+// Valore al percentile q (0..100): limite superiore del bucket che lo
+// contiene, limitato al massimo osservato
+uint64_t hist_percentile(const hist_t *h, double q);
+
+#endif /* HIST_H_ */
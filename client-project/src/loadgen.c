@@ -0,0 +1,254 @@
+/*
+ * loadgen.c
+ *
+ * Ogni thread gestisce una connessione alla volta (o una connessione
+ * persistente con -k) e ripete richiesta/risposta finche' non si
+ * raggiunge il numero totale di richieste o la durata indicata. Le
+ * latenze sono misurate dall'apertura della connessione (o dall'invio,
+ * con -k) alla ricezione completa della risposta.
+ */
+
+#include "loadgen.h"
+#include "protocol.h"
+#include "wclient.h"
+#include "hist.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+#if defined _WIN32
+#include <winsock2.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#define closesocket close
+#endif
+
+#define LOADGEN_MAX_MIX 256
+
+typedef struct {
+	int id;
+	pthread_t thread;
+	hist_t hist;
+	uint64_t status_counts[4];     // STATUS_SUCCESS .. STATUS_OVERLOADED
+	uint64_t errors;               // errori di connessione o di I/O
+	uint64_t wire_bytes;           // byte di richiesta e risposta sul filo
+} loadgen_thread_t;
+
+static const struct sockaddr_in *target;
+static const loadgen_config_t *config;
+static unsigned char frames[LOADGEN_MAX_MIX][REQUEST_SIZE];
+static size_t frame_lens[LOADGEN_MAX_MIX];
+static char frame_types[LOADGEN_MAX_MIX];
+static int nframes;
+static atomic_long issued;
+static uint64_t deadline_ns;       // 0 = nessuna scadenza
+
+static uint64_t now_ns(void) {
+#if defined _WIN32
+	LARGE_INTEGER f, c;
+	QueryPerformanceFrequency(&f);
+	QueryPerformanceCounter(&c);
+	return (uint64_t)((double)c.QuadPart * 1e9 / (double)f.QuadPart);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// Prepara i frame (65 byte, o v2 compatti) a partire dalla lista
+// "type city,type city"
+static int build_mix(const char *list) {
+	nframes = 0;
+	const char *p = list;
+	while (*p && nframes < LOADGEN_MAX_MIX) {
+		const char *end = strchr(p, ',');
+		size_t len = end ? (size_t)(end - p) : strlen(p);
+		char entry[128];
+		if (len >= sizeof(entry)) len = sizeof(entry) - 1;
+		memcpy(entry, p, len);
+		entry[len] = '\0';
+		weather_request_t req;
+		if (!wc_parse_request(entry, &req)) {
+			fprintf(stderr, "Voce non valida nel mix: '%s'\n", entry);
+			return -1;
+		}
+		frame_types[nframes] = req.type;
+		if (config->v2) {
+			frame_lens[nframes] = wc_encode_request_v2(&req, frames[nframes]);
+		} else {
+			wc_encode_request(&req, frames[nframes]);
+			frame_lens[nframes] = REQUEST_SIZE;
+		}
+		nframes++;
+		if (!end) break;
+		p = end + 1;
+	}
+	return nframes > 0 ? 0 : -1;
+}
+
+// Prenota la prossima richiesta: ritorna 0 quando il test e' concluso
+static int claim_request(void) {
+	if (config->total > 0 && atomic_fetch_add(&issued, 1) >= config->total) return 0;
+	if (deadline_ns && now_ns() >= deadline_ns) return 0;
+	return 1;
+}
+
+// Lunghezza della risposta attesa a partire dal suo primo byte
+static size_t response_length(const unsigned char *respbuf) {
+	return config->v2 ? wc_response_v2_length(respbuf[0]) : RESPONSE_SIZE;
+}
+
+// Richiesta su TCP; in caso di errore la connessione viene chiusa e
+// riaperta alla richiesta successiva. Ritorna i byte della risposta, 0 in
+// caso di errore.
+static size_t exchange_tcp(int *sock, int f, unsigned char *respbuf) {
+	if (*sock < 0 && (*sock = wc_connect(target)) < 0) return 0;
+	size_t first = config->v2 ? 1 : RESPONSE_SIZE;
+	size_t len = 0;
+	uint64_t deadline = wc_deadline(); // --timeout per l'intera richiesta
+	if (wc_send_until(*sock, frames[f], frame_lens[f], deadline) == 0 &&
+			wc_recv_until(*sock, respbuf, first, deadline) == 0) {
+		len = response_length(respbuf);
+		if (len > first && wc_recv_until(*sock, respbuf + first, len - first, deadline) != 0) len = 0;
+	}
+	if (len == 0) {
+		closesocket(*sock);
+		*sock = -1;
+	}
+	return len;
+}
+
+// Richiesta su UDP con un socket per thread; una risposta persa anche
+// dopo le ritrasmissioni conta come errore
+static size_t exchange_udp(int *sock, int f, unsigned char *respbuf) {
+	if (*sock < 0 && (*sock = wc_udp_open(target)) < 0) return 0;
+	int n = wc_udp_exchange(*sock, frames[f], frame_lens[f], respbuf, RESPONSE_SIZE,
+			config->timeout_ms, config->retries);
+	return (n > 0 && (size_t)n == response_length(respbuf)) ? (size_t)n : 0;
+}
+
+static void *loadgen_thread(void *arg) {
+	loadgen_thread_t *t = (loadgen_thread_t *)arg;
+	int sock = -1;
+	int next = t->id % nframes;
+
+	while (claim_request()) {
+		int f = next;
+		next = (next + 1) % nframes;
+
+		uint64_t t0 = now_ns();
+		unsigned char respbuf[RESPONSE_SIZE];
+		size_t resp_len = config->udp ? exchange_udp(&sock, f, respbuf) : exchange_tcp(&sock, f, respbuf);
+		if (resp_len == 0) {
+			t->errors++;
+			continue;
+		}
+		hist_record(&t->hist, now_ns() - t0);
+		t->wire_bytes += frame_lens[f] + resp_len;
+
+		weather_response_t r;
+		if (config->v2) wc_decode_response_v2(respbuf, frame_types[f], &r);
+		else wc_decode_response(respbuf, &r);
+		if (r.status <= STATUS_OVERLOADED) t->status_counts[r.status]++;
+
+		// oltre il limite di connessioni il server chiude dopo la risposta
+		if ((!config->keepalive || r.status == STATUS_OVERLOADED) && !config->udp) {
+			closesocket(sock);
+			sock = -1;
+		}
+	}
+	if (sock >= 0) closesocket(sock);
+	return NULL;
+}
+
+static void print_report(const hist_t *h, const uint64_t *status, uint64_t errors, uint64_t wire_bytes, double elapsed) {
+	double rps = elapsed > 0 ? (double)h->total / elapsed : 0.0;
+	double bytes_per_req = h->total ? (double)wire_bytes / (double)h->total : 0.0;
+	double us[6] = {
+		hist_percentile(h, 50.0) / 1000.0,
+		hist_percentile(h, 90.0) / 1000.0,
+		hist_percentile(h, 99.0) / 1000.0,
+		hist_percentile(h, 99.9) / 1000.0,
+		h->total ? h->max / 1000.0 : 0.0,
+		h->total ? h->sum / (double)h->total / 1000.0 : 0.0
+	};
+
+	if (config->json) {
+		printf("{\"requests\":%llu,\"errors\":%llu,\"concurrency\":%d,\"keepalive\":%s,\"transport\":\"%s\","
+				"\"format\":\"%s\",\"bytes_per_request\":%.1f,\"duration_s\":%.3f,\"throughput_rps\":%.1f,"
+				"\"status\":{\"success\":%llu,\"city_not_available\":%llu,\"invalid_request\":%llu,\"overloaded\":%llu},"
+				"\"latency_us\":{\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"p99_9\":%.1f,\"max\":%.1f,\"mean\":%.1f}}\n",
+				(unsigned long long)h->total, (unsigned long long)errors, config->concurrency,
+				config->keepalive ? "true" : "false", config->udp ? "udp" : "tcp",
+				config->v2 ? "v2" : "v1", bytes_per_req, elapsed, rps,
+				(unsigned long long)status[0], (unsigned long long)status[1], (unsigned long long)status[2],
+				(unsigned long long)status[3], us[0], us[1], us[2], us[3], us[4], us[5]);
+		return;
+	}
+
+	printf("Richieste completate: %llu (errori: %llu)\n", (unsigned long long)h->total, (unsigned long long)errors);
+	printf("Esiti: successo %llu, citta' non disponibile %llu, richiesta non valida %llu, sovraccarico %llu\n",
+			(unsigned long long)status[0], (unsigned long long)status[1], (unsigned long long)status[2],
+			(unsigned long long)status[3]);
+	printf("Durata: %.3f s, %s: %d%s\n", elapsed, config->udp ? "socket UDP" : "connessioni",
+			config->concurrency, (config->keepalive && !config->udp) ? " persistenti" : "");
+	printf("Throughput: %.1f req/s\n", rps);
+	printf("Byte sul filo per richiesta (formato %s): %.1f\n", config->v2 ? "v2" : "v1", bytes_per_req);
+	printf("Latenza (us): p50 %.1f, p90 %.1f, p99 %.1f, p99.9 %.1f, max %.1f, media %.1f\n",
+			us[0], us[1], us[2], us[3], us[4], us[5]);
+}
+
+int run_loadgen(const struct sockaddr_in *server_addr, const loadgen_config_t *cfg) {
+	if (cfg->concurrency < 1 || cfg->concurrency > LOADGEN_MAX_THREADS) {
+		fprintf(stderr, "Numero di connessioni non valido: %d (1-%d)\n", cfg->concurrency, LOADGEN_MAX_THREADS);
+		return 1;
+	}
+	config = cfg;
+	if (build_mix(cfg->mix ? cfg->mix : LOADGEN_DEFAULT_MIX) != 0) return 1;
+
+	target = server_addr;
+	atomic_init(&issued, 0);
+
+	loadgen_thread_t *threads = calloc((size_t)cfg->concurrency, sizeof(*threads));
+	if (!threads) return 1;
+
+	uint64_t start = now_ns();
+	deadline_ns = cfg->duration > 0 ? start + (uint64_t)cfg->duration * 1000000000ull : 0;
+	int started = 0;
+	for (int i = 0; i < cfg->concurrency; i++) {
+		threads[i].id = i;
+		hist_init(&threads[i].hist);
+		if (pthread_create(&threads[i].thread, NULL, loadgen_thread, &threads[i]) != 0) {
+			fprintf(stderr, "Impossibile creare il thread %d\n", i);
+			break;
+		}
+		started++;
+	}
+
+	hist_t total;
+	hist_init(&total);
+	uint64_t status[4] = { 0, 0, 0, 0 };
+	uint64_t errors = 0;
+	uint64_t wire_bytes = 0;
+	for (int i = 0; i < started; i++) {
+		pthread_join(threads[i].thread, NULL);
+		hist_merge(&total, &threads[i].hist);
+		for (int s = 0; s < 4; s++) status[s] += threads[i].status_counts[s];
+		errors += threads[i].errors;
+		wire_bytes += threads[i].wire_bytes;
+	}
+	double elapsed = (double)(now_ns() - start) / 1e9;
+
+	print_report(&total, status, errors, wire_bytes, elapsed);
+	free(threads);
+	return (started == cfg->concurrency && errors == 0) ? 0 : 1;
+}
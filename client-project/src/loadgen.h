@@ -0,0 +1,33 @@
+/*
+ * loadgen.h
+ *
+ * Generatore di carico del client: guida il protocollo binario da piu'
+ * thread, registra la latenza di ogni richiesta in un istogramma
+ * logaritmico e stampa throughput e percentili.
+ */
+
+#ifndef LOADGEN_H_
+#define LOADGEN_H_
+
+#define LOADGEN_MAX_THREADS 256
+#define LOADGEN_DEFAULT_MIX "t bari,h roma,w milano,p napoli"
+
+typedef struct {
+	long total;          // -n: richieste totali, 0 = limitate solo da -d
+	int concurrency;     // -c: connessioni (thread) concorrenti
+	int duration;        // -d: durata massima in secondi, 0 = nessuna
+	const char *mix;     // -m: richieste "type city,..." usate a rotazione
+	int keepalive;       // -k: una connessione persistente per thread
+	int json;            // -j: report in JSON
+	int udp;             // --udp: un datagramma per richiesta
+	int v2;              // --v2: formato compatto v2
+	int timeout_ms;      // --timeout: attesa di una risposta UDP
+	int retries;         // --retries: ritrasmissioni di una richiesta UDP
+} loadgen_config_t;
+
+struct sockaddr_in;
+
+// Esegue il test di carico. Restituisce 0 in caso di successo, 1 altrimenti.
+int run_loadgen(const struct sockaddr_in *server_addr, const loadgen_config_t *cfg);
+
+#endif /* LOADGEN_H_ */
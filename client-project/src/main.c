@@ -23,172 +23,568 @@
 #endif
 
 #include "protocol.h"
-
-//Correzione problema lettura caratteri speciali in console Windows
-#if defined _WIN32
-#define DEG_C_SUFFIX "C"
-#else
-#define DEG_C_SUFFIX "°C"
-#endif
+#include "wclient.h"
+#include "loadgen.h"
+#include "rcache.h"
 
 /*
- * my_inet_pton
- * Wrapper di compatibilità per `inet_pton`.
- * Alcune toolchain Windows (MinGW) non forniscono inet_pton; questa
- * funzione tenta prima la conversione con `inet_addr` e, se fallisce,
- * risolve il nome host con `gethostbyname`.
- *
- * Parametri:
- *  - af: address family (AF_INET)
- *  - src: stringa contenente l'indirizzo IP o hostname
- *  - dst: puntatore dove scrivere la struttura in_addr risultante
+ * print_usage
+ * Stampa il formato corretto dell'utilizzo del programma.
  *
- * Restituisce 1 in caso di successo, 0 in caso di errore.
+ * static void print_usage(const char *progname)
+{
+    printf("Usage: %s [-s server] [-p port] -r \"type city\"\n", progname);
+}
+*/
+
+/*
+ * validaporta
+ * Verifica che la stringa fornita rappresenti un numero intero
+ * compreso nell'intervallo delle porte valide (1-65535).
+ * Se valida, scrive il valore in `out_port` e restituisce 1.
+ * Altrimenti restituisce 0.
  */
-static int my_inet_pton(int af, const char *src, void *dst)
+static int validaporta(const char *s, int *out_port)
 {
-#if defined _WIN32
-    if (af != AF_INET) return 0;
-    unsigned long a = inet_addr(src);
-    if (a == INADDR_NONE) {
-        struct hostent *he = gethostbyname(src);
-        if (!he) return 0;
-        memcpy(dst, he->h_addr_list[0], he->h_length);
-        return 1;
-    }
-    struct in_addr in;
-    in.s_addr = a;
-    memcpy(dst, &in, sizeof(in));
+    char *end;
+    errno = 0;
+    long v = strtol(s, &end, 10);
+    if (errno != 0) return 0;
+    if (*end != '\0') return 0;
+    if (v < 1 || v > 65535) return 0;
+    *out_port = (int)v;
     return 1;
-#else
-    return inet_pton(af, src, dst);
-#endif
 }
 
 /*
- * my_inet_ntop
- * Wrapper di compatibilità per `inet_ntop`.
- * Converte una struttura in_addr in una stringa leggibile. Su Windows usa
- * inet_ntoa e copia il risultato in `dst`.
- *
- * Parametri:
- *  - af: address family
- *  - src: puntatore alla struttura in_addr
- *  - dst: buffer di destinazione
- *  - size: dimensione del buffer
- *
- * Restituisce `dst` in caso di successo, NULL in caso di errore.
+ * print_result
+ * Costruzione del messaggio finale da mostrare all'utente secondo la
+ * specifica: "Ricevuto risultato dal server ip <ip_address>. <messaggio>"
  */
-static const char *my_inet_ntop(int af, const void *src, char *dst, size_t size)
+static void print_result(const char *peer_ip, const char *req_city, const weather_response_t *r)
 {
-#if defined _WIN32
-    if (af != AF_INET) return NULL;
-    const struct in_addr *in = (const struct in_addr *)src;
-    const char *s = inet_ntoa(*in);
-    if (!s) return NULL;
-    strncpy(dst, s, size - 1);
-    dst[size - 1] = '\0';
-    return dst;
-#else
-    return inet_ntop(af, src, dst, (socklen_t)size);
-#endif
+    char message[256];
+    wc_format_result(req_city, r, message, sizeof(message));
+    printf("Ricevuto risultato dal server ip %s. %s\n", peer_ip, message);
 }
 
+// Opzioni del trasporto UDP (--udp, --timeout, --retries)
+static int use_udp = 0;
+static int udp_timeout_ms = WC_UDP_TIMEOUT_MS;
+static int udp_retries = WC_UDP_RETRIES;
+// Formato compatto v2 per le richieste classiche (--v2)
+static int use_v2 = 0;
+// Cache persistente dei risultati (--cache, --cache-ttl), NULL = nessuna
+static rcache_t *cache = NULL;
+static int cache_ttl_ms = RCACHE_TTL_MS;
+
 /*
- * print_usage
- * Stampa il formato corretto dell'utilizzo del programma.
- *
- * static void print_usage(const char *progname)
+ * exchange
+ * Invia il frame `req` e riceve i `resp_len` byte della risposta, su una
+ * nuova connessione TCP oppure in un datagramma UDP (--udp) con timeout e
+ * ritrasmissione. Con `v2` la risposta è in formato v2 e la sua lunghezza
+ * (al più `resp_len`) dipende dal primo byte. Il socket resta aperto in
+ * *sock_out per ricavare l'IP del server e va chiuso dal chiamante.
+ * Restituisce 0 in caso di successo, -1 in caso di errore (già segnalato
+ * su stderr).
+ */
+static int exchange(const struct sockaddr_in *server_addr, const void *req, size_t req_len,
+                    unsigned char *resp, size_t resp_len, int v2, int *sock_out)
 {
-    printf("Usage: %s [-s server] [-p port] -r \"type city\"\n", progname);
+    int sock = use_udp ? wc_udp_open(server_addr) : wc_connect(server_addr);
+    *sock_out = sock;
+    if (sock < 0) return -1;
+
+    if (use_udp) {
+        int n = wc_udp_exchange(sock, req, req_len, resp, resp_len, udp_timeout_ms, udp_retries);
+        size_t expected = (v2 && n > 0) ? wc_response_v2_length(resp[0]) : resp_len;
+        if (n < 0 || (size_t)n != expected) {
+            fprintf(stderr, n < 0 ? "No response from server\n" : "Failed to receive response\n");
+            return -1;
+        }
+        return 0;
+    }
+    // una sola scadenza per invio e risposta (--timeout)
+    uint64_t deadline = wc_deadline();
+    if (wc_send_until(sock, req, req_len, deadline) != 0) {
+        fprintf(stderr, "Failed to send request\n");
+        return -1;
+    }
+    size_t first = v2 ? 1 : resp_len;
+    if (wc_recv_until(sock, resp, first, deadline) != 0
+            || (v2 && wc_recv_until(sock, resp + 1, wc_response_v2_length(resp[0]) - 1, deadline) != 0)) {
+        fprintf(stderr, "Failed to receive response\n");
+        return -1;
+    }
+    return 0;
 }
-*/
 
 /*
- * send_all
- * Assicura l'invio di tutti i byte del buffer sul socket. `send` potrebbe
- * inviare un numero di byte inferiore a quelli richiesti, pertanto si itera
- * finché tutto il buffer non è stato inviato o si verifica un errore.
- * Restituisce 0 in caso di successo, -1 in caso di errore.
+ * run_oneshot
+ * Comportamento classico: una connessione (o un datagramma, con --udp) per
+ * richiesta, chiusa dopo la risposta, nel formato v1 o v2 (--v2). Con
+ * --cache una risposta recente viene stampata senza contattare il server.
+ * Restituisce 0 in caso di successo, 1 in caso di errore.
  */
-static int send_all(int sock, const void *buf, size_t len)
+static int run_oneshot(const struct sockaddr_in *server_addr, const char *server,
+                       const weather_request_t *req)
 {
-    const char *p = (const char *)buf;
-    size_t remaining = len;
-    while (remaining > 0) {
-        int sent = send(sock, p, (int)remaining, 0);
-        if (sent <= 0) return -1;
-        p += sent;
-        remaining -= sent;
+    unsigned char reqbuf[REQUEST_SIZE];
+    unsigned char respbuf[RESPONSE_SIZE];
+    size_t req_len = REQUEST_SIZE;
+    int sock;
+    weather_response_t r;
+    char peer_ip[INET_ADDRSTRLEN];
+    if (cache && rcache_get(cache, server_addr, req, cache_ttl_ms, &r, peer_ip, sizeof(peer_ip)) == 0) {
+        print_result(peer_ip, req->city, &r);
+        return 0;
     }
+    if (use_v2) req_len = wc_encode_request_v2(req, reqbuf);
+    else wc_encode_request(req, reqbuf);
+    if (exchange(server_addr, reqbuf, req_len, respbuf,
+                 use_v2 ? V2_RESPONSE_SIZE : RESPONSE_SIZE, use_v2, &sock) != 0) {
+        if (sock >= 0) closesocket(sock);
+        return 1;
+    }
+
+    if (use_v2) wc_decode_response_v2(respbuf, req->type, &r);
+    else wc_decode_response(respbuf, &r);
+    wc_peer_ip(sock, server, peer_ip, sizeof(peer_ip));
+    print_result(peer_ip, req->city, &r);
+    if (cache) rcache_put(cache, server_addr, req, &r, peer_ip);
+
+    closesocket(sock);
     return 0;
 }
 
 /*
- * recv_all
- * Riceve esattamente `len` byte dal socket. Poiché `recv` può restituire
- * meno byte di quelli richiesti, si itera finché non si riceve l'intero
- * buffer o si verifica un errore/chiusura della connessione.
- * Restituisce 0 in caso di successo, -1 in caso di errore.
+ * run_pipelined
+ * Connessione persistente (-k): tutte le richieste valide vengono accodate
+ * sulla stessa connessione tramite l'API non bloccante, senza attendere
+ * le risposte, e i risultati vengono stampati nell'ordine delle richieste.
+ * Con --cache partono solo le richieste senza una risposta recente, e se
+ * non ne resta nessuna la connessione non viene aperta. Richiede un server
+ * avviato con -k. Restituisce 0 in caso di successo, 1 in caso di errore.
+ */
+static int run_pipelined(const struct sockaddr_in *server_addr, const char *server,
+                         const weather_request_t *reqs, const int *valid, int count)
+{
+    wc_future_t futs[MAX_REQUESTS];
+    int cached[MAX_REQUESTS];
+    char cached_ip[MAX_REQUESTS][INET_ADDRSTRLEN];
+    int pending = 0;
+    for (int i = 0; i < count; ++i) {
+        cached[i] = valid[i] && cache
+                    && rcache_get(cache, server_addr, &reqs[i], cache_ttl_ms, &futs[i].resp,
+                                  cached_ip[i], sizeof(cached_ip[i])) == 0;
+        if (valid[i] && !cached[i]) pending++;
+    }
+
+    wc_conn_t *conn = NULL;
+    char peer_ip[INET_ADDRSTRLEN];
+    if (pending > 0) {
+        conn = wc_open(server_addr);
+        if (!conn) {
+            perror("connect");
+            return 1;
+        }
+        wc_set_v2(conn, use_v2);
+        for (int i = 0; i < count; ++i) {
+            if (valid[i] && !cached[i]) wc_submit_future(conn, &reqs[i], &futs[i]);
+        }
+        // senza risposte per wc_timeout() ms la connessione si considera persa
+        if (wc_run(conn, wc_timeout() > 0 ? wc_timeout() : -1) != 0) {
+            fprintf(stderr, "Failed to receive response\n");
+            wc_close(conn);
+            return 1;
+        }
+        wc_peer_ip(wc_fd(conn), server, peer_ip, sizeof(peer_ip));
+    }
+
+    int rc = 0;
+    for (int i = 0; i < count; ++i) {
+        if (!valid[i]) {
+            printf("Ricevuto risultato dal server ip %s. Richiesta non valida\n", server);
+            rc = 1;
+            continue;
+        }
+        print_result(cached[i] ? cached_ip[i] : peer_ip, reqs[i].city, &futs[i].resp);
+        if (cache && !cached[i]) rcache_put(cache, server_addr, &reqs[i], &futs[i].resp, peer_ip);
+    }
+
+    if (conn) wc_close(conn);
+    return rc;
+}
+
+/*
+ * parse_list
+ * Analizza le voci di `list` (formato "type city,type city,...") in
+ * `reqs`, segnando in `valid` quelle corrette e contandole in *nvalid.
+ * Restituisce il numero di voci, oppure -1 se sono più di `max`.
+ */
+static int parse_list(const char *list, weather_request_t *reqs, int *valid, int max, int *nvalid)
+{
+    int count = 0;
+    *nvalid = 0;
+    const char *p = list;
+    while (*p) {
+        const char *end = strchr(p, ',');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        if (count == max) return -1;
+        char entry[128];
+        if (len >= sizeof(entry)) len = sizeof(entry) - 1;
+        memcpy(entry, p, len);
+        entry[len] = '\0';
+        valid[count] = wc_parse_request(entry, &reqs[count]);
+        if (valid[count]) (*nvalid)++;
+        count++;
+        if (!end) break;
+        p = end + 1;
+    }
+    return count;
+}
+
+/*
+ * run_batch
+ * Invia tutte le voci di `list` (formato "type city,type city,...") in un
+ * unico frame batch e stampa una riga per voce, nello stesso ordine.
+ * Le voci malformate non vengono inviate e sono segnalate come richieste
+ * non valide. Restituisce 0 in caso di successo, 1 in caso di errore.
+ */
+static int run_batch(const struct sockaddr_in *server_addr, const char *server, const char *list)
+{
+    static weather_request_t reqs[BATCH_MAX];
+    int valid[BATCH_MAX];
+    int sent = 0;
+    int count = parse_list(list, reqs, valid, BATCH_MAX, &sent);
+    if (count < 0) {
+        fprintf(stderr, "Troppe voci nel batch (massimo %d)\n", BATCH_MAX);
+        return 1;
+    }
+
+    int rc = 0;
+    int sock = -1;
+    char peer_ip[INET_ADDRSTRLEN];
+    unsigned char respbuf[MAX_RESPONSE_FRAME];
+    if (sent > 0) {
+        // Preparazione del frame: intestazione + voci di lunghezza variabile
+        static unsigned char reqbuf[MAX_REQUEST_FRAME];
+        size_t len = BATCH_HEADER_SIZE;
+        reqbuf[0] = BATCH_MAGIC;
+        reqbuf[1] = (unsigned char)(sent >> 8);
+        reqbuf[2] = (unsigned char)(sent & 0xFF);
+        for (int i = 0; i < count; ++i) {
+            if (!valid[i]) continue;
+            size_t clen = strnlen(reqs[i].city, BATCH_CITY_MAX);
+            reqbuf[len] = (unsigned char)reqs[i].type;
+            reqbuf[len + 1] = (unsigned char)clen;
+            memcpy(&reqbuf[len + 2], reqs[i].city, clen);
+            len += 2 + clen;
+        }
+
+        size_t resp_len = BATCH_HEADER_SIZE + (size_t)sent * RESPONSE_SIZE;
+        if (exchange(server_addr, reqbuf, len, respbuf, resp_len, 0, &sock) != 0) {
+            if (sock >= 0) closesocket(sock);
+            return 1;
+        }
+        if (respbuf[0] != BATCH_MAGIC || ((respbuf[1] << 8) | respbuf[2]) != sent) {
+            fprintf(stderr, "Failed to receive response\n");
+            closesocket(sock);
+            return 1;
+        }
+        wc_peer_ip(sock, server, peer_ip, sizeof(peer_ip));
+    }
+
+    const unsigned char *rp = respbuf + BATCH_HEADER_SIZE;
+    for (int i = 0; i < count; ++i) {
+        if (!valid[i]) {
+            printf("Ricevuto risultato dal server ip %s. Richiesta non valida\n", server);
+            rc = 1;
+            continue;
+        }
+        weather_response_t r;
+        wc_decode_response(rp, &r);
+        print_result(peer_ip, reqs[i].city, &r);
+        rp += RESPONSE_SIZE;
+    }
+
+    if (sock >= 0) closesocket(sock);
+    return rc;
+}
+
+/*
+ * run_subscribe
+ * Sottoscrive le voci di `list` (--subscribe) e stampa i valori iniziali e
+ * poi ogni aggiornamento ricevuto dal server, fino a `updates` frame push
+ * (0 = finché la connessione resta aperta). Con `interval_ms` 0 il server
+ * invia solo i valori cambiati, altrimenti tutti a intervallo fisso.
+ * Richiede un server avviato con -e e --snapshot. Restituisce 0 in caso di
+ * successo, 1 in caso di errore.
+ */
+static int run_subscribe(const struct sockaddr_in *server_addr, const char *server, const char *list,
+                         unsigned int interval_ms, long updates)
+{
+    weather_request_t reqs[SUB_MAX];
+    weather_request_t sent_reqs[SUB_MAX];
+    int valid[SUB_MAX];
+    int nvalid = 0;
+    int count = parse_list(list, reqs, valid, SUB_MAX, &nvalid);
+    if (count < 0) {
+        fprintf(stderr, "Troppe voci nella sottoscrizione (massimo %d)\n", SUB_MAX);
+        return 1;
+    }
+    int rc = 0;
+    for (int i = 0; i < count; ++i) {
+        if (!valid[i]) {
+            printf("Ricevuto risultato dal server ip %s. Richiesta non valida\n", server);
+            rc = 1;
+        }
+    }
+    if (nvalid == 0) return 1;
+
+    // il server numera le voci nell'ordine in cui sono inviate
+    int n = 0;
+    for (int i = 0; i < count; ++i) {
+        if (valid[i]) sent_reqs[n++] = reqs[i];
+    }
+    unsigned char frame[SUB_HEADER_SIZE + SUB_MAX * (2 + BATCH_CITY_MAX)];
+    size_t len = wc_encode_subscribe(sent_reqs, n, interval_ms, frame);
+
+    int sock = wc_connect(server_addr);
+    if (sock < 0) return 1;
+    if (wc_send_all(sock, frame, len) != 0) {
+        fprintf(stderr, "Failed to send request\n");
+        closesocket(sock);
+        return 1;
+    }
+    char peer_ip[INET_ADDRSTRLEN];
+    wc_peer_ip(sock, server, peer_ip, sizeof(peer_ip));
+
+    // il primo frame contiene tutte le voci, anche quelle rifiutate
+    for (long received = 0; updates == 0 || received <= updates; ++received) {
+        wc_push_t push;
+        // con --interval 0 gli aggiornamenti arrivano solo quando i valori
+        // cambiano: la ricezione non ha un'attesa massima
+        if (wc_recv_push(sock, &push, 0) != 0) {
+            if (received == 0) {
+                fprintf(stderr, "Sottoscrizione rifiutata dal server (serve -e con --snapshot)\n");
+                rc = 1;
+            }
+            break;
+        }
+        for (int i = 0; i < push.count; ++i) {
+            if (push.index[i] >= n) continue;
+            print_result(peer_ip, sent_reqs[push.index[i]].city, &push.resp[i]);
+        }
+        fflush(stdout);
+    }
+
+    closesocket(sock);
+    return rc;
+}
+
+/*
+ * run_search
+ * Chiede al server le città il cui nome inizia con `prefix` (--search),
+ * al più `limit`, e le stampa una per riga in ordine alfabetico.
+ * Restituisce 0 in caso di successo, 1 in caso di errore.
  */
-static int recv_all(int sock, void *buf, size_t len)
+static int run_search(const struct sockaddr_in *server_addr, const char *server, const char *prefix,
+                      int limit)
 {
-    char *p = (char *)buf;
-    size_t remaining = len;
-    while (remaining > 0) {
-        int r = recv(sock, p, (int)remaining, 0);
-        if (r <= 0) return -1;
-        p += r;
-        remaining -= r;
+    unsigned char req[SEARCH_HEADER_SIZE + BATCH_CITY_MAX];
+    size_t req_len = wc_encode_search(prefix, limit > 0 ? (unsigned int)limit : 1, req);
+    wc_search_t res;
+    int rc;
+    int sock = wc_connect(server_addr);
+    if (sock < 0) return 1;
+    uint64_t deadline = wc_deadline();
+    rc = wc_send_until(sock, req, req_len, deadline);
+    if (rc == 0) rc = wc_recv_search(sock, &res, deadline);
+    if (rc != 0) {
+        fprintf(stderr, "Failed to receive search results\n");
+        closesocket(sock);
+        return 1;
     }
+    char peer_ip[INET_ADDRSTRLEN];
+    wc_peer_ip(sock, server, peer_ip, sizeof(peer_ip));
+    closesocket(sock);
+
+    printf("Ricevuti %d risultati dal server ip %s per '%s'\n", res.count, peer_ip, prefix);
+    for (int i = 0; i < res.count; ++i) printf("%s\n", res.names[i]);
     return 0;
 }
 
 /*
- * ntohf
- * Converte un uint32_t ricevuto in network byte order nella corrispondente
- * variabile `float` in host byte order. Il float viene trasmesso in rete
- * come bit pattern (uint32_t) e qui si usano ntohl + memcpy per rispettare
- * l'endianness e le aliasing rules.
+ * run_history
+ * Chiede al server gli aggregati della cronologia per la richiesta
+ * "type city" (--history) sugli ultimi `last` campioni e sugli ultimi
+ * `window_ms` millisecondi (0 = nessun limite) e li stampa.
+ * Restituisce 0 in caso di successo, 1 in caso di errore.
  */
-static float ntohf(uint32_t i)
+static int run_history(const struct sockaddr_in *server_addr, const char *server, const char *request,
+                       uint32_t last, uint32_t window_ms)
 {
-    i = ntohl(i);
-    float f;
-    memcpy(&f, &i, sizeof(f));
-    return f;
+    weather_request_t req;
+    if (!wc_parse_request(request, &req)) {
+        printf("Ricevuto risultato dal server ip %s. Richiesta non valida\n", server);
+        return 1;
+    }
+    unsigned char buf[HISTORY_HEADER_SIZE + BATCH_CITY_MAX + HISTORY_TRAILER_SIZE];
+    size_t req_len = wc_encode_history(&req, last, window_ms, buf);
+    unsigned char resp[HISTORY_RESPONSE_SIZE];
+    wc_history_t res;
+    int rc;
+    int sock = wc_connect(server_addr);
+    if (sock < 0) return 1;
+    uint64_t deadline = wc_deadline();
+    rc = wc_send_until(sock, buf, req_len, deadline);
+    if (rc == 0) rc = wc_recv_until(sock, resp, sizeof(resp), deadline);
+    if (rc == 0) rc = wc_decode_history(resp, sizeof(resp), &res);
+    if (rc != 0) {
+        fprintf(stderr, "Failed to receive history\n");
+        closesocket(sock);
+        return 1;
+    }
+    char peer_ip[INET_ADDRSTRLEN];
+    wc_peer_ip(sock, server, peer_ip, sizeof(peer_ip));
+    closesocket(sock);
+
+    if (res.status == STATUS_CITY_NOT_AVAILABLE) {
+        printf("Ricevuto risultato dal server ip %s. Città non disponibile\n", peer_ip);
+        return 1;
+    }
+    if (res.status == STATUS_OVERLOADED) {
+        printf("Ricevuto risultato dal server ip %s. Server sovraccarico, riprovare piu' tardi\n", peer_ip);
+        return 1;
+    }
+    if (res.status != STATUS_SUCCESS) {
+        printf("Ricevuto risultato dal server ip %s. Richiesta non valida\n", peer_ip);
+        return 1;
+    }
+    printf("Ricevuti aggregati dal server ip %s per '%c %s': %u campioni", peer_ip, req.type, req.city,
+           (unsigned int)res.count);
+    if (res.count > 0) {
+        printf(", min %.1f, max %.1f, media %.2f, dev. std. %.2f", res.min, res.max, res.mean, res.stddev);
+    }
+    printf("\n");
+    return 0;
 }
 
 /*
- * validaporta
- * Verifica che la stringa fornita rappresenti un numero intero
- * compreso nell'intervallo delle porte valide (1-65535).
- * Se valida, scrive il valore in `out_port` e restituisce 1.
- * Altrimenti restituisce 0.
+ * run_stats
+ * Richiede le statistiche al server (--stats) e le stampa: richieste per
+ * esito e per tipo, connessioni attive e, per ogni fase, il numero di
+ * campioni con p50 e p99 (limite superiore del bucket, in microsecondi).
  */
-static int validaporta(const char *s, int *out_port)
+static int run_stats(const struct sockaddr_in *server_addr, const char *server)
 {
-    char *end;
-    errno = 0;
-    long v = strtol(s, &end, 10);
-    if (errno != 0) return 0;
-    if (*end != '\0') return 0;
-    if (v < 1 || v > 65535) return 0;
-    *out_port = (int)v;
-    return 1;
+    static const char *stage_names[STATS_STAGES] = {
+        "accept->recv", "recv->build", "build->send"
+    };
+    weather_request_t req;
+    memset(&req, 0, sizeof(req));
+    req.type = STATS_REQUEST;
+    unsigned char reqbuf[REQUEST_SIZE];
+    unsigned char frame[STATS_FRAME_SIZE];
+    wc_encode_request(&req, reqbuf);
+
+    int sock;
+    wc_stats_t st;
+    if (exchange(server_addr, reqbuf, sizeof(reqbuf), frame, sizeof(frame), 0, &sock) != 0) {
+        if (sock >= 0) closesocket(sock);
+        return 1;
+    }
+    if (wc_decode_stats(frame, &st) != 0) {
+        fprintf(stderr, "Failed to receive statistics\n");
+        closesocket(sock);
+        return 1;
+    }
+    char peer_ip[INET_ADDRSTRLEN];
+    wc_peer_ip(sock, server, peer_ip, sizeof(peer_ip));
+    closesocket(sock);
+
+    printf("Statistiche dal server ip %s\n", peer_ip);
+    printf("Esiti: successo %u, citta' non disponibile %u, richiesta non valida %u, sovraccarico %u\n",
+           st.status[0], st.status[1], st.status[2], st.status[3]);
+    printf("Tipi: t %u, h %u, w %u, p %u, altro %u\n",
+           st.types[0], st.types[1], st.types[2], st.types[3], st.types[4]);
+    printf("Connessioni attive: %u, chiuse per scadenza: %u\n", st.active_connections, st.timeouts);
+    for (int i = 0; i < STATS_STAGES; ++i) {
+        unsigned long samples = 0;
+        for (int k = 0; k < STATS_BUCKETS; ++k) samples += st.hist[i][k];
+        printf("Fase %-13s campioni %lu, p50 < %.1f us, p99 < %.1f us\n", stage_names[i], samples,
+               wc_stats_percentile_us(st.hist[i], 0.50), wc_stats_percentile_us(st.hist[i], 0.99));
+    }
+    return 0;
 }
 
 int main(int argc, char *argv[])
 {
     const char *server = SERVER_IP; // unified constant from protocol.h
     int port = SERVER_PORT;         // unified constant from protocol.h
-    const char *request = NULL;
+    const char *requests[MAX_REQUESTS];
+    int count = 0;
+    int keepalive = 0;
+    const char *batch = NULL;
+    int loadtest = 0;
+    int stats = 0;
+    const char *subscribe = NULL;
+    const char *search = NULL;
+    int search_limit = 10;
+    const char *history = NULL;
+    uint32_t history_samples = 0;
+    uint32_t history_window = 0;
+    unsigned int sub_interval = 0;
+    long sub_updates = 0;
+    const char *cache_path = NULL;
+    wc_sockopts_t sockopts;
+    memset(&sockopts, 0, sizeof(sockopts));
+    loadgen_config_t lcfg;
+    memset(&lcfg, 0, sizeof(lcfg));
+    lcfg.concurrency = 1;
 
     /*
      * Parsing degli argomenti da linea di comando
      * -s server : indirizzo del server (opzionale)
      * -p port   : porta del server (opzionale)
-     * -r request: stringa obbligatoria con il formato "type city"
+     * -r request: stringa obbligatoria con il formato "type city",
+     *             ripetibile per inviare più richieste
+     * -k        : tutte le richieste su un'unica connessione persistente
+     * -b list   : un unico frame batch con le voci "type city,type city,..."
+     * --stats   : statistiche interne del server
+     * --subscribe list : sottoscrizione alle voci "type city,..." con
+     *             stampa degli aggiornamenti inviati dal server
+     * --interval ms : aggiornamenti a intervallo fisso (default: a ogni
+     *             variazione); --updates n : termina dopo n aggiornamenti
+     * --search prefix : città il cui nome inizia con prefix (senza
+     *             distinzione tra maiuscole e minuscole); --limit k :
+     *             al più k risultati (default 10, massimo 32)
+     * --history "type city" : aggregati dei valori serviti dal server
+     *             (avviato con --history); --samples n : solo gli ultimi
+     *             n campioni; --window ms : solo gli ultimi ms millisecondi
+     * --udp     : trasporto UDP, un datagramma per richiesta e risposta,
+     *             solo per -r e per il test di carico (il server rifiuta
+     *             su UDP batch, statistiche, ricerche e aggregati)
+     * --v2      : formato compatto v2 per le richieste -r e per -n
+     * --timeout ms, --retries n : attesa di ogni risposta UDP e numero
+     *             di ritrasmissioni; --timeout limita anche la connect
+     *             e ogni richiesta TCP, dall'invio all'ultimo byte della
+     *             risposta (default 5000 ms, 0 = nessuno)
+     * --fastopen : TCP Fast Open, la richiesta parte nel SYN (dalla
+     *             seconda connessione, con il cookie del server)
+     * --nodelay  : TCP_NODELAY sui socket; --busy-poll us : attesa
+     *             attiva in ricezione (SO_BUSY_POLL)
+     * --low-latency : --fastopen, --nodelay e --busy-poll 50 insieme
+     * --cache file : cache persistente delle risposte -r, condivisa tra
+     *             processi (rcache.h); --cache-ttl ms : età massima di
+     *             una risposta in cache (default 10000)
+     * Modalità test di carico (attivata da -n, -c o -d):
+     * -n total  : richieste totali
+     * -c conn   : connessioni concorrenti (una per thread)
+     * -d sec    : durata massima del test
+     * -m list   : richieste usate a rotazione, "type city,type city,..."
+     * -j        : report finale in JSON
      */
     for (int i = 1; i < argc; ++i) {
         if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
@@ -200,207 +596,180 @@ int main(int argc, char *argv[])
                 return 1;
             }
         } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
-            request = argv[++i];
+            if (count == MAX_REQUESTS) {
+                fprintf(stderr, "Troppe richieste (massimo %d)\n", MAX_REQUESTS);
+                return 1;
+            }
+            requests[count++] = argv[++i];
+        } else if (strcmp(argv[i], "-k") == 0) {
+            keepalive = 1;
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            batch = argv[++i];
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            stats = 1;
+        } else if (strcmp(argv[i], "--subscribe") == 0 && i + 1 < argc) {
+            subscribe = argv[++i];
+        } else if (strcmp(argv[i], "--interval") == 0 && i + 1 < argc) {
+            sub_interval = (unsigned int)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--updates") == 0 && i + 1 < argc) {
+            sub_updates = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--search") == 0 && i + 1 < argc) {
+            search = argv[++i];
+        } else if (strcmp(argv[i], "--limit") == 0 && i + 1 < argc) {
+            search_limit = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--history") == 0 && i + 1 < argc) {
+            history = argv[++i];
+        } else if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc) {
+            history_samples = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--window") == 0 && i + 1 < argc) {
+            history_window = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--udp") == 0) {
+            use_udp = 1;
+        } else if (strcmp(argv[i], "--v2") == 0) {
+            use_v2 = 1;
+        } else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc) {
+            udp_timeout_ms = atoi(argv[++i]);
+            wc_set_timeout(udp_timeout_ms);
+        } else if (strcmp(argv[i], "--fastopen") == 0) {
+            sockopts.fastopen = 1;
+        } else if (strcmp(argv[i], "--nodelay") == 0) {
+            sockopts.nodelay = 1;
+        } else if (strcmp(argv[i], "--busy-poll") == 0 && i + 1 < argc) {
+            sockopts.busy_poll_us = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--low-latency") == 0) {
+            sockopts.fastopen = 1;
+            sockopts.nodelay = 1;
+            if (sockopts.busy_poll_us == 0) sockopts.busy_poll_us = WC_BUSY_POLL_US;
+        } else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+            cache_path = argv[++i];
+        } else if (strcmp(argv[i], "--cache-ttl") == 0 && i + 1 < argc) {
+            cache_ttl_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--retries") == 0 && i + 1 < argc) {
+            udp_retries = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            lcfg.total = atol(argv[++i]);
+            loadtest = 1;
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            lcfg.concurrency = atoi(argv[++i]);
+            loadtest = 1;
+        } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            lcfg.duration = atoi(argv[++i]);
+            loadtest = 1;
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            lcfg.mix = argv[++i];
+        } else if (strcmp(argv[i], "-j") == 0) {
+            lcfg.json = 1;
         } else {
             //print_usage(argv[0]);
             return 1;
         }
     }
 
-    if (!request) {
+    if (loadtest && lcfg.total <= 0 && lcfg.duration <= 0) {
+        lcfg.total = 10000; // default: 10000 richieste
+    }
+
+    if (count == 0 && !batch && !loadtest && !stats && !subscribe && !search && !history) {
         //print_usage(argv[0]);
         return 1;
     }
 
-    /*
-     * Inizializzazione Winsock su Windows. Su sistemi POSIX questa sezione
-     * viene saltata.
-     */
-#if defined _WIN32
-    WSADATA wsa_data;
-    if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) {
-        fprintf(stderr, "WSAStartup failed\n");
+    // su UDP il server risponde solo alle richieste classiche e v2: le
+    // altre risposte sono piu' grandi della richiesta e amplificherebbero
+    // verso un mittente falsificato
+    if (use_udp && (batch || stats || subscribe || search || history)) {
+        fprintf(stderr, "--udp vale solo per le richieste -r e il test di carico\n");
         return 1;
     }
-#endif
 
-    /*
-     * Parsing della richiesta nel formato "type city". Si considera il primo
-     * carattere non-spazio come il `type` e il resto della stringa come
-     * il nome della città. Il nome viene copiato in `city` (size limitata).
-     */
-    /*
-     * Parsing della richiesta nel formato "type city".
-     * Richiesta valida: il primo token (prima del primo spazio) deve
-     * essere esattamente un singolo carattere che rappresenta il tipo.
-     * Esempi:
-     *  - "t bari"  -> type='t', city='bari'  (valido)
-     *  - "pippo bari" -> token 'pippo' ha lunghezza>1 -> richiesta non valida
-     */
-    const char *p = request;
-    while (*p && isspace((unsigned char)*p)) p++;
-    const char *token_start = p;
-    while (*p && !isspace((unsigned char)*p)) p++;
-    size_t token_len = (size_t)(p - token_start);
-    if (token_len != 1) {
+    weather_request_t reqs[MAX_REQUESTS];
+    int valid[MAX_REQUESTS];
+    int any_valid = 0;
+    for (int i = 0; i < count; ++i) {
+        valid[i] = wc_parse_request(requests[i], &reqs[i]);
+        any_valid |= valid[i];
+    }
+    if (!any_valid && count == 1 && !batch && !subscribe && !search && !history) {
         // Token non valido: stampiamo il messaggio richiesto senza contattare il server
         printf("Ricevuto risultato dal server ip %s. Richiesta non valida\n", server);
         return 1;
     }
-    char type = token_start[0];
-    while (*p && isspace((unsigned char)*p)) p++;
-    char city[64];
-    memset(city, 0, sizeof(city));
-    strncpy(city, p, sizeof(city) - 1);
 
     /*
-     * Risoluzione dell'indirizzo del server. Si usa `my_inet_pton` per
-     * compatibilità con diverse toolchain; se fallisce si prova a risolvere
-     * il nome host con `gethostbyname`.
+     * Inizializzazione Winsock su Windows. Su sistemi POSIX questa sezione
+     * viene saltata.
      */
-    // Resolve server address (IPv4)
-    struct sockaddr_in server_addr;
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons((uint16_t)port);
-    // Resolve server address (IPv4) with compatibility wrapper
-    if (my_inet_pton(AF_INET, server, &server_addr.sin_addr) != 1) {
-        struct hostent *he = gethostbyname(server);
-        if (!he) {
-            fprintf(stderr, "Failed to resolve server address\n");
 #if defined _WIN32
-            WSACleanup();
-#endif
-            return 1;
-        }
-        server_addr.sin_addr = *(struct in_addr *)he->h_addr_list[0];
-    }
-
-    int sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
-    if (sock < 0) {
-        perror("socket");
-    #if defined _WIN32
-        WSACleanup();
-    #endif
-        return 1;
-        }
-
-        if (connect(sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
-        perror("connect");
-        closesocket(sock);
-    #if defined _WIN32
-        WSACleanup();
-    #endif
+    WSADATA wsa_data;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) {
+        fprintf(stderr, "WSAStartup failed\n");
         return 1;
-        }
-
-    /*
-     * Preparazione della richiesta in formato binario fisso: 1 byte per il
-     * tipo e 64 byte per la città. Si invia con send_all per assicurare che
-     * tutti i byte vengano trasmessi.
-     */
-    // Prepare and send request: fixed 65 bytes (1 type + 64 city)
-    unsigned char reqbuf[65];
-    memset(reqbuf, 0, sizeof(reqbuf));
-    reqbuf[0] = (unsigned char)type;
-    strncpy((char *)&reqbuf[1], city, 63);
-    if (send_all(sock, reqbuf, sizeof(reqbuf)) != 0) {
-        fprintf(stderr, "Failed to send request\n");
-        closesocket(sock);
-#if defined _WIN32
-        WSACleanup();
+    }
 #endif
-        return 1;
+
+    // Opzioni dei socket TCP: quelle non supportate vengono ignorate
+    if ((sockopts.fastopen || sockopts.nodelay || sockopts.busy_poll_us > 0)
+            && wc_set_sockopts(&sockopts) != 0) {
+        fprintf(stderr, "Alcune opzioni dei socket non sono supportate e vengono ignorate\n");
     }
 
-    /*
-     * Ricezione della risposta: protocollo binario composto da
-     *  - 4 byte: status (uint32_t in network byte order)
-     *  - 1 byte: type (char)
-     *  - 4 byte: value (float inviato come uint32_t in network byte order)
-     * Si usa recv_all per assicurare la ricezione completa dei 9 byte.
-     */
-    // Receive response: 4 bytes status (network), 1 byte type, 4 bytes float
-    unsigned char respbuf[9];
-    if (recv_all(sock, respbuf, sizeof(respbuf)) != 0) {
-        fprintf(stderr, "Failed to receive response\n");
-        closesocket(sock);
+    // Risoluzione dell'indirizzo del server (IPv4)
+    struct sockaddr_in server_addr;
+    if (wc_resolve(server, port, &server_addr) != 0) {
+        fprintf(stderr, "Failed to resolve server address\n");
 #if defined _WIN32
         WSACleanup();
 #endif
         return 1;
     }
 
-    uint32_t net_status;
-    memcpy(&net_status, respbuf, 4);
-    uint32_t status = ntohl(net_status);
-    char rtype = (char)respbuf[4];
-    uint32_t net_f;
-    memcpy(&net_f, &respbuf[5], 4);
-    float value = ntohf(net_f);
+    // Senza cache utilizzabile le richieste vanno comunque al server
+    if (cache_path && count > 0) cache = rcache_open(cache_path);
 
-    /*
-     * Ottenimento dell'indirizzo del peer per stampare l'IP del server che
-     * ha risposto. Se getpeername fallisce si usa la stringa del server
-     * fornita dall'utente.
-     */
-    // Get peer IP for printing
-    struct sockaddr_in peer_addr;
-#if defined _WIN32
-    int peer_len = sizeof(peer_addr);
-#else
-    socklen_t peer_len = sizeof(peer_addr);
-#endif
-    char peer_ip[INET_ADDRSTRLEN] = "";
-    if (getpeername(sock, (struct sockaddr *)&peer_addr, &peer_len) == 0) {
-        my_inet_ntop(AF_INET, &peer_addr.sin_addr, peer_ip, sizeof(peer_ip));
-    } else {
-        strncpy(peer_ip, server, sizeof(peer_ip) - 1);
+    int rc = 0;
+    if (loadtest) {
+        lcfg.keepalive = keepalive;
+        lcfg.udp = use_udp;
+        lcfg.v2 = use_v2;
+        lcfg.timeout_ms = udp_timeout_ms;
+        lcfg.retries = udp_retries;
+        rc = run_loadgen(&server_addr, &lcfg);
     }
-
-    /*
-     * Costruzione del messaggio finale da mostrare all'utente secondo la
-     * specifica: "Ricevuto risultato dal server ip <ip_address>. <messaggio>"
-     * A seconda del codice di stato e del tipo si formatta il testo in
-     * italiano (Temperatura, Umidità, Vento, Pressione) con una cifra
-     * decimale.
-     */
-    // Capitalizza la prima lettera della città per stampa estetica
-    if (city[0]) city[0] = (char)toupper((unsigned char)city[0]);
-
-    // Build message per spec
-    char message[256];
-    if (status == STATUS_SUCCESS) {
-        switch (rtype) {
-        case 't':
-            snprintf(message, sizeof(message), "%s: Temperatura = %.1f%s", city, value, DEG_C_SUFFIX);
-            break;
-        case 'h':
-            snprintf(message, sizeof(message), "%s: Umidita' = %.1f%%", city, value);
-            break;
-        case 'w':
-            snprintf(message, sizeof(message), "%s: Vento = %.1f km/h", city, value);
-            break;
-        case 'p':
-            snprintf(message, sizeof(message), "%s: Pressione = %.1f hPa", city, value);
-            break;
-        default:
-            snprintf(message, sizeof(message), "Tipo di dato non valido");
-            break;
-        }
-    } else if (status == STATUS_CITY_NOT_AVAILABLE) {
-        snprintf(message, sizeof(message), "Citta' non disponibile");
-    } else if (status == STATUS_INVALID_REQUEST) {
-        snprintf(message, sizeof(message), "Richiesta non valida");
+    if (batch) {
+        rc |= run_batch(&server_addr, server, batch);
+    }
+    if (stats) {
+        rc |= run_stats(&server_addr, server);
+    }
+    if (search) {
+        rc |= run_search(&server_addr, server, search, search_limit);
+    }
+    if (history) {
+        rc |= run_history(&server_addr, server, history, history_samples, history_window);
+    }
+    if (subscribe) {
+        rc |= run_subscribe(&server_addr, server, subscribe, sub_interval, sub_updates);
+    }
+    // con UDP non ci sono connessioni: -k non ha effetto sulle richieste -r
+    if (keepalive && !use_udp && count > 0) {
+        rc |= run_pipelined(&server_addr, server, reqs, valid, count);
     } else {
-        snprintf(message, sizeof(message), "Errore");
+        for (int i = 0; i < count; ++i) {
+            if (!valid[i]) {
+                printf("Ricevuto risultato dal server ip %s. Richiesta non valida\n", server);
+                rc = 1;
+                continue;
+            }
+            if (run_oneshot(&server_addr, server, &reqs[i]) != 0) {
+                rc = 1;
+                break;
+            }
+        }
     }
 
-    printf("Ricevuto risultato dal server ip %s. %s\n", peer_ip, message);
-
-    closesocket(sock);
+    rcache_close(cache);
 #if defined _WIN32
     WSACleanup();
 #endif
-    return 0;
+    return rc;
 }
@@ -8,16 +8,87 @@
 #ifndef PROTOCOL_H_
 #define PROTOCOL_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 // Unified shared constants (mirrors server header)
 #define SERVER_PORT 56700
 #define SERVER_IP   "127.0.0.1"
 #define BUFFER_SIZE 512
 #define QLEN  6
 
+// Dimensioni fisse dei messaggi binari sul filo
+#define REQUEST_SIZE  65    // 1 byte tipo + 64 byte città
+#define RESPONSE_SIZE 9     // 4 byte status + 1 byte tipo + 4 byte valore
+#define MAX_REQUESTS  64    // richieste (-r) accettate in una singola esecuzione
+
+// Frame batch (mirrors server header): BATCH_MAGIC + numero voci (uint16
+// network) + voci (1 byte tipo, 1 byte lunghezza città, città). La risposta
+// ripete l'intestazione seguita da una risposta da RESPONSE_SIZE byte per voce.
+#define BATCH_MAGIC        0xBA
+#define BATCH_MAX          256
+#define BATCH_HEADER_SIZE  3
+#define BATCH_CITY_MAX     63
+#define MAX_REQUEST_FRAME  (BATCH_HEADER_SIZE + BATCH_MAX * (2 + BATCH_CITY_MAX))
+#define MAX_RESPONSE_FRAME (BATCH_HEADER_SIZE + BATCH_MAX * RESPONSE_SIZE)
+
+// Richiesta di statistiche (mirrors server stats.h): frame classico con
+// tipo STATS_REQUEST; la risposta e' un frame di STATS_FRAME_SIZE byte che
+// inizia con STATS_MAGIC (formato descritto in wclient.h).
+#define STATS_REQUEST    's'
+#define STATS_MAGIC      0x5A
+#define STATS_STATUSES   4
+#define STATS_TYPES      5     // 't','h','w','p', altro
+#define STATS_STAGES     3
+#define STATS_BUCKETS    32
+#define STATS_FRAME_SIZE (3 + 4 * (STATS_STATUSES + STATS_TYPES + 2 + STATS_STAGES * STATS_BUCKETS))
+
+// Formato compatto v2 (mirrors server header), riconosciuto dal server dal
+// primo byte del frame. Richiesta: V2_MAGIC, tipo, lunghezza città e città,
+// oppure V2_CITY_ID e l'identificativo della città (uint16 network).
+// Risposta: 1 byte di status; se STATUS_SUCCESS seguono 2 byte con il
+// valore in decimi (int16 network). Il tipo non viene ripetuto.
+#define V2_MAGIC           0xC2
+#define V2_CITY_ID         0xFF
+#define V2_HEADER_SIZE     3
+#define V2_REQUEST_MAX     (V2_HEADER_SIZE + BATCH_CITY_MAX)
+#define V2_RESPONSE_SIZE   3
+#define V2_VALUE_SCALE     10
+
+// Sottoscrizioni (mirrors server header): SUB_MAGIC, intervallo in ms
+// (uint16 network, 0 = a ogni variazione), numero voci e voci come nel
+// batch. Il server invia frame push: SUB_MAGIC, numero voci e per ogni
+// voce l'indice nella sottoscrizione seguito da una risposta da
+// RESPONSE_SIZE byte.
+#define SUB_MAGIC          0xB5
+#define SUB_MAX            64
+#define SUB_HEADER_SIZE    4
+#define SUB_PUSH_HEADER    2
+#define SUB_ENTRY_SIZE     (1 + RESPONSE_SIZE)
+
+// Ricerca per prefisso (mirrors server header): SEARCH_MAGIC, numero
+// massimo di risultati, lunghezza e byte del prefisso. Risposta:
+// SEARCH_MAGIC, numero di nomi e per ogni nome lunghezza e byte.
+#define SEARCH_MAGIC       0xB8
+#define SEARCH_MAX         32
+#define SEARCH_HEADER_SIZE 3
+#define SEARCH_RESPONSE_MAX (2 + SEARCH_MAX * (1 + BATCH_CITY_MAX))
+
+// Aggregati sulla cronologia (mirrors server header): HISTORY_MAGIC,
+// tipo, lunghezza e byte della città, campioni recenti e finestra in ms
+// (uint32 network, 0 = nessun limite). Risposta: HISTORY_MAGIC, status,
+// campioni aggregati e min, max, media, deviazione standard (uint32 e
+// bit di float in network byte order).
+#define HISTORY_MAGIC         0xB9
+#define HISTORY_HEADER_SIZE   3
+#define HISTORY_TRAILER_SIZE  8
+#define HISTORY_RESPONSE_SIZE 22
+
 // Status codes (shared)
 #define STATUS_SUCCESS            0u
 #define STATUS_CITY_NOT_AVAILABLE 1u
 #define STATUS_INVALID_REQUEST    2u
+#define STATUS_OVERLOADED         3u  // server oltre i limiti di connessioni o di frequenza
 
 // Request (client -> server)
 typedef struct {
@@ -32,16 +103,34 @@ typedef struct {
     float value;         // weather value (0.0 if error)
 } weather_response_t;
 
+// Layout sul filo dei messaggi classici (mirrors server header): campi
+// interi in network byte order, valore come pattern di bit del float.
+// Strutture impacchettate: si leggono e scrivono con memcpy.
+#pragma pack(push, 1)
+typedef struct {
+    uint8_t type;    // 't','h','w','p'
+    char city[64];   // città terminata da '\0' e riempita di zeri
+} wire_request_t;
+
+typedef struct {
+    uint32_t status; // STATUS_* (network)
+    uint8_t type;    // tipo della richiesta, '\0' in caso di errore
+    uint32_t value;  // bit del float (network)
+} wire_response_t;
+#pragma pack(pop)
+
+_Static_assert(sizeof(wire_request_t) == REQUEST_SIZE, "wire_request_t deve occupare REQUEST_SIZE byte");
+_Static_assert(offsetof(wire_request_t, city) == 1, "la città segue il byte del tipo");
+_Static_assert(sizeof(wire_response_t) == RESPONSE_SIZE, "wire_response_t deve occupare RESPONSE_SIZE byte");
+_Static_assert(offsetof(wire_response_t, type) == 4 && offsetof(wire_response_t, value) == 5,
+        "layout della risposta: status, tipo, valore");
+
 // Server-side prototypes (not used by client directly, included for symmetry)
 int handleclientconnection(int client_socket, const char *client_ip);
 float typecheck(char type);
 char citycheck(const char *city);
 weather_response_t build_weather_response(char type, const char *city);
 
-// Cross-platform inet_pton/ntop wrappers
-static int my_inet_pton(int af, const char *src, void *dst);
-static const char *my_inet_ntop(int af, const void *src, char *dst, size_t size);
-
 // Data generation functions (shared)
 float get_temperature(void); // -10.0 .. 40.0
 float get_humidity(void);    // 20.0 .. 100.0
@@ -0,0 +1,296 @@
+/*
+ * rcache.c
+ *
+ * Il file contiene un'intestazione e RCACHE_SLOTS voci da 128 byte,
+ * indirizzate con l'hash della chiave e ispezione lineare su
+ * RCACHE_PROBES voci. I campi di una voce sono parole atomiche lette e
+ * scritte con accessi relaxed tra i due aggiornamenti del contatore di
+ * sequenza, come la tabella di snapshot del server. Un processo che
+ * termina durante una scrittura lascia il contatore dispari: la voce
+ * resta assente per i lettori finche' la scrittura successiva, che ha il
+ * lock, non la riporta a un valore pari.
+ *
+ * Gli istanti sono in millisecondi sull'orologio di sistema, comune a
+ * tutti i processi e valido dopo un riavvio della macchina; una voce con
+ * istante nel futuro (orologio spostato indietro) non e' valida.
+ */
+
+#include "rcache.h"
+
+#include <stdio.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+
+rcache_t *rcache_open(const char *path) {
+	(void)path;
+	fprintf(stderr, "Cache dei risultati non disponibile su questa piattaforma\n");
+	return NULL;
+}
+
+void rcache_close(rcache_t *c) {
+	(void)c;
+}
+
+int rcache_get(rcache_t *c, const struct sockaddr_in *server, const weather_request_t *req,
+               int ttl_ms, weather_response_t *out, char *peer_ip, size_t size) {
+	(void)c; (void)server; (void)req; (void)ttl_ms; (void)out; (void)peer_ip; (void)size;
+	return -1;
+}
+
+void rcache_put(rcache_t *c, const struct sockaddr_in *server, const weather_request_t *req,
+                const weather_response_t *r, const char *peer_ip) {
+	(void)c; (void)server; (void)req; (void)r; (void)peer_ip;
+}
+
+#else
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+
+#define RCACHE_MAGIC        "WXCACHE1"
+#define RCACHE_RECORD_WORDS 31 // voce da 128 byte con il contatore
+
+typedef struct {
+	char magic[8];        // RCACHE_MAGIC
+	uint32_t slots;       // RCACHE_SLOTS
+	uint32_t record_words; // RCACHE_RECORD_WORDS
+	unsigned char pad[48];
+} rcache_header_t;
+
+// Contenuto di una voce; la chiave occupa i campi che precedono fetched_ms
+typedef struct {
+	uint32_t addr;        // IPv4 del server (ordine di rete)
+	uint32_t port;        // porta del server (ordine di rete)
+	uint32_t type;        // tipo della richiesta
+	char city[64];        // città in minuscolo, riempita di zeri
+	uint64_t fetched_ms;  // arrivo della risposta, 0 = voce libera
+	uint32_t status;
+	uint32_t value;       // bit del float
+	char peer_ip[16];     // server che ha risposto, come stampato
+} rcache_record_t;
+
+typedef struct {
+	atomic_uint seq;      // dispari durante la scrittura
+	atomic_uint words[RCACHE_RECORD_WORDS];
+} rcache_slot_t;
+
+_Static_assert(sizeof(rcache_record_t) <= RCACHE_RECORD_WORDS * sizeof(uint32_t),
+		"la voce entra nelle parole dello slot");
+_Static_assert(sizeof(rcache_header_t) == 64, "intestazione da 64 byte");
+_Static_assert((RCACHE_SLOTS & (RCACHE_SLOTS - 1)) == 0, "RCACHE_SLOTS potenza di due");
+
+#define RCACHE_FILE_SIZE (sizeof(rcache_header_t) + (size_t)RCACHE_SLOTS * sizeof(rcache_slot_t))
+
+struct rcache {
+	int fd;
+	void *map;
+	rcache_slot_t *slots;
+};
+
+static uint64_t now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000ull + (uint64_t)ts.tv_nsec / 1000000ull;
+}
+
+static int lock_file(int fd, int op) {
+	int rc;
+	do {
+		rc = flock(fd, op);
+	} while (rc < 0 && errno == EINTR);
+	return rc;
+}
+
+static void fill_header(rcache_header_t *h) {
+	memset(h, 0, sizeof(*h));
+	memcpy(h->magic, RCACHE_MAGIC, sizeof(h->magic));
+	h->slots = RCACHE_SLOTS;
+	h->record_words = RCACHE_RECORD_WORDS;
+}
+
+// Inizializza un file nuovo o mai completato (intestazione a zero): nessun
+// altro processo lo ha mappato, perche' la mappatura richiede
+// un'intestazione valida. Si chiama con il lock esclusivo.
+static int prepare_file(int fd) {
+	struct stat st;
+	rcache_header_t h, expected;
+	if (fstat(fd, &st) != 0) return -1;
+	memset(&h, 0, sizeof(h));
+	if (st.st_size >= (off_t)sizeof(h) && pread(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h)) return -1;
+	fill_header(&expected);
+	int blank = 1;
+	for (size_t i = 0; i < sizeof(h.magic); i++) blank &= h.magic[i] == 0;
+	if (blank) {
+		// prima la dimensione: un'intestazione valida implica un file completo
+		if (ftruncate(fd, (off_t)RCACHE_FILE_SIZE) != 0) return -1;
+		if (pwrite(fd, &expected, sizeof(expected), 0) != (ssize_t)sizeof(expected)) return -1;
+		return 0;
+	}
+	if (st.st_size != (off_t)RCACHE_FILE_SIZE || memcmp(&h, &expected, sizeof(h)) != 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+rcache_t *rcache_open(const char *path) {
+	rcache_t *c = calloc(1, sizeof(*c));
+	if (!c) return NULL;
+	c->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (c->fd < 0) {
+		fprintf(stderr, "Cache %s: %s\n", path, strerror(errno));
+		free(c);
+		return NULL;
+	}
+	int rc = lock_file(c->fd, LOCK_EX);
+	if (rc == 0) {
+		rc = prepare_file(c->fd);
+		int saved = errno;
+		lock_file(c->fd, LOCK_UN);
+		errno = saved;
+	}
+	if (rc == 0) {
+		c->map = mmap(NULL, RCACHE_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, c->fd, 0);
+		if (c->map == MAP_FAILED) rc = -1;
+	}
+	if (rc != 0) {
+		fprintf(stderr, "Cache %s: %s\n", path,
+		        errno == EINVAL ? "formato del file non riconosciuto" : strerror(errno));
+		close(c->fd);
+		free(c);
+		return NULL;
+	}
+	c->slots = (rcache_slot_t *)((char *)c->map + sizeof(rcache_header_t));
+	return c;
+}
+
+void rcache_close(rcache_t *c) {
+	if (!c) return;
+	munmap(c->map, RCACHE_FILE_SIZE);
+	close(c->fd);
+	free(c);
+}
+
+// Chiave della richiesta: il server confronta tipo e città senza
+// distinguere maiuscole e minuscole, quindi "T Bari" e "t bari"
+// condividono la voce (il tipo riportato e' quello in minuscolo, come
+// nella risposta del server)
+static void make_key(rcache_record_t *k, const struct sockaddr_in *server, const weather_request_t *req) {
+	memset(k, 0, sizeof(*k));
+	k->addr = server->sin_addr.s_addr;
+	k->port = server->sin_port;
+	k->type = (unsigned char)tolower((unsigned char)req->type);
+	for (size_t i = 0; i < sizeof(k->city) - 1 && req->city[i]; i++) {
+		k->city[i] = (char)tolower((unsigned char)req->city[i]);
+	}
+}
+
+static int same_key(const rcache_record_t *a, const rcache_record_t *b) {
+	return memcmp(a, b, offsetof(rcache_record_t, fetched_ms)) == 0;
+}
+
+// FNV-1a dei byte della chiave
+static size_t key_slot(const rcache_record_t *k) {
+	const unsigned char *p = (const unsigned char *)k;
+	uint64_t h = 0xcbf29ce484222325ull;
+	for (size_t i = 0; i < offsetof(rcache_record_t, fetched_ms); i++) {
+		h ^= p[i];
+		h *= 0x100000001b3ull;
+	}
+	return (size_t)(h >> 32) & (RCACHE_SLOTS - 1);
+}
+
+// Copia coerente della voce; -1 se e' in scrittura o cambia durante la copia
+static int read_slot(rcache_slot_t *s, rcache_record_t *out) {
+	uint32_t words[RCACHE_RECORD_WORDS];
+	unsigned int s1 = atomic_load_explicit(&s->seq, memory_order_acquire);
+	if (s1 & 1) return -1;
+	for (int i = 0; i < RCACHE_RECORD_WORDS; i++) {
+		words[i] = atomic_load_explicit(&s->words[i], memory_order_relaxed);
+	}
+	atomic_thread_fence(memory_order_acquire);
+	if (atomic_load_explicit(&s->seq, memory_order_relaxed) != s1) return -1;
+	memcpy(out, words, sizeof(*out));
+	return 0;
+}
+
+// Si chiama con il lock esclusivo: nessun'altra scrittura e' in corso
+static void write_slot(rcache_slot_t *s, const rcache_record_t *r) {
+	uint32_t words[RCACHE_RECORD_WORDS];
+	memset(words, 0, sizeof(words));
+	memcpy(words, r, sizeof(*r));
+	// dispari: scrittura interrotta da un processo terminato
+	unsigned int seq = atomic_load_explicit(&s->seq, memory_order_relaxed) & ~1u;
+	atomic_store_explicit(&s->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	for (int i = 0; i < RCACHE_RECORD_WORDS; i++) {
+		atomic_store_explicit(&s->words[i], words[i], memory_order_relaxed);
+	}
+	atomic_store_explicit(&s->seq, seq + 2, memory_order_release);
+}
+
+int rcache_get(rcache_t *c, const struct sockaddr_in *server, const weather_request_t *req,
+               int ttl_ms, weather_response_t *out, char *peer_ip, size_t size) {
+	rcache_record_t key, r;
+	make_key(&key, server, req);
+	size_t base = key_slot(&key);
+	uint64_t now = now_ms();
+	for (size_t p = 0; p < RCACHE_PROBES; p++) {
+		if (read_slot(&c->slots[(base + p) & (RCACHE_SLOTS - 1)], &r) != 0) continue;
+		if (r.fetched_ms == 0 || !same_key(&r, &key)) continue;
+		if (r.fetched_ms > now || now - r.fetched_ms >= (uint64_t)(ttl_ms > 0 ? ttl_ms : 0)) return -1;
+		out->status = r.status;
+		out->type = (char)r.type;
+		memcpy(&out->value, &r.value, sizeof(out->value));
+		r.peer_ip[sizeof(r.peer_ip) - 1] = '\0';
+		snprintf(peer_ip, size, "%s", r.peer_ip);
+		return 0;
+	}
+	return -1;
+}
+
+void rcache_put(rcache_t *c, const struct sockaddr_in *server, const weather_request_t *req,
+                const weather_response_t *r, const char *peer_ip) {
+	if (r->status != STATUS_SUCCESS) return;
+	rcache_record_t rec, cur;
+	make_key(&rec, server, req);
+	rec.fetched_ms = now_ms();
+	rec.status = r->status;
+	memcpy(&rec.value, &r->value, sizeof(rec.value));
+	snprintf(rec.peer_ip, sizeof(rec.peer_ip), "%s", peer_ip);
+
+	if (lock_file(c->fd, LOCK_EX) != 0) return;
+	// la voce con la stessa chiave, altrimenti la piu' vecchia tra quelle
+	// esaminate (le voci libere hanno istante 0)
+	size_t base = key_slot(&rec);
+	rcache_slot_t *victim = NULL;
+	uint64_t oldest = UINT64_MAX;
+	for (size_t p = 0; p < RCACHE_PROBES; p++) {
+		rcache_slot_t *s = &c->slots[(base + p) & (RCACHE_SLOTS - 1)];
+		if (read_slot(s, &cur) != 0) cur.fetched_ms = 0; // scrittura interrotta
+		else if (cur.fetched_ms != 0 && same_key(&cur, &rec)) {
+			victim = s;
+			break;
+		}
+		if (cur.fetched_ms < oldest) {
+			oldest = cur.fetched_ms;
+			victim = s;
+		}
+	}
+	write_slot(victim, &rec);
+	lock_file(c->fd, LOCK_UN);
+}
+
+#endif
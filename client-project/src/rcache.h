@@ -0,0 +1,47 @@
+/*
+ * rcache.h
+ *
+ * Cache persistente dei risultati del client (--cache): un file di
+ * dimensione fissa mappato in memoria, indicizzato per (server, porta,
+ * tipo, città) e condiviso tra processi client concorrenti. Ogni voce
+ * conserva la risposta con successo, l'IP del server che l'ha data e
+ * l'istante in cui e' arrivata; chi legge decide quanto puo' essere
+ * vecchia (--cache-ttl). Una voce trovata evita connessione e richiesta.
+ *
+ * Le letture non prendono lock: ogni voce ha un contatore di sequenza,
+ * dispari durante la scrittura, e una lettura concorrente a una
+ * scrittura vale come voce assente. Le scritture sono serializzate con
+ * flock sul file, rilasciato dal kernel anche se il processo termina a
+ * meta' aggiornamento. Non disponibile su Windows.
+ */
+
+#ifndef RCACHE_H_
+#define RCACHE_H_
+
+#include <stddef.h>
+
+#include "protocol.h"
+
+#define RCACHE_SLOTS  4096   // voci del file, potenza di due
+#define RCACHE_PROBES 8      // voci esaminate a partire da quella dell'hash
+#define RCACHE_TTL_MS 10000  // eta' massima di default di una voce (--cache-ttl)
+
+struct sockaddr_in;
+typedef struct rcache rcache_t;
+
+// Apre (o crea) il file di cache; NULL in caso di errore, gia' segnalato
+// su stderr
+rcache_t *rcache_open(const char *path);
+void rcache_close(rcache_t *c);
+
+// Cerca la risposta a req dal server indicato, arrivata da meno di
+// ttl_ms: la scrive in *out con l'IP del server in peer_ip e ritorna 0,
+// altrimenti -1
+int rcache_get(rcache_t *c, const struct sockaddr_in *server, const weather_request_t *req,
+               int ttl_ms, weather_response_t *out, char *peer_ip, size_t size);
+
+// Registra una risposta con successo (le altre vengono ignorate)
+void rcache_put(rcache_t *c, const struct sockaddr_in *server, const weather_request_t *req,
+                const weather_response_t *r, const char *peer_ip);
+
+#endif /* RCACHE_H_ */
@@ -0,0 +1,1212 @@
+/*
+ * wclient.c
+ * Libreria client del servizio meteo: risoluzione dell'indirizzo,
+ * codifica/decodifica dei messaggi binari, formattazione dei risultati
+ * e connessioni non bloccanti con piu' richieste in volo.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <errno.h>
+
+#if defined _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#define poll WSAPoll
+#else
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#define closesocket close
+#endif
+
+#include "wclient.h"
+
+// Un server sovraccarico puo' chiudere la connessione (admit.h lato
+// server): l'invio successivo deve fallire con un errore, non con SIGPIPE
+#if defined(MSG_NOSIGNAL)
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+// Invio che non si ferma ad attendere spazio nel socket: con una scadenza
+// l'attesa avviene in poll. Su Windows si attende sempre prima dell'invio.
+#if defined(MSG_DONTWAIT)
+#define SEND_NOWAIT MSG_DONTWAIT
+#else
+#define SEND_NOWAIT 0
+#endif
+
+#if defined _WIN32
+#define WC_WOULDBLOCK() (WSAGetLastError() == WSAEWOULDBLOCK)
+#define WC_INPROGRESS() (WSAGetLastError() == WSAEWOULDBLOCK)
+#else
+#define WC_WOULDBLOCK() (errno == EAGAIN || errno == EWOULDBLOCK)
+#define WC_INPROGRESS() (errno == EINPROGRESS)
+#endif
+
+// Attesa massima di connect, invio e ricezione sui socket TCP bloccanti
+static int io_timeout_ms = WC_IO_TIMEOUT_MS;
+
+// Opzioni applicate a ogni socket TCP (wc_set_sockopts)
+static wc_sockopts_t sock_opts;
+
+static int set_nonblocking(int sock)
+{
+#if defined _WIN32
+    u_long mode = 1;
+    return ioctlsocket(sock, FIONBIO, &mode) == 0 ? 0 : -1;
+#else
+    int flags = fcntl(sock, F_GETFL, 0);
+    if (flags < 0) return -1;
+    return fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+#endif
+}
+
+static int set_blocking(int sock)
+{
+#if defined _WIN32
+    u_long mode = 0;
+    return ioctlsocket(sock, FIONBIO, &mode) == 0 ? 0 : -1;
+#else
+    int flags = fcntl(sock, F_GETFL, 0);
+    if (flags < 0) return -1;
+    return fcntl(sock, F_SETFL, flags & ~O_NONBLOCK);
+#endif
+}
+
+//Correzione problema lettura caratteri speciali in console Windows
+#if defined _WIN32
+#define DEG_C_SUFFIX "C"
+#else
+#define DEG_C_SUFFIX "°C"
+#endif
+
+/*
+ * my_inet_pton
+ * Wrapper di compatibilità per `inet_pton`.
+ * Alcune toolchain Windows (MinGW) non forniscono inet_pton; questa
+ * funzione tenta prima la conversione con `inet_addr` e, se fallisce,
+ * risolve il nome host con `gethostbyname`.
+ *
+ * Parametri:
+ *  - af: address family (AF_INET)
+ *  - src: stringa contenente l'indirizzo IP o hostname
+ *  - dst: puntatore dove scrivere la struttura in_addr risultante
+ *
+ * Restituisce 1 in caso di successo, 0 in caso di errore.
+ */
+static int my_inet_pton(int af, const char *src, void *dst)
+{
+#if defined _WIN32
+    if (af != AF_INET) return 0;
+    unsigned long a = inet_addr(src);
+    if (a == INADDR_NONE) {
+        struct hostent *he = gethostbyname(src);
+        if (!he) return 0;
+        memcpy(dst, he->h_addr_list[0], he->h_length);
+        return 1;
+    }
+    struct in_addr in;
+    in.s_addr = a;
+    memcpy(dst, &in, sizeof(in));
+    return 1;
+#else
+    return inet_pton(af, src, dst);
+#endif
+}
+
+/*
+ * my_inet_ntop
+ * Wrapper di compatibilità per `inet_ntop`.
+ * Converte una struttura in_addr in una stringa leggibile. Su Windows usa
+ * inet_ntoa e copia il risultato in `dst`.
+ *
+ * Parametri:
+ *  - af: address family
+ *  - src: puntatore alla struttura in_addr
+ *  - dst: buffer di destinazione
+ *  - size: dimensione del buffer
+ *
+ * Restituisce `dst` in caso di successo, NULL in caso di errore.
+ */
+static const char *my_inet_ntop(int af, const void *src, char *dst, size_t size)
+{
+#if defined _WIN32
+    if (af != AF_INET) return NULL;
+    const struct in_addr *in = (const struct in_addr *)src;
+    const char *s = inet_ntoa(*in);
+    if (!s) return NULL;
+    strncpy(dst, s, size - 1);
+    dst[size - 1] = '\0';
+    return dst;
+#else
+    return inet_ntop(af, src, dst, (socklen_t)size);
+#endif
+}
+
+/*
+ * now_ms
+ * Orologio monotono in millisecondi, per le scadenze delle richieste.
+ */
+static uint64_t now_ms(void)
+{
+#if defined _WIN32
+    return (uint64_t)GetTickCount64();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+#endif
+}
+
+/*
+ * wait_socket
+ * Attende `events` sul socket fino all'istante `deadline` (now_ms, 0 per
+ * nessun limite). Restituisce 1 se il socket è pronto, 0 alla scadenza,
+ * -1 in caso di errore.
+ */
+static int wait_socket(int sock, short events, uint64_t deadline)
+{
+    for (;;) {
+        int timeout = -1;
+        if (deadline) {
+            uint64_t now = now_ms();
+            if (now >= deadline) return 0;
+            timeout = (int)(deadline - now);
+        }
+        struct pollfd pfd;
+        pfd.fd = sock;
+        pfd.events = events;
+        pfd.revents = 0;
+        int n = poll(&pfd, 1, timeout);
+        if (n > 0) return 1;
+        if (n == 0) return 0;
+        if (errno != EINTR) return -1;
+    }
+}
+
+/*
+ * wc_deadline
+ * Istante limite di una richiesta che inizia adesso, con l'attesa
+ * impostata da wc_set_timeout: tutti gli invii e le ricezioni della
+ * richiesta devono concludersi entro questo istante. 0 se senza limite.
+ */
+uint64_t wc_deadline(void)
+{
+    return io_timeout_ms > 0 ? now_ms() + (uint64_t)io_timeout_ms : 0;
+}
+
+/*
+ * wc_send_until
+ * Assicura l'invio di tutti i byte del buffer sul socket entro `deadline`
+ * (wc_deadline, 0 per nessun limite). `send` potrebbe inviare un numero
+ * di byte inferiore a quelli richiesti, pertanto si itera finché tutto il
+ * buffer non è stato inviato; con una scadenza ogni attesa avviene in
+ * poll per il solo tempo rimasto. Restituisce 0 in caso di successo, -1
+ * in caso di errore o alla scadenza.
+ */
+int wc_send_until(int sock, const void *buf, size_t len, uint64_t deadline)
+{
+    const char *p = (const char *)buf;
+    size_t remaining = len;
+    while (remaining > 0) {
+        if (deadline && SEND_NOWAIT == 0 && wait_socket(sock, POLLOUT, deadline) <= 0) return -1;
+        int sent = send(sock, p, (int)remaining, SEND_FLAGS | (deadline ? SEND_NOWAIT : 0));
+        if (sent < 0 && deadline && (WC_WOULDBLOCK() || WC_INPROGRESS() || errno == EINTR)) {
+            // socket pieno, o handshake di Fast Open ancora in corso
+            if (wait_socket(sock, POLLOUT, deadline) <= 0) return -1;
+            continue;
+        }
+        if (sent <= 0) return -1;
+        p += sent;
+        remaining -= sent;
+    }
+    return 0;
+}
+
+/*
+ * wc_recv_until
+ * Riceve esattamente `len` byte dal socket entro `deadline` (wc_deadline,
+ * 0 per nessun limite). Poiché `recv` può restituire meno byte di quelli
+ * richiesti, si itera finché non si riceve l'intero buffer; con una
+ * scadenza ogni recv è preceduta da un poll per il solo tempo rimasto,
+ * così un server che invia un byte alla volta non prolunga l'attesa.
+ * Restituisce 0 in caso di successo, -1 in caso di errore, chiusura
+ * della connessione o scadenza.
+ */
+int wc_recv_until(int sock, void *buf, size_t len, uint64_t deadline)
+{
+    char *p = (char *)buf;
+    size_t remaining = len;
+    while (remaining > 0) {
+        if (deadline && wait_socket(sock, POLLIN, deadline) <= 0) return -1;
+        int r = recv(sock, p, (int)remaining, 0);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        p += r;
+        remaining -= r;
+    }
+    return 0;
+}
+
+/*
+ * wc_send_all
+ * Come wc_send_until, con una scadenza calcolata all'inizio della
+ * chiamata (wc_deadline). Restituisce 0 in caso di successo, -1 in caso
+ * di errore.
+ */
+int wc_send_all(int sock, const void *buf, size_t len)
+{
+    return wc_send_until(sock, buf, len, wc_deadline());
+}
+
+/*
+ * wc_recv_all
+ * Come wc_recv_until, con una scadenza calcolata all'inizio della
+ * chiamata (wc_deadline). Restituisce 0 in caso di successo, -1 in caso
+ * di errore.
+ */
+int wc_recv_all(int sock, void *buf, size_t len)
+{
+    return wc_recv_until(sock, buf, len, wc_deadline());
+}
+
+/*
+ * wc_ntohf
+ * Converte un uint32_t ricevuto in network byte order nella corrispondente
+ * variabile `float` in host byte order. Il float viene trasmesso in rete
+ * come bit pattern (uint32_t) e qui si usano ntohl + memcpy per rispettare
+ * l'endianness e le aliasing rules.
+ */
+float wc_ntohf(uint32_t i)
+{
+    i = ntohl(i);
+    float f;
+    memcpy(&f, &i, sizeof(f));
+    return f;
+}
+
+/*
+ * wc_parse_request
+ * Parsing della richiesta nel formato "type city".
+ * Richiesta valida: il primo token (prima del primo spazio) deve
+ * essere esattamente un singolo carattere che rappresenta il tipo.
+ * Esempi:
+ *  - "t bari"  -> type='t', city='bari'  (valido)
+ *  - "pippo bari" -> token 'pippo' ha lunghezza>1 -> richiesta non valida
+ * Il nome viene copiato in `out->city` (size limitata).
+ * Restituisce 1 se la richiesta e' ben formata, 0 altrimenti.
+ */
+int wc_parse_request(const char *request, weather_request_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    const char *p = request;
+    while (*p && isspace((unsigned char)*p)) p++;
+    const char *token_start = p;
+    while (*p && !isspace((unsigned char)*p)) p++;
+    size_t token_len = (size_t)(p - token_start);
+    if (token_len != 1) return 0;
+    out->type = token_start[0];
+    // il tipo delle statistiche ha una risposta diversa: si usa wc_fetch_stats
+    if (tolower((unsigned char)out->type) == STATS_REQUEST) return 0;
+    while (*p && isspace((unsigned char)*p)) p++;
+    strncpy(out->city, p, sizeof(out->city) - 1);
+    return 1;
+}
+
+/*
+ * wc_encode_request
+ * Preparazione della richiesta in formato binario fisso: 1 byte per il
+ * tipo e 64 byte per la città (terminata da '\0' e riempita di zeri).
+ */
+void wc_encode_request(const weather_request_t *req, unsigned char *reqbuf)
+{
+    wire_request_t w;
+    memset(&w, 0, sizeof(w));
+    w.type = (uint8_t)req->type;
+    memcpy(w.city, req->city, strnlen(req->city, sizeof(w.city) - 1));
+    memcpy(reqbuf, &w, sizeof(w));
+}
+
+/*
+ * wc_decode_response
+ * Decodifica dei 9 byte di risposta (wire_response_t):
+ *  - 4 byte: status (uint32_t in network byte order)
+ *  - 1 byte: type (char)
+ *  - 4 byte: value (float inviato come uint32_t in network byte order)
+ */
+void wc_decode_response(const unsigned char *respbuf, weather_response_t *out)
+{
+    wire_response_t w;
+    memcpy(&w, respbuf, sizeof(w));
+    out->status = ntohl(w.status);
+    out->type = (char)w.type;
+    out->value = wc_ntohf(w.value);
+}
+
+/*
+ * wc_encode_request_v2
+ * Codifica nel formato compatto v2: V2_MAGIC, tipo, lunghezza della città
+ * e i soli byte della città, senza riempimento. `reqbuf` deve avere spazio
+ * per V2_REQUEST_MAX byte. Restituisce la lunghezza del frame.
+ */
+size_t wc_encode_request_v2(const weather_request_t *req, unsigned char *reqbuf)
+{
+    size_t clen = strnlen(req->city, BATCH_CITY_MAX);
+    reqbuf[0] = V2_MAGIC;
+    reqbuf[1] = (unsigned char)req->type;
+    reqbuf[2] = (unsigned char)clen;
+    memcpy(&reqbuf[V2_HEADER_SIZE], req->city, clen);
+    return V2_HEADER_SIZE + clen;
+}
+
+/*
+ * wc_encode_request_v2_id
+ * Variante v2 con l'identificativo della città (l'indice nella tabella del
+ * server) al posto del nome: 5 byte qualunque sia la città.
+ */
+size_t wc_encode_request_v2_id(char type, unsigned int city_id, unsigned char *reqbuf)
+{
+    reqbuf[0] = V2_MAGIC;
+    reqbuf[1] = (unsigned char)type;
+    reqbuf[2] = V2_CITY_ID;
+    reqbuf[3] = (unsigned char)(city_id >> 8);
+    reqbuf[4] = (unsigned char)city_id;
+    return V2_HEADER_SIZE + 2;
+}
+
+/*
+ * wc_response_v2_length
+ * Lunghezza di una risposta v2 a partire dal suo primo byte (lo status).
+ */
+size_t wc_response_v2_length(unsigned char status)
+{
+    return status == STATUS_SUCCESS ? V2_RESPONSE_SIZE : 1;
+}
+
+/*
+ * wc_decode_response_v2
+ * Decodifica una risposta v2 completa (wc_response_v2_length byte). Il
+ * tipo non viaggia sul filo: `type` è quello della richiesta.
+ */
+void wc_decode_response_v2(const unsigned char *respbuf, char type, weather_response_t *out)
+{
+    out->status = respbuf[0];
+    out->type = '\0';
+    out->value = 0.0f;
+    if (out->status != STATUS_SUCCESS) return;
+    int16_t tenths = (int16_t)(((unsigned)respbuf[1] << 8) | respbuf[2]);
+    // come in v1, il tipo riportato è quello normalizzato in minuscolo
+    out->type = (type >= 'A' && type <= 'Z') ? (char)(type + ('a' - 'A')) : type;
+    out->value = (float)tenths / V2_VALUE_SCALE;
+}
+
+/*
+ * wc_set_timeout
+ * Imposta l'attesa massima, in millisecondi, di una connect e di una
+ * richiesta (invio e ricezione della risposta, wc_deadline) sui socket
+ * TCP (0 o negativo per attendere senza limite). Il default è
+ * WC_IO_TIMEOUT_MS.
+ */
+void wc_set_timeout(int ms)
+{
+    io_timeout_ms = ms > 0 ? ms : 0;
+}
+
+/*
+ * wc_timeout
+ * Attesa impostata con wc_set_timeout, 0 se senza limite.
+ */
+int wc_timeout(void)
+{
+    return io_timeout_ms;
+}
+
+/*
+ * apply_sockopts
+ * Imposta sul socket le opzioni di wc_set_sockopts; restituisce 0, oppure
+ * -1 se il sistema ne rifiuta almeno una.
+ */
+static int apply_sockopts(int sock, const wc_sockopts_t *opts)
+{
+    int on = 1;
+    int rc = 0;
+    if (opts->nodelay
+            && setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&on, sizeof(on)) != 0) {
+        rc = -1;
+    }
+    if (opts->fastopen) {
+#if defined(TCP_FASTOPEN_CONNECT)
+        if (setsockopt(sock, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, (const char *)&on, sizeof(on)) != 0) {
+            rc = -1;
+        }
+#else
+        rc = -1;
+#endif
+    }
+    if (opts->busy_poll_us > 0) {
+#if defined(SO_BUSY_POLL)
+        if (setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, (const char *)&opts->busy_poll_us,
+                       sizeof(opts->busy_poll_us)) != 0) {
+            rc = -1;
+        }
+#else
+        rc = -1;
+#endif
+    }
+    return rc;
+}
+
+/*
+ * wc_set_sockopts
+ * Sceglie le opzioni dei socket TCP aperti in seguito. Le prova una per
+ * una su un socket di prova e tiene solo quelle accettate dal sistema
+ * (TCP Fast Open richiede Linux >= 4.11 e net.ipv4.tcp_fastopen con il
+ * bit 1; SO_BUSY_POLL oltre net.core.busy_poll richiede CAP_NET_ADMIN).
+ * Restituisce 0, oppure -1 se qualche opzione e' stata scartata.
+ */
+int wc_set_sockopts(const wc_sockopts_t *opts)
+{
+    wc_sockopts_t one;
+    int rc = 0;
+    memset(&sock_opts, 0, sizeof(sock_opts));
+    int sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock < 0) return -1;
+
+    memset(&one, 0, sizeof(one));
+    one.nodelay = opts->nodelay;
+    if (apply_sockopts(sock, &one) == 0) sock_opts.nodelay = one.nodelay;
+    else rc = -1;
+
+    memset(&one, 0, sizeof(one));
+    one.fastopen = opts->fastopen;
+    if (apply_sockopts(sock, &one) == 0) sock_opts.fastopen = one.fastopen;
+    else rc = -1;
+
+    memset(&one, 0, sizeof(one));
+    one.busy_poll_us = opts->busy_poll_us;
+    if (apply_sockopts(sock, &one) == 0) sock_opts.busy_poll_us = one.busy_poll_us;
+    else rc = -1;
+
+    closesocket(sock);
+    return rc;
+}
+
+/*
+ * wc_connect
+ * Crea il socket TCP e si connette al server entro l'attesa impostata
+ * con wc_set_timeout, che limita poi anche ogni richiesta (wc_deadline,
+ * wc_send_until e wc_recv_until). Con
+ * TCP Fast Open (wc_set_sockopts) e un cookie gia' ottenuto la connect
+ * ritorna subito e l'handshake avviene nel primo invio.
+ * Restituisce il socket oppure -1 in caso di errore (già segnalato su
+ * stderr).
+ */
+int wc_connect(const struct sockaddr_in *server_addr)
+{
+    int sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock < 0) {
+        perror("socket");
+        return -1;
+    }
+    // opzioni gia' provate da wc_set_sockopts: un errore qui non e' fatale
+    apply_sockopts(sock, &sock_opts);
+    if (io_timeout_ms == 0) {
+        if (connect(sock, (const struct sockaddr *)server_addr, sizeof(*server_addr)) < 0) {
+            perror("connect");
+            closesocket(sock);
+            return -1;
+        }
+        return sock;
+    }
+
+    // connect non bloccante: senza risposta il kernel ritrasmetterebbe il
+    // SYN per minuti
+    if (set_nonblocking(sock) != 0) {
+        perror("fcntl");
+        closesocket(sock);
+        return -1;
+    }
+    if (connect(sock, (const struct sockaddr *)server_addr, sizeof(*server_addr)) < 0) {
+        if (!WC_INPROGRESS()) {
+            perror("connect");
+            closesocket(sock);
+            return -1;
+        }
+        struct pollfd pfd;
+        pfd.fd = sock;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        int n;
+        do {
+            n = poll(&pfd, 1, io_timeout_ms);
+        } while (n < 0 && errno == EINTR);
+        int err = 0;
+#if defined _WIN32
+        int err_len = sizeof(err);
+#else
+        socklen_t err_len = sizeof(err);
+#endif
+        if (n == 0) {
+            fprintf(stderr, "connect: timeout dopo %d ms\n", io_timeout_ms);
+            closesocket(sock);
+            return -1;
+        }
+        if (n < 0 || getsockopt(sock, SOL_SOCKET, SO_ERROR, (char *)&err, &err_len) != 0 || err != 0) {
+            if (err != 0) errno = err;
+            perror("connect");
+            closesocket(sock);
+            return -1;
+        }
+    }
+    if (set_blocking(sock) != 0) {
+        perror("fcntl");
+        closesocket(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/*
+ * wc_peer_ip
+ * Ottenimento dell'indirizzo del peer per stampare l'IP del server che
+ * ha risposto. Se getpeername fallisce si usa la stringa del server
+ * fornita dall'utente.
+ */
+void wc_peer_ip(int sock, const char *server, char *peer_ip, size_t size)
+{
+    struct sockaddr_in peer_addr;
+#if defined _WIN32
+    int peer_len = sizeof(peer_addr);
+#else
+    socklen_t peer_len = sizeof(peer_addr);
+#endif
+    peer_ip[0] = '\0';
+    if (getpeername(sock, (struct sockaddr *)&peer_addr, &peer_len) == 0) {
+        my_inet_ntop(AF_INET, &peer_addr.sin_addr, peer_ip, size);
+    } else {
+        strncpy(peer_ip, server, size - 1);
+        peer_ip[size - 1] = '\0';
+    }
+}
+
+
+/*
+ * wc_resolve
+ * Risoluzione dell'indirizzo del server (IPv4). Si usa `my_inet_pton` per
+ * compatibilità con diverse toolchain; se fallisce si prova a risolvere
+ * il nome host con `gethostbyname`. Restituisce 0 in caso di successo,
+ * -1 in caso di errore.
+ */
+int wc_resolve(const char *host, int port, struct sockaddr_in *out)
+{
+    memset(out, 0, sizeof(*out));
+    out->sin_family = AF_INET;
+    out->sin_port = htons((uint16_t)port);
+    if (my_inet_pton(AF_INET, host, &out->sin_addr) != 1) {
+        struct hostent *he = gethostbyname(host);
+        if (!he) return -1;
+        out->sin_addr = *(struct in_addr *)he->h_addr_list[0];
+    }
+    return 0;
+}
+
+/*
+ * wc_format_result
+ * Costruzione del messaggio da mostrare all'utente per una risposta.
+ * A seconda del codice di stato e del tipo si formatta il testo in
+ * italiano (Temperatura, Umidità, Vento, Pressione) con una cifra
+ * decimale.
+ */
+void wc_format_result(const char *req_city, const weather_response_t *r, char *message, size_t size)
+{
+    // Capitalizza la prima lettera della città per stampa estetica
+    char city[64];
+    strncpy(city, req_city, sizeof(city) - 1);
+    city[sizeof(city) - 1] = '\0';
+    if (city[0]) city[0] = (char)toupper((unsigned char)city[0]);
+
+    if (r->status == STATUS_SUCCESS) {
+        switch (r->type) {
+        case 't':
+            snprintf(message, size, "%s: Temperatura = %.1f%s", city, r->value, DEG_C_SUFFIX);
+            break;
+        case 'h':
+            snprintf(message, size, "%s: Umidita' = %.1f%%", city, r->value);
+            break;
+        case 'w':
+            snprintf(message, size, "%s: Vento = %.1f km/h", city, r->value);
+            break;
+        case 'p':
+            snprintf(message, size, "%s: Pressione = %.1f hPa", city, r->value);
+            break;
+        default:
+            snprintf(message, size, "Tipo di dato non valido");
+            break;
+        }
+    } else if (r->status == STATUS_CITY_NOT_AVAILABLE) {
+        snprintf(message, size, "Citta' non disponibile");
+    } else if (r->status == STATUS_INVALID_REQUEST) {
+        snprintf(message, size, "Richiesta non valida");
+    } else if (r->status == STATUS_OVERLOADED) {
+        snprintf(message, size, "Server sovraccarico, riprovare piu' tardi");
+    } else {
+        snprintf(message, size, "Errore");
+    }
+}
+
+/*
+ * wc_decode_stats
+ * Decodifica un frame di statistiche di STATS_FRAME_SIZE byte.
+ * Restituisce 0 in caso di successo, -1 se l'intestazione non corrisponde.
+ */
+_Static_assert(sizeof(wc_stats_t) == STATS_FRAME_SIZE - 3, "wc_stats_t deve rispecchiare il frame");
+
+int wc_decode_stats(const unsigned char *buf, wc_stats_t *out)
+{
+    if (buf[0] != STATS_MAGIC || buf[1] != STATS_STAGES || buf[2] != STATS_BUCKETS) return -1;
+    uint32_t *dst = (uint32_t *)out;
+    const unsigned char *p = buf + 3;
+    for (size_t i = 0; i < sizeof(*out) / sizeof(uint32_t); i++, p += 4) {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        dst[i] = ntohl(v);
+    }
+    return 0;
+}
+
+/*
+ * wc_fetch_stats
+ * Invia una richiesta di statistiche sul socket connesso e ne decodifica
+ * la risposta. Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int wc_fetch_stats(int sock, wc_stats_t *out)
+{
+    weather_request_t req;
+    memset(&req, 0, sizeof(req));
+    req.type = STATS_REQUEST;
+    unsigned char reqbuf[REQUEST_SIZE];
+    unsigned char frame[STATS_FRAME_SIZE];
+    wc_encode_request(&req, reqbuf);
+    uint64_t deadline = wc_deadline();
+    if (wc_send_until(sock, reqbuf, sizeof(reqbuf), deadline) != 0) return -1;
+    if (wc_recv_until(sock, frame, sizeof(frame), deadline) != 0) return -1;
+    return wc_decode_stats(frame, out);
+}
+
+/*
+ * wc_encode_subscribe
+ * Prepara il frame di sottoscrizione per le `count` richieste (al più
+ * SUB_MAX): `interval_ms` 0 chiede un frame push a ogni variazione dei
+ * valori, altrimenti un frame con tutti i valori a intervallo fisso. `buf`
+ * deve avere spazio per SUB_HEADER_SIZE + count * (2 + BATCH_CITY_MAX)
+ * byte. Restituisce la lunghezza del frame.
+ */
+size_t wc_encode_subscribe(const weather_request_t *reqs, int count, unsigned int interval_ms,
+                           unsigned char *buf)
+{
+    if (interval_ms > 0xFFFF) interval_ms = 0xFFFF;
+    buf[0] = SUB_MAGIC;
+    buf[1] = (unsigned char)(interval_ms >> 8);
+    buf[2] = (unsigned char)interval_ms;
+    buf[3] = (unsigned char)count;
+    size_t len = SUB_HEADER_SIZE;
+    for (int i = 0; i < count; ++i) {
+        size_t clen = strnlen(reqs[i].city, BATCH_CITY_MAX);
+        buf[len] = (unsigned char)reqs[i].type;
+        buf[len + 1] = (unsigned char)clen;
+        memcpy(&buf[len + 2], reqs[i].city, clen);
+        len += 2 + clen;
+    }
+    return len;
+}
+
+/*
+ * wc_recv_push
+ * Attende il prossimo frame push di una sottoscrizione, entro `deadline`
+ * (wc_deadline, 0 per nessun limite), e lo decodifica. Restituisce 0 in
+ * caso di successo, -1 in caso di errore, alla scadenza o se il server
+ * non ha accettato la sottoscrizione (risposta che non inizia con
+ * SUB_MAGIC).
+ */
+int wc_recv_push(int sock, wc_push_t *out, uint64_t deadline)
+{
+    unsigned char hdr[SUB_PUSH_HEADER];
+    if (wc_recv_until(sock, hdr, sizeof(hdr), deadline) != 0) return -1;
+    if (hdr[0] != SUB_MAGIC || hdr[1] == 0 || hdr[1] > SUB_MAX) return -1;
+    unsigned char body[SUB_MAX * SUB_ENTRY_SIZE];
+    size_t len = (size_t)hdr[1] * SUB_ENTRY_SIZE;
+    if (wc_recv_until(sock, body, len, deadline) != 0) return -1;
+    out->count = hdr[1];
+    for (int i = 0; i < out->count; ++i) {
+        out->index[i] = body[(size_t)i * SUB_ENTRY_SIZE];
+        wc_decode_response(&body[(size_t)i * SUB_ENTRY_SIZE + 1], &out->resp[i]);
+    }
+    return 0;
+}
+
+/*
+ * wc_encode_search
+ * Prepara la richiesta di ricerca delle città il cui nome inizia con
+ * `prefix` (al più BATCH_CITY_MAX byte), con al più `max` risultati
+ * (1..SEARCH_MAX). `buf` deve avere spazio per SEARCH_HEADER_SIZE +
+ * BATCH_CITY_MAX byte. Restituisce la lunghezza del frame.
+ */
+size_t wc_encode_search(const char *prefix, unsigned int max, unsigned char *buf)
+{
+    size_t plen = strnlen(prefix, BATCH_CITY_MAX);
+    if (max < 1) max = 1;
+    if (max > SEARCH_MAX) max = SEARCH_MAX;
+    buf[0] = SEARCH_MAGIC;
+    buf[1] = (unsigned char)max;
+    buf[2] = (unsigned char)plen;
+    memcpy(&buf[SEARCH_HEADER_SIZE], prefix, plen);
+    return SEARCH_HEADER_SIZE + plen;
+}
+
+/*
+ * wc_decode_search
+ * Decodifica una risposta di ricerca completa di `len` byte (per esempio
+ * un datagramma UDP). Restituisce 0, oppure -1 se il frame non è valido.
+ */
+int wc_decode_search(const unsigned char *buf, size_t len, wc_search_t *out)
+{
+    if (len < 2 || buf[0] != SEARCH_MAGIC || buf[1] > SEARCH_MAX) return -1;
+    size_t off = 2;
+    out->count = buf[1];
+    for (int i = 0; i < out->count; ++i) {
+        if (off >= len || buf[off] > BATCH_CITY_MAX || len - off - 1 < buf[off]) return -1;
+        memcpy(out->names[i], &buf[off + 1], buf[off]);
+        out->names[i][buf[off]] = '\0';
+        off += 1 + buf[off];
+    }
+    return off == len ? 0 : -1;
+}
+
+/*
+ * wc_recv_search
+ * Riceve e decodifica la risposta a una ricerca su una connessione TCP,
+ * entro `deadline` (wc_deadline della richiesta, 0 per nessun limite).
+ * Restituisce 0, oppure -1 in caso di errore, di scadenza o di risposta
+ * non valida.
+ */
+int wc_recv_search(int sock, wc_search_t *out, uint64_t deadline)
+{
+    unsigned char hdr[2];
+    if (wc_recv_until(sock, hdr, sizeof(hdr), deadline) != 0) return -1;
+    if (hdr[0] != SEARCH_MAGIC || hdr[1] > SEARCH_MAX) return -1;
+    out->count = hdr[1];
+    for (int i = 0; i < out->count; ++i) {
+        unsigned char len;
+        if (wc_recv_until(sock, &len, 1, deadline) != 0 || len > BATCH_CITY_MAX) return -1;
+        if (wc_recv_until(sock, out->names[i], len, deadline) != 0) return -1;
+        out->names[i][len] = '\0';
+    }
+    return 0;
+}
+
+/*
+ * wc_encode_history
+ * Prepara la richiesta degli aggregati per la coppia di `req` sugli
+ * ultimi `last` campioni e sugli ultimi `window_ms` millisecondi (0 =
+ * nessun limite). `buf` deve avere spazio per HISTORY_HEADER_SIZE +
+ * BATCH_CITY_MAX + HISTORY_TRAILER_SIZE byte. Restituisce la lunghezza
+ * del frame.
+ */
+size_t wc_encode_history(const weather_request_t *req, uint32_t last, uint32_t window_ms,
+                         unsigned char *buf)
+{
+    size_t clen = strnlen(req->city, BATCH_CITY_MAX);
+    buf[0] = HISTORY_MAGIC;
+    buf[1] = (unsigned char)req->type;
+    buf[2] = (unsigned char)clen;
+    memcpy(&buf[HISTORY_HEADER_SIZE], req->city, clen);
+    uint32_t trailer[2] = { htonl(last), htonl(window_ms) };
+    memcpy(&buf[HISTORY_HEADER_SIZE + clen], trailer, sizeof(trailer));
+    return HISTORY_HEADER_SIZE + clen + HISTORY_TRAILER_SIZE;
+}
+
+/*
+ * wc_decode_history
+ * Decodifica una risposta di HISTORY_RESPONSE_SIZE byte. Restituisce 0,
+ * oppure -1 se il frame non è valido.
+ */
+int wc_decode_history(const unsigned char *buf, size_t len, wc_history_t *out)
+{
+    if (len != HISTORY_RESPONSE_SIZE || buf[0] != HISTORY_MAGIC) return -1;
+    uint32_t fields[5];
+    memcpy(fields, &buf[2], sizeof(fields));
+    out->status = buf[1];
+    out->count = ntohl(fields[0]);
+    out->min = wc_ntohf(fields[1]);
+    out->max = wc_ntohf(fields[2]);
+    out->mean = wc_ntohf(fields[3]);
+    out->stddev = wc_ntohf(fields[4]);
+    return 0;
+}
+
+/*
+ * wc_stats_percentile_us
+ * Percentile q (0..1) di un istogramma di fase, in microsecondi. Il
+ * valore e' il limite superiore del bucket che contiene il percentile;
+ * 0 se l'istogramma e' vuoto.
+ */
+double wc_stats_percentile_us(const uint32_t *hist, double q)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < STATS_BUCKETS; i++) total += hist[i];
+    if (total == 0) return 0.0;
+    uint64_t rank = (uint64_t)(q * (double)total);
+    if (rank >= total) rank = total - 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < STATS_BUCKETS; i++) {
+        seen += hist[i];
+        if (seen > rank) return (double)(1ull << (i + 1)) / 1000.0;
+    }
+    return (double)(1ull << STATS_BUCKETS) / 1000.0;
+}
+
+/*
+ * wc_udp_open
+ * Crea un socket UDP connesso al server: send/recv usano l'indirizzo del
+ * server e il kernel scarta i datagrammi provenienti da altri mittenti.
+ * Restituisce il socket oppure -1 in caso di errore (già segnalato).
+ */
+int wc_udp_open(const struct sockaddr_in *server_addr)
+{
+    int sock = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0) {
+        perror("socket");
+        return -1;
+    }
+    if (connect(sock, (const struct sockaddr *)server_addr, sizeof(*server_addr)) < 0) {
+        perror("connect");
+        closesocket(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/*
+ * wc_udp_exchange
+ * Invia la richiesta in un datagramma e attende la risposta per al più
+ * `timeout_ms` millisecondi; in mancanza di risposta la richiesta viene
+ * ritrasmessa fino a `retries` volte. Le richieste sono idempotenti, per
+ * cui una risposta in ritardo a una trasmissione precedente è comunque
+ * valida. Restituisce i byte ricevuti oppure -1 (timeout o errore).
+ */
+int wc_udp_exchange(int sock, const void *req, size_t req_len, void *resp, size_t resp_size,
+                    int timeout_ms, int retries)
+{
+    for (int attempt = 0; attempt <= retries; ++attempt) {
+        if (send(sock, (const char *)req, (int)req_len, 0) != (int)req_len) return -1;
+        struct pollfd pfd;
+        pfd.fd = sock;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        int n = poll(&pfd, 1, timeout_ms);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) continue; // timeout: ritrasmissione
+        int r = recv(sock, (char *)resp, (int)resp_size, 0);
+        if (r >= 0) return r;
+        // ICMP port unreachable di un invio precedente: si riprova
+#if defined _WIN32
+        if (WSAGetLastError() != WSAECONNRESET) return -1;
+#else
+        if (errno != ECONNREFUSED && errno != EINTR) return -1;
+#endif
+    }
+    return -1;
+}
+
+/*
+ * API non bloccante
+ *
+ * Ogni connessione ha un buffer circolare di WC_MAX_INFLIGHT slot con la
+ * callback delle richieste inviate e non ancora risposte, un buffer di
+ * uscita con le richieste codificate non ancora scritte sul socket e un
+ * buffer di ingresso in cui si accumulano le risposte parziali. Tutto è
+ * allocato insieme alla connessione in wc_open.
+ */
+#define WC_IN_SIZE (64 * RESPONSE_SIZE)
+
+typedef struct {
+    wc_callback_t cb;
+    void *user;
+    char type;                      // tipo richiesto (la risposta v2 non lo ripete)
+} wc_slot_t;
+
+struct wc_conn {
+    int fd;
+    int connecting;                 // connect non ancora completata
+    int failed;                     // connessione in errore: nuove richieste rifiutate
+    int v2;                         // formato compatto v2 (wc_set_v2)
+    unsigned head;                  // prossimo slot in attesa di risposta
+    unsigned count;                 // richieste in volo
+    wc_slot_t slots[WC_MAX_INFLIGHT];
+    size_t out_off, out_len;
+    unsigned char outbuf[WC_MAX_INFLIGHT * REQUEST_SIZE];
+    size_t in_len;
+    unsigned char inbuf[WC_IN_SIZE];
+};
+
+/*
+ * wc_open
+ * Crea il socket non bloccante e avvia la connessione al server. La
+ * connessione si completa durante le successive chiamate a wc_process.
+ * Restituisce NULL in caso di errore.
+ */
+wc_conn_t *wc_open(const struct sockaddr_in *server_addr)
+{
+    wc_conn_t *c = (wc_conn_t *)calloc(1, sizeof(*c));
+    if (!c) return NULL;
+    c->fd = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (c->fd < 0) {
+        free(c);
+        return NULL;
+    }
+    if (set_nonblocking(c->fd) != 0) {
+        closesocket(c->fd);
+        free(c);
+        return NULL;
+    }
+    apply_sockopts(c->fd, &sock_opts);
+    if (connect(c->fd, (const struct sockaddr *)server_addr, sizeof(*server_addr)) < 0) {
+        if (!WC_INPROGRESS()) {
+            closesocket(c->fd);
+            free(c);
+            return NULL;
+        }
+        c->connecting = 1;
+    }
+    return c;
+}
+
+/*
+ * wc_set_v2
+ * Sceglie il formato delle richieste successive: v2 compatto (on != 0) o
+ * v1 a lunghezza fissa. Va chiamata senza richieste in volo.
+ */
+void wc_set_v2(wc_conn_t *c, int on)
+{
+    if (c->count == 0) c->v2 = on != 0;
+}
+
+int wc_fd(const wc_conn_t *c)
+{
+    return c->fd;
+}
+
+/*
+ * wc_want_write
+ * Indica se il chiamante deve attendere anche la scrivibilità del socket:
+ * vero finché la connect è in corso o restano richieste da inviare.
+ */
+int wc_want_write(const wc_conn_t *c)
+{
+    return !c->failed && (c->connecting || c->out_len > c->out_off);
+}
+
+int wc_pending(const wc_conn_t *c)
+{
+    return (int)c->count;
+}
+
+/*
+ * wc_submit
+ * Accoda una richiesta: la codifica nel buffer di uscita e registra la
+ * callback nel primo slot libero. L'invio avviene in wc_process.
+ * Restituisce 0 in caso di successo, -1 se la connessione è in errore o
+ * se ci sono già WC_MAX_INFLIGHT richieste in volo.
+ */
+int wc_submit(wc_conn_t *c, const weather_request_t *req, wc_callback_t cb, void *user)
+{
+    if (c->failed || c->count == WC_MAX_INFLIGHT) return -1;
+
+    // Compattazione: i byte non inviati sono al massimo count * REQUEST_SIZE
+    // (un frame v2 non supera mai REQUEST_SIZE)
+    if (c->out_len + REQUEST_SIZE > sizeof(c->outbuf)) {
+        memmove(c->outbuf, c->outbuf + c->out_off, c->out_len - c->out_off);
+        c->out_len -= c->out_off;
+        c->out_off = 0;
+    }
+    if (c->v2) {
+        c->out_len += wc_encode_request_v2(req, c->outbuf + c->out_len);
+    } else {
+        wc_encode_request(req, c->outbuf + c->out_len);
+        c->out_len += REQUEST_SIZE;
+    }
+
+    wc_slot_t *s = &c->slots[(c->head + c->count) % WC_MAX_INFLIGHT];
+    s->cb = cb;
+    s->user = user;
+    s->type = req->type;
+    c->count++;
+    return 0;
+}
+
+static void future_done(void *user, int error, const weather_response_t *resp)
+{
+    wc_future_t *fut = (wc_future_t *)user;
+    fut->error = error;
+    if (resp) fut->resp = *resp;
+    fut->done = 1;
+}
+
+/*
+ * wc_submit_future
+ * Come wc_submit, ma il completamento viene scritto nel future fornito
+ * dal chiamante, che deve restare valido fino a quando `done` vale 1.
+ */
+int wc_submit_future(wc_conn_t *c, const weather_request_t *req, wc_future_t *fut)
+{
+    fut->done = 0;
+    fut->error = 0;
+    return wc_submit(c, req, future_done, fut);
+}
+
+/*
+ * fail_all
+ * Segna la connessione come fallita e completa con errore tutte le
+ * richieste in volo.
+ */
+static int fail_all(wc_conn_t *c)
+{
+    c->failed = 1;
+    c->out_off = c->out_len = 0;
+    while (c->count > 0) {
+        wc_slot_t s = c->slots[c->head];
+        c->head = (c->head + 1) % WC_MAX_INFLIGHT;
+        c->count--;
+        if (s.cb) s.cb(s.user, -1, NULL);
+    }
+    return -1;
+}
+
+/*
+ * wc_process
+ * Avanza la connessione: completa la connect, scrive quanto possibile del
+ * buffer di uscita e legge le risposte disponibili, invocando una
+ * callback per ogni risposta completa. `readable` e `writable` indicano
+ * gli eventi segnalati dal poll del chiamante. Restituisce il numero di
+ * richieste completate, oppure -1 se la connessione è fallita (le
+ * richieste in volo vengono completate con errore).
+ */
+int wc_process(wc_conn_t *c, int readable, int writable)
+{
+    if (c->failed) return -1;
+
+    if (c->connecting) {
+        if (!writable) return 0;
+        int err = 0;
+#if defined _WIN32
+        int len = sizeof(err);
+#else
+        socklen_t len = sizeof(err);
+#endif
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, (char *)&err, &len) != 0 || err != 0) {
+            return fail_all(c);
+        }
+        c->connecting = 0;
+    }
+
+    while (c->out_off < c->out_len) {
+        int n = send(c->fd, (const char *)c->outbuf + c->out_off, (int)(c->out_len - c->out_off), SEND_FLAGS);
+        if (n < 0) {
+            if (WC_WOULDBLOCK()) break;
+            return fail_all(c);
+        }
+        c->out_off += (size_t)n;
+    }
+    if (c->out_off == c->out_len) c->out_off = c->out_len = 0;
+
+    if (!readable) return 0;
+
+    int completed = 0;
+    for (;;) {
+        int n = recv(c->fd, (char *)c->inbuf + c->in_len, (int)(sizeof(c->inbuf) - c->in_len), 0);
+        if (n == 0) return fail_all(c);
+        if (n < 0) {
+            if (WC_WOULDBLOCK()) break;
+            return fail_all(c);
+        }
+        c->in_len += (size_t)n;
+
+        // Consegna di tutte le risposte complete presenti nel buffer
+        size_t off = 0;
+        while (c->in_len > off) {
+            if (c->count == 0) return fail_all(c); // risposta non richiesta
+            size_t rlen = c->v2 ? wc_response_v2_length(c->inbuf[off]) : RESPONSE_SIZE;
+            if (c->in_len - off < rlen) break;
+            weather_response_t r;
+            wc_slot_t s = c->slots[c->head];
+            if (c->v2) wc_decode_response_v2(c->inbuf + off, s.type, &r);
+            else wc_decode_response(c->inbuf + off, &r);
+            off += rlen;
+            c->head = (c->head + 1) % WC_MAX_INFLIGHT;
+            c->count--;
+            completed++;
+            if (s.cb) s.cb(s.user, 0, &r);
+        }
+        memmove(c->inbuf, c->inbuf + off, c->in_len - off);
+        c->in_len -= off;
+    }
+    return completed;
+}
+
+/*
+ * wc_run
+ * Ciclo di attesa per chi non ha un proprio event loop: esegue poll sul
+ * socket e wc_process finché tutte le richieste in volo sono completate
+ * o per `timeout_ms` millisecondi non arriva alcun evento (negativo per
+ * attendere senza limite). Restituisce il numero di richieste ancora in volo, oppure -1
+ * se la connessione è fallita.
+ */
+int wc_run(wc_conn_t *c, int timeout_ms)
+{
+    while (c->count > 0) {
+        struct pollfd pfd;
+        pfd.fd = c->fd;
+        pfd.events = POLLIN;
+        if (wc_want_write(c)) pfd.events |= POLLOUT;
+        pfd.revents = 0;
+        int n = poll(&pfd, 1, timeout_ms);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return fail_all(c);
+        }
+        if (n == 0) break;
+        int err = (pfd.revents & (POLLERR | POLLHUP)) != 0;
+        if (wc_process(c, (pfd.revents & POLLIN) || err, (pfd.revents & POLLOUT) || err) < 0) return -1;
+    }
+    return c->failed ? -1 : (int)c->count;
+}
+
+/*
+ * wc_close
+ * Chiude la connessione; le richieste ancora in volo vengono completate
+ * con errore prima di liberare la memoria.
+ */
+void wc_close(wc_conn_t *c)
+{
+    if (!c) return;
+    if (!c->failed) fail_all(c);
+    closesocket(c->fd);
+    free(c);
+}
@@ -0,0 +1,167 @@
+/*
+ * wclient.h
+ *
+ * Libreria client del servizio meteo.
+ * Contiene le funzioni di base (risoluzione, codifica/decodifica dei
+ * messaggi, I/O bloccante, formattazione) e un'API non bloccante per
+ * mantenere molte richieste in volo su un'unica connessione persistente
+ * (il server deve essere avviato con -k).
+ *
+ * Uso dell'API non bloccante:
+ *  - wc_open apre la connessione (connect non bloccante); con wc_set_v2,
+ *    prima della prima richiesta, si usa il formato compatto v2;
+ *  - wc_submit / wc_submit_future accodano una richiesta;
+ *  - il chiamante attende su wc_fd (lettura, e scrittura se wc_want_write)
+ *    nel proprio event loop e chiama wc_process quando il socket è pronto,
+ *    oppure usa wc_run che esegue il poll internamente;
+ *  - le risposte arrivano nello stesso ordine delle richieste e vengono
+ *    consegnate alla callback o al future corrispondente.
+ * Nessuna allocazione avviene per richiesta: le richieste in volo occupano
+ * slot di un buffer circolare interno alla connessione.
+ */
+
+#ifndef WCLIENT_H_
+#define WCLIENT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "protocol.h"
+
+#define WC_MAX_INFLIGHT 256   // richieste in volo per connessione
+#define WC_UDP_TIMEOUT_MS 500 // attesa di default di una risposta UDP
+#define WC_UDP_RETRIES    3   // ritrasmissioni di default di una richiesta UDP
+#define WC_IO_TIMEOUT_MS  5000 // attesa di default di connect, invio e ricezione TCP
+#define WC_BUSY_POLL_US   50   // attesa attiva di --low-latency sulla coda della scheda
+
+struct sockaddr_in;
+
+/*
+ * Callback di completamento: `error` vale 0 e `resp` punta alla risposta
+ * decodificata, oppure `error` vale -1 e `resp` è NULL se la connessione
+ * è fallita prima della risposta. Dalla callback si possono accodare
+ * nuove richieste, ma non si deve chiudere la connessione.
+ */
+typedef void (*wc_callback_t)(void *user, int error, const weather_response_t *resp);
+
+// Future interrogabile dal chiamante: `done` diventa 1 al completamento
+typedef struct {
+    int done;
+    int error;
+    weather_response_t resp;
+} wc_future_t;
+
+typedef struct wc_conn wc_conn_t;
+
+/*
+ * Statistiche del server (richiesta STATS_REQUEST). Il frame contiene
+ * STATS_MAGIC, STATS_STAGES, STATS_BUCKETS e poi interi a 32 bit in
+ * network byte order: richieste per stato, richieste per tipo
+ * ('t','h','w','p', altro), connessioni attive, connessioni chiuse per
+ * scadenza e un istogramma per fase
+ * (accept->recv, recv->build, build->send) in cui il bucket i conta le
+ * durate tra 2^i e 2^(i+1) ns.
+ */
+typedef struct {
+    uint32_t status[STATS_STATUSES];
+    uint32_t types[STATS_TYPES];
+    uint32_t active_connections;
+    uint32_t timeouts;            // connessioni chiuse dal server per scadenza
+    uint32_t hist[STATS_STAGES][STATS_BUCKETS];
+} wc_stats_t;
+
+// Frame push di una sottoscrizione: per ogni voce aggiornata l'indice
+// nella sottoscrizione e la risposta decodificata
+typedef struct {
+    int count;
+    unsigned char index[SUB_MAX];
+    weather_response_t resp[SUB_MAX];
+} wc_push_t;
+
+// Risultato di una ricerca per prefisso: nomi in ordine alfabetico
+typedef struct {
+    int count;
+    char names[SEARCH_MAX][BATCH_CITY_MAX + 1];
+} wc_search_t;
+
+// Aggregati della cronologia di una coppia (città, tipo)
+typedef struct {
+    unsigned int status;
+    uint32_t count;
+    float min;
+    float max;
+    float mean;
+    float stddev;
+} wc_history_t;
+
+/*
+ * Opzioni dei socket TCP (--fastopen, --nodelay, --busy-poll o tutte con
+ * --low-latency), applicate da wc_connect e wc_open prima della connect.
+ * Con fastopen la connect non invia subito il SYN: parte con il primo
+ * invio e porta la richiesta, se il client ha gia' un cookie TFO del
+ * server; altrimenti l'handshake e' quello normale.
+ */
+typedef struct {
+    int fastopen;     // TCP_FASTOPEN_CONNECT: richiesta nel SYN
+    int nodelay;      // TCP_NODELAY: nessuna attesa di Nagle sui frame piccoli
+    int busy_poll_us; // SO_BUSY_POLL: attesa attiva in ricezione, 0 = no
+} wc_sockopts_t;
+
+// Funzioni di base
+int wc_resolve(const char *host, int port, struct sockaddr_in *out);
+int wc_connect(const struct sockaddr_in *server_addr);
+void wc_set_timeout(int ms);
+int wc_timeout(void);
+int wc_set_sockopts(const wc_sockopts_t *opts);
+void wc_peer_ip(int sock, const char *server, char *peer_ip, size_t size);
+uint64_t wc_deadline(void);
+int wc_send_until(int sock, const void *buf, size_t len, uint64_t deadline);
+int wc_recv_until(int sock, void *buf, size_t len, uint64_t deadline);
+int wc_send_all(int sock, const void *buf, size_t len);
+int wc_recv_all(int sock, void *buf, size_t len);
+float wc_ntohf(uint32_t i);
+int wc_parse_request(const char *request, weather_request_t *out);
+void wc_encode_request(const weather_request_t *req, unsigned char *reqbuf);
+void wc_decode_response(const unsigned char *respbuf, weather_response_t *out);
+size_t wc_encode_request_v2(const weather_request_t *req, unsigned char *reqbuf);
+size_t wc_encode_request_v2_id(char type, unsigned int city_id, unsigned char *reqbuf);
+size_t wc_response_v2_length(unsigned char status);
+void wc_decode_response_v2(const unsigned char *respbuf, char type, weather_response_t *out);
+void wc_format_result(const char *req_city, const weather_response_t *r, char *message, size_t size);
+int wc_fetch_stats(int sock, wc_stats_t *out);
+int wc_decode_stats(const unsigned char *buf, wc_stats_t *out);
+double wc_stats_percentile_us(const uint32_t *hist, double q);
+
+// Sottoscrizioni (server con -e e --snapshot)
+size_t wc_encode_subscribe(const weather_request_t *reqs, int count, unsigned int interval_ms,
+                           unsigned char *buf);
+int wc_recv_push(int sock, wc_push_t *out, uint64_t deadline);
+
+// Ricerca delle città per prefisso
+size_t wc_encode_search(const char *prefix, unsigned int max, unsigned char *buf);
+int wc_decode_search(const unsigned char *buf, size_t len, wc_search_t *out);
+int wc_recv_search(int sock, wc_search_t *out, uint64_t deadline);
+
+// Aggregati sulla cronologia (server con --history)
+size_t wc_encode_history(const weather_request_t *req, uint32_t last, uint32_t window_ms,
+                         unsigned char *buf);
+int wc_decode_history(const unsigned char *buf, size_t len, wc_history_t *out);
+
+// Trasporto UDP: un datagramma per richiesta e uno per risposta
+int wc_udp_open(const struct sockaddr_in *server_addr);
+int wc_udp_exchange(int sock, const void *req, size_t req_len, void *resp, size_t resp_size,
+                    int timeout_ms, int retries);
+
+// API non bloccante
+wc_conn_t *wc_open(const struct sockaddr_in *server_addr);
+void wc_set_v2(wc_conn_t *c, int on);
+int wc_fd(const wc_conn_t *c);
+int wc_want_write(const wc_conn_t *c);
+int wc_pending(const wc_conn_t *c);
+int wc_submit(wc_conn_t *c, const weather_request_t *req, wc_callback_t cb, void *user);
+int wc_submit_future(wc_conn_t *c, const weather_request_t *req, wc_future_t *fut);
+int wc_process(wc_conn_t *c, int readable, int writable);
+int wc_run(wc_conn_t *c, int timeout_ms);
+void wc_close(wc_conn_t *c);
+
+#endif /* WCLIENT_H_ */
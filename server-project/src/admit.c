@@ -0,0 +1,137 @@
+/*
+ * admit.c
+ *
+ * Le connessioni sono contate con un contatore atomico condiviso: viene
+ * toccato solo ad apertura e chiusura, non per ogni richiesta.
+ *
+ * Il token bucket di un client e' tenuto nella forma equivalente a un
+ * solo istante (GCRA): tat e' il momento in cui il secchio sara' di
+ * nuovo pieno. Una richiesta sposta tat in avanti di un intervallo
+ * (1/rate) e viene rifiutata se tat supererebbe l'istante attuale di
+ * piu' di burst intervalli. Lo stato e' un solo intero a 64 bit,
+ * aggiornato con compare-and-swap senza lock.
+ *
+ * La tabella e' indirizzata con l'hash dell'IP e ispezione lineare su
+ * ADMIT_PROBES voci. Una voce si libera quando il suo secchio e' di
+ * nuovo pieno (tat nel passato): riusarla non cambia il limite di
+ * nessuno. Se tutte le voci esaminate sono attive il nuovo client
+ * condivide il secchio di quella che si riempira' per prima.
+ */
+
+#include "admit.h"
+#include "protocol.h"
+#include "stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#define SHED_FLAGS 0
+#else
+#include <unistd.h>
+#include <sys/socket.h>
+#define closesocket close
+#define SHED_FLAGS (MSG_DONTWAIT | MSG_NOSIGNAL)
+#endif
+
+typedef struct {
+	atomic_uint_fast64_t key; // hash dell'IP, 0 = voce libera
+	atomic_uint_fast64_t tat; // istante in cui il secchio torna pieno (ns)
+} admit_entry_t;
+
+static int max_conns;             // 0 = nessun limite
+static atomic_int conns;
+static uint64_t interval_ns;      // 1/rate, 0 = nessun limite per client
+static uint64_t burst_ns;         // burst * interval_ns
+static admit_entry_t *table;
+
+int admit_start(int conn_limit, unsigned int rate, unsigned int burst) {
+	if (conn_limit < 0) return -1;
+	max_conns = conn_limit;
+	if (rate == 0) return 0;
+	if (rate > 1000000000u) return -1;
+	table = calloc(ADMIT_TABLE_SIZE, sizeof(*table));
+	if (!table) return -1;
+	interval_ns = 1000000000ull / rate;
+	burst_ns = (uint64_t)(burst ? burst : rate) * interval_ns;
+	return 0;
+}
+
+int admit_conn_open(void) {
+	if (max_conns == 0) return 0;
+	if (atomic_fetch_add_explicit(&conns, 1, memory_order_relaxed) >= max_conns) {
+		atomic_fetch_sub_explicit(&conns, 1, memory_order_relaxed);
+		return -1;
+	}
+	return 0;
+}
+
+void admit_conn_close(void) {
+	if (max_conns == 0) return;
+	atomic_fetch_sub_explicit(&conns, 1, memory_order_relaxed);
+}
+
+void admit_shed(int sock) {
+	// 9 byte in un socket appena accettato: la send non resta in attesa
+	send(sock, (const char *)response_overloaded, RESPONSE_SIZE, SHED_FLAGS);
+	stats_count_request('\0', STATUS_OVERLOADED);
+	closesocket(sock);
+}
+
+// FNV-1a dell'indirizzo in forma testuale; mai 0 (voce libera)
+static uint64_t ip_key(const char *ip) {
+	uint64_t h = 0xcbf29ce484222325ull;
+	for (; *ip; ip++) {
+		h ^= (unsigned char)*ip;
+		h *= 0x100000001b3ull;
+	}
+	return h | 1;
+}
+
+static admit_entry_t *entry_for(uint64_t key, uint64_t now) {
+	size_t base = (size_t)(key >> 32);
+	admit_entry_t *victim = NULL;
+	uint64_t oldest = UINT64_MAX;
+	for (size_t p = 0; p < ADMIT_PROBES; p++) {
+		admit_entry_t *e = &table[(base + p) & (ADMIT_TABLE_SIZE - 1)];
+		uint64_t k = atomic_load_explicit(&e->key, memory_order_relaxed);
+		if (k == key) return e;
+		if (k == 0) {
+			if (atomic_compare_exchange_strong_explicit(&e->key, &k, key,
+					memory_order_relaxed, memory_order_relaxed) || k == key) {
+				return e;
+			}
+		}
+		uint64_t tat = atomic_load_explicit(&e->tat, memory_order_relaxed);
+		if (tat < oldest) {
+			oldest = tat;
+			victim = e;
+		}
+	}
+	// secchio gia' pieno: la voce passa al nuovo client senza perdere nulla
+	if (oldest <= now) {
+		uint64_t k = atomic_load_explicit(&victim->key, memory_order_relaxed);
+		atomic_compare_exchange_strong_explicit(&victim->key, &k, key,
+				memory_order_relaxed, memory_order_relaxed);
+	}
+	return victim;
+}
+
+int admit_request(const char *client_ip, unsigned int cost) {
+	if (interval_ns == 0) return 0;
+	uint64_t now = stats_now_ns();
+	admit_entry_t *e = entry_for(ip_key(client_ip), now);
+	uint64_t step = (uint64_t)cost * interval_ns;
+	if (step > burst_ns) step = burst_ns; // un batch piu' grande del burst vuota il secchio
+	uint64_t tat = atomic_load_explicit(&e->tat, memory_order_relaxed);
+	for (;;) {
+		uint64_t next = (tat > now ? tat : now) + step;
+		if (next - now > burst_ns) return -1;
+		if (atomic_compare_exchange_weak_explicit(&e->tat, &tat, next,
+				memory_order_relaxed, memory_order_relaxed)) {
+			return 0;
+		}
+	}
+}
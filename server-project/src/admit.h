@@ -0,0 +1,42 @@
+/*
+ * admit.h
+ *
+ * Controllo di ammissione del server: un limite alle connessioni
+ * contemporanee (--max-conns) e un limite di richieste al secondo per
+ * indirizzo IP del client (--rate, --burst). Oltre i limiti il server
+ * risponde subito con STATUS_OVERLOADED invece di accodare lavoro, cosi'
+ * un client rumoroso o un picco di connessioni non allungano la coda
+ * delle latenze degli altri client.
+ *
+ * Il limite per client e' un token bucket (burst gettoni, rate al
+ * secondo) tenuto in una tabella di dimensione fissa: con piu' client
+ * attivi che voci, i nuovi condividono la voce meno recente invece di
+ * far crescere la memoria.
+ */
+
+#ifndef ADMIT_H_
+#define ADMIT_H_
+
+#define ADMIT_TABLE_SIZE 16384 // voci della tabella dei client, potenza di due
+#define ADMIT_PROBES     8     // voci esaminate per ogni ricerca
+
+// Attiva i limiti: max_conns connessioni (0 = nessun limite), rate
+// richieste al secondo per client con raffiche fino a burst (rate 0 =
+// nessun limite, burst 0 = rate). Va chiamata prima di avviare i thread.
+// Ritorna 0 o -1.
+int admit_start(int max_conns, unsigned int rate, unsigned int burst);
+
+// Registra una nuova connessione: 0 se ammessa, -1 se oltre il limite.
+// Ogni connessione ammessa va chiusa con admit_conn_close.
+int admit_conn_open(void);
+void admit_conn_close(void);
+
+// Risponde a una connessione non ammessa con una risposta classica di
+// sovraccarico, senza attendere il client, e chiude il socket
+void admit_shed(int sock);
+
+// Addebita cost richieste al client: 0 se ammesse, -1 se il client ha
+// esaurito i gettoni
+int admit_request(const char *client_ip, unsigned int cost);
+
+#endif /* ADMIT_H_ */
@@ -0,0 +1,36 @@
+/*
+ * cities.c
+ *
+ * Ricerca O(1) delle città tramite la tabella hash perfetta generata
+ * in city_hash.h: due hash case-insensitive, un accesso alla tabella e
+ * un solo confronto di stringa, qualunque sia il numero di città.
+ */
+
+#include "cities.h"
+#include "city_hash.h"
+
+#define CITY_NAME(id, name) name,
+const char *const city_names[CITY_COUNT] = { CITY_LIST(CITY_NAME) };
+#undef CITY_NAME
+
+#define CITY_LEN(id, name) (uint8_t)(sizeof(name) - 1),
+static const uint8_t city_lengths[CITY_COUNT] = { CITY_LIST(CITY_LEN) };
+#undef CITY_LEN
+
+int city_lookup(const char *name, size_t len) {
+	if (len == 0) return CITY_ID_NONE;
+	uint32_t b = city_hash(0, name, len) % CITY_HASH_BUCKETS;
+	int id = city_hash_slots[city_hash(city_hash_disp[b], name, len) & (CITY_HASH_SIZE - 1)];
+	if (id == CITY_ID_NONE || city_lengths[id] != len) return CITY_ID_NONE;
+
+	// confronto case-insensitive con l'unico candidato
+	const char *ref = city_names[id];
+	for (size_t i = 0; i < len; i++) {
+		unsigned char a = (unsigned char)name[i];
+		unsigned char c = (unsigned char)ref[i];
+		if (a >= 'A' && a <= 'Z') a = (unsigned char)(a + ('a' - 'A'));
+		if (c >= 'A' && c <= 'Z') c = (unsigned char)(c + ('a' - 'A'));
+		if (a != c) return CITY_ID_NONE;
+	}
+	return id;
+}
@@ -0,0 +1,64 @@
+/*
+ * cities.h
+ *
+ * Tabella delle città supportate e indice O(1) case-insensitive che
+ * associa al nome di una città un identificativo intero compatto.
+ * Il resto della pipeline di richiesta lavora sull'identificativo.
+ */
+
+#ifndef CITIES_H_
+#define CITIES_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Elenco delle città supportate (X-macro): aggiungendo una voce qui
+// occorre rigenerare city_hash.h con tools/gencities.c
+#define CITY_LIST(X) \
+	X(CITY_BARI,    "Bari")    \
+	X(CITY_ROMA,    "Roma")    \
+	X(CITY_MILANO,  "Milano")  \
+	X(CITY_NAPOLI,  "Napoli")  \
+	X(CITY_TORINO,  "Torino")  \
+	X(CITY_PALERMO, "Palermo") \
+	X(CITY_GENOVA,  "Genova")  \
+	X(CITY_BOLOGNA, "Bologna") \
+	X(CITY_FIRENZE, "Firenze") \
+	X(CITY_VENEZIA, "Venezia")
+
+#define CITY_ENUM(id, name) id,
+typedef enum {
+	CITY_LIST(CITY_ENUM)
+	CITY_COUNT
+} city_id_t;
+#undef CITY_ENUM
+
+#define CITY_ID_NONE (-1)
+
+extern const char *const city_names[CITY_COUNT];
+
+// Hash FNV-1a con ripiegamento ASCII in minuscolo: lo stesso valore per
+// "Bari", "BARI" e "bari". Usato sia a runtime sia dai generatori. Senza
+// il rimescolamento finale (fmix32 di murmur3) i bit bassi dipendono solo
+// dai bit bassi del seme: con la maschera della tabella due nomi nello
+// stesso slot lo resterebbero per ogni seme.
+static inline uint32_t city_hash(uint32_t seed, const char *name, size_t len) {
+	uint32_t h = 2166136261u ^ seed;
+	for (size_t i = 0; i < len; i++) {
+		unsigned char c = (unsigned char)name[i];
+		if (c >= 'A' && c <= 'Z') c = (unsigned char)(c + ('a' - 'A'));
+		h ^= c;
+		h *= 16777619u;
+	}
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35u;
+	h ^= h >> 16;
+	return h;
+}
+
+// Ritorna l'identificativo della città (case-insensitive) o CITY_ID_NONE.
+int city_lookup(const char *name, size_t len);
+
+#endif /* CITIES_H_ */
@@ -0,0 +1,25 @@
+/*
+ * city_hash.h
+ *
+ * GENERATO da tools/gencities.c: non modificare a mano.
+ * Tabella hash perfetta (hash and displace) per le città di CITY_LIST.
+ */
+
+#ifndef CITY_HASH_H_
+#define CITY_HASH_H_
+
+#include <stdint.h>
+
+#define CITY_HASH_BUCKETS 3
+#define CITY_HASH_SIZE    16
+
+static const uint32_t city_hash_disp[CITY_HASH_BUCKETS] = {
+	4u, 5u, 1u,
+};
+
+static const int16_t city_hash_slots[CITY_HASH_SIZE] = {
+	-1, -1, 0, -1, 8, 7, 4, -1,
+	6, 9, -1, 1, -1, 2, 5, 3,
+};
+
+#endif /* CITY_HASH_H_ */
@@ -0,0 +1,441 @@
+/*
+ * dataset.c
+ *
+ * Mappatura, validazione e sostituzione del dataset. La validazione
+ * controlla solo l'intestazione (sezioni dentro il file e allineate):
+ * id e nomi letti dalla tabella hash sono verificati a ogni ricerca con
+ * due confronti, cosi' il costo dell'avvio non dipende dal numero di
+ * città e un file danneggiato non puo' far leggere fuori dalla mappatura.
+ *
+ * Il dataset corrente e' un puntatore atomico. Ogni thread che legge ha
+ * un contatore di sequenza nell'array statico, riservato al primo uso
+ * come i blocchi di stats.c e scritto solo da lui: dispari dentro una
+ * sezione di lettura. Dopo la sostituzione chi ricarica guarda i
+ * contatori e aspetta che ogni contatore dispari cambi (il thread e'
+ * uscito dalla sezione in cui poteva aver letto il vecchio puntatore);
+ * solo allora smappa il precedente. I thread in eccesso rispetto a
+ * DATASET_READERS condividono l'ultimo contatore, che conta i lettori
+ * dentro una sezione e va atteso fino a zero.
+ */
+
+#include "dataset.h"
+#include "cities.h"
+#include "protocol.h"
+#include "snapshot.h"
+#include "rng.h"
+#include "worker.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define DATASET_READERS (MAX_WORKERS + 2) // worker, thread principale e snapshot
+
+_Static_assert(DATASET_METRICS == WEATHER_TYPES, "una colonna del dataset per tipo");
+
+struct dataset {
+	const unsigned char *base;   // inizio della mappatura
+	size_t size;
+#if defined(_WIN32)
+	HANDLE mapping;
+#endif
+	unsigned int version;
+	uint32_t city_count;
+	uint32_t hash_buckets;
+	uint32_t hash_mask;
+	uint32_t names_size;
+	const dataset_city_t *cities;
+	const char *names;
+	const uint32_t *disp;
+	const int32_t *slots;
+	const uint32_t *sorted;
+	const uint64_t *keys;
+};
+
+static _Atomic(dataset_t *) current = NULL;
+static char *dataset_path;
+static unsigned int loads = 0;   // solo dataset_open e il thread di ricarica
+static pthread_mutex_t reload_lock = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct {
+	_Alignas(CACHE_LINE_SIZE) atomic_uint seq;
+} reader_t;
+
+static reader_t readers[DATASET_READERS + 1]; // l'ultimo e' condiviso
+static atomic_int next_reader;
+static _Thread_local reader_t *my_reader;
+static _Thread_local int my_shared;
+static _Thread_local unsigned int my_depth; // sezioni annidate
+
+// 1 se la sezione [off, off + count * elem) e' dentro il file e allineata
+static int section_ok(size_t size, uint64_t off, uint64_t count, size_t elem, size_t align) {
+	if (off % align != 0 || off > size) return 0;
+	return count <= (size - off) / elem;
+}
+
+static int validate(const dataset_header_t *h, size_t size) {
+	if (memcmp(h->magic, DATASET_MAGIC, sizeof(h->magic)) != 0) return 0;
+	if (h->format != DATASET_FORMAT || h->byte_order != DATASET_BYTE_ORDER) return 0;
+	if (h->city_count > DATASET_MAX_CITIES || h->hash_buckets == 0) return 0;
+	if (h->hash_size == 0 || (h->hash_size & (h->hash_size - 1)) != 0) return 0;
+	return section_ok(size, h->cities_off, h->city_count, sizeof(dataset_city_t), 8) &&
+			section_ok(size, h->names_off, h->names_size, 1, 1) &&
+			section_ok(size, h->disp_off, h->hash_buckets, sizeof(uint32_t), 4) &&
+			section_ok(size, h->slots_off, h->hash_size, sizeof(int32_t), 4) &&
+			section_ok(size, h->sorted_off, h->city_count, sizeof(uint32_t), 4) &&
+			section_ok(size, h->keys_off, h->city_count, sizeof(uint64_t), 8);
+}
+
+static void unmap(dataset_t *ds) {
+#if defined(_WIN32)
+	UnmapViewOfFile(ds->base);
+	CloseHandle(ds->mapping);
+#else
+	munmap((void *)ds->base, ds->size);
+#endif
+	free(ds);
+}
+
+// Mappa e valida il file; ritorna il dataset (non ancora pubblicato) o NULL
+static dataset_t *map_file(const char *path) {
+	dataset_t *ds = calloc(1, sizeof(*ds));
+	if (!ds) return NULL;
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		free(ds);
+		return NULL;
+	}
+	LARGE_INTEGER fsize;
+	if (!GetFileSizeEx(file, &fsize) || fsize.QuadPart < (LONGLONG)sizeof(dataset_header_t)) {
+		CloseHandle(file);
+		free(ds);
+		return NULL;
+	}
+	ds->size = (size_t)fsize.QuadPart;
+	ds->mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file); // la mappatura mantiene il file aperto
+	if (!ds->mapping) {
+		free(ds);
+		return NULL;
+	}
+	ds->base = MapViewOfFile(ds->mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!ds->base) {
+		CloseHandle(ds->mapping);
+		free(ds);
+		return NULL;
+	}
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		free(ds);
+		return NULL;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(dataset_header_t)) {
+		close(fd);
+		free(ds);
+		return NULL;
+	}
+	ds->size = (size_t)st.st_size;
+	void *base = mmap(NULL, ds->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); // la mappatura resta valida
+	if (base == MAP_FAILED) {
+		free(ds);
+		return NULL;
+	}
+	// accessi sparsi dalla tabella hash: niente read-ahead
+	madvise(base, ds->size, MADV_RANDOM);
+	ds->base = base;
+#endif
+	const dataset_header_t *h = (const dataset_header_t *)ds->base;
+	if (!validate(h, ds->size)) {
+		unmap(ds);
+		return NULL;
+	}
+	ds->city_count = h->city_count;
+	ds->hash_buckets = h->hash_buckets;
+	ds->hash_mask = h->hash_size - 1;
+	ds->names_size = h->names_size;
+	ds->cities = (const dataset_city_t *)(ds->base + h->cities_off);
+	ds->names = (const char *)(ds->base + h->names_off);
+	ds->disp = (const uint32_t *)(ds->base + h->disp_off);
+	ds->slots = (const int32_t *)(ds->base + h->slots_off);
+	ds->sorted = (const uint32_t *)(ds->base + h->sorted_off);
+	ds->keys = (const uint64_t *)(ds->base + h->keys_off);
+	return ds;
+}
+
+int dataset_open(const char *path) {
+	dataset_t *ds = map_file(path);
+	if (!ds) {
+		fprintf(stderr, "dataset %s non valido o non leggibile\n", path);
+		return -1;
+	}
+	dataset_path = strdup(path);
+	if (!dataset_path) {
+		unmap(ds);
+		return -1;
+	}
+	ds->version = ++loads;
+	atomic_store_explicit(&current, ds, memory_order_release);
+	printf("Dataset %s: %u citta'\n", path, ds->city_count);
+	return 0;
+}
+
+static void sleep_ms(unsigned int ms) {
+#if defined(_WIN32)
+	Sleep(ms);
+#else
+	struct timespec ts;
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (long)(ms % 1000) * 1000000L;
+	while (nanosleep(&ts, &ts) != 0) { }
+#endif
+}
+
+void dataset_read_begin(void) {
+	if (my_depth++ > 0) return;
+	if (!my_reader) {
+		int i = atomic_fetch_add(&next_reader, 1);
+		if (i >= DATASET_READERS) {
+			i = DATASET_READERS;
+			my_shared = 1;
+		}
+		my_reader = &readers[i];
+	}
+	atomic_uint *seq = &my_reader->seq;
+	if (my_shared) {
+		atomic_fetch_add_explicit(seq, 1, memory_order_relaxed);
+	} else {
+		atomic_store_explicit(seq, atomic_load_explicit(seq, memory_order_relaxed) + 1, memory_order_relaxed);
+	}
+	// l'ingresso deve essere visibile prima della lettura del puntatore:
+	// fa coppia con la barriera di wait_readers dopo lo scambio
+	atomic_thread_fence(memory_order_seq_cst);
+}
+
+void dataset_read_end(void) {
+	if (--my_depth > 0) return;
+	atomic_uint *seq = &my_reader->seq;
+	if (my_shared) {
+		atomic_fetch_sub_explicit(seq, 1, memory_order_release);
+	} else {
+		atomic_store_explicit(seq, atomic_load_explicit(seq, memory_order_relaxed) + 1, memory_order_release);
+	}
+}
+
+// Attende che ogni thread dentro una sezione di lettura al momento della
+// chiamata ne sia uscito. Un thread che entra dopo la barriera legge gia'
+// il nuovo puntatore, anche se si registra solo adesso.
+static void wait_readers(void) {
+	atomic_thread_fence(memory_order_seq_cst);
+	int n = atomic_load(&next_reader);
+	if (n > DATASET_READERS) n = DATASET_READERS;
+	for (int i = 0; i < n; i++) {
+		unsigned int s = atomic_load_explicit(&readers[i].seq, memory_order_relaxed);
+		if ((s & 1) == 0) continue;
+		while (atomic_load_explicit(&readers[i].seq, memory_order_relaxed) == s) {
+			sleep_ms(DATASET_POLL_MS);
+		}
+	}
+	while (atomic_load_explicit(&readers[DATASET_READERS].seq, memory_order_relaxed) != 0) {
+		sleep_ms(DATASET_POLL_MS);
+	}
+	// le letture concluse precedono lo smappamento
+	atomic_thread_fence(memory_order_acquire);
+}
+
+int dataset_reload(void) {
+	if (!dataset_path) return -1;
+	pthread_mutex_lock(&reload_lock);
+	dataset_t *ds = map_file(dataset_path);
+	if (!ds) {
+		pthread_mutex_unlock(&reload_lock);
+		fprintf(stderr, "dataset %s non valido: resta in uso il precedente\n", dataset_path);
+		return -1;
+	}
+	ds->version = ++loads;
+	dataset_t *old = atomic_exchange_explicit(&current, ds, memory_order_acq_rel);
+	printf("Dataset %s ricaricato: %u citta' (versione %u)\n", dataset_path, ds->city_count, ds->version);
+	fflush(stdout);
+
+	wait_readers();
+	if (old) unmap(old);
+	pthread_mutex_unlock(&reload_lock);
+	return 0;
+}
+
+#if defined(_WIN32)
+
+int dataset_watch(void) {
+	printf("Ricaricamento del dataset con SIGHUP non disponibile su Windows\n");
+	return 0;
+}
+
+#else
+
+static sigset_t hup_set;
+
+static void *watcher_main(void *arg) {
+	(void)arg;
+	for (;;) {
+		int sig;
+		if (sigwait(&hup_set, &sig) == 0 && sig == SIGHUP) {
+			dataset_reload();
+		}
+	}
+	return NULL;
+}
+
+int dataset_watch(void) {
+	// SIGHUP bloccato in questo thread e in tutti quelli creati dopo:
+	// lo riceve solo sigwait nel thread dedicato
+	sigemptyset(&hup_set);
+	sigaddset(&hup_set, SIGHUP);
+	if (pthread_sigmask(SIG_BLOCK, &hup_set, NULL) != 0) return -1;
+
+	pthread_t th;
+	if (pthread_create(&th, NULL, watcher_main, NULL) != 0) {
+		errorhandler("errore nella creazione del thread di ricaricamento.\n");
+		return -1;
+	}
+	pthread_detach(th);
+	return 0;
+}
+
+#endif
+
+const dataset_t *dataset_current(void) {
+	return atomic_load_explicit(&current, memory_order_acquire);
+}
+
+unsigned int dataset_version(const dataset_t *ds) {
+	return ds ? ds->version : 0;
+}
+
+int dataset_city_count(const dataset_t *ds) {
+	return ds ? (int)ds->city_count : CITY_COUNT;
+}
+
+const char *dataset_city_name(const dataset_t *ds, int city_id, size_t *len) {
+	if (!ds) {
+		if (city_id < 0 || city_id >= CITY_COUNT) return NULL;
+		*len = strlen(city_names[city_id]);
+		return city_names[city_id];
+	}
+	if (city_id < 0 || (uint32_t)city_id >= ds->city_count) return NULL;
+	const dataset_city_t *c = &ds->cities[city_id];
+	// nomi fuori dal blob o piu' lunghi di una richiesta: file danneggiato
+	if (c->name_len == 0 || c->name_len > BATCH_CITY_MAX ||
+			c->name_off > ds->names_size || c->name_len > ds->names_size - c->name_off) {
+		return NULL;
+	}
+	*len = c->name_len;
+	return ds->names + c->name_off;
+}
+
+int dataset_city_lookup(const dataset_t *ds, const char *name, size_t len) {
+	if (!ds) return city_lookup(name, len);
+	if (len == 0 || ds->city_count == 0) return CITY_ID_NONE;
+	// stesso schema hash and displace della tabella interna
+	uint32_t b = city_hash(0, name, len) % ds->hash_buckets;
+	int id = ds->slots[city_hash(ds->disp[b], name, len) & ds->hash_mask];
+
+	size_t ref_len;
+	const char *ref = dataset_city_name(ds, id, &ref_len);
+	if (!ref || ref_len != len) return CITY_ID_NONE;
+	for (size_t i = 0; i < len; i++) {
+		if (dataset_fold((unsigned char)name[i]) != dataset_fold((unsigned char)ref[i])) return CITY_ID_NONE;
+	}
+	return id;
+}
+
+// Posizione di name rispetto ai nomi con il prefisso indicato, confrontando
+// dal byte from: <0 prima, 0 se ha il prefisso, >0 dopo
+static int prefix_cmp(const char *name, size_t len, const char *prefix, size_t plen, size_t from) {
+	for (size_t i = from; i < plen; i++) {
+		if (i == len) return -1; // nome piu' corto del prefisso
+		unsigned char a = dataset_fold((unsigned char)name[i]);
+		unsigned char b = dataset_fold((unsigned char)prefix[i]);
+		if (a != b) return a < b ? -1 : 1;
+	}
+	return 0;
+}
+
+// Come prefix_cmp per la posizione pos dell'ordine alfabetico: basta la
+// chiave, salvo per prefissi piu' lunghi di DATASET_KEY_BYTES con i primi
+// caratteri uguali
+static int sorted_cmp(const dataset_t *ds, uint32_t pos, const char *prefix, size_t plen, uint64_t pkey, uint64_t mask) {
+	uint64_t k = ds->keys[pos] & mask;
+	if (k != pkey) return k < pkey ? -1 : 1;
+	if (plen <= DATASET_KEY_BYTES) return 0;
+	size_t len;
+	const char *name = dataset_city_name(ds, (int)ds->sorted[pos], &len);
+	return name ? prefix_cmp(name, len, prefix, plen, DATASET_KEY_BYTES) : -1;
+}
+
+int dataset_city_prefix(const dataset_t *ds, const char *prefix, size_t len, int *ids, int max) {
+	int n = 0;
+	if (!ds) {
+		// tabella interna: poche città, inserimento ordinato
+		for (int id = 0; id < CITY_COUNT; id++) {
+			const char *name = city_names[id];
+			size_t nlen = strlen(name);
+			if (prefix_cmp(name, nlen, prefix, len, 0) != 0) continue;
+			int pos = n;
+			while (pos > 0) {
+				const char *prev = city_names[ids[pos - 1]];
+				size_t plen = strlen(prev);
+				int c = prefix_cmp(prev, plen, name, nlen, 0);
+				if (c < 0 || (c == 0 && plen <= nlen)) break; // prev viene prima
+				if (pos < max) ids[pos] = ids[pos - 1];
+				pos--;
+			}
+			if (pos < max) ids[pos] = id;
+			if (n < max) n++;
+		}
+		return n;
+	}
+
+	// ricerca binaria sulle sole chiavi (8 byte per città, contigue), poi
+	// scansione finche' i nomi hanno il prefisso
+	uint64_t pkey = dataset_key(prefix, len);
+	uint64_t mask = len >= DATASET_KEY_BYTES ? ~0ull : ~(~0ull >> (8 * len));
+	uint32_t lo = 0, hi = ds->city_count;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (sorted_cmp(ds, mid, prefix, len, pkey, mask) < 0) lo = mid + 1;
+		else hi = mid;
+	}
+	for (uint32_t pos = lo; pos < ds->city_count && n < max; pos++) {
+		if (sorted_cmp(ds, pos, prefix, len, pkey, mask) != 0) break;
+		size_t nlen;
+		if (dataset_city_name(ds, (int)ds->sorted[pos], &nlen)) ids[n++] = (int)ds->sorted[pos];
+	}
+	return n;
+}
+
+float dataset_value(const dataset_t *ds, int city_id, int type_index) {
+	const dataset_city_t *c = &ds->cities[city_id];
+	float lo = c->lo[type_index];
+	float hi = c->hi[type_index];
+	if (!(hi > lo)) return lo; // valore osservato
+	// passi da 0.1 nell'intervallo, estremi compresi
+	float span = (hi - lo) * 10.0f + 1.5f;
+	uint32_t steps = span < 4294967295.0f ? (uint32_t)span : 4294967295u;
+	return lo + (float)rng_range(rng_thread(), steps) / 10.0f;
+}
@@ -0,0 +1,127 @@
+/*
+ * dataset.h
+ *
+ * Dataset delle città caricato da file (--dataset): nomi, identificativi
+ * e per ogni città e metrica un valore osservato o un intervallo in cui
+ * generarlo. Il file e' prodotto offline da tools/mkdataset.c ed e' gia'
+ * nel formato usato a runtime: viene mappato in memoria con mmap e letto
+ * direttamente, senza parsing, quindi l'avvio costa lo stesso per dieci o
+ * per un milione di città (le pagine arrivano dal disco al primo accesso).
+ *
+ * Con SIGHUP il file viene rimappato e il nuovo dataset sostituisce il
+ * precedente con una scrittura atomica: le richieste in corso finiscono
+ * sul dataset che hanno letto, le successive usano il nuovo. Chi legge
+ * il dataset lo fa tra dataset_read_begin e dataset_read_end, e il
+ * precedente viene smappato solo quando tutti i thread che erano dentro
+ * una lettura al momento della sostituzione ne sono usciti. Senza
+ * --dataset si usa la tabella interna di cities.h.
+ */
+
+#ifndef DATASET_H_
+#define DATASET_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DATASET_MAGIC      "WXDSET1"   // 8 byte con il terminatore
+#define DATASET_FORMAT     3u          // 3: city_hash con rimescolamento finale
+#define DATASET_BYTE_ORDER 0x01020304u // scritto nell'ordine della macchina
+#define DATASET_METRICS    4           // 't','h','w','p' (weather_type_index)
+#define DATASET_MAX_CITIES (1u << 24)
+#define DATASET_POLL_MS    1           // attesa tra due controlli dei lettori
+#define DATASET_KEY_BYTES  8           // caratteri in una chiave di ordinamento
+
+// Layout del file: intestazione, poi le sezioni agli offset indicati,
+// allineate a 8 byte. Numeri nell'ordine di byte della macchina che ha
+// generato il file (verificato con byte_order). L'ordine alfabetico
+// ignora maiuscole e minuscole (ASCII); la chiave di un nome sono i suoi
+// primi 8 byte ripiegati in minuscolo, big endian e completati con zeri
+// (dataset_key), cosi' un confronto tra interi equivale al confronto dei
+// primi 8 caratteri.
+typedef struct {
+	char magic[8];
+	uint32_t format;
+	uint32_t byte_order;
+	uint32_t city_count;
+	uint32_t hash_buckets;   // bucket del primo hash
+	uint32_t hash_size;      // slot della tabella, potenza di due
+	uint32_t names_size;     // byte del blob dei nomi
+	uint64_t cities_off;     // dataset_city_t[city_count]
+	uint64_t names_off;      // nomi concatenati, senza terminatore
+	uint64_t disp_off;       // uint32_t[hash_buckets], semi di spostamento
+	uint64_t slots_off;      // int32_t[hash_size], id o CITY_ID_NONE
+	uint64_t sorted_off;     // uint32_t[city_count], id in ordine alfabetico
+	uint64_t keys_off;       // uint64_t[city_count], chiavi dei nomi ordinati
+} dataset_header_t;
+
+// Una città: lo == hi e' un valore osservato, altrimenti il valore e'
+// generato in [lo, hi] con passo 0.1 come per la tabella interna
+typedef struct {
+	uint32_t name_off;       // offset nel blob dei nomi
+	uint32_t name_len;
+	float lo[DATASET_METRICS];
+	float hi[DATASET_METRICS];
+} dataset_city_t;
+
+_Static_assert(sizeof(dataset_header_t) == 80, "intestazione del dataset da 80 byte");
+_Static_assert(sizeof(dataset_city_t) == 40, "record città del dataset da 40 byte");
+
+typedef struct dataset dataset_t;
+
+static inline unsigned char dataset_fold(unsigned char c) {
+	return (c >= 'A' && c <= 'Z') ? (unsigned char)(c + ('a' - 'A')) : c;
+}
+
+// Chiave di ordinamento dei primi DATASET_KEY_BYTES caratteri di name
+static inline uint64_t dataset_key(const char *name, size_t len) {
+	uint64_t k = 0;
+	for (size_t i = 0; i < DATASET_KEY_BYTES; i++) {
+		k = (k << 8) | (i < len ? dataset_fold((unsigned char)name[i]) : 0);
+	}
+	return k;
+}
+
+// Mappa il file e lo rende il dataset corrente. Ritorna 0 o -1.
+int dataset_open(const char *path);
+
+// Rimappa il file indicato a dataset_open e, se valido, sostituisce il
+// dataset corrente; ritorna dopo aver smappato il precedente, quando
+// nessun thread lo puo' piu' leggere. In caso di errore il dataset
+// corrente non cambia. Ritorna 0 o -1.
+int dataset_reload(void);
+
+// Avvia il thread che esegue dataset_reload a ogni SIGHUP. Va chiamata
+// prima di creare gli altri thread, che ereditano il segnale bloccato.
+int dataset_watch(void);
+
+// Sezione di lettura del thread chiamante: un puntatore ottenuto da
+// dataset_current resta valido fino alla dataset_read_end corrispondente.
+// Le sezioni si possono annidare; quella esterna deve essere breve (una
+// richiesta, un aggiornamento), perche' una ricarica la attende.
+void dataset_read_begin(void);
+void dataset_read_end(void);
+
+// Dataset corrente, NULL senza --dataset. Va letto dentro una sezione
+// di lettura e il puntatore non va conservato dopo la sua fine.
+const dataset_t *dataset_current(void);
+
+// Numero progressivo del caricamento (1, 2, ...), 0 per la tabella interna
+unsigned int dataset_version(const dataset_t *ds);
+
+// Accesso alle città del dataset, o della tabella interna se ds e' NULL.
+// city_name ritorna il nome (non terminato) e la sua lunghezza, oppure
+// NULL se l'id non e' valido.
+int dataset_city_count(const dataset_t *ds);
+int dataset_city_lookup(const dataset_t *ds, const char *name, size_t len);
+const char *dataset_city_name(const dataset_t *ds, int city_id, size_t *len);
+
+// Fino a max città il cui nome inizia con prefix (senza distinzione tra
+// maiuscole e minuscole), in ordine alfabetico: gli id vanno in ids.
+// Un prefisso vuoto elenca le prime città. Ritorna quante ne ha trovate.
+int dataset_city_prefix(const dataset_t *ds, const char *prefix, size_t len, int *ids, int max);
+
+// Valore della metrica (indice di weather_type_index) per una città
+// valida del dataset: quello osservato o uno generato nel suo intervallo
+float dataset_value(const dataset_t *ds, int city_id, int type_index);
+
+#endif /* DATASET_H_ */
@@ -0,0 +1,201 @@
+/*
+ * history.c
+ *
+ * Ring per coppia con slot a sequenza: lo scrittore prende una posizione
+ * con fetch_add, azzera la sequenza dello slot, scrive istante e valore e
+ * pubblica la sequenza posizione + 1. Il lettore accetta uno slot solo se
+ * la sequenza e' quella attesa per la posizione prima e dopo la lettura
+ * (stesso schema della tabella snapshot), quindi un campione sovrascritto
+ * o a meta' viene scartato invece di essere mescolato.
+ *
+ * Gli id sono quelli del dataset: quando cambia la versione il primo
+ * scrittore della coppia avanza la testa di un giro intero, cosi' i
+ * campioni del dataset precedente non corrispondono piu' ad alcuna
+ * posizione valida.
+ *
+ * Gli aggregati copiano i valori validi in un buffer del thread e lo
+ * riducono con LANES accumulatori indipendenti: l'ordine delle operazioni
+ * e' esplicito, quindi il compilatore vettorizza i cicli senza opzioni di
+ * matematica approssimata.
+ */
+
+#include "history.h"
+#include "dataset.h"
+#include "snapshot.h"
+#include "stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdatomic.h>
+
+#define LANES 8 // accumulatori indipendenti delle riduzioni
+
+typedef struct {
+	atomic_uint source;           // versione del dataset dei campioni
+	atomic_uint_fast64_t head;    // prossima posizione da scrivere
+	atomic_uint_fast64_t *seq;    // posizione + 1 se completo, 0 in scrittura
+	atomic_uint_fast64_t *ts;     // istante (stats_now_ns)
+	atomic_uint *bits;            // valore (bit del float)
+} history_ring_t;
+
+static _Atomic(history_ring_t *) *rings; // [città][tipo], allocati al primo uso
+static int capacity;                     // città, fissato all'avvio
+static uint32_t samples;
+static int enabled = 0;
+static _Thread_local float *scratch;     // valori da aggregare
+
+int history_start(unsigned int n) {
+	if (n == 0 || n > HISTORY_MAX_SAMPLES) return -1;
+	samples = 1;
+	while (samples < n) samples <<= 1;
+	dataset_read_begin();
+	capacity = dataset_city_count(dataset_current());
+	dataset_read_end();
+	rings = calloc((size_t)capacity * WEATHER_TYPES, sizeof(*rings));
+	if (!rings) return -1;
+	enabled = 1;
+	return 0;
+}
+
+int history_enabled(void) {
+	return enabled;
+}
+
+static history_ring_t *ring_alloc(void) {
+	// un solo blocco: intestazione e poi i tre array dello slot
+	size_t size = sizeof(history_ring_t) +
+			samples * (2 * sizeof(atomic_uint_fast64_t) + sizeof(atomic_uint));
+	history_ring_t *r = calloc(1, size);
+	if (!r) return NULL;
+	r->seq = (atomic_uint_fast64_t *)(r + 1);
+	r->ts = r->seq + samples;
+	r->bits = (atomic_uint *)(r->ts + samples);
+	return r;
+}
+
+static history_ring_t *ring_get(int city_id, int type_index, int create) {
+	if (city_id < 0 || city_id >= capacity) return NULL; // dataset ricaricato piu' grande
+	_Atomic(history_ring_t *) *slot = &rings[(size_t)city_id * WEATHER_TYPES + (size_t)type_index];
+	history_ring_t *r = atomic_load_explicit(slot, memory_order_acquire);
+	if (r || !create) return r;
+	history_ring_t *fresh = ring_alloc();
+	if (!fresh) return NULL;
+	if (atomic_compare_exchange_strong_explicit(slot, &r, fresh, memory_order_acq_rel, memory_order_acquire)) {
+		return fresh;
+	}
+	free(fresh); // allocato nel frattempo da un altro thread
+	return r;
+}
+
+void history_record(const struct dataset *ds, int city_id, int type_index, float value) {
+	history_ring_t *r = ring_get(city_id, type_index, 1);
+	if (!r) return;
+	unsigned int version = dataset_version(ds);
+	unsigned int old = atomic_load_explicit(&r->source, memory_order_relaxed);
+	if (old != version && atomic_compare_exchange_strong_explicit(&r->source, &old, version,
+			memory_order_relaxed, memory_order_relaxed)) {
+		atomic_fetch_add_explicit(&r->head, samples, memory_order_relaxed);
+	}
+
+	uint64_t pos = atomic_fetch_add_explicit(&r->head, 1, memory_order_relaxed);
+	size_t i = (size_t)(pos & (samples - 1));
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	atomic_store_explicit(&r->seq[i], 0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&r->ts[i], stats_now_ns(), memory_order_relaxed);
+	atomic_store_explicit(&r->bits[i], bits, memory_order_relaxed);
+	atomic_store_explicit(&r->seq[i], pos + 1, memory_order_release);
+}
+
+// Copia in out i valori validi delle ultime n posizioni, dal piu' recente,
+// fermandosi al primo piu' vecchio di min_ts. Ritorna quanti ne ha copiati.
+static uint32_t collect(history_ring_t *r, uint32_t n, uint64_t min_ts, float *out) {
+	uint64_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+	uint32_t m = 0;
+	for (uint32_t k = 0; k < n && k < head; k++) {
+		uint64_t pos = head - 1 - k;
+		size_t i = (size_t)(pos & (samples - 1));
+		uint64_t s = atomic_load_explicit(&r->seq[i], memory_order_acquire);
+		if (s != pos + 1) continue; // in scrittura o gia' sovrascritto
+		uint64_t ts = atomic_load_explicit(&r->ts[i], memory_order_relaxed);
+		uint32_t bits = atomic_load_explicit(&r->bits[i], memory_order_relaxed);
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&r->seq[i], memory_order_relaxed) != s) continue;
+		if (ts < min_ts) break;
+		memcpy(&out[m++], &bits, sizeof(float));
+	}
+	return m;
+}
+
+// Minimo, massimo, media e deviazione standard di v[0..n), n > 0
+static void summarize(const float *v, uint32_t n, history_stats_t *out) {
+	float lo[LANES], hi[LANES];
+	double sum[LANES], dev[LANES];
+	for (int l = 0; l < LANES; l++) {
+		lo[l] = hi[l] = v[0];
+		sum[l] = dev[l] = 0.0;
+	}
+	uint32_t body = n - n % LANES;
+	for (uint32_t i = 0; i < body; i += LANES) {
+		for (int l = 0; l < LANES; l++) {
+			float x = v[i + l];
+			lo[l] = x < lo[l] ? x : lo[l];
+			hi[l] = x > hi[l] ? x : hi[l];
+			sum[l] += x;
+		}
+	}
+	for (uint32_t i = body; i < n; i++) {
+		lo[0] = v[i] < lo[0] ? v[i] : lo[0];
+		hi[0] = v[i] > hi[0] ? v[i] : hi[0];
+		sum[0] += v[i];
+	}
+	double total = 0.0;
+	for (int l = 0; l < LANES; l++) {
+		lo[0] = lo[l] < lo[0] ? lo[l] : lo[0];
+		hi[0] = hi[l] > hi[0] ? hi[l] : hi[0];
+		total += sum[l];
+	}
+	double mean = total / n;
+
+	// seconda passata sugli scarti: evita la cancellazione di E[x^2] - E[x]^2
+	for (uint32_t i = 0; i < body; i += LANES) {
+		for (int l = 0; l < LANES; l++) {
+			double d = v[i + l] - mean;
+			dev[l] += d * d;
+		}
+	}
+	for (uint32_t i = body; i < n; i++) {
+		double d = v[i] - mean;
+		dev[0] += d * d;
+	}
+	double var = 0.0;
+	for (int l = 0; l < LANES; l++) var += dev[l];
+
+	out->count = n;
+	out->min = lo[0];
+	out->max = hi[0];
+	out->mean = (float)mean;
+	out->stddev = (float)sqrt(var / n);
+}
+
+void history_aggregate(const struct dataset *ds, int city_id, int type_index, uint32_t last,
+		uint32_t window_ms, history_stats_t *out) {
+	memset(out, 0, sizeof(*out));
+	history_ring_t *r = ring_get(city_id, type_index, 0);
+	if (!r || atomic_load_explicit(&r->source, memory_order_relaxed) != dataset_version(ds)) return;
+	if (!scratch) {
+		scratch = malloc(samples * sizeof(float));
+		if (!scratch) return;
+	}
+	uint32_t n = (last == 0 || last > samples) ? samples : last;
+	uint64_t min_ts = 0;
+	if (window_ms > 0) {
+		uint64_t now = stats_now_ns();
+		uint64_t window = (uint64_t)window_ms * 1000000ull;
+		min_ts = now > window ? now - window : 0;
+	}
+	uint32_t m = collect(r, n, min_ts, scratch);
+	if (m > 0) summarize(scratch, m, out);
+}
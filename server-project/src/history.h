@@ -0,0 +1,51 @@
+/*
+ * history.h
+ *
+ * Cronologia dei valori serviti (--history N): per ogni coppia (città,
+ * tipo) un ring degli ultimi N valori con il loro istante, in layout a
+ * struttura di array (valori, istanti e sequenze in array separati), e
+ * gli aggregati min/max/media/deviazione standard sugli ultimi campioni
+ * o su una finestra di tempo, calcolati dal server con una sola
+ * richiesta (frame HISTORY_MAGIC, protocol.h).
+ *
+ * La scrittura non prende lock: ogni campione occupa la posizione
+ * ottenuta con un incremento atomico e ha un numero di sequenza per slot,
+ * cosi' chi legge scarta gli slot in corso di scrittura. I ring sono
+ * allocati al primo valore della coppia: la memoria cresce con le coppie
+ * richieste, non con le città del dataset.
+ */
+
+#ifndef HISTORY_H_
+#define HISTORY_H_
+
+#include <stdint.h>
+
+#define HISTORY_MAX_SAMPLES 65536 // campioni massimi per coppia
+
+struct dataset;
+
+typedef struct {
+	uint32_t count;  // campioni aggregati, 0 se nessuno
+	float min;
+	float max;
+	float mean;
+	float stddev;    // deviazione standard della popolazione
+} history_stats_t;
+
+// Attiva la cronologia con samples campioni per coppia (arrotondati alla
+// potenza di due successiva) per le città del dataset corrente. Ritorna
+// 0 o -1.
+int history_start(unsigned int samples);
+
+// 1 se la cronologia e' attiva
+int history_enabled(void);
+
+// Registra il valore servito per (città di ds, indice tipo)
+void history_record(const struct dataset *ds, int city_id, int type_index, float value);
+
+// Aggregati sugli ultimi last campioni (0 = tutti quelli conservati) e,
+// se window_ms > 0, solo su quelli degli ultimi window_ms millisecondi
+void history_aggregate(const struct dataset *ds, int city_id, int type_index, uint32_t last,
+		uint32_t window_ms, history_stats_t *out);
+
+#endif /* HISTORY_H_ */
@@ -18,16 +18,51 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #define closesocket close
 #endif
 
 #include "protocol.h"
+#include "reactor.h"
+#include "uring.h"
+#include "udp.h"
+#include "worker.h"
+#include "cities.h"
+#include "dataset.h"
+#include "history.h"
+#include "admit.h"
+#include "rng.h"
+#include "snapshot.h"
+#include "reqlog.h"
+#include "stats.h"
+#include "timer.h"
+#include "upgrade.h"
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 
 #include <time.h>
 #include <ctype.h>
+#include <errno.h>
+#include <math.h>
+
+// MSG_MORE (Linux) accorpa invii consecutivi; altrove gli invii restano
+// separati
+#if defined(MSG_MORE)
+#define SEND_MORE_FLAG MSG_MORE
+#else
+#define SEND_MORE_FLAG 0
+#endif
+
+// Gli invii del ciclo bloccante non devono attendere oltre la scadenza:
+// si attende con poll e si invia senza bloccare
+#if defined(_WIN32)
+#define poll WSAPoll
+#define SEND_NOWAIT_FLAG 0
+#else
+#define SEND_NOWAIT_FLAG MSG_DONTWAIT
+#endif
 
 // Wrapper compatibile per inet_pton: su Windows usa inet_addr/gethostbyname,
 // su Linux/macOS chiama direttamente inet_pton.
@@ -52,6 +87,53 @@ static int my_inet_pton(int af, const char *src, void *dst)
 }
 
 
+server_options_t server_options; // opzioni globali (tutte disattivate di default)
+
+// Attende che il socket sia pronto per events (POLLIN o POLLOUT) fino
+// all'istante deadline_ms (0 = senza limite). Ritorna 1 se pronto, 0 alla
+// scadenza, -1 su errore.
+static int wait_socket(int sock, short events, uint64_t deadline_ms) {
+	for (;;) {
+		int timeout = -1;
+		if (deadline_ms) {
+			uint64_t now = timer_now_ms();
+			if (now >= deadline_ms) return 0;
+			timeout = (int)(deadline_ms - now);
+		}
+		struct pollfd pfd;
+		pfd.fd = sock;
+		pfd.events = events;
+		pfd.revents = 0;
+		int n = poll(&pfd, 1, timeout);
+		if (n > 0) return 1;
+		if (n == 0) return 0;
+		if (errno != EINTR) return -1;
+	}
+}
+
+static uint64_t deadline_after(int timeout_ms) {
+	return timeout_ms > 0 ? timer_now_ms() + (uint64_t)timeout_ms : 0;
+}
+
+// recv che non attende oltre deadline_ms (0 = senza limite): si prova una
+// ricezione non bloccante e si attende con poll solo se non ci sono dati,
+// cosi' il caso comune resta una sola syscall. Ritorna come recv, oppure
+// -2 alla scadenza.
+static int recv_deadline(int sock, unsigned char *buf, size_t len, uint64_t deadline_ms) {
+	if (!deadline_ms) return recv(sock, (char *)buf, (int)len, 0);
+	for (;;) {
+#if !defined(_WIN32)
+		int r = recv(sock, (char *)buf, (int)len, MSG_DONTWAIT);
+		if (r >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) return r;
+#endif
+		int ready = wait_socket(sock, POLLIN, deadline_ms);
+		if (ready <= 0) return ready == 0 ? -2 : -1;
+#if defined(_WIN32)
+		return recv(sock, (char *)buf, (int)len, 0);
+#endif
+	}
+}
+
 void clearwinsock() {
 #if defined(_WIN32)
 	WSACleanup();
@@ -62,35 +144,303 @@ void errorhandler(char *errorMessage) {
 	printf ("%s", errorMessage);
 }
 
+// I valori sono generati dal PRNG del thread corrente (rng.c): nessuno
+// stato condiviso tra i worker e riduzione all'intervallo senza bias.
 float get_temperature(void) {
-	return ((float)(rand() % 501) / 10.0f) - 10.0f; // -10.0 to 40.0 °C
+	return ((float)rng_range(rng_thread(), 501) / 10.0f) - 10.0f; // -10.0 to 40.0 °C
 }
 
 float get_humidity(void) {
-	return ((float)(rand() % 801) / 10.0f) + 20.0f; // 20.0 to 100.0 %
+	return ((float)rng_range(rng_thread(), 801) / 10.0f) + 20.0f; // 20.0 to 100.0 %
 }
 
 float get_wind(void) {
-	return ((float)(rand() % 1001) / 10.0f); // 0.0 to 100.0 km/h
+	return ((float)rng_range(rng_thread(), 1001) / 10.0f); // 0.0 to 100.0 km/h
 }
 
 float get_pressure(void) {
-	return ((float)(rand() % 1011) / 10.0f) + 950.0f; // 950.0 to 1050.0 hPa
+	return ((float)rng_range(rng_thread(), 1011) / 10.0f) + 950.0f; // 950.0 to 1050.0 hPa
+}
+
+// Versione batch dei get_*: riempie out con n valori del tipo indicato
+// ('t','h','w','p') in un'unica chiamata. Ritorna 0, oppure -1 se il tipo
+// non e' valido.
+int fill_weather_values(char type, float *out, size_t n) {
+	rng_t *r = rng_thread();
+	switch (type) {
+		case 't': rng_fill_range(r, -10.0f, 0.1f, 501, out, n); break;
+		case 'h': rng_fill_range(r, 20.0f, 0.1f, 801, out, n); break;
+		case 'w': rng_fill_range(r, 0.0f, 0.1f, 1001, out, n); break;
+		case 'p': rng_fill_range(r, 950.0f, 0.1f, 1011, out, n); break;
+		default: return -1;
+	}
+	return 0;
 }
 
+// Crea un socket TCP, lo lega all'indirizzo indicato e lo mette in ascolto.
+// Con reuseport != 0 abilita SO_REUSEPORT, cosi' piu' worker possono avere
+// ciascuno il proprio socket di ascolto sulla stessa porta e il kernel
+// distribuisce le connessioni tra di essi. Ritorna il socket o -1.
+int open_listener(const struct sockaddr_in *server_addr, int reuseport) {
+	//creazione della socket
+	int my_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+	if (my_socket < 0) {
+		errorhandler("errore nella creazione del socket.\n");
+		return -1;
+	}
+
+	if (reuseport) {
+#if defined(SO_REUSEPORT)
+		int on = 1;
+		if (setsockopt(my_socket, SOL_SOCKET, SO_REUSEPORT, (const char *)&on, sizeof(on)) < 0) {
+			errorhandler("errore nell'impostazione di SO_REUSEPORT.\n");
+			closesocket(my_socket);
+			return -1;
+		}
+#else
+		errorhandler("SO_REUSEPORT non supportato su questa piattaforma.\n");
+		closesocket(my_socket);
+		return -1;
+#endif
+	}
+
+	// socket binding
+	if (bind(my_socket, (const struct sockaddr*) server_addr, sizeof(*server_addr)) <0) {
+		errorhandler("errore nella bind.\n");
+		closesocket(my_socket);
+		return -1;
+	}
+
+	// settaggio della socket in listening: una coda corta fa scartare i SYN
+	// di una raffica di connessioni e il client li ritrasmette dopo secondi
+	int backlog = server_options.backlog > 0 ? server_options.backlog : QLEN;
+	if (listen (my_socket, backlog) < 0) {
+		errorhandler("errore nella listen.\n");
+		closesocket(my_socket);
+		return -1;
+	}
+	return my_socket;
+}
+
+// Ciclo accept/handle bloccante: una connessione alla volta.
+// Ritorna -1 se la accept fallisce.
+int run_blocking_loop(int my_socket) {
+	// accettazione connessioni dai client
+	struct sockaddr_in cad; //structure for the client address
+	int client_socket;      //socket descriptor for the client
+#if defined(_WIN32)
+	int client_len;         //the size of the client address
+#else
+	socklen_t client_len;   //the size of the client address
+#endif
+	char client_ip[INET_ADDRSTRLEN];
+	int loop_id = upgrade_register_loop(0);
+
+	while (1) {
+		// attesa a intervalli: durante un riavvio (upgrade.h) il ciclo
+		// smette di accettare anche se non arrivano connessioni
+		int ready = wait_socket(my_socket, POLLIN, deadline_after(UPGRADE_POLL_MS));
+		if (upgrade_draining()) {
+			upgrade_loop_stopped(loop_id);
+			upgrade_park();
+		}
+		if (ready == 0) continue;
+		client_len = sizeof(cad); //set the size of the client address
+		if ( ready < 0 || (client_socket=accept(my_socket, (struct sockaddr *)&cad,
+		&client_len)) < 0 ) {
+#if !defined(_WIN32)
+			// durante un riavvio il socket e' condiviso con l'altra istanza,
+			// che puo' aver gia' accettato la connessione
+			if (ready > 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ||
+					errno == ECONNABORTED)) {
+				continue;
+			}
+#endif
+			errorhandler("errore nella accept.\n");
+			upgrade_loop_stopped(loop_id);
+			return -1;
+		}
+		// gestione della connessione con il client
+#if defined(_WIN32)
+		strncpy(client_ip, inet_ntoa(cad.sin_addr), sizeof(client_ip) - 1);
+		client_ip[sizeof(client_ip) - 1] = '\0';
+#else
+		inet_ntop(AF_INET, &cad.sin_addr, client_ip, sizeof(client_ip));
+#endif
+		reqlog_connect(client_ip);
+		if (admit_conn_open() != 0) {
+			admit_shed(client_socket);
+			continue;
+		}
+		handleclientconnection(client_socket, client_ip);
+		admit_conn_close();
+	}// fine while loop
+}
+
+
+// Imposta un'opzione di basso livello del socket del server; un errore
+// lascia il valore del sistema e viene solo segnalato
+static void tune_socket(int sock, int level, int name, int value, const char *what) {
+	if (setsockopt(sock, level, name, (const char *)&value, sizeof(value)) < 0) {
+		printf("Opzione %s non applicata: %s\n", what, strerror(errno));
+	}
+}
+
+// Applica al socket del server le opzioni di latenza (--fastopen,
+// --nodelay, --defer-accept, --busy-poll, --low-latency). Su Linux le
+// connessioni accettate ereditano TCP_NODELAY e SO_BUSY_POLL dal
+// listener; TCP_FASTOPEN e TCP_DEFER_ACCEPT valgono per il listener
+// stesso e si possono impostare anche dopo la listen, quindi pure su un
+// socket ereditato da un riavvio.
+static void apply_latency_options(int sock, int tcp) {
+	if (tcp && server_options.nodelay) {
+		tune_socket(sock, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+	}
+#if defined(TCP_FASTOPEN)
+	// serve anche il bit 2 di net.ipv4.tcp_fastopen (lato server)
+	if (tcp && server_options.fastopen > 0) {
+		tune_socket(sock, IPPROTO_TCP, TCP_FASTOPEN, server_options.fastopen, "TCP_FASTOPEN");
+	}
+#endif
+#if defined(TCP_DEFER_ACCEPT)
+	// la accept avviene quando la richiesta e' gia' arrivata
+	if (tcp && server_options.defer_accept > 0) {
+		tune_socket(sock, IPPROTO_TCP, TCP_DEFER_ACCEPT, server_options.defer_accept, "TCP_DEFER_ACCEPT");
+	}
+#endif
+#if defined(SO_BUSY_POLL)
+	// ha effetto solo con schede che usano NAPI, non sul loopback
+	if (server_options.busy_poll_us > 0) {
+		tune_socket(sock, SOL_SOCKET, SO_BUSY_POLL, server_options.busy_poll_us, "SO_BUSY_POLL");
+	}
+#endif
+}
+
+// Apre il socket del server per il trasporto scelto: UDP (--udp) oppure
+// TCP in ascolto. Dopo un riavvio (upgrade.h) usa il socket ereditato,
+// gia' legato alla porta; il socket viene registrato per il prossimo.
+int open_server_socket(const struct sockaddr_in *server_addr, const worker_config_t *cfg, int reuseport) {
+	int fd = upgrade_take_socket(cfg->use_udp ? SOCK_DGRAM : SOCK_STREAM);
+	if (fd < 0) {
+		fd = cfg->use_udp ? open_udp_socket(server_addr, reuseport) : open_listener(server_addr, reuseport);
+	}
+	if (fd >= 0) {
+		apply_latency_options(fd, !cfg->use_udp);
+		upgrade_add_socket(fd);
+	}
+	return fd;
+}
+
+// Esegue il ciclo del server scelto con le opzioni: UDP (--udp), io_uring
+// (-u), epoll (-e) o accept/handle bloccante. Se io_uring non e'
+// disponibile si ripiega su epoll (se richiesto) o sul ciclo bloccante.
+int run_server_loop(int listen_socket, const worker_config_t *cfg) {
+	if (cfg->use_udp) {
+		return run_udp_loop(listen_socket);
+	}
+	if (cfg->use_uring) {
+		int rc = run_uring_loop(listen_socket);
+		if (rc != URING_UNAVAILABLE) return rc;
+		printf("io_uring non disponibile, uso %s.\n", cfg->use_epoll ? "epoll" : "il ciclo bloccante");
+	}
+	if (cfg->use_epoll) {
+#if defined(HAVE_EPOLL)
+		// event loop non bloccante: ritorna solo in caso di errore fatale
+		return run_event_loop(listen_socket);
+#else
+		printf("Modalita' epoll non supportata, uso il ciclo bloccante.\n");
+#endif
+	}
+	return run_blocking_loop(listen_socket);
+}
 
 int main(int argc, char *argv[]) {
 
-	srand(time(NULL));
 	int port = SERVER_PORT;          // valore di default
 	const char *bind_ip = SERVER_IP; // valore di default
+	worker_config_t wcfg;            // configurazione dei worker
+	memset(&wcfg, 0, sizeof(wcfg));
+	wcfg.threads = 1;                // singolo thread di default
+	int low_latency = 0;             // --low-latency
+	server_options.read_timeout_ms = READ_TIMEOUT_MS;
+	server_options.write_timeout_ms = WRITE_TIMEOUT_MS;
+	server_options.idle_timeout_ms = IDLE_TIMEOUT_MS;
 
-	// Parsing opzionale di -s (IP) e -p (porta)
+	// Parsing opzionale di -s (IP), -p (porta), -e (event loop epoll), -u
+	// (backend io_uring, con ripiego sui socket se non disponibile), --udp
+	// (trasporto UDP, un datagramma per richiesta e per risposta, solo
+	// richieste classiche e v2: batch, ricerche, aggregati e statistiche
+	// sono rifiutati perche' amplificherebbero verso mittenti falsificati),
+	// -k (connessioni persistenti), -t (numero di worker), --pin (affinita'
+	// CPU), -S (report per worker), --seed (seme per esecuzioni riproducibili)
+	// --snapshot (tabella dei valori rigenerata ogni N ms), --log-async (log
+	// asincrono con ring di N record), --log-block (attende invece di scartare)
+	// --dataset (città e valori da file, ricaricato con SIGHUP), --history
+	// (ultimi N valori per città e tipo, per le richieste di aggregati),
+	// --backlog (coda di listen), --max-conns (connessioni contemporanee),
+	// --rate e --burst (richieste al secondo e raffica per IP del client),
+	// --read-timeout, --write-timeout e --idle-timeout (attese massime per
+	// connessione in ms, 0 = nessuna), --fastopen (coda TCP Fast Open),
+	// --nodelay, --defer-accept (secondi), --busy-poll (us) e
+	// --low-latency (profilo con tutte e quattro). A SIGUSR2 il server passa i socket
+	// di ascolto a una nuova istanza e termina dopo le connessioni in corso.
 	for (int i = 1; i < argc; i++) {
 		if (strcmp(argv[i], "-s") == 0 && (i + 1) < argc) {
 			bind_ip = argv[++i];
 		} else if (strcmp(argv[i], "-p") == 0 && (i + 1) < argc) {
 			port = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-e") == 0) {
+			wcfg.use_epoll = 1;
+		} else if (strcmp(argv[i], "-u") == 0) {
+			wcfg.use_uring = 1;
+		} else if (strcmp(argv[i], "--udp") == 0) {
+			wcfg.use_udp = 1;
+		} else if (strcmp(argv[i], "-k") == 0) {
+			server_options.keepalive = 1;
+		} else if (strcmp(argv[i], "-t") == 0 && (i + 1) < argc) {
+			wcfg.threads = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--pin") == 0) {
+			wcfg.pin_cpus = 1;
+		} else if (strcmp(argv[i], "-S") == 0 && (i + 1) < argc) {
+			wcfg.report_interval = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--snapshot") == 0 && (i + 1) < argc) {
+			server_options.snapshot_ms = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--log-async") == 0 && (i + 1) < argc) {
+			server_options.log_capacity = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--log-block") == 0) {
+			server_options.log_block = 1;
+		} else if (strcmp(argv[i], "--dataset") == 0 && (i + 1) < argc) {
+			server_options.dataset = argv[++i];
+		} else if (strcmp(argv[i], "--history") == 0 && (i + 1) < argc) {
+			server_options.history = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--read-timeout") == 0 && (i + 1) < argc) {
+			server_options.read_timeout_ms = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--write-timeout") == 0 && (i + 1) < argc) {
+			server_options.write_timeout_ms = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--idle-timeout") == 0 && (i + 1) < argc) {
+			server_options.idle_timeout_ms = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--backlog") == 0 && (i + 1) < argc) {
+			server_options.backlog = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--max-conns") == 0 && (i + 1) < argc) {
+			server_options.max_conns = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--rate") == 0 && (i + 1) < argc) {
+			server_options.rate = (unsigned int)strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--burst") == 0 && (i + 1) < argc) {
+			server_options.burst = (unsigned int)strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--fastopen") == 0 && (i + 1) < argc) {
+			server_options.fastopen = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--nodelay") == 0) {
+			server_options.nodelay = 1;
+		} else if (strcmp(argv[i], "--defer-accept") == 0 && (i + 1) < argc) {
+			server_options.defer_accept = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--busy-poll") == 0 && (i + 1) < argc) {
+			server_options.busy_poll_us = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--low-latency") == 0) {
+			low_latency = 1;
+		} else if (strcmp(argv[i], "--seed") == 0 && (i + 1) < argc) {
+			server_options.seed = strtoull(argv[++i], NULL, 0);
+			server_options.seed_set = 1;
 		}
 	}
 
@@ -99,6 +449,61 @@ int main(int argc, char *argv[]) {
 		return 0;
 	}
 
+	// Le opzioni indicate esplicitamente prevalgono sul profilo
+	if (low_latency) {
+		server_options.nodelay = 1;
+		if (server_options.fastopen == 0) server_options.fastopen = LOWLAT_FASTOPEN;
+		if (server_options.defer_accept == 0) server_options.defer_accept = LOWLAT_DEFER_ACCEPT;
+		if (server_options.busy_poll_us == 0) server_options.busy_poll_us = LOWLAT_BUSY_POLL_US;
+	}
+
+	// Senza --seed il seme cambia a ogni avvio
+	if (!server_options.seed_set) {
+		server_options.seed = (uint64_t)time(NULL);
+	}
+	rng_seed_thread(server_options.seed);
+
+	// Prima degli altri thread, che ereditano SIGUSR2 bloccato
+	if (upgrade_start(argv) != 0) {
+		errorhandler("errore nell'avvio del riavvio senza interruzioni.\n");
+		return -1;
+	}
+
+	// Il dataset precede gli altri thread: la tabella snapshot si dimensiona
+	// sul numero di città e tutti ereditano SIGHUP bloccato
+	if (server_options.dataset != NULL &&
+			(dataset_open(server_options.dataset) != 0 || dataset_watch() != 0)) {
+		errorhandler("errore nel caricamento del dataset.\n");
+		return -1;
+	}
+
+	if (server_options.log_capacity > 0 &&
+			reqlog_start_async((unsigned int)server_options.log_capacity,
+					server_options.log_block ? REQLOG_BLOCK : REQLOG_DROP) != 0) {
+		errorhandler("errore nell'avvio del log asincrono.\n");
+		return -1;
+	}
+
+	if (server_options.history > 0 && history_start((unsigned int)server_options.history) != 0) {
+		printf("Cronologia non valida: %d campioni (1-%d)\n", server_options.history, HISTORY_MAX_SAMPLES);
+		return 0;
+	}
+
+	if (admit_start(server_options.max_conns, server_options.rate, server_options.burst) != 0) {
+		errorhandler("errore nella configurazione del controllo di ammissione.\n");
+		return -1;
+	}
+
+	if (server_options.snapshot_ms > 0 && snapshot_start((unsigned int)server_options.snapshot_ms) != 0) {
+		errorhandler("errore nell'avvio della tabella snapshot.\n");
+		return -1;
+	}
+
+	if (wcfg.threads < 1 || wcfg.threads > MAX_WORKERS) {
+		printf("Numero di thread non valido: %d (1-%d)\n", wcfg.threads, MAX_WORKERS);
+		return 0;
+	}
+
 #if defined(_WIN32)
 	// Initialize Winsock
 	WSADATA wsa_data;
@@ -108,13 +513,6 @@ int main(int argc, char *argv[]) {
 		return 0;
 	}
 #endif
-	//creazione della socket
-	int my_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-
-	if (my_socket < 0) {
-		errorhandler("errore nella creazione del socket.\n");
-		return -1;
-	}
 
 	// assegnazione di un indirizzo alla socket
 	struct sockaddr_in server_addr;
@@ -126,116 +524,588 @@ int main(int argc, char *argv[]) {
 		struct hostent *he = gethostbyname(bind_ip);
 		if (!he) {
 			errorhandler("risoluzione IP fallita\n");
-			closesocket(my_socket);
 			clearwinsock();
 			return -1;
 		}
 		server_addr.sin_addr = *(struct in_addr*)he->h_addr_list[0];
 	}
 
-	// socket binding
-	if (bind(my_socket, (struct sockaddr*) &server_addr, sizeof(server_addr)) <0) {
-		errorhandler("errore nella bind.\n");
-		closesocket(my_socket);
-		return -1;
+	// Pool di worker: ognuno con il proprio socket di ascolto
+	if (wcfg.threads > 1 || wcfg.report_interval > 0) {
+		printf( "In attesa di connessioni sulla porta %d (%d worker)...\n", port, wcfg.threads );
+		int rc = run_workers(&server_addr, &wcfg);
+		clearwinsock();
+		return rc;
 	}
 
-	// settaggio della socket in listening
-	
-	if (listen (my_socket, QLEN) < 0) {
-		errorhandler("errore nella listen.\n");
-		closesocket(my_socket);
+	int my_socket = open_server_socket(&server_addr, &wcfg, 0);
+	if (my_socket < 0) {
+		clearwinsock();
 		return -1;
 	}
 
-	// accettazione connessioni dai client
-	struct sockaddr_in cad; //structure for the client address
-	int client_socket;      //socket descriptor for the client
-	int client_len;         //the size of the client address
 	printf( "In attesa di connessioni sulla porta %d...\n", port );
+	upgrade_ready();
 
-	while (1) {
-		client_len = sizeof(cad); //set the size of the client address
-		if ( (client_socket=accept(my_socket, (struct sockaddr *)&cad,
-		&client_len)) < 0 ) {
-			errorhandler("errore nella accept.\n");
-			closesocket(my_socket);	//chiusura della connesione
-			clearwinsock();
-			return -1;
-		}
-		// gestione della connessione con il client
-		char *client_ip = inet_ntoa(cad.sin_addr);
-		printf( "Gestione del client %s\n", client_ip );
-		handleclientconnection(client_socket, client_ip);
-	}// fine while loop
+	int rc = run_server_loop(my_socket, &wcfg);
 
 	printf("Server terminato.\n");
 
-	closesocket(my_socket);
+	closesocket(my_socket);	//chiusura della connesione
 	clearwinsock();
-	return 0;
+	return rc;
 } // main end
 
 
 int handleclientconnection(int client_socket, const char *client_ip) {
-	// Protocollo binario: richiesta fissa 65 byte (1 tipo + 64 città)
-	unsigned char reqbuf[65];
-	size_t needed = sizeof(reqbuf);
-	size_t offset = 0;
-	while (offset < needed) {
-		int r = recv(client_socket, (char*)reqbuf + offset, (int)(needed - offset), 0);
-		if (r <= 0) {
+	// Il buffer di ingresso contiene almeno un frame batch completo; quello
+	// di uscita almeno due risposte batch, cosi' si accumulano piu' risposte
+	// prima di ogni send.
+	unsigned char inbuf[MAX_REQUEST_FRAME];
+	unsigned char outbuf[2 * MAX_RESPONSE_FRAME];
+	size_t in_len = 0;
+	int done = 0;
+	// istanti per le statistiche di fase (stats.h)
+	uint64_t t_accept = stats_now_ns();
+	uint64_t t_recv = 0, t_built = 0;
+	stats_conn_open();
+	// scadenze: il primo frame (dalla accept) e ogni frame iniziato devono
+	// completarsi entro --read-timeout; tra due frame vale --idle-timeout
+	int in_frame = 1;
+	uint64_t frame_deadline = deadline_after(server_options.read_timeout_ms);
+	uint64_t idle_deadline = 0;
+
+	while (!done) {
+		uint64_t deadline = in_frame ? frame_deadline : idle_deadline;
+		uint64_t wait = deadline;
+		if (!in_frame) {
+			// tra due frame si attende a intervalli: durante un riavvio
+			// (upgrade.h) la connessione ferma viene chiusa
+			if (upgrade_draining()) break;
+			uint64_t slice = deadline_after(UPGRADE_POLL_MS);
+			if (!deadline || slice < deadline) wait = slice;
+		}
+		int r = recv_deadline(client_socket, inbuf + in_len, sizeof(inbuf) - in_len, wait);
+		if (r == -2 && wait != deadline) continue;
+		if (r == -2) {
+			stats_conn_timeout();
+			stats_conn_close();
+			closesocket(client_socket);
+			return -1;
+		}
+		if (r < 0 || (r == 0 && (in_len > 0 || !server_options.keepalive))) {
 			errorhandler("Errore nella ricezione della richiesta.\n");
+			stats_conn_close();
 			closesocket(client_socket);
 			return -1;
 		}
-		offset += r;
+		if (r == 0) break; // chiusura ordinata tra due richieste (-k)
+		in_len += r;
+		if (!in_frame) {
+			in_frame = 1;
+			frame_deadline = deadline_after(server_options.read_timeout_ms);
+		}
+		t_recv = stats_now_ns();
+		if (t_accept) {
+			stats_record_stage(STAGE_ACCEPT_RECV, t_accept, t_recv);
+			t_accept = 0;
+		}
+
+		// Elabora tutti i frame completi presenti nel buffer: senza -k se
+		// ne elabora uno solo e poi si chiude la connessione.
+		size_t off = 0;
+		size_t out_len = 0;
+		while (!done) {
+			long flen = frame_length(inbuf + off, in_len - off);
+			if (flen == 0) break;
+			if (flen < 0) {
+				// frame malformato: impossibile risincronizzarsi sul flusso
+				out_len += invalid_frame_response(inbuf + off, outbuf + out_len);
+				done = 1;
+				break;
+			}
+			out_len += process_frame(inbuf + off, (size_t)flen, outbuf + out_len, client_ip);
+			t_built = stats_now_ns();
+			stats_record_stage(STAGE_RECV_BUILD, t_recv, t_built);
+			off += (size_t)flen;
+			if (!server_options.keepalive) done = 1;
+
+			if (!done && sizeof(outbuf) - out_len < MAX_RESPONSE_FRAME) {
+				// buffer quasi pieno a meta' raffica: se segue un altro frame
+				// gia' ricevuto l'invio viene accorpato con il successivo
+				int more = frames_pending(inbuf + off, in_len - off);
+				if (send_all_more(client_socket, outbuf, out_len, more) != 0) {
+					errorhandler("Errore nell'invio della risposta.\n");
+					stats_conn_close();
+					closesocket(client_socket);
+					return -1;
+				}
+				stats_record_stage(STAGE_BUILD_SEND, t_built, stats_now_ns());
+				out_len = 0;
+			}
+		}
+		// sposta in testa l'eventuale frame incompleto
+		memmove(inbuf, inbuf + off, in_len - off);
+		in_len -= off;
+		if (off > 0) {
+			// i byte rimasti aprono un nuovo frame
+			in_frame = in_len > 0;
+			frame_deadline = deadline_after(server_options.read_timeout_ms);
+		}
+
+		// Invio completo delle risposte accumulate (gestione invii parziali)
+		if (send_all(client_socket, outbuf, out_len) != 0) {
+			errorhandler("Errore nell'invio della risposta.\n");
+			stats_conn_close();
+			closesocket(client_socket);
+			return -1;
+		}
+		if (out_len > 0 && t_built) stats_record_stage(STAGE_BUILD_SEND, t_built, stats_now_ns());
+		if (!in_frame) idle_deadline = deadline_after(server_options.idle_timeout_ms);
+	}
+
+	stats_conn_close();
+	closesocket(client_socket);
+	return 0;
+}
+
+// Invia tutti i byte del buffer gestendo gli invii parziali.
+// Ritorna 0 in caso di successo, -1 in caso di errore.
+int send_all(int sock, const unsigned char *buf, size_t len) {
+	return send_all_more(sock, buf, len, 0);
+}
+
+// Come send_all; con more != 0 e MSG_MORE disponibile segnala al kernel
+// che seguiranno altri dati, cosi' piu' invii consecutivi della stessa
+// raffica escono negli stessi segmenti TCP (il primo invio senza more
+// spinge fuori tutto). Se il client non legge, l'invio fallisce quando
+// non avanza per --write-timeout.
+int send_all_more(int sock, const unsigned char *buf, size_t len, int more) {
+	size_t sent_total = 0;
+	int flags = (more ? SEND_MORE_FLAG : 0) | SEND_NOWAIT_FLAG;
+	uint64_t deadline = 0;
+	while (sent_total < len) {
+		int s = send(sock, (const char*)buf + sent_total, (int)(len - sent_total), flags);
+		if (s > 0) {
+			sent_total += s;
+			deadline = 0; // l'invio avanza: la scadenza riparte
+			continue;
+		}
+		if (s == 0 || !SEND_NOWAIT_FLAG || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+			return -1;
+		}
+		if (!deadline) deadline = deadline_after(server_options.write_timeout_ms);
+		int ready = wait_socket(sock, POLLOUT, deadline);
+		if (ready == 0) stats_conn_timeout();
+		if (ready <= 0) return -1;
+	}
+	return 0;
+}
+
+// Ritorna 1 se buf inizia con un frame completo da elaborare subito: chi
+// sta svuotando il buffer delle risposte puo' allora usare send_all_more.
+int frames_pending(const unsigned char *buf, size_t len) {
+	return frame_length(buf, len) > 0;
+}
+
+// Lunghezza di un frame con count voci (tipo, lunghezza città, città) a
+// partire dall'offset off: come frame_length, 0 se incompleto e -1 se
+// malformato.
+static long entries_length(const unsigned char *buf, size_t len, size_t off, unsigned int count) {
+	for (unsigned int i = 0; i < count; i++) {
+		if (len < off + 2) return 0;
+		unsigned int clen = buf[off + 1];
+		if (clen > BATCH_CITY_MAX) return -1;
+		off += 2 + clen;
 	}
-	char req_type = (char)reqbuf[0];
-	char city[65];
-	memcpy(city, &reqbuf[1], 64);
-	city[64] = '\0'; // Garantisce terminazione
+	return len >= off ? (long)off : 0;
+}
+
+// Lunghezza del frame che inizia in buf, avendo a disposizione len byte.
+// Ritorna la lunghezza se il frame e' completo, 0 se servono altri byte,
+// -1 se il frame e' malformato.
+//  - frame classico: 1 byte tipo + 64 byte città (REQUEST_SIZE)
+//  - frame batch: BATCH_MAGIC, numero voci (uint16 network), poi per ogni
+//    voce 1 byte tipo, 1 byte lunghezza città e i byte della città
+//  - frame v2: V2_MAGIC, tipo, lunghezza città e città, oppure V2_CITY_ID
+//    e l'identificativo a 16 bit
+//  - sottoscrizione: SUB_MAGIC, intervallo (uint16), numero voci e voci
+//    come nel batch
+long frame_length(const unsigned char *buf, size_t len) {
+	if (len == 0) return 0;
+	if (buf[0] == V2_MAGIC) {
+		if (len < V2_HEADER_SIZE) return 0;
+		unsigned int clen = buf[2];
+		if (clen == V2_CITY_ID) clen = 2;
+		else if (clen > BATCH_CITY_MAX) return -1;
+		return len >= V2_HEADER_SIZE + clen ? (long)(V2_HEADER_SIZE + clen) : 0;
+	}
+	if (buf[0] == HISTORY_MAGIC) {
+		if (len < HISTORY_HEADER_SIZE) return 0;
+		if (buf[2] > BATCH_CITY_MAX) return -1;
+		size_t total = (size_t)HISTORY_HEADER_SIZE + buf[2] + HISTORY_TRAILER_SIZE;
+		return len >= total ? (long)total : 0;
+	}
+	if (buf[0] == SEARCH_MAGIC) {
+		if (len < SEARCH_HEADER_SIZE) return 0;
+		if (buf[1] == 0 || buf[1] > SEARCH_MAX || buf[2] > BATCH_CITY_MAX) return -1;
+		return len >= (size_t)SEARCH_HEADER_SIZE + buf[2] ? (long)(SEARCH_HEADER_SIZE + buf[2]) : 0;
+	}
+	if (buf[0] == SUB_MAGIC) {
+		if (len < SUB_HEADER_SIZE) return 0;
+		if (buf[3] == 0 || buf[3] > SUB_MAX) return -1;
+		return entries_length(buf, len, SUB_HEADER_SIZE, buf[3]);
+	}
+	if (buf[0] != BATCH_MAGIC) {
+		return len >= REQUEST_SIZE ? REQUEST_SIZE : 0;
+	}
+	if (len < BATCH_HEADER_SIZE) return 0;
+	unsigned int count = ((unsigned int)buf[1] << 8) | buf[2];
+	if (count == 0 || count > BATCH_MAX) return -1;
+	return entries_length(buf, len, BATCH_HEADER_SIZE, count);
+}
+
+// Risposte di errore pre-serializzate (status in network byte order, tipo
+// '\0', valore 0.0f): identiche a quelle prodotte da serialize_response
+const unsigned char response_city_not_available[RESPONSE_SIZE] = {
+	0, 0, 0, STATUS_CITY_NOT_AVAILABLE, '\0', 0, 0, 0, 0
+};
+const unsigned char response_invalid_request[RESPONSE_SIZE] = {
+	0, 0, 0, STATUS_INVALID_REQUEST, '\0', 0, 0, 0, 0
+};
+const unsigned char response_overloaded[RESPONSE_SIZE] = {
+	0, 0, 0, STATUS_OVERLOADED, '\0', 0, 0, 0, 0
+};
+
+// Serializzazione binaria risposta secondo wire_response_t: 4 byte status
+// (network), 1 byte type, 4 byte float (network bit pattern). Gli esiti di
+// errore copiano il frame pre-serializzato.
+void serialize_response(const weather_response_t *r, unsigned char *respbuf) {
+	if (r->status == STATUS_CITY_NOT_AVAILABLE) {
+		memcpy(respbuf, response_city_not_available, RESPONSE_SIZE);
+		return;
+	}
+	if (r->status == STATUS_INVALID_REQUEST) {
+		memcpy(respbuf, response_invalid_request, RESPONSE_SIZE);
+		return;
+	}
+	wire_response_t w;
+	uint32_t fbits;
+	memcpy(&fbits, &r->value, sizeof(fbits));
+	w.status = htonl(r->status);
+	w.type = (uint8_t)((r->status == STATUS_SUCCESS) ? r->type : '\0');
+	w.value = htonl(fbits);
+	memcpy(respbuf, &w, sizeof(w));
+}
+
+// Serializzazione v2: 1 byte di status e, in caso di successo, il valore in
+// decimi come int16 network. Un valore di un dataset oltre l'intervallo
+// di int16 viene saturato; NaN e infiniti non hanno una rappresentazione.
+// Ritorna i byte scritti (1 o V2_RESPONSE_SIZE).
+size_t serialize_response_v2(const weather_response_t *r, unsigned char *respbuf) {
+	respbuf[0] = (unsigned char)r->status;
+	if (r->status != STATUS_SUCCESS) return 1;
+	if (!isfinite(r->value)) {
+		respbuf[0] = (unsigned char)STATUS_CITY_NOT_AVAILABLE;
+		return 1;
+	}
+	// confronto in float prima della conversione, che fuori intervallo e'
+	// un comportamento indefinito
+	float scaled = r->value * V2_VALUE_SCALE;
+	int16_t tenths;
+	if (scaled >= V2_VALUE_MAX) tenths = V2_VALUE_MAX;
+	else if (scaled <= -V2_VALUE_MAX) tenths = -V2_VALUE_MAX;
+	else tenths = (int16_t)(scaled < 0 ? scaled - 0.5f : scaled + 0.5f);
+	uint16_t net = htons((uint16_t)tenths);
+	memcpy(&respbuf[1], &net, 2);
+	return V2_RESPONSE_SIZE;
+}
+
+// Tipo di una richiesta normalizzato per statistiche e risposta: 't',
+// 'h', 'w', 'p' oppure '\0' se non valido
+static char request_type(char req_type) {
+	char type_lower = tolower((unsigned char)req_type);
+	if (!(type_lower == 't' || type_lower == 'h' || type_lower == 'w' || type_lower == 'p')) {
+		return '\0';
+	}
+	return type_lower;
+}
+
+// Conta, valida, registra e costruisce la risposta a una singola richiesta
+// con la città gia' risolta (city e' il nome usato per il log); il
+// city_id appartiene a ds, letto una sola volta per richiesta.
+static weather_response_t resolve_request(const dataset_t *ds, char req_type, const char *city, int city_id,
+		const char *client_ip) {
+	worker_count_request();
+
+	// Validazione e costruzione risposta (unificata)
+	char type_lower = request_type(req_type);
+	weather_response_t r = build_weather_response_in(ds, type_lower, city_id);
+	reqlog_request(client_ip, req_type, city, city_id, r.status);
+	stats_count_request(type_lower, r.status);
+	return r;
+}
+
+// Logga, valida e risponde a una singola richiesta (tipo, città) gia'
+// estratta dal frame. Scrive RESPONSE_SIZE byte in respbuf.
+static int answer_request(char req_type, char *city, unsigned char *respbuf, const char *client_ip) {
 	// Normalizza city rimuovendo trailing null/spazi
 	int clen = (int)strlen(city);
 	while (clen > 0 && (city[clen-1] == ' ' || city[clen-1] == '\r' || city[clen-1] == '\n' || city[clen-1] == '\t')) {
 		city[clen-1] = '\0';
 		clen--;
 	}
-	printf("Richiesta '%c %s' dal client ip %s\n", req_type ? req_type : '-', city[0] ? city : "(vuota)", client_ip);
+	const dataset_t *ds = dataset_current();
+	weather_response_t r = resolve_request(ds, req_type, city, dataset_city_lookup(ds, city, (size_t)clen), client_ip);
+	serialize_response(&r, respbuf);
+	return (int)r.status;
+}
 
-	// Validazione e costruzione risposta (unificata)
-	char type_lower = tolower((unsigned char)req_type);
-	if (!(type_lower == 't' || type_lower == 'h' || type_lower == 'w' || type_lower == 'p')) {
-		type_lower = '\0';
+// Risponde a un frame v2 gia' validato da frame_length(); ritorna i byte
+// scritti in out.
+static size_t answer_request_v2(const unsigned char *frame, unsigned char *out, const char *client_ip) {
+	char req_type = (char)frame[1];
+	char city[BATCH_CITY_MAX + 1];
+	const dataset_t *ds = dataset_current();
+	int city_id;
+	if (frame[2] == V2_CITY_ID) {
+		city_id = (frame[3] << 8) | frame[4];
+		size_t clen = 0;
+		const char *name = dataset_city_name(ds, city_id, &clen);
+		if (!name) city_id = CITY_ID_NONE;
+		memcpy(city, name ? name : "", clen);
+		city[clen] = '\0';
+	} else {
+		size_t clen = frame[2];
+		memcpy(city, &frame[V2_HEADER_SIZE], clen);
+		city[clen] = '\0';
+		city_id = dataset_city_lookup(ds, city, clen);
 	}
-	weather_response_t r = build_weather_response(type_lower, city);
+	weather_response_t r = resolve_request(ds, req_type, city, city_id, client_ip);
+	return serialize_response_v2(&r, out);
+}
 
-	// Serializzazione binaria risposta: 4 byte status (network), 1 byte type, 4 byte float (network bit pattern)
-	unsigned char respbuf[9];
-	uint32_t net_status = htonl(r.status);
-	memcpy(respbuf, &net_status, 4);
-	respbuf[4] = (r.status == STATUS_SUCCESS) ? r.type : '\0';
-	uint32_t fbits;
-	memcpy(&fbits, &r.value, sizeof(fbits));
-	fbits = htonl(fbits);
-	memcpy(&respbuf[5], &fbits, 4);
+// Risponde a una ricerca per prefisso gia' validata da frame_length();
+// ritorna i byte scritti in out (al piu' SEARCH_RESPONSE_MAX).
+static size_t answer_search(const unsigned char *frame, unsigned char *out, const char *client_ip) {
+	char prefix[BATCH_CITY_MAX + 1];
+	size_t plen = frame[2];
+	memcpy(prefix, &frame[SEARCH_HEADER_SIZE], plen);
+	prefix[plen] = '\0';
+	worker_count_request();
 
-	// Invio completo (gestione invii parziali)
-	size_t remaining = sizeof(respbuf);
-	size_t sent_total = 0;
-	while (remaining > 0) {
-		int s = send(client_socket, (char*)respbuf + sent_total, (int)remaining, 0);
-		if (s <= 0) {
-			errorhandler("Errore nell'invio della risposta.\n");
-			closesocket(client_socket);
-			return -1;
+	const dataset_t *ds = dataset_current();
+	int ids[SEARCH_MAX];
+	int n = dataset_city_prefix(ds, prefix, plen, ids, frame[1]);
+	size_t off = 2;
+	for (int i = 0; i < n; i++) {
+		size_t len;
+		const char *name = dataset_city_name(ds, ids[i], &len);
+		out[off] = (unsigned char)len;
+		memcpy(&out[off + 1], name, len);
+		off += 1 + len;
+	}
+	out[0] = SEARCH_MAGIC;
+	out[1] = (unsigned char)n;
+	reqlog_request(client_ip, SEARCH_LOG_TYPE, prefix, CITY_ID_NONE, STATUS_SUCCESS);
+	stats_count_request(SEARCH_LOG_TYPE, STATUS_SUCCESS);
+	return off;
+}
+
+static void put_u32(unsigned char *p, uint32_t v) {
+	uint32_t net = htonl(v);
+	memcpy(p, &net, sizeof(net));
+}
+
+static uint32_t get_u32(const unsigned char *p) {
+	uint32_t net;
+	memcpy(&net, p, sizeof(net));
+	return ntohl(net);
+}
+
+// Risponde a una richiesta di aggregati gia' validata da frame_length();
+// scrive HISTORY_RESPONSE_SIZE byte in out. Senza --history la risposta
+// ha STATUS_INVALID_REQUEST.
+static size_t answer_history(const unsigned char *frame, unsigned char *out, const char *client_ip) {
+	char city[BATCH_CITY_MAX + 1];
+	size_t clen = frame[2];
+	memcpy(city, &frame[HISTORY_HEADER_SIZE], clen);
+	city[clen] = '\0';
+	const unsigned char *trailer = &frame[HISTORY_HEADER_SIZE + clen];
+	worker_count_request();
+
+	const dataset_t *ds = dataset_current();
+	int city_id = dataset_city_lookup(ds, city, clen);
+	int t = weather_type_index((char)tolower(frame[1]));
+	unsigned int status = STATUS_SUCCESS;
+	history_stats_t hs;
+	memset(&hs, 0, sizeof(hs));
+	if (t < 0 || !history_enabled()) {
+		status = STATUS_INVALID_REQUEST;
+	} else if (city_id == CITY_ID_NONE) {
+		status = STATUS_CITY_NOT_AVAILABLE;
+	} else {
+		history_aggregate(ds, city_id, t, get_u32(trailer), get_u32(trailer + 4), &hs);
+	}
+
+	out[0] = HISTORY_MAGIC;
+	out[1] = (unsigned char)status;
+	put_u32(&out[2], hs.count);
+	const float fields[4] = { hs.min, hs.max, hs.mean, hs.stddev };
+	for (int i = 0; i < 4; i++) {
+		uint32_t bits;
+		memcpy(&bits, &fields[i], sizeof(bits));
+		put_u32(&out[6 + 4 * i], bits);
+	}
+	reqlog_request(client_ip, HISTORY_LOG_TYPE, city, city_id, status);
+	stats_count_request(HISTORY_LOG_TYPE, status);
+	return HISTORY_RESPONSE_SIZE;
+}
+
+// Elabora una richiesta completa di REQUEST_SIZE byte e scrive in respbuf
+// i RESPONSE_SIZE byte della risposta. Non esegue I/O sul socket, cosi' da
+// poter essere usata sia dal percorso bloccante sia dall'event loop.
+int process_request(const unsigned char *reqbuf, unsigned char *respbuf, const char *client_ip) {
+	const wire_request_t *w = (const wire_request_t *)reqbuf;
+	char city[sizeof(w->city) + 1];
+	memcpy(city, w->city, sizeof(w->city));
+	city[sizeof(w->city)] = '\0'; // Garantisce terminazione
+	dataset_read_begin();
+	int rc = answer_request((char)w->type, city, respbuf, client_ip);
+	dataset_read_end();
+	return rc;
+}
+
+// Statistiche di un frame rifiutato dal controllo di ammissione: una
+// richiesta STATUS_OVERLOADED per ogni richiesta che il frame servito
+// avrebbe contato e sotto lo stesso tipo (quello di ogni voce del batch,
+// della richiesta classica o v2, SEARCH_LOG_TYPE e HISTORY_LOG_TYPE),
+// mai sotto il byte iniziale del frame
+static void count_shed(const unsigned char *frame) {
+	if (frame[0] == BATCH_MAGIC) {
+		unsigned int count = ((unsigned int)frame[1] << 8) | frame[2];
+		size_t off = BATCH_HEADER_SIZE; // frame gia' validato da frame_length()
+		for (unsigned int i = 0; i < count; i++) {
+			stats_count_request(request_type((char)frame[off]), STATUS_OVERLOADED);
+			off += 2 + (size_t)frame[off + 1];
 		}
-		sent_total += s;
-		remaining -= s;
+		return;
 	}
+	char type;
+	if (frame[0] == V2_MAGIC) type = request_type((char)frame[1]);
+	else if (frame[0] == SEARCH_MAGIC) type = SEARCH_LOG_TYPE;
+	else if (frame[0] == HISTORY_MAGIC) type = HISTORY_LOG_TYPE;
+	else type = request_type((char)frame[0]);
+	stats_count_request(type, STATUS_OVERLOADED);
+}
 
-	closesocket(client_socket);
-	return 0;
+// Risposta a un frame rifiutato dal controllo di ammissione, nel formato
+// del frame: STATUS_OVERLOADED per ogni voce del batch, nel byte di status
+// (v2, aggregati) o nessun risultato (ricerca). Non legge il dataset.
+static size_t overload_frame_response(const unsigned char *frame, unsigned char *out) {
+	count_shed(frame);
+	if (frame[0] == V2_MAGIC) {
+		out[0] = STATUS_OVERLOADED;
+		return 1;
+	}
+	if (frame[0] == SEARCH_MAGIC) {
+		out[0] = SEARCH_MAGIC;
+		out[1] = 0;
+		return 2;
+	}
+	if (frame[0] == HISTORY_MAGIC) {
+		memset(out, 0, HISTORY_RESPONSE_SIZE);
+		out[0] = HISTORY_MAGIC;
+		out[1] = STATUS_OVERLOADED;
+		return HISTORY_RESPONSE_SIZE;
+	}
+	if (frame[0] != BATCH_MAGIC) {
+		memcpy(out, response_overloaded, RESPONSE_SIZE);
+		return RESPONSE_SIZE;
+	}
+	unsigned int count = ((unsigned int)frame[1] << 8) | frame[2];
+	memcpy(out, frame, BATCH_HEADER_SIZE);
+	for (unsigned int i = 0; i < count; i++) {
+		memcpy(out + BATCH_HEADER_SIZE + (size_t)i * RESPONSE_SIZE, response_overloaded, RESPONSE_SIZE);
+	}
+	return BATCH_HEADER_SIZE + (size_t)count * RESPONSE_SIZE;
+}
+
+// Risposta a un frame ammesso che legge il dataset (tutti tranne le
+// statistiche); va chiamata dentro una sezione di lettura del dataset.
+// La risposta batch e' BATCH_MAGIC, numero voci (uint16 network) e una
+// risposta da RESPONSE_SIZE byte per voce, nello stesso ordine.
+static size_t answer_frame(const unsigned char *frame, size_t frame_len, unsigned char *out, const char *client_ip) {
+	if (frame[0] == V2_MAGIC) {
+		return answer_request_v2(frame, out, client_ip);
+	}
+	if (frame[0] == SEARCH_MAGIC) {
+		return answer_search(frame, out, client_ip);
+	}
+	if (frame[0] == HISTORY_MAGIC) {
+		return answer_history(frame, out, client_ip);
+	}
+	if (frame[0] == SUB_MAGIC) {
+		// le sottoscrizioni sono gestite dal reactor (sub.h): qui non
+		// esiste una connessione su cui inviare gli aggiornamenti
+		return invalid_frame_response(NULL, out);
+	}
+	if (frame[0] != BATCH_MAGIC) {
+		process_request(frame, out, client_ip);
+		return RESPONSE_SIZE;
+	}
+	(void)frame_len; // gia' validata da frame_length()
+	unsigned int count = ((unsigned int)frame[1] << 8) | frame[2];
+	memcpy(out, frame, BATCH_HEADER_SIZE);
+	size_t in_off = BATCH_HEADER_SIZE;
+	size_t out_off = BATCH_HEADER_SIZE;
+	for (unsigned int i = 0; i < count; i++) {
+		char req_type = (char)frame[in_off];
+		unsigned int clen = frame[in_off + 1];
+		char city[BATCH_CITY_MAX + 1];
+		memcpy(city, &frame[in_off + 2], clen);
+		city[clen] = '\0';
+		answer_request(req_type, city, out + out_off, client_ip);
+		in_off += 2 + clen;
+		out_off += RESPONSE_SIZE;
+	}
+	return out_off;
+}
+
+// Elabora un frame completo (classico, batch, v2 o ricerca) e scrive la
+// risposta in out, che deve avere spazio per almeno MAX_RESPONSE_FRAME byte.
+// Una richiesta classica di tipo STATS_REQUEST riceve il frame di
+// statistiche. Con --rate ogni frame costa un gettone al client (un batch
+// uno per voce), comprese le statistiche, la cui risposta e' molte volte
+// piu' grande della richiesta (per questo su --udp udp.c non le inoltra);
+// a gettoni esauriti riceve una risposta di sovraccarico. Ritorna il
+// numero di byte scritti.
+size_t process_frame(const unsigned char *frame, size_t frame_len, unsigned char *out, const char *client_ip) {
+	unsigned int cost = frame[0] == BATCH_MAGIC ? ((unsigned int)frame[1] << 8) | frame[2] : 1;
+	if (admit_request(client_ip, cost) != 0) {
+		return overload_frame_response(frame, out);
+	}
+	if (tolower(frame[0]) == STATS_REQUEST) {
+		// richiesta di statistiche: frame classico, città ignorata
+		return stats_build_frame(out);
+	}
+	dataset_read_begin();
+	size_t n = answer_frame(frame, frame_len, out, client_ip);
+	dataset_read_end();
+	return n;
+}
+
+// Risposta per un frame malformato: una risposta con STATUS_INVALID_REQUEST
+// nel formato del frame (v2 se inizia con V2_MAGIC, altrimenti classica),
+// dopo la quale la connessione viene chiusa. frame puo' essere NULL se non
+// e' arrivato alcun byte.
+size_t invalid_frame_response(const unsigned char *frame, unsigned char *out) {
+	if (frame && frame[0] == V2_MAGIC) {
+		out[0] = STATUS_INVALID_REQUEST;
+		return 1;
+	}
+	memcpy(out, response_invalid_request, RESPONSE_SIZE);
+	return RESPONSE_SIZE;
 }
 
 float typecheck(char type){
@@ -260,63 +1130,69 @@ float typecheck(char type){
 }
 
 char citycheck(const char *city) {
-	static const char *valid_cities[] = {
-		"Bari","Roma","Milano","Napoli","Torino",
-		"Palermo","Genova","Bologna","Firenze","Venezia"
-	};
-	for (size_t i = 0; i < sizeof(valid_cities)/sizeof(valid_cities[0]); ++i) {
-		const char *a = city;
-		const char *b = valid_cities[i];
-		while (*a && *b) {
-			if (tolower((unsigned char)*a) != tolower((unsigned char)*b)) {
-				break;
-			}
-			a++; b++;
-		}
-		if (*a == '\0' && *b == '\0') {
-			return 0; // valida (case insensitive)
-		}
-	}
-	return 2; // non valida
+	// ricerca O(1) nella tabella hash perfetta (case insensitive)
+	dataset_read_begin();
+	int id = dataset_city_lookup(dataset_current(), city, strlen(city));
+	dataset_read_end();
+	return id != CITY_ID_NONE ? 0 : 2;
 }
 
 // Funzione che combina validazione e generazione valore secondo specifica.
 weather_response_t build_weather_response(char type, const char *city) {
+	dataset_read_begin();
+	const dataset_t *ds = dataset_current();
+	int city_id = (city == NULL) ? CITY_ID_NONE : dataset_city_lookup(ds, city, strlen(city));
+	weather_response_t r = build_weather_response_in(ds, type, city_id);
+	dataset_read_end();
+	return r;
+}
+
+// Come build_weather_response, ma con la città gia' risolta nel suo
+// identificativo (CITY_ID_NONE se sconosciuta) nel dataset corrente.
+weather_response_t build_weather_response_id(char type, int city_id) {
+	dataset_read_begin();
+	weather_response_t r = build_weather_response_in(dataset_current(), type, city_id);
+	dataset_read_end();
+	return r;
+}
+
+// Variante usata dal percorso di richiesta, che risolve il nome una sola
+// volta: city_id e' un identificativo di ds (NULL = tabella interna).
+weather_response_t build_weather_response_in(const dataset_t *ds, char type, int city_id) {
 	weather_response_t r;
 	r.status = STATUS_SUCCESS;
 	r.type = '\0';
 	r.value = 0.0f;
 
-	// Validazione type
-	if (type == '\0' || typecheck(type) != 0) {
-		// Richiesta non valida (tipo errato)
-		r.status = STATUS_INVALID_REQUEST;
-		return r;
+	// Validazione type e generazione valore meteo
+	float (*generate)(void);
+	switch (type) {
+		case 't': generate = get_temperature; break;
+		case 'h': generate = get_humidity; break;
+		case 'w': generate = get_wind; break;
+		case 'p': generate = get_pressure; break;
+		default:
+			// Richiesta non valida (tipo errato)
+			r.status = STATUS_INVALID_REQUEST;
+			return r;
 	}
 
 	// Validazione city
-	if (city == NULL || *city == '\0' || citycheck(city) != 0) {
+	if (city_id == CITY_ID_NONE) {
 		// Città non disponibile
 		r.status = STATUS_CITY_NOT_AVAILABLE;
 		return r;
 	}
 
-	// Generazione valore meteo
-	float value = 0.0f;
-	switch (type) {
-		case 't': value = get_temperature(); break;
-		case 'h': value = get_humidity(); break;
-		case 'w': value = get_wind(); break;
-		case 'p': value = get_pressure(); break;
-		default:
-			// fallback
-			r.status = STATUS_INVALID_REQUEST;
-			return r;
-	}
-
-	// Popolamento struttura in caso di successo
+	// Popolamento struttura in caso di successo: con --snapshot il valore
+	// e' una semplice lettura dalla tabella aggiornata in background, se
+	// questa e' gia' stata generata dallo stesso dataset
 	r.status = STATUS_SUCCESS;
 	r.type = type;
-	r.value = value;
+	int t = weather_type_index(type);
+	if (!snapshot_enabled() || snapshot_read(dataset_version(ds), city_id, t, &r.value) != 0) {
+		r.value = ds ? dataset_value(ds, city_id, t) : generate();
+	}
+	if (history_enabled()) history_record(ds, city_id, t, r.value);
 	return r;
 }
@@ -8,17 +8,104 @@
 #ifndef PROTOCOL_H_
 #define PROTOCOL_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 // Shared application parameters (unified client/server constants)
 #define SERVER_PORT  56700         // Default server port
 #define SERVER_IP   "127.0.0.1"    // Default server IP (override in runtime if needed)
 #define BUFFER_SIZE 512            // Generic buffer size
 #define QUEUE_SIZE  5              // Pending connections queue size (server only)
-#define QLEN 6
+#define QLEN       512             // backlog di default di listen (--backlog), limitato dal kernel a somaxconn
+
+// Attese massime di default per connessione (0 sull'opzione = nessuna):
+// un frame iniziato (o il primo, dalla accept) deve completarsi entro
+// READ_TIMEOUT_MS, le risposte in uscita devono avanzare entro
+// WRITE_TIMEOUT_MS e con -k la connessione puo' restare inattiva tra due
+// frame al piu' IDLE_TIMEOUT_MS. Allo scadere la connessione viene chiusa.
+#define READ_TIMEOUT_MS  5000      // --read-timeout
+#define WRITE_TIMEOUT_MS 5000      // --write-timeout
+#define IDLE_TIMEOUT_MS  60000     // --idle-timeout
+
+// Profilo --low-latency dei socket del server: i valori valgono per le
+// opzioni non indicate esplicitamente (--fastopen, --defer-accept,
+// --busy-poll) e si aggiunge --nodelay
+#define LOWLAT_FASTOPEN     256    // connessioni TFO in attesa di accept
+#define LOWLAT_DEFER_ACCEPT 1      // secondi di attesa della richiesta dopo l'handshake
+#define LOWLAT_BUSY_POLL_US 50     // attesa attiva in ricezione sulla coda della scheda
+
+// Dimensioni fisse dei messaggi binari sul filo
+#define REQUEST_SIZE  65           // 1 byte tipo + 64 byte città
+#define RESPONSE_SIZE 9            // 4 byte status + 1 byte tipo + 4 byte valore
+
+// Frame batch: BATCH_MAGIC + numero voci (uint16 network) + voci
+// (1 byte tipo, 1 byte lunghezza città, città). La risposta ripete
+// l'intestazione seguita da una risposta da RESPONSE_SIZE byte per voce.
+#define BATCH_MAGIC        0xBA    // primo byte di un frame batch (non e' un tipo valido)
+#define BATCH_MAX          256     // voci massime in un frame batch
+#define BATCH_HEADER_SIZE  3       // magic + numero voci
+#define BATCH_CITY_MAX     63      // lunghezza massima della città in una voce
+#define MAX_REQUEST_FRAME  (BATCH_HEADER_SIZE + BATCH_MAX * (2 + BATCH_CITY_MAX))
+#define MAX_RESPONSE_FRAME (BATCH_HEADER_SIZE + BATCH_MAX * RESPONSE_SIZE)
+
+// Formato compatto v2, riconosciuto dal primo byte del frame: i client v1
+// (frame da REQUEST_SIZE byte) continuano a funzionare sulla stessa porta.
+// Richiesta: V2_MAGIC, tipo, lunghezza città (0..BATCH_CITY_MAX) e i byte
+// della città, oppure V2_CITY_ID e l'identificativo della città (uint16
+// network). Risposta: 1 byte di status; se STATUS_SUCCESS seguono 2 byte
+// con il valore in decimi (int16 network), la risoluzione dei valori
+// generati; oltre +-V2_VALUE_MAX decimi il valore e' saturato e un valore
+// non finito risponde STATUS_CITY_NOT_AVAILABLE. Il tipo non viene
+// ripetuto: le risposte arrivano in ordine.
+#define V2_MAGIC           0xC2    // primo byte di un frame v2 (non e' un tipo valido)
+#define V2_CITY_ID         0xFF    // al posto della lunghezza: segue l'id della città
+#define V2_HEADER_SIZE     3       // magic + tipo + lunghezza
+#define V2_REQUEST_MAX     (V2_HEADER_SIZE + BATCH_CITY_MAX)
+#define V2_RESPONSE_SIZE   3       // status + valore; un errore occupa 1 byte
+#define V2_VALUE_SCALE     10      // il valore viaggia in decimi
+#define V2_VALUE_MAX       32767   // modulo massimo in decimi (int16)
+
+// Frame di sottoscrizione (sub.h): SUB_MAGIC, intervallo in ms (uint16
+// network, 0 = a ogni variazione dei valori), numero voci (1..SUB_MAX) e
+// voci come nel batch (tipo, lunghezza città, città). Il server risponde
+// con frame push: SUB_MAGIC, numero voci e per ogni voce l'indice nella
+// sottoscrizione seguito da una risposta da RESPONSE_SIZE byte.
+#define SUB_MAGIC          0xB5    // primo byte di sottoscrizioni e frame push
+#define SUB_MAX            64      // voci massime in una sottoscrizione
+#define SUB_HEADER_SIZE    4       // magic + intervallo + numero voci
+#define SUB_PUSH_HEADER    2       // magic + numero voci
+#define SUB_ENTRY_SIZE     (1 + RESPONSE_SIZE)
+#define SUB_PUSH_MAX       (SUB_PUSH_HEADER + SUB_MAX * SUB_ENTRY_SIZE)
+
+// Ricerca per prefisso: SEARCH_MAGIC, numero massimo di risultati
+// (1..SEARCH_MAX), lunghezza del prefisso (0..BATCH_CITY_MAX) e i byte
+// del prefisso. Risposta: SEARCH_MAGIC, numero di nomi e per ogni nome
+// la lunghezza seguita dai byte, in ordine alfabetico senza distinzione
+// tra maiuscole e minuscole.
+#define SEARCH_MAGIC       0xB8    // primo byte di ricerche e risposte
+#define SEARCH_MAX         32      // risultati massimi di una ricerca
+#define SEARCH_HEADER_SIZE 3       // magic + massimo + lunghezza
+#define SEARCH_RESPONSE_MAX (2 + SEARCH_MAX * (1 + BATCH_CITY_MAX))
+#define SEARCH_LOG_TYPE    '?'     // tipo registrato nel log per le ricerche
+
+// Aggregati sulla cronologia (history.h, --history): HISTORY_MAGIC, tipo,
+// lunghezza città (0..BATCH_CITY_MAX), città, numero di campioni recenti
+// (uint32 network, 0 = tutti) e finestra in ms (uint32 network, 0 =
+// nessuna). Risposta di HISTORY_RESPONSE_SIZE byte: HISTORY_MAGIC, status,
+// campioni aggregati (uint32 network) e min, max, media, deviazione
+// standard come bit di float in network byte order (zero se nessun
+// campione o in caso di errore).
+#define HISTORY_MAGIC         0xB9
+#define HISTORY_HEADER_SIZE   3       // magic + tipo + lunghezza
+#define HISTORY_TRAILER_SIZE  8       // campioni + finestra, dopo la città
+#define HISTORY_RESPONSE_SIZE 22
+#define HISTORY_LOG_TYPE      '#'     // tipo registrato nel log per gli aggregati
 
 // Status codes (shared)
 #define STATUS_SUCCESS            0u
 #define STATUS_CITY_NOT_AVAILABLE 1u
 #define STATUS_INVALID_REQUEST    2u
+#define STATUS_OVERLOADED         3u  // rifiutata dal controllo di ammissione (admit.h)
 
 // Client request structure (binary protocol: 1 byte type + 64 bytes city when sent)
 typedef struct {
@@ -33,18 +120,86 @@ typedef struct {
     float value;         // generated weather value (0.0 on error)
 } weather_response_t;
 
+// Layout sul filo dei messaggi classici: i campi interi sono in network
+// byte order e il valore e' il pattern di bit del float. Le strutture sono
+// impacchettate, quindi vanno lette e scritte con memcpy o per copia.
+#pragma pack(push, 1)
+typedef struct {
+    uint8_t type;    // 't','h','w','p' (o BATCH_MAGIC/STATS_REQUEST)
+    char city[64];   // città terminata da '\0' e riempita di zeri
+} wire_request_t;
+
+typedef struct {
+    uint32_t status; // STATUS_* (network)
+    uint8_t type;    // tipo della richiesta, '\0' in caso di errore
+    uint32_t value;  // bit del float (network)
+} wire_response_t;
+#pragma pack(pop)
+
+_Static_assert(SEARCH_RESPONSE_MAX <= MAX_RESPONSE_FRAME, "una ricerca entra nel buffer di risposta");
+_Static_assert(sizeof(wire_request_t) == REQUEST_SIZE, "wire_request_t deve occupare REQUEST_SIZE byte");
+_Static_assert(offsetof(wire_request_t, city) == 1, "la città segue il byte del tipo");
+_Static_assert(sizeof(wire_response_t) == RESPONSE_SIZE, "wire_response_t deve occupare RESPONSE_SIZE byte");
+_Static_assert(offsetof(wire_response_t, type) == 4 && offsetof(wire_response_t, value) == 5,
+        "layout della risposta: status, tipo, valore");
+
+// Risposte di errore pre-serializzate: i loro byte non cambiano mai
+extern const unsigned char response_city_not_available[RESPONSE_SIZE];
+extern const unsigned char response_invalid_request[RESPONSE_SIZE];
+extern const unsigned char response_overloaded[RESPONSE_SIZE];
+
+// Opzioni di runtime del server, impostate da main() e lette dai worker
+typedef struct {
+    int keepalive;   // -k: connessioni persistenti con richieste in pipeline
+    int seed_set;    // --seed indicato: esecuzioni riproducibili
+    unsigned long long seed; // seme base del PRNG (worker i usa seed + i)
+    int snapshot_ms; // --snapshot: intervallo di aggiornamento della tabella, 0 = disattivata
+    int log_capacity; // --log-async: record nel ring del log asincrono, 0 = log sincrono
+    int log_block;   // --log-block: a ring pieno attende invece di scartare
+    const char *dataset; // --dataset: file delle città (dataset.h), NULL = tabella interna
+    int history;     // --history: campioni conservati per (città, tipo), 0 = disattivata
+    int backlog;     // --backlog: coda delle connessioni in attesa di accept
+    int max_conns;   // --max-conns: connessioni contemporanee, 0 = nessun limite
+    unsigned int rate;  // --rate: richieste al secondo per IP, 0 = nessun limite
+    unsigned int burst; // --burst: raffica massima per IP, 0 = rate
+    int read_timeout_ms;  // --read-timeout: completamento di un frame
+    int write_timeout_ms; // --write-timeout: avanzamento dell'invio
+    int idle_timeout_ms;  // --idle-timeout: inattivita' tra due frame (-k)
+    int fastopen;     // --fastopen: coda TCP Fast Open del listener, 0 = disattivato
+    int nodelay;      // --nodelay: TCP_NODELAY sulle connessioni accettate
+    int defer_accept; // --defer-accept: secondi di attesa dei dati prima di accept, 0 = no
+    int busy_poll_us; // --busy-poll: attesa attiva in ricezione (SO_BUSY_POLL), 0 = no
+} server_options_t;
+
+extern server_options_t server_options;
+
 // Server-side function prototypes
+void errorhandler(char *errorMessage);
 int handleclientconnection(int client_socket, const char *client_ip);
 float typecheck(char type);
 char citycheck(const char *city);
 weather_response_t build_weather_response(char type, const char *city);
+weather_response_t build_weather_response_id(char type, int city_id);
+struct dataset;
+weather_response_t build_weather_response_in(const struct dataset *ds, char type, int city_id);
+int process_request(const unsigned char *reqbuf, unsigned char *respbuf, const char *client_ip);
+void serialize_response(const weather_response_t *r, unsigned char *respbuf);
+size_t serialize_response_v2(const weather_response_t *r, unsigned char *respbuf);
+int send_all(int sock, const unsigned char *buf, size_t len);
+int send_all_more(int sock, const unsigned char *buf, size_t len, int more);
+int frames_pending(const unsigned char *buf, size_t len);
+long frame_length(const unsigned char *buf, size_t len);
+size_t process_frame(const unsigned char *frame, size_t frame_len, unsigned char *out, const char *client_ip);
+size_t invalid_frame_response(const unsigned char *frame, unsigned char *out);
+struct sockaddr_in;
+int open_listener(const struct sockaddr_in *server_addr, int reuseport);
+int run_blocking_loop(int my_socket);
 
 // Data generation (shared)
+int fill_weather_values(char type, float *out, size_t n); // versione batch
 float get_temperature(void);    // Range: -10.0 .. 40.0 °C
 float get_humidity(void);       // Range: 20.0 .. 100.0 %
 float get_wind(void);           // Range: 0.0 .. 100.0 km/h
 float get_pressure(void);       // Range: 950.0 .. 1050.0 hPa
 
-static int my_inet_pton(int af, const char *src, void *dst);
-
 #endif /* PROTOCOL_H_ */
@@ -0,0 +1,495 @@
+/*
+ * reactor.c
+ *
+ * Event loop epoll edge-triggered per il server meteo.
+ *
+ * Il socket di ascolto e tutti i socket client sono non bloccanti.
+ * Ogni connessione ha una piccola macchina a stati che accumula i 65 byte
+ * della richiesta attraverso letture parziali, elabora la richiesta con
+ * process_request() e svuota i 9 byte della risposta attraverso scritture
+ * parziali, chiudendo infine la connessione. Un client lento o inattivo
+ * non blocca piu' gli altri. Con le connessioni persistenti (-k) si
+ * elaborano in ordine tutte le richieste complete ricevute e la
+ * connessione resta aperta finche' il client non la chiude.
+ * Il reactor serve anche le sottoscrizioni (sub.h): l'attesa di epoll_wait
+ * e' limitata dalla prossima scadenza e dopo ogni giro di eventi si
+ * accodano i frame push delle sottoscrizioni scadute.
+ * Le attese massime delle connessioni (--read-timeout, --write-timeout,
+ * --idle-timeout) sono voci di una ruota temporale per thread (timer.h),
+ * aggiornate dopo ogni evento: dopo il giro di eventi si chiudono le
+ * connessioni scadute.
+ * Durante un riavvio (upgrade.h) il reactor toglie da epoll il socket di
+ * ascolto, chiude le connessioni ferme tra due frame e le sottoscrizioni
+ * e lascia finire quelle con un frame o una risposta in corso.
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE // accept4
+#endif
+
+#include "reactor.h"
+#include "protocol.h"
+#include "reqlog.h"
+#include "stats.h"
+#include "sub.h"
+#include "admit.h"
+#include "timer.h"
+#include "upgrade.h"
+
+#include <stdio.h>
+
+#if defined(HAVE_EPOLL)
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+typedef struct conn {
+	int fd;
+	int closing;                          // one-shot: risposta prodotta, chiudere dopo l'invio
+	size_t in_len;                        // byte ricevuti e non ancora elaborati
+	size_t out_len;                       // byte di risposta pronti
+	size_t out_off;                       // byte di risposta gia' inviati
+	uint64_t accept_ns;                   // istante della accept, 0 dopo la prima ricezione
+	uint64_t recv_ns;                     // ultima ricezione di dati
+	uint64_t built_ns;                    // ultima risposta costruita
+	unsigned char inbuf[MAX_REQUEST_FRAME];
+	unsigned char outbuf[2 * MAX_RESPONSE_FRAME];
+	char client_ip[INET_ADDRSTRLEN];
+	struct conn *next_free;               // collegamento nella free list
+	int subscribed;                       // nella lista dei sottoscrittori
+	struct conn *sub_prev, *sub_next;     // lista dei sottoscrittori del thread
+	sub_t sub;                            // sottoscrizione attiva (sub.h)
+	timer_entry_t deadline;               // prossima scadenza (timer.h)
+	uint64_t frame_ms;                    // inizio del frame atteso, 0 tra due frame
+} conn_t;
+
+// Free list delle strutture di connessione, una per thread: evita una
+// malloc/free per ogni connessione di breve durata.
+static _Thread_local conn_t *free_conns = NULL;
+
+// Connessioni con una sottoscrizione attiva, servite a ogni scadenza
+static _Thread_local conn_t *subscribers = NULL;
+
+// Scadenze delle connessioni del thread
+static _Thread_local timer_wheel_t wheel;
+
+// Chiusura graduale in corso: niente accept, connessioni ferme chiuse
+static _Thread_local int draining;
+static _Thread_local int loop_id; // indice del ciclo in upgrade.h
+
+static void sub_link(conn_t *c) {
+	if (c->subscribed) return;
+	c->subscribed = 1;
+	c->sub_prev = NULL;
+	c->sub_next = subscribers;
+	if (subscribers) subscribers->sub_prev = c;
+	subscribers = c;
+}
+
+static void sub_unlink(conn_t *c) {
+	if (!c->subscribed) return;
+	c->subscribed = 0;
+	if (c->sub_prev) c->sub_prev->sub_next = c->sub_next;
+	else subscribers = c->sub_next;
+	if (c->sub_next) c->sub_next->sub_prev = c->sub_prev;
+}
+
+static conn_t *conn_alloc(void) {
+	conn_t *c = free_conns;
+	if (c) {
+		free_conns = c->next_free;
+	} else {
+		c = malloc(sizeof(*c));
+		if (!c) return NULL;
+	}
+	c->closing = 0;
+	c->in_len = 0;
+	c->out_len = 0;
+	c->out_off = 0;
+	c->recv_ns = 0;
+	c->built_ns = 0;
+	c->next_free = NULL;
+	c->subscribed = 0;
+	c->sub.count = 0;
+	c->deadline.prev = c->deadline.next = NULL;
+	c->frame_ms = 0;
+	return c;
+}
+
+static void conn_close(int epfd, conn_t *c) {
+	timer_cancel(&wheel, &c->deadline);
+	stats_conn_close();
+	admit_conn_close();
+	sub_unlink(c);
+	epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	c->next_free = free_conns;
+	free_conns = c;
+}
+
+static int set_nonblocking(int fd) {
+	int flags = fcntl(fd, F_GETFL, 0);
+	if (flags < 0) return -1;
+	return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// Svuota il buffer di uscita. Ritorna 1 se tutte le risposte pronte sono
+// state inviate, 0 se il socket non accetta altri dati per ora, -1 su errore.
+// more indica che il chiamante invia subito dopo altre risposte (frame
+// completi rimasti in ingresso a buffer di uscita pieno): MSG_MORE accorpa
+// questo invio con il successivo. Va passato 0 quando un invio successivo
+// non e' garantito, altrimenti i dati restano trattenuti nel kernel.
+static int conn_flush(conn_t *c, int more) {
+	int flags = MSG_NOSIGNAL;
+	if (more) flags |= MSG_MORE;
+	while (c->out_off < c->out_len) {
+		ssize_t s = send(c->fd, c->outbuf + c->out_off, c->out_len - c->out_off, flags);
+		if (s > 0) {
+			c->out_off += (size_t)s;
+		} else if (s < 0 && errno == EINTR) {
+			continue;
+		} else if (s < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return 0;
+		} else {
+			return -1;
+		}
+	}
+	if (c->out_len > 0) stats_record_stage(STAGE_BUILD_SEND, c->built_ns, stats_now_ns());
+	c->out_len = 0;
+	c->out_off = 0;
+	return 1;
+}
+
+// Legge quanto disponibile fino a riempire il buffer di ingresso. Con epoll
+// in modalita' edge-triggered si deve leggere fino a EAGAIN, a meno di
+// fermarsi volontariamente a buffer pieno. Ritorna 1 se sono arrivati nuovi
+// dati, 0 su EAGAIN senza dati nuovi, 2 su chiusura ordinata del client,
+// -1 su errore. In *drained indica se il socket e' stato letto fino a EAGAIN.
+static int conn_fill(conn_t *c, int *drained) {
+	int got = 0;
+	*drained = 0;
+	while (c->in_len < sizeof(c->inbuf)) {
+		ssize_t r = recv(c->fd, c->inbuf + c->in_len, sizeof(c->inbuf) - c->in_len, 0);
+		if (r > 0) {
+			c->in_len += (size_t)r;
+			got = 1;
+		} else if (r < 0 && errno == EINTR) {
+			continue;
+		} else if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			*drained = 1;
+			break;
+		} else if (r == 0) {
+			if (!got) return 2;
+			break;
+		} else {
+			return -1;
+		}
+	}
+	if (got) {
+		c->recv_ns = stats_now_ns();
+		if (c->accept_ns) {
+			stats_record_stage(STAGE_ACCEPT_RECV, c->accept_ns, c->recv_ns);
+			c->accept_ns = 0;
+		}
+	}
+	return *drained ? got : 1;
+}
+
+// Elabora tutti i frame completi presenti nel buffer (classici o batch),
+// finche' c'e' spazio per una risposta di dimensione massima. In modalita'
+// one-shot si elabora un solo frame e la connessione viene marcata per la
+// chiusura, come anche dopo un frame malformato.
+static void conn_parse(conn_t *c) {
+	size_t off = 0;
+	while (!c->closing && sizeof(c->outbuf) - c->out_len >= MAX_RESPONSE_FRAME) {
+		long flen = frame_length(c->inbuf + off, c->in_len - off);
+		if (flen == 0) break;
+		if (flen < 0) {
+			c->out_len += invalid_frame_response(c->inbuf + off, c->outbuf + c->out_len);
+			c->closing = 1;
+			break;
+		}
+		if (c->inbuf[off] == SUB_MAGIC) {
+			// (ri)sottoscrizione: primo frame push con tutte le voci
+			c->out_len += sub_start(&c->sub, c->inbuf + off, c->outbuf + c->out_len, c->client_ip, stats_now_ns());
+			if (c->sub.count > 0) sub_link(c);
+			else sub_unlink(c);
+		} else {
+			c->out_len += process_frame(c->inbuf + off, (size_t)flen, c->outbuf + c->out_len, c->client_ip);
+		}
+		c->built_ns = stats_now_ns();
+		stats_record_stage(STAGE_RECV_BUILD, c->recv_ns, c->built_ns);
+		off += (size_t)flen;
+		// una connessione sottoscritta resta aperta anche senza -k
+		if (!server_options.keepalive && !c->subscribed) c->closing = 1;
+	}
+	if (off > 0) {
+		memmove(c->inbuf, c->inbuf + off, c->in_len - off);
+		c->in_len -= off;
+		c->frame_ms = 0; // i byte rimasti aprono un nuovo frame
+	}
+}
+
+// Arma la scadenza che corrisponde allo stato della connessione: risposte
+// ferme in uscita (--write-timeout, dall'ultimo avanzamento), frame
+// iniziato o primo frame dalla accept (--read-timeout, dall'inizio del
+// frame), attesa tra due frame con -k (--idle-timeout). Una connessione
+// sottoscritta non scade per inattivita': i dati li invia il server.
+static void conn_deadline(conn_t *c) {
+	uint64_t now = timer_now_ms();
+	int timeout;
+	uint64_t from = now;
+	if (c->out_off < c->out_len) {
+		timeout = server_options.write_timeout_ms;
+	} else if (c->in_len > 0 || c->frame_ms) {
+		if (!c->frame_ms) c->frame_ms = now;
+		from = c->frame_ms;
+		timeout = server_options.read_timeout_ms;
+	} else {
+		timeout = c->subscribed ? 0 : server_options.idle_timeout_ms;
+	}
+	if (timeout > 0) timer_set(&wheel, &c->deadline, from + (uint64_t)timeout);
+	else timer_cancel(&wheel, &c->deadline);
+}
+
+// Gestisce un evento della connessione. Ritorna 0, oppure -1 se la
+// connessione e' stata chiusa.
+static int conn_io(int epfd, conn_t *c) {
+	int drained = 0;
+	for (;;) {
+		conn_parse(c);
+
+		// frame completi rimasti in ingresso (buffer di uscita pieno a meta'
+		// raffica): vanno elaborati dopo questo invio, perche' in modalita'
+		// edge-triggered non arrivera' un altro EPOLLIN per byte gia' letti
+		int pending = !c->closing && frames_pending(c->inbuf, c->in_len);
+
+		// si prova subito a scrivere, senza attendere EPOLLOUT
+		int rc = conn_flush(c, pending);
+		if (rc < 0) {
+			errorhandler("Errore nell'invio della risposta.\n");
+			conn_close(epfd, c);
+			return -1;
+		}
+		if (rc == 0) return 0; // si riprende al prossimo EPOLLOUT
+		if (c->closing) {      // one-shot: risposta inviata
+			conn_close(epfd, c);
+			return -1;
+		}
+		if (pending) continue; // buffer di uscita di nuovo libero
+		if (drained) return 0; // nulla da leggere fino al prossimo EPOLLIN
+
+		rc = conn_fill(c, &drained);
+		if (rc < 0 || (rc == 2 && c->in_len > 0)) {
+			errorhandler("Errore nella ricezione della richiesta.\n");
+			conn_close(epfd, c);
+			return -1;
+		}
+		if (rc == 2) {         // chiusura ordinata tra due richieste
+			conn_close(epfd, c);
+			return -1;
+		}
+		if (rc == 0) return 0;
+	}
+}
+
+// Nessun frame iniziato e nessuna risposta in uscita: chiuderla non
+// interrompe alcuna richiesta
+static int conn_idle(const conn_t *c) {
+	return c->in_len == 0 && !c->frame_ms && c->out_off >= c->out_len;
+}
+
+static void conn_handle(int epfd, conn_t *c, uint32_t events) {
+	(void)events; // gli errori emergono da recv/send
+	if (conn_io(epfd, c) != 0) return;
+	if (draining && conn_idle(c)) conn_close(epfd, c);
+	else conn_deadline(c);
+}
+
+// Chiude le connessioni la cui scadenza e' passata
+static void deadlines_tick(int epfd) {
+	uint64_t now = timer_now_ms();
+	timer_entry_t *e;
+	while ((e = timer_expired(&wheel, now)) != NULL) {
+		conn_t *c = (conn_t *)((char *)e - offsetof(conn_t, deadline));
+		stats_conn_timeout();
+		conn_close(epfd, c);
+	}
+}
+
+// Invia i frame push delle sottoscrizioni scadute. Un frame si aggiunge
+// alle risposte eventualmente ancora in uscita; se il socket non accetta
+// altri dati l'invio prosegue al prossimo EPOLLOUT.
+static void subs_tick(int epfd) {
+	uint64_t now = stats_now_ns();
+	conn_t *next;
+	for (conn_t *c = subscribers; c; c = next) {
+		next = c->sub_next;
+		size_t n = sub_update(&c->sub, c->outbuf + c->out_len, sizeof(c->outbuf) - c->out_len, now);
+		if (c->sub.count == 0) sub_unlink(c); // tutte le città rimosse dal dataset
+		if (n == 0) continue;
+		c->out_len += n;
+		c->built_ns = now;
+		if (conn_flush(c, 0) < 0) {
+			errorhandler("Errore nell'invio della risposta.\n");
+			conn_close(epfd, c);
+		} else {
+			conn_deadline(c);
+		}
+	}
+}
+
+// Attesa massima di epoll_wait: fino alla prossima scadenza di una
+// sottoscrizione, senza limite se non ce ne sono.
+static int subs_timeout_ms(void) {
+	if (!subscribers) return -1;
+	uint64_t now = stats_now_ns();
+	int timeout = INT_MAX;
+	for (conn_t *c = subscribers; c && timeout > 0; c = c->sub_next) {
+		int t = sub_timeout_ms(&c->sub, now);
+		if (t < timeout) timeout = t;
+	}
+	return timeout;
+}
+
+// Accetta tutte le connessioni pendenti (edge-triggered: fino a EAGAIN).
+static int accept_pending(int epfd, int listen_socket) {
+	for (;;) {
+		struct sockaddr_in cad;
+		socklen_t client_len = sizeof(cad);
+		int fd = accept4(listen_socket, (struct sockaddr *)&cad, &client_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			// EMFILE/ENFILE e simili: si riprova al prossimo evento
+			errorhandler("errore nella accept.\n");
+			return errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM ? 0 : -1;
+		}
+
+		if (admit_conn_open() != 0) {
+			admit_shed(fd);
+			continue;
+		}
+		conn_t *c = conn_alloc();
+		if (!c) {
+			admit_conn_close();
+			close(fd);
+			continue;
+		}
+		c->fd = fd;
+		c->accept_ns = stats_now_ns();
+		inet_ntop(AF_INET, &cad.sin_addr, c->client_ip, sizeof(c->client_ip));
+		reqlog_connect(c->client_ip);
+
+		struct epoll_event ev;
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		ev.data.ptr = c;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			admit_conn_close();
+			close(fd);
+			c->next_free = free_conns;
+			free_conns = c;
+			continue;
+		}
+		stats_conn_open();
+		c->frame_ms = timer_now_ms();
+		conn_deadline(c);
+	}
+}
+
+static void drain_visit(timer_entry_t *e, void *arg) {
+	conn_t *c = (conn_t *)((char *)e - offsetof(conn_t, deadline));
+	if (conn_idle(c)) conn_close(*(int *)arg, c);
+}
+
+// Inizio della chiusura graduale. Le connessioni ferme sono quelle in
+// attesa nella ruota (--idle-timeout) e le sottoscrizioni; le altre
+// vengono chiuse da conn_handle quando tornano ferme.
+static void drain_start(int epfd, int listen_socket) {
+	draining = 1;
+	epoll_ctl(epfd, EPOLL_CTL_DEL, listen_socket, NULL);
+	upgrade_loop_stopped(loop_id);
+	timer_visit(&wheel, drain_visit, &epfd);
+	conn_t *next;
+	for (conn_t *c = subscribers; c; c = next) {
+		next = c->sub_next;
+		if (conn_idle(c)) conn_close(epfd, c);
+	}
+}
+
+int run_event_loop(int listen_socket) {
+	if (set_nonblocking(listen_socket) < 0) {
+		errorhandler("errore nella configurazione non bloccante del socket.\n");
+		return -1;
+	}
+
+	int epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0) {
+		errorhandler("errore nella creazione di epoll.\n");
+		return -1;
+	}
+
+	// Il socket di ascolto e' identificato da data.ptr == NULL
+	struct epoll_event ev;
+	ev.events = EPOLLIN | EPOLLET;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, listen_socket, &ev) < 0) {
+		errorhandler("errore nella registrazione del socket di ascolto.\n");
+		close(epfd);
+		return -1;
+	}
+
+	timer_init(&wheel, timer_now_ms());
+	loop_id = upgrade_register_loop(1);
+	struct epoll_event events[REACTOR_MAX_EVENTS];
+	for (;;) {
+		// prima dell'attesa: il segnale di upgrade.h la interrompe con EINTR
+		if (!draining && upgrade_draining()) drain_start(epfd, listen_socket);
+		int timeout = subs_timeout_ms();
+		int tick = timer_timeout_ms(&wheel);
+		if (timeout < 0 || (tick >= 0 && tick < timeout)) timeout = tick;
+		int n = epoll_wait(epfd, events, REACTOR_MAX_EVENTS, timeout);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			errorhandler("errore in epoll_wait.\n");
+			// il ciclo termina: una chiusura graduale non deve attenderlo
+			upgrade_loop_stopped(loop_id);
+			close(epfd);
+			return -1;
+		}
+		for (int i = 0; i < n; i++) {
+			if (events[i].data.ptr == NULL) {
+				if (!draining && accept_pending(epfd, listen_socket) < 0) {
+					upgrade_loop_stopped(loop_id);
+					close(epfd);
+					return -1;
+				}
+			} else {
+				conn_handle(epfd, (conn_t *)events[i].data.ptr, events[i].events);
+			}
+		}
+		if (subscribers) subs_tick(epfd);
+		// dopo gli eventi: nessun evento del giro si riferisce a una
+		// connessione gia' chiusa qui
+		deadlines_tick(epfd);
+	}
+}
+
+#else
+
+int run_event_loop(int listen_socket) {
+	(void)listen_socket;
+	printf("Modalita' epoll non supportata su questa piattaforma.\n");
+	return -1;
+}
+
+#endif /* HAVE_EPOLL */
@@ -0,0 +1,23 @@
+/*
+ * reactor.h
+ *
+ * Event loop non bloccante (epoll, edge-triggered) per il server.
+ * Disponibile solo su Linux; sulle altre piattaforme il server
+ * continua a usare il ciclo accept/handle bloccante.
+ */
+
+#ifndef REACTOR_H_
+#define REACTOR_H_
+
+#if defined(__linux__)
+#define HAVE_EPOLL 1
+#endif
+
+// Numero massimo di eventi raccolti per ogni chiamata a epoll_wait
+#define REACTOR_MAX_EVENTS 256
+
+// Esegue il ciclo di eventi sul socket di ascolto fornito (gia' in listen).
+// Ritorna solo in caso di errore fatale (-1).
+int run_event_loop(int listen_socket);
+
+#endif /* REACTOR_H_ */
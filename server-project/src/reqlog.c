@@ -0,0 +1,209 @@
+/*
+ * reqlog.c
+ *
+ * Ring buffer MPSC limitato (schema di Vyukov): ogni slot ha un numero di
+ * sequenza che indica se e' libero per il produttore della posizione
+ * corrente o pronto per il consumatore. I produttori si contendono la
+ * posizione con una CAS; l'unico consumatore e' il thread di scrittura,
+ * che formatta i record in un buffer e lo scrive con una sola fwrite.
+ */
+
+#include "reqlog.h"
+#include "protocol.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sched.h>
+#endif
+
+#define REQLOG_BATCH 256 // record formattati per ogni scrittura
+
+typedef enum {
+	REC_CONNECT,
+	REC_REQUEST
+} rec_kind_t;
+
+// Record binario di dimensione fissa (64 byte, una linea di cache)
+typedef struct {
+	uint64_t ts_ns;                       // istante di accodamento (CLOCK_REALTIME)
+	int32_t city_id;                      // CITY_ID_NONE se sconosciuta
+	uint8_t kind;                         // rec_kind_t
+	uint8_t status;                       // STATUS_* della risposta
+	char type;                            // tipo richiesto
+	char client_ip[16];
+	char city[REQLOG_CITY_MAX + 1];
+} reqlog_record_t;
+
+_Static_assert(sizeof(reqlog_record_t) == 64, "reqlog_record_t deve occupare 64 byte");
+
+typedef struct {
+	atomic_size_t seq;
+	reqlog_record_t rec;
+} reqlog_slot_t;
+
+static reqlog_slot_t *ring;
+static size_t mask;
+static atomic_size_t enqueue_pos;
+static size_t dequeue_pos;            // solo il thread di scrittura
+static reqlog_policy_t policy;
+static int async_enabled = 0;
+static atomic_ulong dropped;
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void pause_briefly(void) {
+#if defined(_WIN32)
+	Sleep(1);
+#else
+	struct timespec ts = { 0, 1000000L }; // 1 ms
+	nanosleep(&ts, NULL);
+#endif
+}
+
+// Riserva uno slot, lo riempie e lo pubblica. Ritorna 0, -1 se scartato.
+static int reqlog_push(const reqlog_record_t *rec) {
+	for (;;) {
+		size_t pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+		reqlog_slot_t *slot = &ring[pos & mask];
+		size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(&enqueue_pos, &pos, pos + 1,
+					memory_order_relaxed, memory_order_relaxed)) {
+				slot->rec = *rec;
+				atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+				return 0;
+			}
+		} else if (diff < 0) {
+			// ring pieno: il consumatore non ha ancora liberato lo slot
+			if (policy == REQLOG_DROP) {
+				atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+				return -1;
+			}
+#if defined(_WIN32)
+			SwitchToThread();
+#else
+			sched_yield();
+#endif
+		}
+		// diff > 0: un altro produttore ha preso la posizione, si riprova
+	}
+}
+
+static size_t format_record(const reqlog_record_t *r, char *out, size_t size) {
+	unsigned long sec = (unsigned long)(r->ts_ns / 1000000000ull);
+	unsigned long usec = (unsigned long)((r->ts_ns / 1000ull) % 1000000ull);
+	int n;
+	if (r->kind == REC_CONNECT) {
+		n = snprintf(out, size, "[%lu.%06lu] Gestione del client %s\n", sec, usec, r->client_ip);
+	} else {
+		n = snprintf(out, size, "[%lu.%06lu] Richiesta '%c %s' dal client ip %s\n", sec, usec,
+				r->type ? r->type : '-', r->city[0] ? r->city : "(vuota)", r->client_ip);
+	}
+	return (n > 0 && (size_t)n < size) ? (size_t)n : 0;
+}
+
+static void *writer_main(void *arg) {
+	(void)arg;
+	static char buf[REQLOG_BATCH * 160];
+	unsigned long reported = 0;
+	for (;;) {
+		size_t len = 0;
+		int count = 0;
+		while (count < REQLOG_BATCH) {
+			reqlog_slot_t *slot = &ring[dequeue_pos & mask];
+			size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+			if (seq != dequeue_pos + 1) break; // vuoto (o produttore non ancora pronto)
+			len += format_record(&slot->rec, buf + len, sizeof(buf) - len);
+			atomic_store_explicit(&slot->seq, dequeue_pos + mask + 1, memory_order_release);
+			dequeue_pos++;
+			count++;
+		}
+
+		unsigned long d = atomic_load_explicit(&dropped, memory_order_relaxed);
+		if (d != reported && sizeof(buf) - len > 64) {
+			len += (size_t)snprintf(buf + len, sizeof(buf) - len, "Log: %lu record scartati (ring pieno)\n", d);
+			reported = d;
+		}
+
+		if (len > 0) {
+			fwrite(buf, 1, len, stdout);
+			fflush(stdout);
+		}
+		if (count < REQLOG_BATCH) pause_briefly(); // ring svuotato
+	}
+	return NULL;
+}
+
+int reqlog_start_async(unsigned int capacity, reqlog_policy_t p) {
+	size_t cap = 2;
+	while (cap < capacity) cap <<= 1;
+	ring = malloc(cap * sizeof(*ring));
+	if (!ring) return -1;
+	for (size_t i = 0; i < cap; i++) atomic_init(&ring[i].seq, i);
+	mask = cap - 1;
+	atomic_init(&enqueue_pos, 0);
+	dequeue_pos = 0;
+	policy = p;
+
+	pthread_t th;
+	if (pthread_create(&th, NULL, writer_main, NULL) != 0) {
+		errorhandler("errore nella creazione del thread di log.\n");
+		return -1;
+	}
+	pthread_detach(th);
+	async_enabled = 1;
+	return 0;
+}
+
+void reqlog_connect(const char *client_ip) {
+	if (!async_enabled) {
+		printf("Gestione del client %s\n", client_ip);
+		return;
+	}
+	reqlog_record_t r;
+	r.ts_ns = now_ns();
+	r.kind = REC_CONNECT;
+	r.city_id = -1;
+	r.status = 0;
+	r.type = '\0';
+	r.city[0] = '\0';
+	strncpy(r.client_ip, client_ip, sizeof(r.client_ip) - 1);
+	r.client_ip[sizeof(r.client_ip) - 1] = '\0';
+	reqlog_push(&r);
+}
+
+void reqlog_request(const char *client_ip, char type, const char *city, int city_id, unsigned int status) {
+	if (!async_enabled) {
+		printf("Richiesta '%c %s' dal client ip %s\n", type ? type : '-', city[0] ? city : "(vuota)", client_ip);
+		return;
+	}
+	reqlog_record_t r;
+	r.ts_ns = now_ns();
+	r.kind = REC_REQUEST;
+	r.city_id = city_id;
+	r.status = (uint8_t)status;
+	r.type = type;
+	size_t len = strnlen(city, REQLOG_CITY_MAX);
+	memcpy(r.city, city, len);
+	r.city[len] = '\0';
+	strncpy(r.client_ip, client_ip, sizeof(r.client_ip) - 1);
+	r.client_ip[sizeof(r.client_ip) - 1] = '\0';
+	reqlog_push(&r);
+}
+
+unsigned long reqlog_dropped(void) {
+	return atomic_load_explicit(&dropped, memory_order_relaxed);
+}
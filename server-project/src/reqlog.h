@@ -0,0 +1,37 @@
+/*
+ * reqlog.h
+ *
+ * Log delle connessioni e delle richieste. In modalita' sincrona (default)
+ * stampa subito su stdout come in origine; in modalita' asincrona
+ * (--log-async) i thread di richiesta accodano record binari di dimensione
+ * fissa in un ring buffer lock-free MPSC e un thread dedicato li formatta
+ * e li scrive a blocchi.
+ */
+
+#ifndef REQLOG_H_
+#define REQLOG_H_
+
+#include <stdint.h>
+
+#define REQLOG_DEFAULT_CAPACITY 65536  // record nel ring (potenza di due)
+#define REQLOG_CITY_MAX         31     // caratteri della città conservati nel record
+
+typedef enum {
+	REQLOG_DROP,   // ring pieno: il record viene scartato e contato
+	REQLOG_BLOCK   // ring pieno: il produttore attende spazio
+} reqlog_policy_t;
+
+// Attiva la modalita' asincrona con un ring di capacity record (arrotondata
+// alla potenza di due successiva). Ritorna 0 o -1 in caso di errore.
+int reqlog_start_async(unsigned int capacity, reqlog_policy_t policy);
+
+// "Gestione del client <ip>"
+void reqlog_connect(const char *client_ip);
+
+// "Richiesta '<type> <city>' dal client ip <ip>"
+void reqlog_request(const char *client_ip, char type, const char *city, int city_id, unsigned int status);
+
+// Record scartati finora per ring pieno (solo politica REQLOG_DROP)
+unsigned long reqlog_dropped(void);
+
+#endif /* REQLOG_H_ */
@@ -0,0 +1,66 @@
+/*
+ * rng.c
+ *
+ * Stato per thread e API batch del generatore xoshiro128**.
+ */
+
+#include "rng.h"
+
+#define RNG_BLOCK 256 // valori grezzi generati per blocco nella API batch
+
+static _Thread_local rng_t thread_rng = { { 0x9E3779B9u, 0x243F6A88u, 0xB7E15162u, 0x8AED2A6Bu } };
+
+static uint64_t splitmix64(uint64_t *x) {
+	uint64_t z = (*x += 0x9E3779B97F4A7C15ull);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+void rng_seed(rng_t *r, uint64_t seed) {
+	uint64_t a = splitmix64(&seed);
+	uint64_t b = splitmix64(&seed);
+	r->s[0] = (uint32_t)a;
+	r->s[1] = (uint32_t)(a >> 32);
+	r->s[2] = (uint32_t)b;
+	r->s[3] = (uint32_t)(b >> 32);
+	// lo stato tutto a zero e' l'unico non valido per xoshiro
+	if ((r->s[0] | r->s[1] | r->s[2] | r->s[3]) == 0) r->s[0] = 1;
+}
+
+rng_t *rng_thread(void) {
+	return &thread_rng;
+}
+
+void rng_seed_thread(uint64_t seed) {
+	rng_seed(&thread_rng, seed);
+}
+
+void rng_fill_range(rng_t *r, float min, float step, uint32_t steps, float *out, size_t n) {
+	uint32_t raw[RNG_BLOCK];
+	uint32_t threshold = (0u - steps) % steps;
+
+	while (n > 0) {
+		size_t len = n < RNG_BLOCK ? n : RNG_BLOCK;
+		for (size_t i = 0; i < len; i++) raw[i] = rng_next(r);
+
+		// riduzione moltiplicativa: nessun salto, vettorizzabile
+		uint32_t rejected = 0;
+		for (size_t i = 0; i < len; i++) {
+			uint64_t m = (uint64_t)raw[i] * steps;
+			rejected |= (uint32_t)((uint32_t)m < threshold);
+			out[i] = min + (float)(uint32_t)(m >> 32) * step;
+		}
+
+		// correzione degli scarti (probabilita' < steps / 2^32 per valore)
+		if (rejected) {
+			for (size_t i = 0; i < len; i++) {
+				if ((uint32_t)((uint64_t)raw[i] * steps) < threshold) {
+					out[i] = min + (float)rng_range(r, steps) * step;
+				}
+			}
+		}
+		out += len;
+		n -= len;
+	}
+}
@@ -0,0 +1,61 @@
+/*
+ * rng.h
+ *
+ * Generatore pseudo-casuale del server: xoshiro128** con stato per
+ * thread, riduzione all'intervallo senza bias (metodo di Lemire) e
+ * API batch per generare molti valori con un solo ciclo.
+ */
+
+#ifndef RNG_H_
+#define RNG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+	uint32_t s[4];
+} rng_t;
+
+// Inizializza lo stato espandendo un seme a 64 bit con splitmix64
+void rng_seed(rng_t *r, uint64_t seed);
+
+// Stato del thread corrente e relativo seme
+rng_t *rng_thread(void);
+void rng_seed_thread(uint64_t seed);
+
+// Prossimo valore a 32 bit (xoshiro128**)
+static inline uint32_t rng_next(rng_t *r) {
+	uint32_t *s = r->s;
+	uint32_t x = s[1] * 5;
+	uint32_t result = ((x << 7) | (x >> 25)) * 9;
+	uint32_t t = s[1] << 9;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = (s[3] << 11) | (s[3] >> 21);
+	return result;
+}
+
+// Intero uniforme in [0, n), senza il bias della riduzione con % n
+static inline uint32_t rng_range(rng_t *r, uint32_t n) {
+	uint64_t m = (uint64_t)rng_next(r) * n;
+	uint32_t low = (uint32_t)m;
+	if (low < n) {
+		uint32_t threshold = (0u - n) % n;
+		while (low < threshold) {
+			m = (uint64_t)rng_next(r) * n;
+			low = (uint32_t)m;
+		}
+	}
+	return (uint32_t)(m >> 32);
+}
+
+// Riempie out[0..n) con valori min + k * step, k uniforme in [0, steps).
+// La riduzione e la conversione avvengono in un ciclo senza diramazioni,
+// vettorizzabile dal compilatore; i rari scarti del metodo di Lemire sono
+// corretti in un secondo passaggio.
+void rng_fill_range(rng_t *r, float min, float step, uint32_t steps, float *out, size_t n);
+
+#endif /* RNG_H_ */
@@ -0,0 +1,169 @@
+/*
+ * snapshot.c
+ *
+ * Doppio buffer con pubblicazione atomica: il thread di aggiornamento
+ * scrive sempre nel buffer non attivo e poi lo rende attivo. Ogni buffer
+ * ha un contatore di sequenza, dispari durante la scrittura: un lettore
+ * ripete la lettura solo nel raro caso in cui il writer abbia completato
+ * due aggiornamenti mentre leggeva, raggiungendo il buffer in uso.
+ */
+
+#include "snapshot.h"
+#include "protocol.h"
+#include "dataset.h"
+#include "rng.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+typedef struct {
+	atomic_uint seq;            // dispari durante la scrittura
+	atomic_uint source;         // versione del dataset da cui e' generato
+	atomic_uint *values;        // bit pattern dei float, indice [tipo][città]
+} snapshot_buf_t;
+
+static snapshot_buf_t bufs[2];
+static atomic_int active = 0;
+static atomic_uint generation = 0; // aggiornamenti pubblicati
+static int enabled = 0;
+static unsigned int refresh_ms;
+static float *scratch;          // colonna generata in blocco per un tipo
+static int capacity;            // città per tipo, fissato all'avvio
+static int overflow_warned = 0;
+
+static const char type_chars[WEATHER_TYPES] = { 't', 'h', 'w', 'p' };
+
+static void snapshot_refresh(void) {
+	int w = 1 - atomic_load_explicit(&active, memory_order_relaxed);
+	snapshot_buf_t *b = &bufs[w];
+
+	unsigned int s = atomic_load_explicit(&b->seq, memory_order_relaxed);
+	atomic_store_explicit(&b->seq, s + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	// un dataset ricaricato con piu' città della capacita' non entra nella
+	// tabella: le letture ripiegano sui valori generati per richiesta
+	dataset_read_begin();
+	const dataset_t *ds = dataset_current();
+	int n = dataset_city_count(ds);
+	unsigned int source = dataset_version(ds);
+	if (n > capacity) {
+		if (!overflow_warned) {
+			fprintf(stderr, "snapshot: %d citta' oltre la capacita' di %d, valori per richiesta\n", n, capacity);
+			overflow_warned = 1;
+		}
+		source = SNAPSHOT_NO_SOURCE;
+		n = 0;
+	}
+	atomic_store_explicit(&b->source, source, memory_order_relaxed);
+
+	for (int t = 0; t < WEATHER_TYPES && n > 0; t++) {
+		if (ds) {
+			for (int c = 0; c < n; c++) scratch[c] = dataset_value(ds, c, t);
+		} else {
+			fill_weather_values(type_chars[t], scratch, (size_t)n);
+		}
+		atomic_uint *col = &b->values[(size_t)t * (size_t)capacity];
+		for (int c = 0; c < n; c++) {
+			uint32_t bits;
+			memcpy(&bits, &scratch[c], sizeof(bits));
+			atomic_store_explicit(&col[c], bits, memory_order_relaxed);
+		}
+	}
+	dataset_read_end();
+
+	atomic_store_explicit(&b->seq, s + 2, memory_order_release);
+	atomic_store_explicit(&active, w, memory_order_release);
+	atomic_fetch_add_explicit(&generation, 1, memory_order_release);
+}
+
+static void sleep_ms(unsigned int ms) {
+#if defined(_WIN32)
+	Sleep(ms);
+#else
+	struct timespec ts;
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (long)(ms % 1000) * 1000000L;
+	while (nanosleep(&ts, &ts) != 0) { }
+#endif
+}
+
+static void *refresher_main(void *arg) {
+	(void)arg;
+	// stream PRNG distinto da quelli dei worker (seed + i)
+	rng_seed_thread(server_options.seed ^ 0x5DEECE66Dull);
+	for (;;) {
+		sleep_ms(refresh_ms);
+		snapshot_refresh();
+	}
+	return NULL;
+}
+
+int snapshot_start(unsigned int interval_ms) {
+	// capacita' del dataset corrente (--dataset e' caricato prima)
+	dataset_read_begin();
+	capacity = dataset_city_count(dataset_current());
+	dataset_read_end();
+	if (capacity < 1) capacity = 1;
+	for (int i = 0; i < 2; i++) {
+		bufs[i].values = calloc((size_t)WEATHER_TYPES * (size_t)capacity, sizeof(atomic_uint));
+		if (!bufs[i].values) return -1;
+		atomic_init(&bufs[i].seq, 0);
+		atomic_init(&bufs[i].source, SNAPSHOT_NO_SOURCE);
+	}
+	scratch = malloc((size_t)capacity * sizeof(float));
+	if (!scratch) return -1;
+	refresh_ms = interval_ms ? interval_ms : 1;
+
+	// primo riempimento sincrono: la tabella e' valida prima di servire
+	snapshot_refresh();
+	enabled = 1;
+
+	pthread_t th;
+	if (pthread_create(&th, NULL, refresher_main, NULL) != 0) {
+		errorhandler("errore nella creazione del thread di aggiornamento.\n");
+		return -1;
+	}
+	pthread_detach(th);
+	return 0;
+}
+
+int snapshot_enabled(void) {
+	return enabled;
+}
+
+unsigned int snapshot_generation(void) {
+	return atomic_load_explicit(&generation, memory_order_acquire);
+}
+
+unsigned int snapshot_interval_ms(void) {
+	return refresh_ms;
+}
+
+int snapshot_read(unsigned int source, int city_id, int type_index, float *out) {
+	size_t idx = (size_t)type_index * (size_t)capacity + (size_t)city_id;
+	for (;;) {
+		snapshot_buf_t *b = &bufs[atomic_load_explicit(&active, memory_order_acquire)];
+		unsigned int s1 = atomic_load_explicit(&b->seq, memory_order_acquire);
+		if (s1 & 1) continue;
+		unsigned int src = atomic_load_explicit(&b->source, memory_order_relaxed);
+		uint32_t bits = 0;
+		if (src == source) bits = atomic_load_explicit(&b->values[idx], memory_order_relaxed);
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&b->seq, memory_order_relaxed) == s1) {
+			if (src != source) return -1;
+			memcpy(out, &bits, sizeof(*out));
+			return 0;
+		}
+	}
+}
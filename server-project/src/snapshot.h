@@ -0,0 +1,48 @@
+/*
+ * snapshot.h
+ *
+ * Tabella dei valori meteo per (città, tipo) rigenerata periodicamente da
+ * un thread in background. Le letture dal percorso di richiesta non
+ * prendono mai un lock: due buffer, un indice attivo pubblicato con una
+ * scrittura atomica e un contatore di sequenza per buffer (seqlock).
+ */
+
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#define WEATHER_TYPES 4 // 't','h','w','p'
+#define SNAPSHOT_NO_SOURCE 0xFFFFFFFFu // tabella non valida per alcun dataset
+
+// Indice del tipo nella tabella ('t'=0, 'h'=1, 'w'=2, 'p'=3), -1 se non valido
+static inline int weather_type_index(char type) {
+	switch (type) {
+		case 't': return 0;
+		case 'h': return 1;
+		case 'w': return 2;
+		case 'p': return 3;
+		default: return -1;
+	}
+}
+
+// Alloca la tabella per le città del dataset corrente, la riempie una
+// prima volta e avvia il thread che la rigenera ogni interval_ms
+// millisecondi. Ritorna 0 o -1 in caso di errore.
+int snapshot_start(unsigned int interval_ms);
+
+// 1 se la modalita' snapshot e' attiva
+int snapshot_enabled(void);
+
+// Numero di aggiornamenti pubblicati: cambia a ogni rigenerazione della
+// tabella (usato dalle sottoscrizioni per riconoscere i valori nuovi)
+unsigned int snapshot_generation(void);
+
+// Intervallo di rigenerazione della tabella in millisecondi
+unsigned int snapshot_interval_ms(void);
+
+// Valore corrente per (città, indice tipo) in out. La tabella e' generata
+// da una versione del dataset (dataset_version): se non e' source, per
+// esempio subito dopo un ricaricamento, ritorna -1 e il chiamante genera
+// il valore direttamente. Non blocca mai; ritorna 0 se ha letto.
+int snapshot_read(unsigned int source, int city_id, int type_index, float *out);
+
+#endif /* SNAPSHOT_H_ */
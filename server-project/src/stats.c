@@ -0,0 +1,151 @@
+/*
+ * stats.c
+ *
+ * Contatori per thread: al primo utilizzo ogni thread riserva un blocco
+ * nell'array statico e da quel momento e' l'unico a scriverci, con
+ * load+store rilassati come per i contatori dei worker. I thread in
+ * eccesso rispetto a STATS_MAX_THREADS condividono l'ultimo blocco, in
+ * cui si usano incrementi atomici.
+ */
+
+#include "stats.h"
+#include "worker.h"
+#include "protocol.h"
+
+#include <string.h>
+#include <stdatomic.h>
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#else
+#include <arpa/inet.h>
+#endif
+
+#define STATS_MAX_THREADS (MAX_WORKERS + 1) // worker piu' il thread principale
+
+_Static_assert(STATS_FRAME_SIZE <= MAX_RESPONSE_FRAME, "il frame di statistiche deve stare in una risposta");
+
+typedef struct {
+	_Alignas(CACHE_LINE_SIZE) atomic_uint status[STATS_STATUSES];
+	atomic_uint types[STATS_TYPES];
+	atomic_uint opened;
+	atomic_uint closed;
+	atomic_uint timeouts;
+	atomic_uint hist[STATS_STAGES][STATS_BUCKETS];
+} stats_block_t;
+
+static stats_block_t blocks[STATS_MAX_THREADS + 1]; // l'ultimo e' condiviso
+static atomic_int next_block;
+static _Thread_local stats_block_t *my_block;
+static _Thread_local int my_shared;
+
+static stats_block_t *block(void) {
+	if (!my_block) {
+		int i = atomic_fetch_add(&next_block, 1);
+		if (i >= STATS_MAX_THREADS) {
+			i = STATS_MAX_THREADS;
+			my_shared = 1;
+		}
+		my_block = &blocks[i];
+	}
+	return my_block;
+}
+
+static inline void inc(atomic_uint *c) {
+	if (my_shared) {
+		atomic_fetch_add_explicit(c, 1, memory_order_relaxed);
+	} else {
+		atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + 1, memory_order_relaxed);
+	}
+}
+
+void stats_conn_open(void) {
+	inc(&block()->opened);
+}
+
+void stats_conn_close(void) {
+	inc(&block()->closed);
+}
+
+void stats_conn_timeout(void) {
+	inc(&block()->timeouts);
+}
+
+void stats_count_request(char type, unsigned int status) {
+	stats_block_t *b = block();
+	int t;
+	switch (type) {
+		case 't': t = 0; break;
+		case 'h': t = 1; break;
+		case 'w': t = 2; break;
+		case 'p': t = 3; break;
+		default:  t = 4; break;
+	}
+	inc(&b->types[t]);
+	if (status < STATS_STATUSES) inc(&b->status[status]);
+}
+
+void stats_record_stage(stats_stage_t stage, uint64_t start_ns, uint64_t end_ns) {
+	uint64_t d = end_ns > start_ns ? end_ns - start_ns : 0;
+	int bucket = 63 - __builtin_clzll(d | 1);
+	if (bucket >= STATS_BUCKETS) bucket = STATS_BUCKETS - 1;
+	inc(&block()->hist[stage][bucket]);
+}
+
+unsigned int stats_active_connections(void) {
+	uint32_t opened = 0, closed = 0;
+	int n = atomic_load(&next_block);
+	if (n > STATS_MAX_THREADS) n = STATS_MAX_THREADS + 1;
+	for (int i = 0; i < n; i++) {
+		opened += atomic_load_explicit(&blocks[i].opened, memory_order_relaxed);
+		closed += atomic_load_explicit(&blocks[i].closed, memory_order_relaxed);
+	}
+	return opened - closed;
+}
+
+static unsigned char *put_u32(unsigned char *p, uint32_t v) {
+	v = htonl(v);
+	memcpy(p, &v, 4);
+	return p + 4;
+}
+
+size_t stats_build_frame(unsigned char *out) {
+	uint32_t status[STATS_STATUSES] = {0};
+	uint32_t types[STATS_TYPES] = {0};
+	uint32_t hist[STATS_STAGES][STATS_BUCKETS];
+	uint32_t opened = 0, closed = 0, timeouts = 0;
+	memset(hist, 0, sizeof(hist));
+
+	int n = atomic_load(&next_block);
+	if (n > STATS_MAX_THREADS) n = STATS_MAX_THREADS + 1;
+	for (int i = 0; i < n; i++) {
+		stats_block_t *b = &blocks[i];
+		for (int s = 0; s < STATS_STATUSES; s++) {
+			status[s] += atomic_load_explicit(&b->status[s], memory_order_relaxed);
+		}
+		for (int t = 0; t < STATS_TYPES; t++) {
+			types[t] += atomic_load_explicit(&b->types[t], memory_order_relaxed);
+		}
+		opened += atomic_load_explicit(&b->opened, memory_order_relaxed);
+		closed += atomic_load_explicit(&b->closed, memory_order_relaxed);
+		timeouts += atomic_load_explicit(&b->timeouts, memory_order_relaxed);
+		for (int s = 0; s < STATS_STAGES; s++) {
+			for (int k = 0; k < STATS_BUCKETS; k++) {
+				hist[s][k] += atomic_load_explicit(&b->hist[s][k], memory_order_relaxed);
+			}
+		}
+	}
+
+	unsigned char *p = out;
+	*p++ = STATS_MAGIC;
+	*p++ = STATS_STAGES;
+	*p++ = STATS_BUCKETS;
+	for (int s = 0; s < STATS_STATUSES; s++) p = put_u32(p, status[s]);
+	for (int t = 0; t < STATS_TYPES; t++) p = put_u32(p, types[t]);
+	p = put_u32(p, opened - closed);
+	p = put_u32(p, timeouts);
+	for (int s = 0; s < STATS_STAGES; s++) {
+		for (int k = 0; k < STATS_BUCKETS; k++) p = put_u32(p, hist[s][k]);
+	}
+	return (size_t)(p - out);
+}
@@ -0,0 +1,76 @@
+/*
+ * stats.h
+ *
+ * Statistiche interne del server, restituite in banda con la richiesta
+ * di tipo 's' (STATS_REQUEST). Ogni thread scrive solo nel proprio blocco
+ * di contatori, allineato alla linea di cache; i blocchi vengono sommati
+ * soltanto quando arriva una richiesta di statistiche.
+ *
+ * Frame di risposta (STATS_FRAME_SIZE byte, interi a 32 bit in network
+ * byte order):
+ *  - STATS_MAGIC, STATS_STAGES, STATS_BUCKETS (1 byte ciascuno)
+ *  - richieste per codice di stato (4 valori, STATUS_SUCCESS ..
+ *    STATUS_OVERLOADED; una connessione rifiutata conta come una
+ *    richiesta di sovraccarico)
+ *  - richieste per tipo ('t','h','w','p', altro)
+ *  - connessioni attive
+ *  - connessioni chiuse allo scadere di un'attesa (timer.h)
+ *  - istogrammi delle latenze per fase, STATS_BUCKETS valori per fase:
+ *    il bucket i conta le durate d con 2^i <= d < 2^(i+1) ns (il primo
+ *    comprende anche 0, l'ultimo tutte le durate maggiori)
+ */
+
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#endif
+
+#define STATS_REQUEST    's'
+#define STATS_MAGIC      0x5A
+#define STATS_STATUSES   4
+#define STATS_TYPES      5     // 't','h','w','p', altro
+#define STATS_STAGES     3
+#define STATS_BUCKETS    32
+#define STATS_FRAME_SIZE (3 + 4 * (STATS_STATUSES + STATS_TYPES + 2 + STATS_STAGES * STATS_BUCKETS))
+
+// Fasi misurate per ogni richiesta
+typedef enum {
+	STAGE_ACCEPT_RECV,   // accept -> prima richiesta ricevuta
+	STAGE_RECV_BUILD,    // richiesta ricevuta -> risposta costruita
+	STAGE_BUILD_SEND     // risposta costruita -> risposta inviata
+} stats_stage_t;
+
+// Orologio monotono in nanosecondi usato per le fasi
+static inline uint64_t stats_now_ns(void) {
+#if defined(_WIN32)
+	LARGE_INTEGER freq, now;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (uint64_t)((double)now.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+void stats_conn_open(void);
+void stats_conn_close(void);
+void stats_conn_timeout(void);
+void stats_count_request(char type, unsigned int status);
+void stats_record_stage(stats_stage_t stage, uint64_t start_ns, uint64_t end_ns);
+
+// Connessioni aperte e non ancora chiuse, sommate su tutti i thread
+unsigned int stats_active_connections(void);
+
+// Somma i contatori di tutti i thread e scrive il frame in out
+// (almeno STATS_FRAME_SIZE byte). Ritorna il numero di byte scritti.
+size_t stats_build_frame(unsigned char *out);
+
+#endif /* STATS_H_ */
@@ -0,0 +1,151 @@
+/*
+ * sub.c
+ *
+ * Stato e frame delle sottoscrizioni. Il modulo non esegue I/O: il
+ * reactor accoda i frame prodotti nel buffer di uscita della connessione
+ * e usa sub_timeout_ms per dimensionare l'attesa di epoll_wait.
+ *
+ * Con intervallo 0 si confronta la generazione della tabella snapshot
+ * SUB_CHECKS volte per intervallo di aggiornamento e si inviano solo le
+ * voci il cui valore e' cambiato; con un intervallo si inviano tutte le
+ * voci con il valore corrente a ogni scadenza. Un sottoscrittore lento
+ * (buffer di uscita pieno) salta gli aggiornamenti intermedi e riceve
+ * comunque i valori piu' recenti.
+ */
+
+#include "sub.h"
+#include "snapshot.h"
+#include "cities.h"
+#include "dataset.h"
+#include "reqlog.h"
+#include "stats.h"
+#include "worker.h"
+
+#include <string.h>
+#include <ctype.h>
+
+#define SUB_CHECKS 4 // controlli per intervallo di aggiornamento della tabella
+
+// Periodo tra due controlli della sottoscrizione, in nanosecondi
+static uint64_t sub_period_ns(const sub_t *s) {
+	if (s->interval_ms > 0) return (uint64_t)s->interval_ms * 1000000ull;
+	uint64_t period = (uint64_t)snapshot_interval_ms() * 1000000ull / SUB_CHECKS;
+	return period > 0 ? period : 1000000ull;
+}
+
+static size_t write_entry(unsigned char *out, unsigned int index, const weather_response_t *r) {
+	out[0] = (unsigned char)index;
+	serialize_response(r, out + 1);
+	return SUB_ENTRY_SIZE;
+}
+
+size_t sub_start(sub_t *s, const unsigned char *frame, unsigned char *out, const char *client_ip, uint64_t now_ns) {
+	s->count = 0;
+	if (!snapshot_enabled()) return invalid_frame_response(NULL, out);
+
+	s->interval_ms = ((unsigned int)frame[1] << 8) | frame[2];
+	// generazione letta prima dei valori: un aggiornamento concorrente
+	// verra' comunque notato al controllo successivo
+	s->generation = snapshot_generation();
+	dataset_read_begin();
+	const dataset_t *ds = dataset_current();
+	s->source = dataset_version(ds);
+
+	unsigned int count = frame[3];
+	out[0] = SUB_MAGIC;
+	out[1] = (unsigned char)count;
+	size_t in_off = SUB_HEADER_SIZE;
+	size_t out_off = SUB_PUSH_HEADER;
+	for (unsigned int i = 0; i < count; i++) {
+		char req_type = (char)frame[in_off];
+		unsigned int clen = frame[in_off + 1];
+		char city[BATCH_CITY_MAX + 1];
+		memcpy(city, &frame[in_off + 2], clen);
+		city[clen] = '\0';
+		in_off += 2 + clen;
+
+		worker_count_request();
+		char type = (char)tolower((unsigned char)req_type);
+		if (weather_type_index(type) < 0) type = '\0';
+		int city_id = dataset_city_lookup(ds, city, clen);
+		weather_response_t r = build_weather_response_in(ds, type, city_id);
+		reqlog_request(client_ip, req_type, city, city_id, r.status);
+		stats_count_request(type, r.status);
+
+		if (r.status == STATUS_SUCCESS) {
+			sub_entry_t *e = &s->entries[s->count++];
+			e->index = (uint8_t)i;
+			e->type = type;
+			e->city_id = city_id;
+			e->city_len = (uint8_t)clen;
+			memcpy(e->city, city, clen + 1);
+			memcpy(&e->last_bits, &r.value, sizeof(e->last_bits));
+		}
+		out_off += write_entry(out + out_off, i, &r);
+	}
+	dataset_read_end();
+	s->next_ns = now_ns + sub_period_ns(s);
+	return out_off;
+}
+
+int sub_timeout_ms(const sub_t *s, uint64_t now_ns) {
+	if (s->next_ns <= now_ns) return 0;
+	// arrotondato per eccesso: epoll_wait non deve svegliarsi in anticipo
+	return (int)((s->next_ns - now_ns + 999999ull) / 1000000ull);
+}
+
+// Frame push con i valori da inviare (0 se non ce ne sono), letti dal
+// dataset corrente dentro la sezione di lettura di sub_update
+static size_t push_values(sub_t *s, unsigned char *out) {
+	const dataset_t *ds = dataset_current();
+	unsigned int source = dataset_version(ds);
+	int rebind = source != s->source;
+	int on_change = s->interval_ms == 0;
+	if (on_change) {
+		unsigned int g = snapshot_generation();
+		if (g == s->generation && !rebind) return 0;
+		s->generation = g;
+	}
+	s->source = source;
+
+	size_t out_off = SUB_PUSH_HEADER;
+	unsigned int n = 0;
+	int kept = 0;
+	for (int i = 0; i < s->count; i++) {
+		sub_entry_t *e = &s->entries[i];
+		if (rebind) e->city_id = dataset_city_lookup(ds, e->city, e->city_len);
+		weather_response_t r = build_weather_response_in(ds, e->type, e->city_id);
+		if (r.status != STATUS_SUCCESS) {
+			// città non piu' presente nel dataset: ultimo avviso e rimozione
+			out_off += write_entry(out + out_off, e->index, &r);
+			n++;
+			continue;
+		}
+		uint32_t bits;
+		memcpy(&bits, &r.value, sizeof(bits));
+		int changed = bits != e->last_bits;
+		e->last_bits = bits;
+		s->entries[kept++] = *e;
+		if (on_change && !changed) continue;
+		out_off += write_entry(out + out_off, e->index, &r);
+		n++;
+	}
+	s->count = kept;
+	if (n == 0) return 0;
+	out[0] = SUB_MAGIC;
+	out[1] = (unsigned char)n;
+	return out_off;
+}
+
+size_t sub_update(sub_t *s, unsigned char *out, size_t space, uint64_t now_ns) {
+	if (s->count == 0 || now_ns < s->next_ns) return 0;
+	uint64_t period = sub_period_ns(s);
+	s->next_ns += period;
+	if (s->next_ns <= now_ns) s->next_ns = now_ns + period; // in ritardo: si riparte
+	if (space < SUB_PUSH_MAX) return 0; // buffer pieno: i valori partiranno dopo
+
+	dataset_read_begin();
+	size_t len = push_values(s, out);
+	dataset_read_end();
+	return len;
+}
@@ -0,0 +1,57 @@
+/*
+ * sub.h
+ *
+ * Sottoscrizioni (modalita' push): un client invia un frame SUB_MAGIC con
+ * un insieme di coppie (città, tipo) e riceve sulla stessa connessione un
+ * frame push ogni volta che i valori cambiano, oppure a intervallo fisso.
+ * I valori provengono dalla tabella snapshot (--snapshot): ogni valore e'
+ * generato una sola volta per aggiornamento e distribuito a tutti i
+ * sottoscrittori della coppia. Le sottoscrizioni sono servite dal reactor
+ * epoll (-e); gli altri percorsi rispondono con una richiesta non valida.
+ */
+
+#ifndef SUB_H_
+#define SUB_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "protocol.h"
+
+typedef struct {
+	uint8_t index;        // posizione della voce nella sottoscrizione
+	char type;            // tipo normalizzato ('t','h','w','p')
+	uint8_t city_len;
+	int city_id;          // id nel dataset della sottoscrizione
+	uint32_t last_bits;   // ultimo valore inviato (bit del float)
+	char city[BATCH_CITY_MAX + 1]; // per risolvere di nuovo dopo un ricaricamento
+} sub_entry_t;
+
+typedef struct {
+	int count;                  // voci valide, 0 = nessuna sottoscrizione
+	unsigned int interval_ms;   // 0 = a ogni variazione
+	unsigned int generation;    // generazione della tabella gia' inviata
+	unsigned int source;        // versione del dataset degli id (dataset.h)
+	uint64_t next_ns;           // prossimo invio (intervallo) o controllo
+	sub_entry_t entries[SUB_MAX];
+} sub_t;
+
+// Attiva la sottoscrizione descritta dal frame (gia' validato da
+// frame_length) e scrive in out il primo frame push con tutte le voci,
+// comprese quelle non valide con il loro status. Ritorna i byte scritti
+// (al piu' SUB_PUSH_MAX). Senza --snapshot scrive una risposta di
+// richiesta non valida e lascia la sottoscrizione inattiva.
+size_t sub_start(sub_t *s, const unsigned char *frame, unsigned char *out, const char *client_ip, uint64_t now_ns);
+
+// Millisecondi al prossimo controllo della sottoscrizione (0 se scaduto)
+int sub_timeout_ms(const sub_t *s, uint64_t now_ns);
+
+// Se la sottoscrizione e' scaduta scrive in out il frame push (le voci
+// cambiate, o tutte con un intervallo) e ritorna i byte scritti; 0 se non
+// c'e' nulla da inviare o se space e' inferiore a SUB_PUSH_MAX (la
+// scadenza avanza comunque). Dopo un ricaricamento del dataset le voci
+// sono risolte di nuovo per nome: quelle sparite ricevono un'ultima voce
+// con STATUS_CITY_NOT_AVAILABLE e vengono rimosse.
+size_t sub_update(sub_t *s, unsigned char *out, size_t space, uint64_t now_ns);
+
+#endif /* SUB_H_ */
@@ -0,0 +1,111 @@
+/*
+ * timer.c
+ *
+ * Ogni lista e' circolare con una sentinella nella ruota, quindi
+ * inserimento e rimozione non hanno casi particolari. Una raccolta
+ * percorre le liste dal cursore tick fino all'istante corrente e sposta
+ * le voci scadute nella lista expired, anch'essa con sentinella: restano
+ * armate (timer_cancel e timer_set funzionano anche li') finche'
+ * timer_expired non le estrae. Dopo una lunga pausa senza chiamate si
+ * visita al piu' un giro di liste.
+ */
+
+#include "timer.h"
+#include "stats.h"
+
+#include <stddef.h>
+
+#define TIMER_MASK (TIMER_SLOTS - 1)
+
+uint64_t timer_now_ms(void) {
+	return stats_now_ns() / 1000000ull;
+}
+
+void timer_init(timer_wheel_t *w, uint64_t now_ms) {
+	for (int i = 0; i < TIMER_SLOTS; i++) {
+		w->slots[i].prev = w->slots[i].next = &w->slots[i];
+	}
+	w->expired.prev = w->expired.next = &w->expired;
+	w->tick = now_ms / TIMER_TICK_MS;
+	w->scanned_ms = 0;
+	w->count = 0;
+}
+
+static void unlink_entry(timer_wheel_t *w, timer_entry_t *e) {
+	e->prev->next = e->next;
+	e->next->prev = e->prev;
+	e->prev = e->next = NULL;
+	w->count--;
+}
+
+void timer_set(timer_wheel_t *w, timer_entry_t *e, uint64_t expire_ms) {
+	if (e->next) unlink_entry(w, e);
+	uint64_t tick = expire_ms / TIMER_TICK_MS;
+	if (tick < w->tick) tick = w->tick; // gia' scaduta: lista corrente
+	timer_entry_t *head = &w->slots[tick & TIMER_MASK];
+	e->expire_ms = expire_ms;
+	e->prev = head->prev;
+	e->next = head;
+	head->prev->next = e;
+	head->prev = e;
+	w->count++;
+}
+
+void timer_cancel(timer_wheel_t *w, timer_entry_t *e) {
+	if (e->next) unlink_entry(w, e);
+}
+
+// Sposta in w->expired tutte le voci scadute entro now_ms, in un solo
+// passaggio sulle liste dei tick arrivati
+static void collect(timer_wheel_t *w, uint64_t now_ms) {
+	uint64_t target = now_ms / TIMER_TICK_MS;
+	w->scanned_ms = now_ms;
+	if (w->count == 0) {
+		if (w->tick < target) w->tick = target;
+		return;
+	}
+	if (target > w->tick + TIMER_SLOTS) w->tick = target - TIMER_SLOTS; // un giro basta
+	timer_entry_t *x = &w->expired;
+	for (;;) {
+		timer_entry_t *head = &w->slots[w->tick & TIMER_MASK];
+		timer_entry_t *next;
+		for (timer_entry_t *e = head->next; e != head; e = next) {
+			next = e->next;
+			if (e->expire_ms > now_ms) continue;
+			e->prev->next = e->next;
+			e->next->prev = e->prev;
+			e->prev = x->prev;
+			e->next = x;
+			x->prev->next = e;
+			x->prev = e;
+		}
+		if (w->tick >= target) return;
+		w->tick++;
+	}
+}
+
+timer_entry_t *timer_expired(timer_wheel_t *w, uint64_t now_ms) {
+	timer_entry_t *x = &w->expired;
+	// nuova raccolta solo a lista vuota e a istante cambiato: la chiamata
+	// che chiude il ciclo del chiamante non ripercorre la lista corrente
+	if (x->next == x && now_ms != w->scanned_ms) collect(w, now_ms);
+	if (x->next == x) return NULL;
+	timer_entry_t *e = x->next;
+	unlink_entry(w, e);
+	return e;
+}
+
+void timer_visit(timer_wheel_t *w, void (*fn)(timer_entry_t *e, void *arg), void *arg) {
+	for (int i = -1; i < TIMER_SLOTS && w->count > 0; i++) {
+		timer_entry_t *head = i < 0 ? &w->expired : &w->slots[i];
+		timer_entry_t *next;
+		for (timer_entry_t *e = head->next; e != head; e = next) {
+			next = e->next;
+			fn(e, arg);
+		}
+	}
+}
+
+int timer_timeout_ms(const timer_wheel_t *w) {
+	return w->count > 0 ? TIMER_TICK_MS : -1;
+}
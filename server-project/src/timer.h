@@ -0,0 +1,61 @@
+/*
+ * timer.h
+ *
+ * Ruota temporale a hash per le scadenze delle connessioni: TIMER_SLOTS
+ * liste, una per tick di TIMER_TICK_MS, indirizzate con l'istante di
+ * scadenza modulo il giro della ruota. Armare, spostare e annullare una
+ * scadenza costa O(1) qualunque sia il numero di connessioni; a ogni
+ * tick si visita una sola lista. Le scadenze oltre un giro restano nella
+ * loro lista e vengono saltate finche' il loro istante non e' arrivato.
+ *
+ * Una ruota per thread, usata solo dal proprio event loop: nessun lock.
+ * Le voci sono incluse nella struttura della connessione.
+ */
+
+#ifndef TIMER_H_
+#define TIMER_H_
+
+#include <stdint.h>
+
+#define TIMER_TICK_MS 10      // risoluzione delle scadenze
+#define TIMER_SLOTS   1024    // liste della ruota, potenza di due (un giro = 10.24 s)
+
+typedef struct timer_entry {
+	struct timer_entry *prev, *next; // NULL se non armata
+	uint64_t expire_ms;
+} timer_entry_t;
+
+typedef struct {
+	timer_entry_t slots[TIMER_SLOTS]; // sentinelle delle liste circolari
+	timer_entry_t expired;            // scadute e non ancora estratte
+	uint64_t tick;                    // prossimo tick da visitare
+	uint64_t scanned_ms;              // istante dell'ultima raccolta
+	unsigned int count;               // voci armate
+} timer_wheel_t;
+
+// Istante corrente in millisecondi sull'orologio monotono delle scadenze
+uint64_t timer_now_ms(void);
+
+void timer_init(timer_wheel_t *w, uint64_t now_ms);
+
+// Arma (o sposta) la voce per scadere all'istante expire_ms
+void timer_set(timer_wheel_t *w, timer_entry_t *e, uint64_t expire_ms);
+
+// Disarma la voce; nessun effetto se non e' armata
+void timer_cancel(timer_wheel_t *w, timer_entry_t *e);
+
+// Estrae e disarma una voce scaduta entro now_ms, NULL se non ce ne sono
+// altre. Si chiama in un ciclo finche' non ritorna NULL: le liste dei tick
+// arrivati vengono percorse una sola volta per istante, spostando tutte
+// le voci scadute in una lista da cui le chiamate successive estraggono.
+timer_entry_t *timer_expired(timer_wheel_t *w, uint64_t now_ms);
+
+// Chiama fn su ogni voce armata, in ordine di lista; fn puo' disarmare
+// la voce ricevuta (non le altre)
+void timer_visit(timer_wheel_t *w, void (*fn)(timer_entry_t *e, void *arg), void *arg);
+
+// Attesa massima dell'event loop per non ritardare le scadenze: un tick
+// se ci sono voci armate, -1 altrimenti
+int timer_timeout_ms(const timer_wheel_t *w);
+
+#endif /* TIMER_H_ */
@@ -0,0 +1,238 @@
+/*
+ * udp.c
+ *
+ * Ciclo UDP del server. Su Linux una recvmmsg con MSG_WAITFORONE attende
+ * il primo datagramma e raccoglie tutti quelli gia' arrivati (fino a
+ * UDP_BATCH); le risposte vengono costruite in un unico buffer e inviate
+ * ai rispettivi mittenti con una sola sendmmsg. Sulle altre piattaforme
+ * si usa una recvfrom/sendto per datagramma.
+ *
+ * Un datagramma deve contenere esattamente un frame (frame_length uguale
+ * alla lunghezza ricevuta); altrimenti si risponde con una risposta di
+ * richiesta non valida.
+ *
+ * Durante un riavvio (upgrade.h) il ciclo smette di ricevere: i
+ * datagrammi ancora in coda nel socket condiviso li riceve la nuova
+ * istanza. Il controllo precede ogni attesa, interrotta da WAKE_SIGNAL
+ * con EINTR, e un gruppo gia' ricevuto viene sempre risposto per intero.
+ *
+ * Il mittente di un datagramma non e' verificato e puo' essere
+ * falsificato: una risposta piu' grande della richiesta amplificherebbe
+ * un attacco verso quell'indirizzo. Per questo su UDP si servono solo le
+ * richieste classiche e v2; batch, ricerche, aggregati, statistiche e
+ * sottoscrizioni ricevono una risposta di richiesta non valida, e nessuna
+ * risposta parte se e' piu' lunga del datagramma che l'ha chiesta.
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE // recvmmsg, sendmmsg
+#endif
+
+#include "udp.h"
+#include "protocol.h"
+#include "stats.h"
+#include "upgrade.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#define closesocket close
+#endif
+
+int open_udp_socket(const struct sockaddr_in *server_addr, int reuseport) {
+	int sock = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (sock < 0) {
+		errorhandler("creazione della socket UDP fallita.\n");
+		return -1;
+	}
+	if (reuseport) {
+#if defined(SO_REUSEPORT)
+		int on = 1;
+		if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (const char *)&on, sizeof(on)) < 0) {
+			errorhandler("errore nell'impostazione di SO_REUSEPORT.\n");
+			closesocket(sock);
+			return -1;
+		}
+#else
+		errorhandler("SO_REUSEPORT non supportato su questa piattaforma.\n");
+		closesocket(sock);
+		return -1;
+#endif
+	}
+	if (bind(sock, (const struct sockaddr *)server_addr, sizeof(*server_addr)) < 0) {
+		errorhandler("errore nella bind.\n");
+		closesocket(sock);
+		return -1;
+	}
+	return sock;
+}
+
+// 1 se il frame che inizia con magic ha una risposta non piu' lunga della
+// richiesta: classico (REQUEST_SIZE contro RESPONSE_SIZE byte) o v2
+static int udp_frame_allowed(unsigned char magic) {
+	if (magic == V2_MAGIC) return 1;
+	if (magic == BATCH_MAGIC || magic == SEARCH_MAGIC || magic == HISTORY_MAGIC || magic == SUB_MAGIC) return 0;
+	return tolower(magic) != STATS_REQUEST;
+}
+
+// Elabora un datagramma e scrive la risposta in out; ritorna i byte
+// scritti, 0 se non va inviata alcuna risposta
+static size_t answer_datagram(const unsigned char *in, size_t len, int truncated,
+		unsigned char *out, const struct sockaddr_in *from) {
+	char client_ip[INET_ADDRSTRLEN];
+#if defined(_WIN32)
+	strncpy(client_ip, inet_ntoa(from->sin_addr), sizeof(client_ip) - 1);
+	client_ip[sizeof(client_ip) - 1] = '\0';
+#else
+	inet_ntop(AF_INET, &from->sin_addr, client_ip, sizeof(client_ip));
+#endif
+	size_t out_len;
+	if (truncated || len == 0 || frame_length(in, len) != (long)len || !udp_frame_allowed(in[0])) {
+		out_len = invalid_frame_response(len > 0 ? in : NULL, out);
+	} else {
+		out_len = process_frame(in, len, out, client_ip);
+	}
+	// mai piu' byte di quelli ricevuti verso un mittente non verificato
+	return out_len <= len ? out_len : 0;
+}
+
+#if defined(__linux__)
+
+int run_udp_loop(int udp_socket) {
+	unsigned char *inbuf = malloc((size_t)UDP_BATCH * MAX_REQUEST_FRAME);
+	unsigned char *outbuf = malloc((size_t)UDP_BATCH * MAX_RESPONSE_FRAME);
+	if (!inbuf || !outbuf) {
+		free(inbuf);
+		free(outbuf);
+		errorhandler("memoria insufficiente per il ciclo UDP.\n");
+		return -1;
+	}
+	struct mmsghdr in_msgs[UDP_BATCH], out_msgs[UDP_BATCH];
+	struct iovec in_iov[UDP_BATCH], out_iov[UDP_BATCH];
+	struct sockaddr_in from[UDP_BATCH];
+	int loop_id = upgrade_register_loop(1);
+
+	for (;;) {
+		// prima dell'attesa: il segnale di upgrade.h la interrompe con EINTR
+		if (upgrade_draining()) {
+			free(inbuf);
+			free(outbuf);
+			upgrade_loop_stopped(loop_id);
+			upgrade_park();
+		}
+		for (int i = 0; i < UDP_BATCH; i++) {
+			in_iov[i].iov_base = inbuf + (size_t)i * MAX_REQUEST_FRAME;
+			in_iov[i].iov_len = MAX_REQUEST_FRAME;
+			memset(&in_msgs[i].msg_hdr, 0, sizeof(in_msgs[i].msg_hdr));
+			in_msgs[i].msg_hdr.msg_name = &from[i];
+			in_msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+			in_msgs[i].msg_hdr.msg_iov = &in_iov[i];
+			in_msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		int n = recvmmsg(udp_socket, in_msgs, UDP_BATCH, MSG_WAITFORONE, NULL);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			errorhandler("errore nella ricezione UDP.\n");
+			break;
+		}
+		uint64_t t_recv = stats_now_ns();
+
+		int m = 0; // risposte da inviare
+		for (int i = 0; i < n; i++) {
+			unsigned char *out = outbuf + (size_t)i * MAX_RESPONSE_FRAME;
+			size_t out_len = answer_datagram(in_iov[i].iov_base, in_msgs[i].msg_len,
+					(in_msgs[i].msg_hdr.msg_flags & MSG_TRUNC) != 0, out, &from[i]);
+			if (out_len == 0) continue;
+			out_iov[m].iov_base = out;
+			out_iov[m].iov_len = out_len;
+			memset(&out_msgs[m].msg_hdr, 0, sizeof(out_msgs[m].msg_hdr));
+			out_msgs[m].msg_hdr.msg_name = &from[i];
+			out_msgs[m].msg_hdr.msg_namelen = in_msgs[i].msg_hdr.msg_namelen;
+			out_msgs[m].msg_hdr.msg_iov = &out_iov[m];
+			out_msgs[m].msg_hdr.msg_iovlen = 1;
+			m++;
+		}
+		uint64_t t_built = stats_now_ns();
+		stats_record_stage(STAGE_RECV_BUILD, t_recv, t_built);
+
+		// Invio delle risposte; un errore su un datagramma (es. mittente
+		// irraggiungibile) non blocca gli altri
+		int sent = 0;
+		while (sent < m) {
+			int r = sendmmsg(udp_socket, out_msgs + sent, (unsigned int)(m - sent), 0);
+			if (r < 0) {
+				if (errno == EINTR) continue;
+				sent++;
+				continue;
+			}
+			sent += r;
+		}
+		stats_record_stage(STAGE_BUILD_SEND, t_built, stats_now_ns());
+	}
+
+	upgrade_loop_stopped(loop_id);
+	free(inbuf);
+	free(outbuf);
+	return -1;
+}
+
+#else
+
+int run_udp_loop(int udp_socket) {
+	unsigned char *inbuf = malloc(MAX_REQUEST_FRAME);
+	unsigned char outbuf[MAX_RESPONSE_FRAME];
+	if (!inbuf) {
+		errorhandler("memoria insufficiente per il ciclo UDP.\n");
+		return -1;
+	}
+	int loop_id = upgrade_register_loop(1);
+	for (;;) {
+		if (upgrade_draining()) {
+			free(inbuf);
+			upgrade_loop_stopped(loop_id);
+			upgrade_park();
+		}
+		struct sockaddr_in from;
+#if defined(_WIN32)
+		int from_len = sizeof(from);
+#else
+		socklen_t from_len = sizeof(from);
+#endif
+		int r = recvfrom(udp_socket, (char *)inbuf, MAX_REQUEST_FRAME, 0, (struct sockaddr *)&from, &from_len);
+		if (r < 0) {
+#if defined(_WIN32)
+			// datagramma piu' grande del buffer o ICMP di una risposta precedente
+			int err = WSAGetLastError();
+			if (err == WSAEMSGSIZE || err == WSAECONNRESET) continue;
+#else
+			if (errno == EINTR) continue;
+#endif
+			errorhandler("errore nella ricezione UDP.\n");
+			break;
+		}
+		uint64_t t_recv = stats_now_ns();
+		size_t out_len = answer_datagram(inbuf, (size_t)r, 0, outbuf, &from);
+		uint64_t t_built = stats_now_ns();
+		stats_record_stage(STAGE_RECV_BUILD, t_recv, t_built);
+		if (out_len > 0) {
+			sendto(udp_socket, (const char *)outbuf, (int)out_len, 0, (struct sockaddr *)&from, from_len);
+		}
+		stats_record_stage(STAGE_BUILD_SEND, t_built, stats_now_ns());
+	}
+	upgrade_loop_stopped(loop_id);
+	free(inbuf);
+	return -1;
+}
+
+#endif
@@ -0,0 +1,28 @@
+/*
+ * udp.h
+ *
+ * Trasporto UDP (--udp): ogni richiesta (classica o v2) arriva in un
+ * datagramma e la risposta parte in un datagramma verso il mittente, con
+ * la stessa codifica di TCP. Batch, ricerche, aggregati e statistiche,
+ * con risposte piu' grandi della richiesta, sono rifiutati: il mittente
+ * UDP non e' verificato. Su Linux si ricevono e si inviano fino a
+ * UDP_BATCH datagrammi per syscall con recvmmsg/sendmmsg.
+ */
+
+#ifndef UDP_H_
+#define UDP_H_
+
+#define UDP_BATCH 64 // datagrammi per recvmmsg/sendmmsg
+
+struct sockaddr_in;
+
+// Crea il socket UDP legato all'indirizzo del server (con reuseport anche
+// con SO_REUSEPORT). Ritorna il socket o -1 in caso di errore.
+int open_udp_socket(const struct sockaddr_in *server_addr, int reuseport);
+
+// Ciclo di ricezione/risposta sul socket UDP. Ritorna solo in caso di
+// errore fatale (-1); durante un riavvio (upgrade.h) smette di ricevere e
+// sospende il thread fino alla fine del processo.
+int run_udp_loop(int udp_socket);
+
+#endif /* UDP_H_ */
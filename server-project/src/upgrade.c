@@ -0,0 +1,390 @@
+/*
+ * upgrade.c
+ *
+ * Il processo figlio eredita solo i socket registrati e l'estremo di
+ * scrittura della pipe di avvio: tutti gli altri descrittori (connessioni
+ * accettate dal ciclo bloccante, file del dataset) vengono chiusi prima
+ * della exec, altrimenti una connessione chiusa dal processo precedente
+ * resterebbe aperta nel nuovo. Tra fork ed exec si usano solo funzioni
+ * async-signal-safe: ambiente e descrittori da conservare si preparano
+ * prima della fork.
+ *
+ * La chiusura graduale non interrompe i cicli: ognuno controlla
+ * upgrade_draining() quando si risveglia, smette di accettare, chiude le
+ * connessioni ferme e lo conferma. Un ciclo fermo in epoll_wait o
+ * io_uring_enter senza scadenze armate non si risveglierebbe: riceve
+ * WAKE_SIGNAL, il cui gestore vuoto fa solo terminare l'attesa con EINTR.
+ * Il segnale si ripete a ogni controllo, perche' puo' arrivare appena
+ * prima che il ciclo si metta in attesa. Il thread di upgrade termina il
+ * processo quando tutti i cicli hanno confermato e il numero di
+ * connessioni attive (stats.h) e' zero, al piu' dopo UPGRADE_DRAIN_MS.
+ */
+
+#include "upgrade.h"
+#include "protocol.h"
+#include "stats.h"
+#include "timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+
+int upgrade_start(char **argv) {
+	(void)argv;
+	return 0;
+}
+
+int upgrade_take_socket(int type) {
+	(void)type;
+	return -1;
+}
+
+void upgrade_add_socket(int fd) {
+	(void)fd;
+}
+
+void upgrade_ready(void) {
+}
+
+int upgrade_draining(void) {
+	return 0;
+}
+
+void upgrade_park(void) {
+}
+
+int upgrade_register_loop(int wake) {
+	(void)wake;
+	return -1;
+}
+
+void upgrade_loop_stopped(int loop) {
+	(void)loop;
+}
+
+#else
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+static char **saved_argv;
+static sigset_t usr2_set;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int sockets[UPGRADE_MAX_SOCKETS];   // da passare alla prossima istanza
+static int nsockets;
+static int inherited[UPGRADE_MAX_SOCKETS]; // ricevuti dalla precedente, -1 se usati
+static int ninherited;
+static int ready_fd = -1;
+static atomic_int draining;
+
+#define WAKE_SIGNAL SIGUSR1
+
+typedef struct {
+	pthread_t thread;
+	int wake;
+	atomic_int stopped;
+} upgrade_loop_t;
+
+static upgrade_loop_t loops[UPGRADE_MAX_LOOPS];
+static int nloops;
+
+static void sleep_ms(unsigned int ms) {
+	struct timespec ts;
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (long)(ms % 1000) * 1000000L;
+	while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+	}
+}
+
+// Legge e rimuove dall'ambiente i descrittori passati dall'istanza
+// precedente: non devono arrivare a un'eventuale istanza successiva
+static void read_environment(void) {
+	const char *p = getenv(UPGRADE_ENV_FDS);
+	while (p && *p && ninherited < UPGRADE_MAX_SOCKETS) {
+		char *end;
+		long fd = strtol(p, &end, 10);
+		if (end == p || fd < 0 || fd > INT_MAX) break;
+		inherited[ninherited++] = (int)fd;
+		p = *end == ',' ? end + 1 : end;
+	}
+	const char *r = getenv(UPGRADE_ENV_READY);
+	if (r) ready_fd = atoi(r);
+	unsetenv(UPGRADE_ENV_FDS);
+	unsetenv(UPGRADE_ENV_READY);
+}
+
+int upgrade_take_socket(int type) {
+	for (int i = 0; i < ninherited; i++) {
+		int fd = inherited[i];
+		if (fd < 0) continue;
+		int t = 0;
+		socklen_t len = sizeof(t);
+		if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &t, &len) != 0 || t != type) continue;
+		inherited[i] = -1;
+		return fd;
+	}
+	return -1;
+}
+
+void upgrade_add_socket(int fd) {
+	pthread_mutex_lock(&lock);
+	if (nsockets < UPGRADE_MAX_SOCKETS) sockets[nsockets++] = fd;
+	pthread_mutex_unlock(&lock);
+}
+
+void upgrade_ready(void) {
+	// socket in piu' (meno worker dell'istanza precedente): restano aperti
+	// nel processo precedente fino alla sua chiusura
+	int unused = 0;
+	for (int i = 0; i < ninherited; i++) {
+		if (inherited[i] >= 0) {
+			close(inherited[i]);
+			inherited[i] = -1;
+			unused++;
+		}
+	}
+	if (ninherited > 0) {
+		printf("Socket ereditati dall'istanza precedente: %d (%d non usati)\n", ninherited - unused, unused);
+	}
+	if (ready_fd >= 0) {
+		char b = 1;
+		while (write(ready_fd, &b, 1) < 0 && errno == EINTR) {
+		}
+		close(ready_fd);
+		ready_fd = -1;
+	}
+}
+
+int upgrade_draining(void) {
+	return atomic_load_explicit(&draining, memory_order_relaxed);
+}
+
+void upgrade_park(void) {
+	for (;;) pause();
+}
+
+int upgrade_register_loop(int wake) {
+	pthread_mutex_lock(&lock);
+	int id = nloops < UPGRADE_MAX_LOOPS ? nloops++ : -1;
+	if (id >= 0) {
+		loops[id].thread = pthread_self();
+		loops[id].wake = wake;
+		atomic_store_explicit(&loops[id].stopped, 0, memory_order_relaxed);
+	}
+	pthread_mutex_unlock(&lock);
+	return id;
+}
+
+void upgrade_loop_stopped(int loop) {
+	if (loop >= 0) atomic_store_explicit(&loops[loop].stopped, 1, memory_order_release);
+}
+
+// Risveglia i cicli che non hanno ancora smesso di accettare. Ritorna
+// quanti sono.
+static int wake_loops(void) {
+	int accepting = 0;
+	pthread_mutex_lock(&lock);
+	for (int i = 0; i < nloops; i++) {
+		if (atomic_load_explicit(&loops[i].stopped, memory_order_acquire)) continue;
+		accepting++;
+		if (loops[i].wake) pthread_kill(loops[i].thread, WAKE_SIGNAL);
+	}
+	pthread_mutex_unlock(&lock);
+	return accepting;
+}
+
+static void on_wake(int sig) {
+	(void)sig;
+}
+
+// Chiude tutti i descrittori da 3 in su tranne keep[0..n), ordinati.
+// Eseguita nel figlio tra fork ed exec: solo syscall.
+static void close_others(const int *keep, int n, long max_fd) {
+	int from = 3;
+	for (int i = 0; i <= n; i++) {
+		long to = i < n ? keep[i] : max_fd; // escluso
+		if (to > from) {
+#if defined(SYS_close_range)
+			unsigned int last = i < n ? (unsigned int)to - 1 : ~0u;
+			if (syscall(SYS_close_range, (unsigned int)from, last, 0) == 0) to = from;
+#endif
+			for (long fd = from; fd < to; fd++) close((int)fd);
+		}
+		if (i < n && keep[i] + 1 > from) from = keep[i] + 1;
+	}
+}
+
+// Avvia la nuova istanza con i socket registrati. Ritorna il pid e in
+// *ready l'estremo di lettura della pipe di avvio, oppure -1.
+static pid_t spawn(int *ready) {
+	int pfd[2];
+	if (pipe(pfd) != 0) return -1;
+	fcntl(pfd[0], F_SETFD, FD_CLOEXEC);
+
+	int keep[UPGRADE_MAX_SOCKETS + 1];
+	int n = 0;
+	char list[UPGRADE_MAX_SOCKETS * 12] = "";
+	size_t used = 0;
+	pthread_mutex_lock(&lock);
+	for (int i = 0; i < nsockets; i++) {
+		keep[n++] = sockets[i];
+		used += (size_t)snprintf(list + used, sizeof(list) - used, "%s%d", i ? "," : "", sockets[i]);
+	}
+	pthread_mutex_unlock(&lock);
+	keep[n++] = pfd[1];
+	for (int i = 1; i < n; i++) { // ordinamento per inserzione: pochi elementi
+		int v = keep[i], j = i;
+		for (; j > 0 && keep[j - 1] > v; j--) keep[j] = keep[j - 1];
+		keep[j] = v;
+	}
+	char rfd[16];
+	snprintf(rfd, sizeof(rfd), "%d", pfd[1]);
+	long max_fd = sysconf(_SC_OPEN_MAX);
+	if (max_fd <= 0) max_fd = 1024;
+
+	setenv(UPGRADE_ENV_FDS, list, 1);
+	setenv(UPGRADE_ENV_READY, rfd, 1);
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid == 0) {
+		// il figlio parte con tutti i segnali sbloccati e i soli
+		// descrittori da passare, ereditabili
+		sigset_t none;
+		sigemptyset(&none);
+		pthread_sigmask(SIG_SETMASK, &none, NULL);
+		for (int i = 0; i < n; i++) fcntl(keep[i], F_SETFD, 0);
+		close_others(keep, n, max_fd);
+		execvp(saved_argv[0], saved_argv);
+		_exit(127);
+	}
+	unsetenv(UPGRADE_ENV_FDS);
+	unsetenv(UPGRADE_ENV_READY);
+	close(pfd[1]);
+	if (pid < 0) {
+		close(pfd[0]);
+		return -1;
+	}
+	*ready = pfd[0];
+	return pid;
+}
+
+// Attende il byte di avvio della nuova istanza. Ritorna 0, oppure -1 se
+// la nuova istanza e' terminata o non ha risposto in tempo.
+static int wait_ready(int fd) {
+	uint64_t deadline = timer_now_ms() + UPGRADE_READY_MS;
+	for (;;) {
+		uint64_t now = timer_now_ms();
+		if (now >= deadline) return -1;
+		struct pollfd pfd;
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		int n = poll(&pfd, 1, (int)(deadline - now));
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return -1;
+		char b;
+		ssize_t r = read(fd, &b, 1);
+		if (r < 0 && errno == EINTR) continue;
+		return r == 1 ? 0 : -1;
+	}
+}
+
+static int upgrade(void) {
+	int ready;
+	pid_t pid = spawn(&ready);
+	if (pid < 0) {
+		errorhandler("errore nell'avvio della nuova istanza.\n");
+		return -1;
+	}
+	int rc = wait_ready(ready);
+	close(ready);
+	if (rc != 0) {
+		// il processo corrente continua a servire: la nuova istanza non
+		// deve restare in ascolto sugli stessi socket
+		printf("La nuova istanza (pid %d) non e' partita, cambio annullato.\n", (int)pid);
+		kill(pid, SIGTERM);
+		waitpid(pid, NULL, 0);
+		return -1;
+	}
+	printf("Nuova istanza in servizio (pid %d), chiusura graduale...\n", (int)pid);
+	fflush(stdout);
+	return 0;
+}
+
+// Attende che i cicli smettano di accettare e che le connessioni in
+// corso finiscano, poi termina il processo
+static void drain(void) {
+	atomic_store_explicit(&draining, 1, memory_order_release);
+	uint64_t start = timer_now_ms();
+	unsigned int active;
+	for (;;) {
+		int accepting = wake_loops();
+		active = stats_active_connections();
+		if ((accepting == 0 && active == 0) || timer_now_ms() - start >= UPGRADE_DRAIN_MS) break;
+		sleep_ms(UPGRADE_POLL_MS);
+	}
+	if (active > 0) {
+		printf("Chiusura forzata: %u connessioni ancora aperte.\n", active);
+	}
+	printf("Istanza precedente terminata.\n");
+	fflush(stdout);
+	_exit(0); // gli altri thread sono ancora attivi: niente distruttori
+}
+
+static void *upgrade_main(void *arg) {
+	(void)arg;
+	for (;;) {
+		int sig;
+		if (sigwait(&usr2_set, &sig) == 0 && sig == SIGUSR2 && upgrade() == 0) {
+			drain();
+		}
+	}
+	return NULL;
+}
+
+int upgrade_start(char **argv) {
+	saved_argv = argv;
+	read_environment();
+
+	// SIGUSR2 bloccato in questo thread e in tutti quelli creati dopo:
+	// lo riceve solo sigwait nel thread dedicato
+	sigemptyset(&usr2_set);
+	sigaddset(&usr2_set, SIGUSR2);
+	if (pthread_sigmask(SIG_BLOCK, &usr2_set, NULL) != 0) return -1;
+
+	// senza SA_RESTART: il segnale interrompe l'attesa del ciclo
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_wake;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(WAKE_SIGNAL, &sa, NULL) != 0) return -1;
+
+	// il thread nasce con tutti i segnali bloccati: un segnale per il
+	// processo (SIGHUP di dataset.h) non deve arrivare a lui
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	pthread_t th;
+	int rc = pthread_create(&th, NULL, upgrade_main, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (rc != 0) {
+		errorhandler("errore nella creazione del thread di riavvio.\n");
+		return -1;
+	}
+	pthread_detach(th);
+	return 0;
+}
+
+#endif
@@ -0,0 +1,67 @@
+/*
+ * upgrade.h
+ *
+ * Riavvio senza interruzioni: a SIGUSR2 il server avvia una nuova istanza
+ * di se stesso (stesso eseguibile e stessi argomenti) che eredita i socket
+ * di ascolto gia' legati alla porta, invece di aprirne di nuovi. Le
+ * connessioni in coda e quelle che arrivano durante il cambio restano
+ * nello stesso socket, quindi non c'e' un intervallo senza bind ne' SYN
+ * rifiutati. Quando la nuova istanza e' in servizio la precedente smette
+ * di accettare, chiude le connessioni ferme tra due frame, completa
+ * quelle in corso e termina.
+ *
+ * I socket passano come descrittori ereditati attraverso exec, elencati
+ * nella variabile d'ambiente UPGRADE_ENV_FDS; la nuova istanza segnala di
+ * essere in servizio scrivendo un byte sulla pipe UPGRADE_ENV_READY. Se
+ * non lo fa entro UPGRADE_READY_MS il cambio viene annullato e il
+ * processo corrente continua a servire.
+ */
+
+#ifndef UPGRADE_H_
+#define UPGRADE_H_
+
+#define UPGRADE_ENV_FDS   "WEATHER_LISTEN_FDS" // socket ereditati, separati da virgole
+#define UPGRADE_ENV_READY "WEATHER_READY_FD"   // pipe di avvio verso il processo precedente
+#define UPGRADE_MAX_SOCKETS 65                 // un socket per worker piu' quello condiviso
+#define UPGRADE_MAX_LOOPS 64                   // cicli che accettano connessioni, uno per worker
+#define UPGRADE_READY_MS  5000                 // attesa massima dell'avvio della nuova istanza
+#define UPGRADE_DRAIN_MS  30000                // attesa massima delle connessioni in corso
+#define UPGRADE_POLL_MS   100                  // intervallo dei controlli durante la chiusura
+
+// Legge i socket ereditati da un'istanza precedente e avvia il thread che
+// esegue il cambio a ogni SIGUSR2. Va chiamata prima di creare gli altri
+// thread, che ereditano il segnale bloccato. Ritorna 0 o -1.
+int upgrade_start(char **argv);
+
+// Socket ereditato del tipo indicato (SOCK_STREAM o SOCK_DGRAM), nello
+// stesso ordine in cui li aveva aperti l'istanza precedente; -1 se non ce
+// ne sono altri
+int upgrade_take_socket(int type);
+
+// Registra un socket del server da passare alla prossima istanza
+void upgrade_add_socket(int fd);
+
+// Segnala all'istanza precedente che questa e' in servizio e chiude i
+// socket ereditati non usati. Va chiamata dopo aver aperto tutti i socket.
+void upgrade_ready(void);
+
+// 1 se e' in corso la chiusura graduale: i cicli non accettano altre
+// connessioni e chiudono quelle ferme tra due frame
+int upgrade_draining(void);
+
+// Registra il ciclo del thread chiamante, che durante la chiusura
+// graduale deve smettere di accettare e confermarlo con
+// upgrade_loop_stopped: il processo non termina prima, altrimenti una
+// connessione gia' tolta dalla coda di accept andrebbe persa. Con
+// wake != 0 il ciclo viene risvegliato con un segnale (le attese
+// ritornano con EINTR) finche' non conferma; wake = 0 per i cicli che si
+// risvegliano da soli. Ritorna l'indice del ciclo, -1 oltre
+// UPGRADE_MAX_LOOPS (ciclo non atteso).
+int upgrade_register_loop(int wake);
+void upgrade_loop_stopped(int loop);
+
+// Sospende il thread chiamante fino alla fine del processo, che termina
+// dal thread di upgrade a connessioni concluse
+void upgrade_park(void);
+
+#endif /* UPGRADE_H_ */
@@ -0,0 +1,653 @@
+/*
+ * uring.c
+ *
+ * Ciclo del server su io_uring, usando direttamente le syscall
+ * io_uring_setup/io_uring_enter/io_uring_register (nessuna libreria).
+ *
+ *  - accept multishot: una sola sottomissione produce un completamento per
+ *    ogni nuova connessione;
+ *  - recv con buffer forniti (anello di URING_BUF_COUNT buffer da
+ *    URING_BUF_SIZE byte): il kernel sceglie il buffer al momento della
+ *    ricezione, i dati vengono copiati nel buffer della connessione e il
+ *    buffer torna subito nell'anello;
+ *  - la risposta viene inviata con una send; quando la connessione deve
+ *    essere chiusa (modalita' one-shot o frame malformato) la close e'
+ *    collegata alla send (IOSQE_IO_LINK) e parte solo se l'invio e'
+ *    completo;
+ *  - le sottomissioni si accumulano per tutto il ciclo e vengono passate
+ *    al kernel con una io_uring_enter, che attende anche i completamenti.
+ *
+ * Ogni connessione ha al piu' una recv e una send in corso. La struttura
+ * viene liberata solo al completamento della close.
+ *
+ * Le attese massime delle connessioni sono voci di una ruota temporale
+ * (timer.h) come nel reactor; finche' ci sono voci armate una operazione
+ * TIMEOUT di un tick risveglia il ciclo. Una connessione scaduta viene
+ * chiusa con shutdown, che completa le recv e send in corso, e poi con
+ * il normale percorso di errore.
+ *
+ * Durante un riavvio (upgrade.h) si annulla la accept multishot e le
+ * connessioni ferme tra due frame vengono chiuse come al termine di una
+ * richiesta one-shot; quelle con un frame o una risposta in corso finiscono.
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include "uring.h"
+#include "protocol.h"
+#include "reqlog.h"
+#include "stats.h"
+#include "admit.h"
+#include "timer.h"
+#include "upgrade.h"
+
+#include <stdio.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#if defined(IORING_ACCEPT_MULTISHOT) && defined(IORING_CQE_F_MORE)
+#define HAVE_IO_URING 1
+#endif
+
+#if defined(HAVE_IO_URING)
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define BUF_GROUP 0
+
+// Il tipo di operazione e' codificato nei bit bassi di user_data, il resto
+// e' il puntatore alla connessione (allineato ad almeno 8 byte)
+enum { OP_ACCEPT, OP_RECV, OP_SEND, OP_CLOSE, OP_TIMEOUT, OP_CANCEL };
+#define OP_MASK 7ull
+
+typedef struct uconn {
+	int fd;
+	int closing;                          // nessun'altra richiesta: chiudere dopo l'invio
+	int failed;                           // errore di I/O: chiudere appena possibile
+	int shut;                             // shutdown gia' eseguito per sbloccare la recv
+	int recv_pending;
+	int send_pending;
+	int close_pending;
+	size_t in_len;                        // byte ricevuti e non ancora elaborati
+	size_t out_len;                       // byte di risposta pronti
+	size_t out_off;                       // byte di risposta gia' inviati
+	uint64_t accept_ns;                   // istante della accept, 0 dopo la prima ricezione
+	uint64_t recv_ns;                     // ultima ricezione di dati
+	uint64_t built_ns;                    // ultima risposta costruita
+	// un frame incompleto occupa al piu' MAX_REQUEST_FRAME - 1 byte: lo
+	// spazio in piu' lascia sempre libero un buffer intero per la recv
+	unsigned char inbuf[MAX_REQUEST_FRAME + URING_BUF_SIZE];
+	unsigned char outbuf[2 * MAX_RESPONSE_FRAME];
+	char client_ip[INET_ADDRSTRLEN];
+	struct uconn *next_free;              // collegamento nella free list
+	timer_entry_t deadline;               // prossima scadenza (timer.h)
+	uint64_t frame_ms;                    // inizio del frame atteso, 0 tra due frame
+} uconn_t;
+
+typedef struct {
+	int fd;
+	unsigned sq_entries;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned sq_local_tail;               // voci preparate, non ancora pubblicate
+	unsigned to_submit;
+	struct io_uring_sqe *sqes;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+	struct io_uring_buf_ring *br;
+	unsigned short br_tail;
+	unsigned char *bufs;
+	void *ring_ptr;
+	size_t ring_size, sqes_size, br_size, bufs_size;
+	timer_wheel_t wheel;                  // scadenze delle connessioni
+	struct __kernel_timespec tick;        // durata dell'operazione TIMEOUT
+	int tick_pending;
+	int draining;                         // chiusura graduale: niente accept
+	int loop_id;                          // indice del ciclo in upgrade.h
+} uring_t;
+
+static _Thread_local uconn_t *free_conns = NULL;
+
+static uconn_t *conn_alloc(void) {
+	uconn_t *c = free_conns;
+	if (c) {
+		free_conns = c->next_free;
+	} else {
+		c = malloc(sizeof(*c));
+		if (!c) return NULL;
+	}
+	memset(c, 0, offsetof(uconn_t, inbuf));
+	c->next_free = NULL;
+	c->deadline.prev = c->deadline.next = NULL;
+	c->frame_ms = 0;
+	return c;
+}
+
+static void conn_free(uring_t *u, uconn_t *c) {
+	timer_cancel(&u->wheel, &c->deadline);
+	stats_conn_close();
+	admit_conn_close();
+	c->next_free = free_conns;
+	free_conns = c;
+}
+
+static int sys_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+// Pubblica le voci preparate e, con wait, attende almeno un completamento
+static int uring_submit(uring_t *u, int wait) {
+	__atomic_store_n(u->sq_tail, u->sq_local_tail, __ATOMIC_RELEASE);
+	if (u->to_submit == 0 && !wait) return 0;
+	int r = sys_enter(u->fd, u->to_submit, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0);
+	if (r > 0) u->to_submit -= (unsigned)r;
+	return r;
+}
+
+// Prossima voce libera dell'anello di sottomissione (azzerata). Se
+// l'anello e' pieno le voci accumulate vengono inviate subito.
+static struct io_uring_sqe *get_sqe(uring_t *u) {
+	while (u->sq_local_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries) {
+		if (uring_submit(u, 0) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+			return NULL;
+		}
+	}
+	unsigned idx = u->sq_local_tail & *u->sq_mask;
+	struct io_uring_sqe *sqe = &u->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	u->sq_array[idx] = idx;
+	u->sq_local_tail++;
+	u->to_submit++;
+	return sqe;
+}
+
+static void buf_recycle(uring_t *u, unsigned short bid) {
+	struct io_uring_buf *b = &u->br->bufs[u->br_tail & (URING_BUF_COUNT - 1)];
+	b->addr = (uint64_t)(uintptr_t)(u->bufs + (size_t)bid * URING_BUF_SIZE);
+	b->len = URING_BUF_SIZE;
+	b->bid = bid;
+	u->br_tail++;
+	__atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+}
+
+static void uring_free(uring_t *u) {
+	if (u->bufs) munmap(u->bufs, u->bufs_size);
+	if (u->br) munmap(u->br, u->br_size);
+	if (u->sqes) munmap(u->sqes, u->sqes_size);
+	if (u->ring_ptr) munmap(u->ring_ptr, u->ring_size);
+	if (u->fd >= 0) close(u->fd);
+}
+
+// Crea l'anello e registra i buffer forniti. Ritorna -1 se io_uring o una
+// delle funzioni richieste non e' disponibile.
+static int uring_init(uring_t *u) {
+	memset(u, 0, sizeof(*u));
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	// un solo thread sottomette: il kernel puo' rimandare il lavoro
+	// asincrono alla prossima io_uring_enter (DEFER_TASKRUN, 6.1+)
+	p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+	p.cq_entries = URING_CQ_ENTRIES;
+	u->fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+	if (u->fd < 0 && errno == EINVAL) {
+		memset(&p, 0, sizeof(p));
+		p.flags = IORING_SETUP_CQSIZE;
+		p.cq_entries = URING_CQ_ENTRIES;
+		u->fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+	}
+	if (u->fd < 0) return -1;
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP)) {
+		uring_free(u);
+		return -1;
+	}
+
+	size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	u->ring_size = sq_size > cq_size ? sq_size : cq_size;
+	u->ring_ptr = mmap(NULL, u->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if (u->ring_ptr == MAP_FAILED) {
+		u->ring_ptr = NULL;
+		uring_free(u);
+		return -1;
+	}
+	u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED) {
+		u->sqes = NULL;
+		uring_free(u);
+		return -1;
+	}
+
+	char *ring = (char *)u->ring_ptr;
+	u->sq_entries = p.sq_entries;
+	u->sq_head = (unsigned *)(ring + p.sq_off.head);
+	u->sq_tail = (unsigned *)(ring + p.sq_off.tail);
+	u->sq_mask = (unsigned *)(ring + p.sq_off.ring_mask);
+	u->sq_array = (unsigned *)(ring + p.sq_off.array);
+	u->sq_local_tail = *u->sq_tail;
+	u->cq_head = (unsigned *)(ring + p.cq_off.head);
+	u->cq_tail = (unsigned *)(ring + p.cq_off.tail);
+	u->cq_mask = (unsigned *)(ring + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)(ring + p.cq_off.cqes);
+
+	// Anello dei buffer forniti (5.19+) e memoria dei buffer
+	u->br_size = URING_BUF_COUNT * sizeof(struct io_uring_buf);
+	u->br = mmap(NULL, u->br_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	u->bufs_size = (size_t)URING_BUF_COUNT * URING_BUF_SIZE;
+	u->bufs = mmap(NULL, u->bufs_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (u->br == MAP_FAILED || u->bufs == MAP_FAILED) {
+		if (u->br == MAP_FAILED) u->br = NULL;
+		if (u->bufs == MAP_FAILED) u->bufs = NULL;
+		uring_free(u);
+		return -1;
+	}
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)u->br;
+	reg.ring_entries = URING_BUF_COUNT;
+	reg.bgid = BUF_GROUP;
+	if (syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		uring_free(u);
+		return -1;
+	}
+	for (unsigned short i = 0; i < URING_BUF_COUNT; i++) buf_recycle(u, i);
+	return 0;
+}
+
+static int arm_accept(uring_t *u, int listen_socket) {
+	struct io_uring_sqe *sqe = get_sqe(u);
+	if (!sqe) return -1;
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = listen_socket;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->accept_flags = SOCK_CLOEXEC;
+	sqe->user_data = OP_ACCEPT;
+	return 0;
+}
+
+static void arm_recv(uring_t *u, uconn_t *c) {
+	struct io_uring_sqe *sqe = get_sqe(u);
+	if (!sqe) {
+		c->failed = 1;
+		return;
+	}
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = c->fd;
+	sqe->len = URING_BUF_SIZE;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = BUF_GROUP;
+	sqe->user_data = (uint64_t)(uintptr_t)c | OP_RECV;
+	c->recv_pending = 1;
+}
+
+static void submit_close(uring_t *u, uconn_t *c) {
+	struct io_uring_sqe *sqe = get_sqe(u);
+	if (!sqe) {
+		// anello inutilizzabile: chiusura sincrona
+		close(c->fd);
+		conn_free(u, c);
+		return;
+	}
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->fd = c->fd;
+	sqe->user_data = (uint64_t)(uintptr_t)c | OP_CLOSE;
+	c->close_pending = 1;
+}
+
+// Invia le risposte pronte; con link la close viene collegata alla send
+static void submit_send(uring_t *u, uconn_t *c, int link) {
+	struct io_uring_sqe *sqe = get_sqe(u);
+	if (!sqe) {
+		c->failed = 1;
+		return;
+	}
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = c->fd;
+	sqe->addr = (uint64_t)(uintptr_t)(c->outbuf + c->out_off);
+	sqe->len = (unsigned)(c->out_len - c->out_off);
+	sqe->msg_flags = MSG_NOSIGNAL;
+	// altri frame gia' ricevuti: le loro risposte seguiranno subito
+	if (!c->closing && frames_pending(c->inbuf, c->in_len)) sqe->msg_flags |= MSG_MORE;
+	sqe->user_data = (uint64_t)(uintptr_t)c | OP_SEND;
+	c->send_pending = 1;
+	if (link) {
+		sqe->flags |= IOSQE_IO_LINK;
+		submit_close(u, c);
+	}
+}
+
+// Elabora i frame completi presenti nel buffer finche' c'e' spazio per una
+// risposta di dimensione massima (come conn_parse del reactor). Le nuove
+// risposte vengono accodate dopo quelle eventualmente in invio.
+static void conn_parse(uconn_t *c) {
+	size_t off = 0;
+	while (!c->closing && sizeof(c->outbuf) - c->out_len >= MAX_RESPONSE_FRAME) {
+		long flen = frame_length(c->inbuf + off, c->in_len - off);
+		if (flen == 0) break;
+		if (flen < 0) {
+			c->out_len += invalid_frame_response(c->inbuf + off, c->outbuf + c->out_len);
+			c->closing = 1;
+			break;
+		}
+		c->out_len += process_frame(c->inbuf + off, (size_t)flen, c->outbuf + c->out_len, c->client_ip);
+		c->built_ns = stats_now_ns();
+		stats_record_stage(STAGE_RECV_BUILD, c->recv_ns, c->built_ns);
+		off += (size_t)flen;
+		if (!server_options.keepalive) c->closing = 1;
+	}
+	if (off > 0) {
+		memmove(c->inbuf, c->inbuf + off, c->in_len - off);
+		c->in_len -= off;
+		c->frame_ms = 0; // i byte rimasti aprono un nuovo frame
+	}
+}
+
+// Arma la scadenza che corrisponde allo stato della connessione, come
+// conn_deadline del reactor. Una connessione in chiusura scade solo se
+// l'ultima risposta non riesce a partire (la close e' collegata alla send).
+static void conn_deadline(uring_t *u, uconn_t *c) {
+	uint64_t now = timer_now_ms();
+	int timeout;
+	uint64_t from = now;
+	if (c->failed) {
+		timeout = 0;
+	} else if (c->out_off < c->out_len) {
+		timeout = server_options.write_timeout_ms;
+	} else if (c->closing || c->close_pending) {
+		timeout = 0;
+	} else if (c->in_len > 0 || c->frame_ms) {
+		if (!c->frame_ms) c->frame_ms = now;
+		from = c->frame_ms;
+		timeout = server_options.read_timeout_ms;
+	} else {
+		timeout = server_options.idle_timeout_ms;
+	}
+	if (timeout > 0) timer_set(&u->wheel, &c->deadline, from + (uint64_t)timeout);
+	else timer_cancel(&u->wheel, &c->deadline);
+}
+
+static void conn_advance_io(uring_t *u, uconn_t *c);
+
+// Nessun frame iniziato e nessuna risposta in uscita: chiuderla non
+// interrompe alcuna richiesta
+static int conn_idle(const uconn_t *c) {
+	return c->in_len == 0 && !c->frame_ms && c->out_off >= c->out_len;
+}
+
+// Decide le prossime operazioni della connessione in base al suo stato e
+// ne aggiorna la scadenza
+static void conn_advance(uring_t *u, uconn_t *c) {
+	if (u->draining && conn_idle(c)) c->closing = 1;
+	conn_advance_io(u, c);
+	conn_deadline(u, c);
+}
+
+static void conn_advance_io(uring_t *u, uconn_t *c) {
+	if (c->close_pending) return; // si attende l'esito della close
+	if (!c->failed && !c->closing) conn_parse(c);
+
+	if ((c->failed || c->closing) && c->recv_pending) {
+		// una recv in corso impedirebbe la chiusura: la si sblocca
+		if (!c->shut) shutdown(c->fd, SHUT_RD);
+		c->shut = 1;
+		if (c->failed) return;
+	}
+	if (c->failed) {
+		if (!c->send_pending) submit_close(u, c);
+		return;
+	}
+
+	if (!c->send_pending && c->out_off < c->out_len) {
+		submit_send(u, c, c->closing && !c->recv_pending);
+	} else if (c->closing && !c->send_pending && !c->recv_pending) {
+		submit_close(u, c);
+		return;
+	}
+	if (!c->closing && !c->recv_pending && sizeof(c->inbuf) - c->in_len >= URING_BUF_SIZE) {
+		arm_recv(u, c);
+	}
+}
+
+static void on_accept(uring_t *u, int fd) {
+	if (admit_conn_open() != 0) {
+		admit_shed(fd);
+		return;
+	}
+	uconn_t *c = conn_alloc();
+	if (!c) {
+		admit_conn_close();
+		close(fd);
+		return;
+	}
+	c->fd = fd;
+	c->accept_ns = stats_now_ns();
+	struct sockaddr_in cad;
+	socklen_t client_len = sizeof(cad);
+	if (getpeername(fd, (struct sockaddr *)&cad, &client_len) == 0) {
+		inet_ntop(AF_INET, &cad.sin_addr, c->client_ip, sizeof(c->client_ip));
+	} else {
+		strcpy(c->client_ip, "?");
+	}
+	reqlog_connect(c->client_ip);
+	stats_conn_open();
+	c->frame_ms = timer_now_ms();
+	conn_advance(u, c);
+}
+
+// Chiude le connessioni scadute: shutdown completa le operazioni in
+// corso e la chiusura segue il percorso di errore di conn_advance
+static void deadlines_tick(uring_t *u) {
+	uint64_t now = timer_now_ms();
+	timer_entry_t *e;
+	while ((e = timer_expired(&u->wheel, now)) != NULL) {
+		uconn_t *c = (uconn_t *)((char *)e - offsetof(uconn_t, deadline));
+		stats_conn_timeout();
+		shutdown(c->fd, SHUT_RDWR);
+		c->shut = 1;
+		c->failed = 1;
+		conn_advance(u, c);
+	}
+}
+
+// Operazione TIMEOUT di un tick: risveglia io_uring_enter finche' ci
+// sono scadenze armate
+static void arm_tick(uring_t *u) {
+	if (u->tick_pending || timer_timeout_ms(&u->wheel) < 0) return;
+	struct io_uring_sqe *sqe = get_sqe(u);
+	if (!sqe) return;
+	u->tick.tv_sec = 0;
+	u->tick.tv_nsec = (long long)TIMER_TICK_MS * 1000000;
+	sqe->opcode = IORING_OP_TIMEOUT;
+	sqe->addr = (uint64_t)(uintptr_t)&u->tick;
+	sqe->len = 1;
+	sqe->user_data = OP_TIMEOUT;
+	u->tick_pending = 1;
+}
+
+static void drain_visit(timer_entry_t *e, void *arg) {
+	uring_t *u = (uring_t *)arg;
+	uconn_t *c = (uconn_t *)((char *)e - offsetof(uconn_t, deadline));
+	if (!c->close_pending && conn_idle(c)) conn_advance(u, c);
+}
+
+// Inizio della chiusura graduale: si annulla la accept e si chiudono le
+// connessioni ferme in attesa nella ruota (--idle-timeout); le altre
+// vengono chiuse da conn_advance quando tornano ferme
+static void drain_start(uring_t *u) {
+	u->draining = 1;
+	struct io_uring_sqe *sqe = get_sqe(u);
+	if (sqe) {
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->addr = OP_ACCEPT;
+		sqe->user_data = OP_CANCEL;
+	}
+	timer_visit(&u->wheel, drain_visit, u);
+}
+
+static void on_recv(uring_t *u, uconn_t *c, int res, unsigned flags) {
+	c->recv_pending = 0;
+	if (res > 0) {
+		unsigned short bid = (unsigned short)(flags >> IORING_CQE_BUFFER_SHIFT);
+		// la recv viene armata solo con almeno URING_BUF_SIZE byte liberi,
+		// sempre disponibili finche' il frame atteso non e' completo
+		memcpy(c->inbuf + c->in_len, u->bufs + (size_t)bid * URING_BUF_SIZE, (size_t)res);
+		c->in_len += (size_t)res;
+		buf_recycle(u, bid);
+		c->recv_ns = stats_now_ns();
+		if (c->accept_ns) {
+			stats_record_stage(STAGE_ACCEPT_RECV, c->accept_ns, c->recv_ns);
+			c->accept_ns = 0;
+		}
+	} else if (res == 0 || c->shut) {
+		// chiusura del client (o recv sbloccata dallo shutdown)
+		if (c->in_len > 0 && !c->closing && !c->failed) {
+			errorhandler("Errore nella ricezione della richiesta.\n");
+		}
+		c->closing = 1;
+	} else if (res != -ENOBUFS) {
+		// ENOBUFS: buffer esauriti, si riprova al prossimo giro
+		errorhandler("Errore nella ricezione della richiesta.\n");
+		c->failed = 1;
+	}
+	conn_advance(u, c);
+}
+
+static void on_send(uring_t *u, uconn_t *c, int res) {
+	c->send_pending = 0;
+	if (res < 0) {
+		errorhandler("Errore nell'invio della risposta.\n");
+		c->failed = 1;
+	} else {
+		c->out_off += (size_t)res;
+		if (c->out_off == c->out_len) {
+			stats_record_stage(STAGE_BUILD_SEND, c->built_ns, stats_now_ns());
+			c->out_off = 0;
+			c->out_len = 0;
+		} else {
+			// invio parziale: il resto in testa al buffer (nessuna send in corso)
+			memmove(c->outbuf, c->outbuf + c->out_off, c->out_len - c->out_off);
+			c->out_len -= c->out_off;
+			c->out_off = 0;
+		}
+	}
+	conn_advance(u, c);
+}
+
+static void on_close(uring_t *u, uconn_t *c, int res) {
+	c->close_pending = 0;
+	if (res == -ECANCELED) {
+		// close collegata annullata da una send fallita o parziale
+		conn_advance(u, c);
+		return;
+	}
+	conn_free(u, c);
+}
+
+// Uscita dal ciclo dopo la registrazione presso upgrade.h: il ciclo non
+// accetta piu', quindi una chiusura graduale non deve attenderlo ne'
+// risvegliarlo.
+static int uring_leave(uring_t *u, int rc) {
+	upgrade_loop_stopped(u->loop_id);
+	uring_free(u);
+	return rc;
+}
+
+int run_uring_loop(int listen_socket) {
+	uring_t u;
+	if (uring_init(&u) != 0) return URING_UNAVAILABLE;
+	timer_init(&u.wheel, timer_now_ms());
+	if (arm_accept(&u, listen_socket) != 0) {
+		uring_free(&u);
+		return URING_UNAVAILABLE;
+	}
+	u.loop_id = upgrade_register_loop(1);
+
+	int accepted = 0;
+	for (;;) {
+		// prima dell'attesa: il segnale di upgrade.h la interrompe con EINTR
+		if (!u.draining && upgrade_draining()) drain_start(&u);
+		if (uring_submit(&u, 1) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+			errorhandler("errore in io_uring_enter.\n");
+			return uring_leave(&u, accepted ? -1 : URING_UNAVAILABLE);
+		}
+
+		unsigned head = *u.cq_head;
+		unsigned tail = __atomic_load_n(u.cq_tail, __ATOMIC_ACQUIRE);
+		while (head != tail) {
+			struct io_uring_cqe *cqe = &u.cqes[head & *u.cq_mask];
+			uint64_t data = cqe->user_data;
+			int res = cqe->res;
+			unsigned flags = cqe->flags;
+			head++;
+			// il completamento viene liberato subito: i gestori possono
+			// accodare nuove sottomissioni
+			__atomic_store_n(u.cq_head, head, __ATOMIC_RELEASE);
+
+			uconn_t *c = (uconn_t *)(uintptr_t)(data & ~OP_MASK);
+			switch (data & OP_MASK) {
+				case OP_ACCEPT:
+					if (res >= 0) {
+						accepted = 1;
+						on_accept(&u, res);
+					} else if (!accepted && res == -EINVAL) {
+						// accept multishot non supportata da questo kernel:
+						// il ciclo che subentra si registra a sua volta
+						return uring_leave(&u, URING_UNAVAILABLE);
+					} else if (res != -EINTR && res != -ECONNABORTED && res != -ECANCELED) {
+						// EMFILE/ENFILE e simili: si continua con la prossima
+						errorhandler("errore nella accept.\n");
+					}
+					if (flags & IORING_CQE_F_MORE) break;
+					if (u.draining) {
+						// ultimo completamento della accept annullata: le
+						// connessioni gia' accettate sono state contate
+						upgrade_loop_stopped(u.loop_id);
+					} else if (arm_accept(&u, listen_socket) != 0) {
+						return uring_leave(&u, -1);
+					}
+					break;
+				case OP_RECV:
+					on_recv(&u, c, res, flags);
+					break;
+				case OP_SEND:
+					on_send(&u, c, res);
+					break;
+				case OP_CLOSE:
+					on_close(&u, c, res);
+					break;
+				case OP_TIMEOUT:
+					u.tick_pending = 0;
+					break;
+				case OP_CANCEL:
+					break;
+			}
+			tail = __atomic_load_n(u.cq_tail, __ATOMIC_ACQUIRE);
+		}
+		deadlines_tick(&u);
+		arm_tick(&u);
+	}
+}
+
+#else
+
+int run_uring_loop(int listen_socket) {
+	(void)listen_socket;
+	return URING_UNAVAILABLE;
+}
+
+#endif /* HAVE_IO_URING */
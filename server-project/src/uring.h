@@ -0,0 +1,27 @@
+/*
+ * uring.h
+ *
+ * Backend di I/O basato su io_uring (Linux 6.0 o successivo), selezionato
+ * con -u. Accept, recv, send e close vengono accodati nell'anello di
+ * sottomissione e inviati al kernel con una sola io_uring_enter per ciclo,
+ * che raccoglie anche i completamenti. Se io_uring non e' disponibile
+ * (kernel datato, syscall disabilitata, header assenti) il server torna
+ * al percorso con i socket.
+ */
+
+#ifndef URING_H_
+#define URING_H_
+
+#define URING_ENTRIES     256    // voci dell'anello di sottomissione
+#define URING_CQ_ENTRIES  4096   // voci dell'anello di completamento
+#define URING_BUF_COUNT   1024   // buffer forniti al kernel per le recv
+#define URING_BUF_SIZE    128    // una richiesta classica sta in un buffer
+
+#define URING_UNAVAILABLE (-2)
+
+// Esegue il ciclo io_uring sul socket di ascolto fornito (gia' in listen).
+// Ritorna URING_UNAVAILABLE se io_uring non puo' essere usato, prima di
+// aver accettato connessioni, oppure -1 in caso di errore fatale.
+int run_uring_loop(int listen_socket);
+
+#endif /* URING_H_ */
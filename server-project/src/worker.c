@@ -0,0 +1,148 @@
+/*
+ * worker.c
+ *
+ * Pool di worker del server. Ogni worker e' un thread con un proprio
+ * socket di ascolto legato alla stessa porta tramite SO_REUSEPORT: il
+ * kernel bilancia le nuove connessioni tra i socket, senza una accept
+ * condivisa. Dove SO_REUSEPORT non e' disponibile i worker condividono
+ * un unico socket di ascolto.
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE // pthread_setaffinity_np
+#endif
+
+#include "worker.h"
+#include "protocol.h"
+#include "rng.h"
+#include "upgrade.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#define closesocket close
+#endif
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+// Contatore per worker allineato alla linea di cache: ogni worker scrive
+// solo il proprio, quindi non c'e' false sharing ne' contesa.
+typedef struct {
+	_Alignas(CACHE_LINE_SIZE) atomic_ulong requests;
+} worker_counter_t;
+
+typedef struct {
+	int id;
+	int listen_socket;
+	const worker_config_t *cfg;
+	pthread_t thread;
+} worker_t;
+
+static worker_counter_t counters[MAX_WORKERS];
+static _Thread_local int current_worker = 0;
+
+void worker_count_request(void) {
+	// unico scrittore per contatore: load+store rilassati, niente lock add
+	atomic_ulong *c = &counters[current_worker].requests;
+	atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+static void pin_to_cpu(int id) {
+#if defined(__linux__)
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpu <= 0) return;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET((int)(id % ncpu), &set);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+		printf("Worker %d: impossibile fissare l'affinita' CPU.\n", id);
+	}
+#else
+	(void)id;
+#endif
+}
+
+static void *worker_main(void *arg) {
+	worker_t *w = (worker_t *)arg;
+	current_worker = w->id;
+	// seme diverso per ogni worker: stato PRNG indipendente e, con
+	// --seed, riproducibile
+	rng_seed_thread(server_options.seed + (uint64_t)w->id);
+	if (w->cfg->pin_cpus) {
+		pin_to_cpu(w->id);
+	}
+
+	run_server_loop(w->listen_socket, w->cfg);
+	return NULL;
+}
+
+static void report_loop(int threads, int interval) {
+	unsigned long last[MAX_WORKERS];
+	memset(last, 0, sizeof(last));
+	for (;;) {
+#if defined(_WIN32)
+		Sleep((DWORD)interval * 1000);
+#else
+		sleep((unsigned int)interval);
+#endif
+		unsigned long total = 0;
+		for (int i = 0; i < threads; i++) {
+			unsigned long now = atomic_load_explicit(&counters[i].requests, memory_order_relaxed);
+			printf("Worker %d: %lu richieste (+%lu)\n", i, now, now - last[i]);
+			total += now;
+			last[i] = now;
+		}
+		printf("Totale: %lu richieste\n", total);
+		fflush(stdout);
+	}
+}
+
+int run_workers(const struct sockaddr_in *server_addr, const worker_config_t *cfg) {
+	static worker_t workers[MAX_WORKERS];
+	int n = cfg->threads;
+
+#if defined(SO_REUSEPORT)
+	int reuseport = 1;
+	int shared_socket = -1;
+#else
+	int reuseport = 0;
+	int shared_socket = open_server_socket(server_addr, cfg, 0);
+	if (shared_socket < 0) return -1;
+#endif
+
+	for (int i = 0; i < n; i++) {
+		workers[i].id = i;
+		workers[i].cfg = cfg;
+		workers[i].listen_socket = reuseport ? open_server_socket(server_addr, cfg, 1) : shared_socket;
+		if (workers[i].listen_socket < 0) return -1;
+		if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) != 0) {
+			errorhandler("errore nella creazione del worker.\n");
+			return -1;
+		}
+	}
+	upgrade_ready();
+
+	if (cfg->report_interval > 0) {
+		report_loop(n, cfg->report_interval);
+	}
+
+	for (int i = 0; i < n; i++) {
+		pthread_join(workers[i].thread, NULL);
+		if (reuseport) closesocket(workers[i].listen_socket);
+	}
+	if (!reuseport) closesocket(shared_socket);
+	printf("Server terminato.\n");
+	return -1;
+}
@@ -0,0 +1,40 @@
+/*
+ * worker.h
+ *
+ * Pool di worker multi-core: ogni worker ha il proprio socket di ascolto
+ * (SO_REUSEPORT sulla stessa porta), il proprio stato PRNG e i propri
+ * contatori, cosi' il percorso di una richiesta non tocca alcun lock.
+ */
+
+#ifndef WORKER_H_
+#define WORKER_H_
+
+#define MAX_WORKERS     64
+#define CACHE_LINE_SIZE 64
+
+// Configurazione del pool, compilata da main() a partire dagli argomenti
+typedef struct {
+	int threads;          // numero di worker (-t)
+	int use_epoll;        // ogni worker usa l'event loop epoll (-e)
+	int use_uring;        // ogni worker usa il backend io_uring (-u)
+	int use_udp;          // trasporto UDP al posto di TCP (--udp)
+	int pin_cpus;         // fissa il worker i sulla CPU i (--pin)
+	int report_interval;  // secondi tra due report per worker, 0 = nessuno (-S)
+} worker_config_t;
+
+struct sockaddr_in;
+
+// Avvia i worker e, se richiesto, stampa periodicamente il numero di
+// richieste servite da ciascuno. Ritorna solo in caso di errore (-1).
+int run_workers(const struct sockaddr_in *server_addr, const worker_config_t *cfg);
+
+// Socket del server per il trasporto scelto in cfg (TCP in ascolto o UDP)
+// e ciclo scelto in cfg (UDP, io_uring, epoll o bloccante); definite in
+// main.c
+int open_server_socket(const struct sockaddr_in *server_addr, const worker_config_t *cfg, int reuseport);
+int run_server_loop(int listen_socket, const worker_config_t *cfg);
+
+// Incrementa il contatore di richieste del worker corrente (nessun lock)
+void worker_count_request(void);
+
+#endif /* WORKER_H_ */
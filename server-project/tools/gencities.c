@@ -0,0 +1,100 @@
+/*
+ * gencities.c
+ *
+ * Generatore della tabella hash perfetta delle città (src/city_hash.h).
+ * Schema "hash and displace": un primo hash assegna ogni città a un
+ * bucket, poi per ogni bucket si cerca un seme di spostamento tale che
+ * tutte le sue città cadano in slot ancora liberi della tabella. A runtime
+ * la ricerca costa due hash, un accesso e un confronto, indipendentemente
+ * dal numero di città.
+ *
+ * Uso (dalla cartella server-project):
+ *   gcc -O2 -Isrc -o gencities tools/gencities.c && ./gencities > src/city_hash.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cities.h"
+
+#define CITY_NAME(id, name) name,
+static const char *const names[CITY_COUNT] = { CITY_LIST(CITY_NAME) };
+#undef CITY_NAME
+
+#define KEYS_PER_BUCKET 4
+
+static unsigned int nbuckets;
+static int bucket_size[CITY_COUNT];   // al piu' un bucket per città
+static int order[CITY_COUNT];
+static uint32_t disp[CITY_COUNT];
+
+static int by_size_desc(const void *a, const void *b) {
+	return bucket_size[*(const int *)b] - bucket_size[*(const int *)a];
+}
+
+int main(void) {
+	unsigned int size = 1;
+	while (size < CITY_COUNT + CITY_COUNT / 4) size <<= 1; // fattore di carico <= 0.8
+	nbuckets = (CITY_COUNT + KEYS_PER_BUCKET - 1) / KEYS_PER_BUCKET;
+
+	int *slots = malloc(size * sizeof(int));
+	if (!slots) return 1;
+
+	for (int id = 0; id < CITY_COUNT; id++) {
+		bucket_size[city_hash(0, names[id], strlen(names[id])) % nbuckets]++;
+	}
+	for (unsigned int b = 0; b < nbuckets; b++) order[b] = (int)b;
+	qsort(order, nbuckets, sizeof(int), by_size_desc);
+	for (unsigned int i = 0; i < size; i++) slots[i] = CITY_ID_NONE;
+
+	// I bucket piu' popolati vengono sistemati per primi, quando la
+	// tabella e' ancora quasi vuota.
+	for (unsigned int k = 0; k < nbuckets; k++) {
+		unsigned int b = (unsigned int)order[k];
+		if (bucket_size[b] == 0) break;
+		int members[64];
+		int n = 0;
+		for (int id = 0; id < CITY_COUNT && n < 64; id++) {
+			if (city_hash(0, names[id], strlen(names[id])) % nbuckets == b) members[n++] = id;
+		}
+		uint32_t d;
+		for (d = 1; d < 10000000u; d++) {
+			uint32_t taken[64];
+			int ok = 1;
+			for (int i = 0; i < n && ok; i++) {
+				uint32_t s = city_hash(d, names[members[i]], strlen(names[members[i]])) & (size - 1);
+				if (slots[s] != CITY_ID_NONE) ok = 0;
+				for (int j = 0; j < i && ok; j++) if (taken[j] == s) ok = 0;
+				taken[i] = s;
+			}
+			if (!ok) continue;
+			for (int i = 0; i < n; i++) slots[taken[i]] = members[i];
+			disp[b] = d;
+			break;
+		}
+		if (d == 10000000u) {
+			fprintf(stderr, "nessun seme trovato per il bucket %u\n", b);
+			return 1;
+		}
+	}
+
+	printf("/*\n * city_hash.h\n *\n");
+	printf(" * GENERATO da tools/gencities.c: non modificare a mano.\n");
+	printf(" * Tabella hash perfetta (hash and displace) per le città di CITY_LIST.\n */\n\n");
+	printf("#ifndef CITY_HASH_H_\n#define CITY_HASH_H_\n\n");
+	printf("#include <stdint.h>\n\n");
+	printf("#define CITY_HASH_BUCKETS %u\n", nbuckets);
+	printf("#define CITY_HASH_SIZE    %u\n\n", size);
+	printf("static const uint32_t city_hash_disp[CITY_HASH_BUCKETS] = {\n");
+	for (unsigned int b = 0; b < nbuckets; b++) {
+		printf("%s%uu,%s", (b % 8) ? " " : "\t", disp[b], (b % 8 == 7 || b + 1 == nbuckets) ? "\n" : "");
+	}
+	printf("};\n\n");
+	printf("static const int16_t city_hash_slots[CITY_HASH_SIZE] = {\n");
+	for (unsigned int i = 0; i < size; i++) {
+		printf("%s%d,%s", (i % 8) ? " " : "\t", slots[i], (i % 8 == 7 || i + 1 == size) ? "\n" : "");
+	}
+	printf("};\n\n#endif /* CITY_HASH_H_ */\n");
+	return 0;
+}
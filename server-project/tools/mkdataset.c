@@ -0,0 +1,347 @@
+/*
+ * mkdataset.c
+ *
+ * Convertitore offline da CSV al dataset binario del server (dataset.h).
+ * Ogni riga e' "nome,t,h,w,p": per ogni metrica un valore osservato
+ * ("21.5"), un intervallo in cui il server genera il valore ("15:25")
+ * oppure un campo vuoto per l'intervallo dei generatori interni. I
+ * valori devono essere finiti e al piu' 3276.7 in modulo (formato v2).
+ * Righe vuote, commenti (#) e un'intestazione che inizia con "name" o
+ * "city" vengono ignorati. I nomi sono unici senza distinzione tra maiuscole e
+ * minuscole e lunghi al piu' BATCH_CITY_MAX byte.
+ *
+ * La tabella hash perfetta e' costruita con lo stesso schema di
+ * gencities.c, con i bucket ordinati per dimensione in tempo lineare;
+ * per la ricerca per prefisso si aggiungono gli id in ordine alfabetico
+ * e le relative chiavi (dataset_key).
+ * Il file viene scritto accanto alla destinazione e poi rinominato: un
+ * server che lo ha mappato continua a vedere il contenuto precedente
+ * finche' non riceve SIGHUP.
+ *
+ * Uso (dalla cartella server-project):
+ *   gcc -O2 -Isrc -o mkdataset tools/mkdataset.c -lm
+ *   ./mkdataset citta.csv citta.wxd && kill -HUP <pid del server>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <math.h>
+
+#include "cities.h"
+#include "dataset.h"
+#include "protocol.h"
+
+#define KEYS_PER_BUCKET 4
+#define MAX_DISPLACEMENT 1000000u   // semi provati per bucket prima di ingrandire la tabella
+#define MAX_GROWTH       4            // raddoppi della tabella oltre il fattore di carico 0.8
+
+// Intervalli dei generatori interni (get_* in main.c), per i campi vuoti
+static const float default_lo[DATASET_METRICS] = { -10.0f, 20.0f, 0.0f, 950.0f };
+static const float default_hi[DATASET_METRICS] = { 40.0f, 100.0f, 100.0f, 1050.0f };
+
+static dataset_city_t *cities;
+static char *names;
+static uint32_t count, capacity;
+static size_t names_size, names_capacity;
+
+static char *trim(char *s) {
+	while (isspace((unsigned char)*s)) s++;
+	char *end = s + strlen(s);
+	while (end > s && isspace((unsigned char)end[-1])) *--end = '\0';
+	return s;
+}
+
+// Valore servibile in entrambi i formati: finito e entro l'int16 in
+// decimi del formato v2 (+-V2_VALUE_MAX / V2_VALUE_SCALE)
+static int representable(float v) {
+	return isfinite(v) && fabsf(v) * V2_VALUE_SCALE <= V2_VALUE_MAX;
+}
+
+// Campo di una metrica: vuoto, valore o lo:hi. Ritorna 0 o -1.
+static int parse_metric(char *field, int m, float *lo, float *hi) {
+	field = trim(field);
+	if (*field == '\0') {
+		*lo = default_lo[m];
+		*hi = default_hi[m];
+		return 0;
+	}
+	char *end;
+	*lo = strtof(field, &end);
+	if (end == field || !representable(*lo)) return -1;
+	if (*end == ':') {
+		char *start = end + 1;
+		*hi = strtof(start, &end);
+		if (end == start || !representable(*hi) || *hi < *lo) return -1;
+	} else {
+		*hi = *lo;
+	}
+	return *trim(end) == '\0' ? 0 : -1;
+}
+
+static int add_city(const char *name, size_t len, const float *lo, const float *hi) {
+	if (count == capacity) {
+		capacity = capacity ? capacity * 2 : 1024;
+		dataset_city_t *c = realloc(cities, capacity * sizeof(*c));
+		if (!c) return -1;
+		cities = c;
+	}
+	if (names_size + len > names_capacity) {
+		names_capacity = names_capacity ? names_capacity * 2 : 16384;
+		char *n = realloc(names, names_capacity);
+		if (!n) return -1;
+		names = n;
+	}
+	dataset_city_t *c = &cities[count++];
+	memset(c, 0, sizeof(*c));
+	c->name_off = (uint32_t)names_size;
+	c->name_len = (uint32_t)len;
+	memcpy(c->lo, lo, sizeof(c->lo));
+	memcpy(c->hi, hi, sizeof(c->hi));
+	memcpy(names + names_size, name, len);
+	names_size += len;
+	return 0;
+}
+
+static int read_csv(FILE *in, const char *path) {
+	char line[1024];
+	unsigned long lineno = 0;
+	while (fgets(line, sizeof(line), in)) {
+		lineno++;
+		char *fields[1 + DATASET_METRICS] = { line, "", "", "", "" };
+		int nf = 1;
+		for (char *p = line; *p && nf <= DATASET_METRICS; p++) {
+			if (*p == ',') {
+				*p = '\0';
+				fields[nf++] = p + 1;
+			}
+		}
+		char *name = trim(fields[0]);
+		if (*name == '\0' || *name == '#') continue;
+		if (lineno == 1 && (strcasecmp(name, "name") == 0 || strcasecmp(name, "city") == 0)) continue;
+
+		size_t len = strlen(name);
+		float lo[DATASET_METRICS], hi[DATASET_METRICS];
+		int ok = len <= BATCH_CITY_MAX && strchr(fields[DATASET_METRICS], ',') == NULL;
+		for (int m = 0; m < DATASET_METRICS && ok; m++) {
+			ok = parse_metric(fields[1 + m], m, &lo[m], &hi[m]) == 0;
+		}
+		if (!ok) {
+			fprintf(stderr, "%s:%lu: riga non valida\n", path, lineno);
+			return -1;
+		}
+		if (count == DATASET_MAX_CITIES || add_city(name, len, lo, hi) != 0) {
+			fprintf(stderr, "%s:%lu: troppe citta'\n", path, lineno);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int same_name(uint32_t a, uint32_t b) {
+	if (cities[a].name_len != cities[b].name_len) return 0;
+	const char *x = names + cities[a].name_off;
+	const char *y = names + cities[b].name_off;
+	for (uint32_t i = 0; i < cities[a].name_len; i++) {
+		if (tolower((unsigned char)x[i]) != tolower((unsigned char)y[i])) return 0;
+	}
+	return 1;
+}
+
+// Ordine alfabetico senza distinzione tra maiuscole e minuscole (ASCII,
+// come dataset_fold); a parita' di prefisso il nome piu' corto viene prima
+static int by_name(const void *pa, const void *pb) {
+	const dataset_city_t *a = &cities[*(const uint32_t *)pa];
+	const dataset_city_t *b = &cities[*(const uint32_t *)pb];
+	uint32_t len = a->name_len < b->name_len ? a->name_len : b->name_len;
+	for (uint32_t i = 0; i < len; i++) {
+		unsigned char x = dataset_fold((unsigned char)names[a->name_off + i]);
+		unsigned char y = dataset_fold((unsigned char)names[b->name_off + i]);
+		if (x != y) return x < y ? -1 : 1;
+	}
+	return (a->name_len > b->name_len) - (a->name_len < b->name_len);
+}
+
+static uint32_t hash_of(uint32_t seed, uint32_t id) {
+	return city_hash(seed, names + cities[id].name_off, cities[id].name_len);
+}
+
+// Hash and displace: riempie disp e slots. Ritorna 0, 1 se un bucket non
+// trova un seme entro MAX_DISPLACEMENT (si riprova con una tabella piu'
+// grande) o -1 per gli altri errori.
+static int build_hash(uint32_t nbuckets, uint32_t size, uint32_t *disp, int32_t *slots) {
+	// città raggruppate per bucket (ordinamento per conteggio)
+	int rc = 0;
+	uint32_t *start = calloc(nbuckets + 1, sizeof(uint32_t));
+	uint32_t *members = malloc((count ? count : 1) * sizeof(uint32_t));
+	uint32_t *order = malloc(nbuckets * sizeof(uint32_t));
+	uint32_t *taken = malloc((count ? count : 1) * sizeof(uint32_t));
+	uint32_t *fill = NULL;
+	uint32_t *by_size = NULL;
+	if (!start || !members || !order || !taken) {
+		rc = -1;
+		goto done;
+	}
+	for (uint32_t id = 0; id < count; id++) start[hash_of(0, id) % nbuckets + 1]++;
+	uint32_t max_size = 0;
+	for (uint32_t b = 0; b < nbuckets; b++) {
+		if (start[b + 1] > max_size) max_size = start[b + 1];
+		start[b + 1] += start[b];
+	}
+	fill = calloc(nbuckets, sizeof(uint32_t));
+	by_size = calloc(max_size + 2, sizeof(uint32_t));
+	if (!fill || !by_size) {
+		rc = -1;
+		goto done;
+	}
+	for (uint32_t id = 0; id < count; id++) {
+		uint32_t b = hash_of(0, id) % nbuckets;
+		members[start[b] + fill[b]++] = id;
+	}
+	// bucket in ordine di dimensione decrescente: i piu' popolati vengono
+	// sistemati per primi, quando la tabella e' ancora quasi vuota
+	for (uint32_t b = 0; b < nbuckets; b++) by_size[max_size - (start[b + 1] - start[b]) + 1]++;
+	for (uint32_t k = 0; k <= max_size; k++) by_size[k + 1] += by_size[k];
+	for (uint32_t b = 0; b < nbuckets; b++) order[by_size[max_size - (start[b + 1] - start[b])]++] = b;
+
+	for (uint32_t i = 0; i < size; i++) slots[i] = CITY_ID_NONE;
+	for (uint32_t k = 0; k < nbuckets && rc == 0; k++) {
+		uint32_t b = order[k];
+		uint32_t *m = &members[start[b]];
+		uint32_t n = start[b + 1] - start[b];
+		disp[b] = 0;
+		if (n == 0) break;
+		for (uint32_t i = 0; i < n; i++) {
+			for (uint32_t j = 0; j < i; j++) {
+				if (same_name(m[i], m[j])) {
+					fprintf(stderr, "citta' duplicata: %.*s\n", (int)cities[m[i]].name_len,
+							names + cities[m[i]].name_off);
+					rc = -1;
+					goto done;
+				}
+			}
+		}
+		uint32_t d;
+		for (d = 1; d < MAX_DISPLACEMENT; d++) {
+			int ok = 1;
+			for (uint32_t i = 0; i < n && ok; i++) {
+				uint32_t s = hash_of(d, m[i]) & (size - 1);
+				if (slots[s] != CITY_ID_NONE) ok = 0;
+				for (uint32_t j = 0; j < i && ok; j++) if (taken[j] == s) ok = 0;
+				taken[i] = s;
+			}
+			if (!ok) continue;
+			for (uint32_t i = 0; i < n; i++) slots[taken[i]] = (int32_t)m[i];
+			disp[b] = d;
+			break;
+		}
+		if (d == MAX_DISPLACEMENT) rc = 1;
+	}
+done:
+	free(start);
+	free(members);
+	free(order);
+	free(taken);
+	free(fill);
+	free(by_size);
+	return rc;
+}
+
+static uint64_t align8(uint64_t off) {
+	return (off + 7) & ~(uint64_t)7;
+}
+
+static int write_section(FILE *out, uint64_t *pos, uint64_t off, const void *data, size_t len) {
+	static const char zeros[8];
+	if (fwrite(zeros, 1, (size_t)(off - *pos), out) != off - *pos) return -1;
+	if (len > 0 && fwrite(data, 1, len, out) != len) return -1;
+	*pos = off + len;
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 3) {
+		fprintf(stderr, "uso: %s <file.csv | -> <dataset>\n", argv[0]);
+		return 1;
+	}
+	FILE *in = strcmp(argv[1], "-") == 0 ? stdin : fopen(argv[1], "r");
+	if (!in) {
+		perror(argv[1]);
+		return 1;
+	}
+	if (read_csv(in, argv[1]) != 0) return 1;
+	if (in != stdin) fclose(in);
+
+	uint32_t size = 1;
+	while (size < count + count / 4) size <<= 1; // fattore di carico <= 0.8
+	uint32_t nbuckets = (count + KEYS_PER_BUCKET - 1) / KEYS_PER_BUCKET;
+	if (nbuckets == 0) nbuckets = 1;
+	uint32_t *disp = calloc(nbuckets, sizeof(uint32_t));
+	int32_t *slots = NULL;
+	if (!disp) return 1;
+	// di rado un bucket non trova semi liberi: si riprova con piu' slot
+	for (int growth = 0;; growth++, size <<= 1) {
+		free(slots);
+		slots = malloc((size_t)size * sizeof(int32_t));
+		int rc = slots ? build_hash(nbuckets, size, disp, slots) : -1;
+		if (rc == 0) break;
+		if (rc < 0) return 1;
+		if (growth == MAX_GROWTH) {
+			fprintf(stderr, "nessun seme trovato con %u slot\n", size);
+			return 1;
+		}
+	}
+
+	// indice per la ricerca per prefisso: id ordinati e chiavi a 8 byte
+	uint32_t *sorted = malloc((count ? count : 1) * sizeof(uint32_t));
+	uint64_t *keys = malloc((count ? count : 1) * sizeof(uint64_t));
+	if (!sorted || !keys) return 1;
+	for (uint32_t id = 0; id < count; id++) sorted[id] = id;
+	qsort(sorted, count, sizeof(uint32_t), by_name);
+	for (uint32_t i = 0; i < count; i++) {
+		keys[i] = dataset_key(names + cities[sorted[i]].name_off, cities[sorted[i]].name_len);
+	}
+
+	dataset_header_t h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, DATASET_MAGIC, sizeof(h.magic));
+	h.format = DATASET_FORMAT;
+	h.byte_order = DATASET_BYTE_ORDER;
+	h.city_count = count;
+	h.hash_buckets = nbuckets;
+	h.hash_size = size;
+	h.names_size = (uint32_t)names_size;
+	h.cities_off = sizeof(h);
+	h.names_off = h.cities_off + (uint64_t)count * sizeof(dataset_city_t);
+	h.disp_off = align8(h.names_off + names_size);
+	h.slots_off = align8(h.disp_off + (uint64_t)nbuckets * sizeof(uint32_t));
+	h.sorted_off = align8(h.slots_off + (uint64_t)size * sizeof(int32_t));
+	h.keys_off = align8(h.sorted_off + (uint64_t)count * sizeof(uint32_t));
+
+	// scrittura su un file temporaneo e rename atomica
+	char tmp[4096];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", argv[2]);
+	FILE *out = fopen(tmp, "wb");
+	if (!out) {
+		perror(tmp);
+		return 1;
+	}
+	uint64_t pos = 0;
+	int rc = write_section(out, &pos, 0, &h, sizeof(h));
+	if (rc == 0) rc = write_section(out, &pos, h.cities_off, cities, (size_t)count * sizeof(dataset_city_t));
+	if (rc == 0) rc = write_section(out, &pos, h.names_off, names, names_size);
+	if (rc == 0) rc = write_section(out, &pos, h.disp_off, disp, nbuckets * sizeof(uint32_t));
+	if (rc == 0) rc = write_section(out, &pos, h.slots_off, slots, size * sizeof(int32_t));
+	if (rc == 0) rc = write_section(out, &pos, h.sorted_off, sorted, (size_t)count * sizeof(uint32_t));
+	if (rc == 0) rc = write_section(out, &pos, h.keys_off, keys, (size_t)count * sizeof(uint64_t));
+	if (fclose(out) != 0 || rc != 0 || rename(tmp, argv[2]) != 0) {
+		perror(argv[2]);
+		remove(tmp);
+		return 1;
+	}
+	printf("%s: %u citta', %u bucket, %u slot, %llu byte\n", argv[2], count, nbuckets, size,
+			(unsigned long long)pos);
+	return 0;
+}
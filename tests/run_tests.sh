@@ -0,0 +1,128 @@
+#!/bin/sh
+#
+# run_tests.sh
+#
+# Compila il server e i test nella cartella tests/build ed esegue prima
+# i test di unita' sui moduli del server e del client, poi i test end-to-end su
+# loopback contro ogni backend di I/O del server (ciclo bloccante,
+# epoll, io_uring). Esegue tutti i test e termina con codice di uscita
+# diverso da zero se almeno uno fallisce.
+#
+# Uso (da qualsiasi cartella):
+#   tests/run_tests.sh
+# Variabili d'ambiente opzionali:
+#   CC, CFLAGS   compilatore e opzioni (default gcc, -O2 con assert)
+#   PORT         prima porta del server di prova (default casuale, una
+#                porta diversa per scenario)
+
+set -e
+
+cd "$(dirname "$0")"
+ROOT=..
+OUT=build
+CC=${CC:-gcc}
+CFLAGS=${CFLAGS:-"-std=gnu11 -O2 -Wall -Wextra -pthread"}
+PORT=${PORT:-$((20000 + $$ % 30000))}
+FAILED=0
+
+mkdir -p "$OUT"
+$CC $CFLAGS -o "$OUT/server" $ROOT/server-project/src/*.c -lm
+$CC $CFLAGS -I$ROOT/server-project/src -o "$OUT/test_pipeline" test_pipeline.c
+# Sorgenti del server con main rinominato, linkati nei test di unita'
+mkdir -p "$OUT/server-obj"
+for src in $ROOT/server-project/src/*.c; do
+	$CC $CFLAGS -Dmain=server_main -c -o "$OUT/server-obj/$(basename "$src" .c).o" "$src"
+done
+for t in test_admit test_dataset test_history test_snapshot test_timer; do
+	$CC $CFLAGS -I$ROOT/server-project/src -o "$OUT/$t" $t.c "$OUT"/server-obj/*.o -lm
+done
+$CC $CFLAGS -I$ROOT/client-project/src \
+	-o "$OUT/test_rcache" test_rcache.c $ROOT/client-project/src/rcache.c
+$CC $CFLAGS -I$ROOT/server-project/src -o "$OUT/mkdataset" $ROOT/server-project/tools/mkdataset.c -lm
+
+# Dataset da 1, 1000 e 50000 città con nomi di più parole e la
+# temperatura osservata (test_dataset.c)
+for n in 1 1000 50000; do
+	awk -v n="$n" 'BEGIN {
+		split("San Santa Reggio Castel Monte Villa Borgo Porto", a, " ")
+		split("Calabria Emilia Marina Alto Basso Vecchio Nuovo Terme", b, " ")
+		for (i = 0; i < n; i++) printf "%s %s %d,%d.5,,,\n", a[i % 8 + 1], b[int(i / 8) % 8 + 1], i, i % 200 - 50
+	}' > "$OUT/cities-$n.csv"
+	"$OUT/mkdataset" "$OUT/cities-$n.csv" "$OUT/cities-$n.wxd" > /dev/null
+done
+
+# Due dataset da 300 città con intervalli disgiunti per ogni (città,
+# tipo): positivi nel primo, negativi nel secondo (test_snapshot.c)
+awk 'BEGIN {
+	for (c = 0; c < 300; c++) {
+		printf "Citta %d", c
+		for (t = 0; t < 4; t++) printf ",%d:%d.5", c * 10 + t, c * 10 + t
+		printf "\n"
+	}
+}' > "$OUT/snap-a.csv"
+awk 'BEGIN {
+	for (c = 0; c < 300; c++) {
+		printf "Citta %d", c
+		for (t = 0; t < 4; t++) printf ",-%d.5:-%d", c * 10 + t, c * 10 + t
+		printf "\n"
+	}
+}' > "$OUT/snap-b.csv"
+"$OUT/mkdataset" "$OUT/snap-a.csv" "$OUT/snap-a.wxd" > /dev/null
+"$OUT/mkdataset" "$OUT/snap-b.csv" "$OUT/snap-b.wxd" > /dev/null
+
+# Esegue un test e ne registra l'esito senza interrompere gli altri
+run() {
+	"$@" || FAILED=1
+}
+
+# Scenario end-to-end: $1 nome, $2 opzioni server, poi il test e i suoi
+# argomenti (PORT viene sostituita con la porta del server)
+e2e() {
+	name=$1
+	opts=$2
+	shift 2
+	"$OUT/server" -p "$PORT" $opts > /dev/null 2>&1 &
+	spid=$!
+	sleep 0.3
+	if ! kill -0 "$spid" 2>/dev/null; then
+		echo "e2e/$name: avvio del server fallito sulla porta $PORT" >&2
+		FAILED=1
+		PORT=$((PORT + 1))
+		return
+	fi
+	cmd=""
+	for a in "$@"; do
+		[ "$a" = PORT ] && a=$PORT
+		cmd="$cmd $a"
+	done
+	run $cmd
+	kill "$spid" 2>/dev/null || true
+	wait "$spid" 2>/dev/null || true
+	PORT=$((PORT + 1))
+}
+
+echo "== unita'"
+run "$OUT/test_admit"
+run "$OUT/test_dataset" "$OUT/cities-1.csv" "$OUT/cities-1.wxd" "$OUT/cities-1000.csv" \
+	"$OUT/cities-1000.wxd" "$OUT/cities-50000.csv" "$OUT/cities-50000.wxd"
+run "$OUT/test_history"
+run "$OUT/test_rcache" "$OUT/rcache.bin"
+run "$OUT/test_snapshot" "$OUT/snap.wxd" "$OUT/snap-a.wxd" "$OUT/snap-b.wxd"
+run "$OUT/test_timer"
+
+echo "== end-to-end (loopback)"
+# Molti frame batch piccoli in pipeline su una connessione: le risposte
+# riempiono il buffer di uscita del server a ogni giro
+e2e pipeline-blocking "-k" "$OUT/test_pipeline" PORT 5000 e2e/pipeline-blocking
+if [ "$(uname)" = "Linux" ]; then
+	e2e pipeline-epoll "-e -k" "$OUT/test_pipeline" PORT 5000 e2e/pipeline-epoll
+	e2e pipeline-epoll-4 "-e -k -t 4" "$OUT/test_pipeline" PORT 5000 e2e/pipeline-epoll-4
+	# se il kernel non supporta io_uring il server ripiega sui socket
+	e2e pipeline-uring "-u -k" "$OUT/test_pipeline" PORT 5000 e2e/pipeline-uring
+fi
+
+if [ "$FAILED" -ne 0 ]; then
+	echo "test falliti" >&2
+	exit 1
+fi
+echo "tutti i test superati"
@@ -0,0 +1,44 @@
+/*
+ * test.h
+ *
+ * Supporto comune ai test: controlli che non interrompono il test al
+ * primo errore, ma stampano file, riga e condizione fallita e contano i
+ * fallimenti. Il main di ogni test termina con test_done(), che riporta
+ *   <nome> ok
+ * oppure il numero di controlli falliti, e ritorna il codice di uscita.
+ */
+
+#ifndef TEST_H_
+#define TEST_H_
+
+#include <stdio.h>
+
+static int test_failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: controllo fallito: %s\n", __FILE__, __LINE__, #cond); \
+		test_failures++; \
+	} \
+} while (0)
+
+// Come CHECK, con un messaggio printf per i valori in gioco
+#define CHECKF(cond, ...) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: controllo fallito: %s: ", __FILE__, __LINE__, #cond); \
+		fprintf(stderr, __VA_ARGS__); \
+		fputc('\n', stderr); \
+		test_failures++; \
+	} \
+} while (0)
+
+static inline int test_done(const char *name) {
+	if (test_failures) {
+		printf("%-32s FALLITO (%d controlli)\n", name, test_failures);
+		return 1;
+	}
+	printf("%-32s ok\n", name);
+	return 0;
+}
+
+#endif /* TEST_H_ */
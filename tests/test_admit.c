@@ -0,0 +1,103 @@
+/*
+ * test_admit.c
+ *
+ * Test del controllo di ammissione (admit.h) con 2 connessioni e 10
+ * richieste al secondo per client con raffiche fino a 5:
+ *  - oltre il limite di connessioni una nuova connessione e' rifiutata
+ *    finche' un'altra non si chiude
+ *  - un client ottiene la raffica e poi una richiesta ogni 100 ms, senza
+ *    toccare il secchio degli altri client
+ *  - un batch costa quanto le sue voci, ma al piu' la raffica intera
+ *  - thread concorrenti sullo stesso client non superano il limite
+ */
+
+#include <stdio.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "test.h"
+#include "admit.h"
+
+#define RATE      10
+#define BURST     5
+#define THREADS   4
+#define RUN_MS    300
+
+static atomic_long admitted;
+static atomic_int stop;
+
+static long now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+static void sleep_ms(long ms) {
+	struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+	nanosleep(&ts, NULL);
+}
+
+static void *client_main(void *arg) {
+	(void)arg;
+	while (!atomic_load(&stop)) {
+		if (admit_request("10.0.0.9", 1) == 0) atomic_fetch_add(&admitted, 1);
+	}
+	return NULL;
+}
+
+int main(void) {
+	CHECK(admit_start(-1, 0, 0) == -1);
+	CHECK(admit_start(2, RATE, BURST) == 0);
+
+	CHECK(admit_conn_open() == 0);
+	CHECK(admit_conn_open() == 0);
+	CHECK(admit_conn_open() == -1);
+	admit_conn_close();
+	CHECK(admit_conn_open() == 0);
+	CHECK(admit_conn_open() == -1);
+	admit_conn_close();
+	admit_conn_close();
+
+	// raffica di BURST richieste, poi il secchio e' vuoto
+	for (int i = 0; i < BURST; i++) CHECKF(admit_request("10.0.0.1", 1) == 0, "richiesta %d", i);
+	CHECK(admit_request("10.0.0.1", 1) == -1);
+	// un altro client ha il proprio secchio
+	for (int i = 0; i < BURST; i++) CHECKF(admit_request("10.0.0.2", 1) == 0, "richiesta %d", i);
+	CHECK(admit_request("10.0.0.2", 1) == -1);
+
+	// costo di un batch: 3 + 2 voci riempiono la raffica
+	CHECK(admit_request("10.0.0.3", 3) == 0);
+	CHECK(admit_request("10.0.0.3", 2) == 0);
+	CHECK(admit_request("10.0.0.3", 1) == -1);
+	// un batch piu' grande della raffica la consuma tutta, senza debito
+	CHECK(admit_request("10.0.0.4", 100) == 0);
+	CHECK(admit_request("10.0.0.4", 1) == -1);
+
+	// dopo un intervallo torna disponibile una richiesta
+	sleep_ms(1000 / RATE + 10);
+	CHECK(admit_request("10.0.0.1", 1) == 0);
+
+	// molti client diversi: la prima richiesta di ognuno e' ammessa
+	int refused = 0;
+	for (int i = 0; i < 1000; i++) {
+		char ip[32];
+		snprintf(ip, sizeof(ip), "192.168.%d.%d", i / 256, i % 256);
+		refused += admit_request(ip, 1) != 0;
+	}
+	CHECKF(refused == 0, "%d client rifiutati alla prima richiesta", refused);
+
+	// thread concorrenti sullo stesso client: raffica piu' una richiesta
+	// per intervallo trascorso
+	pthread_t th[THREADS];
+	long start = now_ms();
+	for (int i = 0; i < THREADS; i++) pthread_create(&th[i], NULL, client_main, NULL);
+	sleep_ms(RUN_MS);
+	atomic_store(&stop, 1);
+	for (int i = 0; i < THREADS; i++) pthread_join(th[i], NULL);
+	long elapsed = now_ms() - start;
+	long limit = BURST + elapsed * RATE / 1000 + 1;
+	long n = atomic_load(&admitted);
+	CHECKF(n >= BURST && n <= limit, "%ld richieste ammesse in %ld ms (limite %ld)", n, elapsed, limit);
+	return test_done("unita/admit");
+}
@@ -0,0 +1,197 @@
+/*
+ * test_dataset.c
+ *
+ * Test dell'indice delle città di un dataset (dataset.h) generato da
+ * tools/mkdataset.c a partire dal CSV indicato:
+ *  - ogni nome del CSV, con maiuscole e minuscole mescolate, e' trovato
+ *    dalla tabella hash perfetta e porta alla città con quel nome e con
+ *    il valore osservato della sua riga
+ *  - nomi assenti (un carattere in piu', in meno o cambiato) non sono
+ *    trovati
+ *  - dataset_city_prefix coincide con una scansione lineare ordinata
+ * Controlla anche la tabella interna di cities.h (dataset NULL).
+ *
+ * Uso: test_dataset <citta.csv> <citta.wxd> [...]
+ * run_tests.sh genera CSV di diverse dimensioni, cosi' la tabella hash
+ * viene costruita con diversi numeri di bucket. I file vanno nella
+ * stessa cartella: il primo e' aperto, gli altri lo sostituiscono con
+ * dataset_reload come farebbe SIGHUP.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "dataset.h"
+#include "cities.h"
+#include "protocol.h"
+#include "rng.h"
+
+#define PREFIXES 200
+#define MAX_IDS  10
+
+typedef struct {
+	char name[BATCH_CITY_MAX + 1];
+	float t;
+} row_t;
+
+static row_t *rows;
+static int nrows;
+static const dataset_t *ds;
+
+// Righe "nome,t,h,w,p" del CSV generato da run_tests.sh
+static int load_csv(const char *path) {
+	FILE *f = fopen(path, "r");
+	if (!f) return -1;
+	char line[256];
+	nrows = 0;
+	int cap = 0;
+	while (fgets(line, sizeof(line), f)) {
+		char *comma = strchr(line, ',');
+		if (!comma) continue;
+		if (nrows == cap) {
+			cap = cap ? cap * 2 : 1024;
+			rows = realloc(rows, (size_t)cap * sizeof(*rows));
+			if (!rows) return -1;
+		}
+		*comma = '\0';
+		snprintf(rows[nrows].name, sizeof(rows[nrows].name), "%.*s", BATCH_CITY_MAX, line);
+		rows[nrows].t = strtof(comma + 1, NULL);
+		nrows++;
+	}
+	fclose(f);
+	return 0;
+}
+
+// Ordine dell'indice: alfabetico ASCII senza maiuscole e minuscole
+static int name_cmp(const char *a, size_t alen, const char *b, size_t blen) {
+	size_t n = alen < blen ? alen : blen;
+	for (size_t i = 0; i < n; i++) {
+		int d = dataset_fold((unsigned char)a[i]) - dataset_fold((unsigned char)b[i]);
+		if (d) return d;
+	}
+	return (alen > blen) - (alen < blen);
+}
+
+static int row_cmp(const void *a, const void *b) {
+	const row_t *x = a, *y = b;
+	return name_cmp(x->name, strlen(x->name), y->name, strlen(y->name));
+}
+
+static void check_lookups(rng_t *r) {
+	char name[BATCH_CITY_MAX + 2];
+	for (int i = 0; i < nrows; i++) {
+		size_t len = strlen(rows[i].name);
+		for (size_t k = 0; k < len; k++) {
+			unsigned char c = (unsigned char)rows[i].name[k];
+			name[k] = (char)(rng_range(r, 2) ? toupper(c) : tolower(c));
+		}
+		int id = dataset_city_lookup(ds, name, len);
+		CHECKF(id >= 0, "%s non trovata", rows[i].name);
+		if (id < 0) continue;
+		size_t found_len;
+		const char *found = dataset_city_name(ds, id, &found_len);
+		CHECKF(found && found_len == len && memcmp(found, rows[i].name, len) == 0,
+				"%s porta alla città %d", rows[i].name, id);
+		CHECKF(dataset_value(ds, id, 0) == rows[i].t, "%s: t %.1f invece di %.1f", rows[i].name,
+				dataset_value(ds, id, 0), rows[i].t);
+
+		// varianti assenti dello stesso nome
+		memcpy(name, rows[i].name, len);
+		name[len] = '#';
+		CHECK(dataset_city_lookup(ds, name, len + 1) == CITY_ID_NONE);
+		CHECK(dataset_city_lookup(ds, name, len - 1) != id);
+		name[len - 1] = '#';
+		CHECK(dataset_city_lookup(ds, name, len) == CITY_ID_NONE);
+		if (test_failures > 10) return;
+	}
+}
+
+static void check_prefix(const char *prefix, size_t plen) {
+	int ids[MAX_IDS];
+	int n = dataset_city_prefix(ds, prefix, plen, ids, MAX_IDS);
+	// rows e' ordinato: i risultati attesi sono i primi che iniziano
+	// con il prefisso
+	int want = 0;
+	for (int i = 0; i < nrows && want < MAX_IDS; i++) {
+		if (strlen(rows[i].name) < plen || strncasecmp(rows[i].name, prefix, plen) != 0) continue;
+		size_t len;
+		const char *name = want < n ? dataset_city_name(ds, ids[want], &len) : NULL;
+		CHECKF(name && len == strlen(rows[i].name) && memcmp(name, rows[i].name, len) == 0,
+				"prefisso \"%.*s\": risultato %d diverso da %s", (int)plen, prefix, want, rows[i].name);
+		want++;
+	}
+	CHECKF(n == want, "prefisso \"%.*s\": %d risultati invece di %d", (int)plen, prefix, n, want);
+}
+
+static void check_dataset(const char *csv, const char *wxd) {
+	if (load_csv(csv) != 0 || nrows == 0) {
+		fprintf(stderr, "%s non leggibile\n", csv);
+		test_failures++;
+		return;
+	}
+	// il primo file si apre, i successivi sostituiscono il corrente
+	static int opened;
+	char live[512];
+	const char *base = strrchr(wxd, '/');
+	snprintf(live, sizeof(live), "%.*sdataset.wxd", base ? (int)(base - wxd + 1) : 0, wxd);
+	unlink(live);
+	if (symlink(base ? base + 1 : wxd, live) != 0 || (opened ? dataset_reload() : dataset_open(live)) != 0) {
+		fprintf(stderr, "%s non valido\n", wxd);
+		test_failures++;
+		return;
+	}
+	opened = 1;
+
+	dataset_read_begin();
+	ds = dataset_current();
+	CHECKF(dataset_city_count(ds) == nrows, "%s: %d città invece di %d", wxd, dataset_city_count(ds), nrows);
+	rng_t *r = rng_thread();
+	check_lookups(r);
+	CHECK(dataset_city_lookup(ds, "", 0) == CITY_ID_NONE);
+	size_t len;
+	CHECK(dataset_city_name(ds, nrows, &len) == NULL);
+
+	qsort(rows, (size_t)nrows, sizeof(*rows), row_cmp);
+	check_prefix("", 0);
+	for (int q = 0; q < PREFIXES; q++) {
+		const char *name = rows[rng_range(r, (uint32_t)nrows)].name;
+		check_prefix(name, 1 + rng_range(r, (uint32_t)strlen(name)));
+	}
+	check_prefix("zzz", 3);
+	dataset_read_end();
+}
+
+// Tabella interna (dataset NULL): tutte le città di cities.h
+static void check_builtin(void) {
+	CHECK(dataset_city_count(NULL) == CITY_COUNT);
+	for (int id = 0; id < CITY_COUNT; id++) {
+		char upper[64];
+		size_t len = strlen(city_names[id]);
+		for (size_t k = 0; k <= len; k++) upper[k] = (char)toupper((unsigned char)city_names[id][k]);
+		CHECK(dataset_city_lookup(NULL, city_names[id], len) == id);
+		CHECK(dataset_city_lookup(NULL, upper, len) == id);
+		CHECK(dataset_city_lookup(NULL, upper, len - 1) == CITY_ID_NONE);
+	}
+	CHECK(dataset_city_lookup(NULL, "atlantide", 9) == CITY_ID_NONE);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 3 || argc % 2 == 0) {
+		fprintf(stderr, "uso: %s <citta.csv> <citta.wxd> [...]\n", argv[0]);
+		return 2;
+	}
+	// i messaggi di caricamento del dataset non servono nell'esito
+	int saved = dup(STDOUT_FILENO);
+	if (!freopen("/dev/null", "w", stdout)) return 2;
+	check_builtin();
+	for (int i = 1; i + 1 < argc; i += 2) check_dataset(argv[i], argv[i + 1]);
+	fflush(stdout);
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+	return test_done("unita/dataset");
+}
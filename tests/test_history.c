@@ -0,0 +1,115 @@
+/*
+ * test_history.c
+ *
+ * Test della cronologia dei valori (history.h) sulla tabella interna
+ * delle città:
+ *  - il numero di campioni e' arrotondato alla potenza di due e il ring
+ *    conserva solo gli ultimi
+ *  - aggregati (min, max, media, deviazione standard) sugli ultimi N
+ *    campioni e su una finestra di tempo
+ *  - coppie (città, tipo) indipendenti e id fuori dalla tabella ignorati
+ *  - scrittori concorrenti e un lettore: ogni aggregato contiene solo
+ *    valori scritti, mai slot a meta'
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "test.h"
+#include "history.h"
+#include "cities.h"
+
+#define WRITERS 4
+#define WRITES  200000
+
+static atomic_int writers_done;
+
+static int near(float a, float b) {
+	return fabsf(a - b) < 1e-3f;
+}
+
+static void sleep_ms(long ms) {
+	struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+	nanosleep(&ts, NULL);
+}
+
+// Ogni scrittore registra solo il proprio valore (1, 2, 3, 4)
+static void *writer_main(void *arg) {
+	float v = (float)(long)arg;
+	for (int i = 0; i < WRITES; i++) history_record(NULL, CITY_NAPOLI, 3, v);
+	atomic_fetch_add(&writers_done, 1);
+	return NULL;
+}
+
+int main(void) {
+	CHECK(history_start(0) == -1);
+	CHECK(history_start(HISTORY_MAX_SAMPLES + 1) == -1);
+	CHECK(!history_enabled());
+	CHECK(history_start(5) == 0); // 8 campioni per coppia
+	CHECK(history_enabled());
+
+	history_stats_t s;
+	history_aggregate(NULL, CITY_BARI, 0, 0, 0, &s);
+	CHECK(s.count == 0);
+
+	// 1..20: restano gli ultimi 8, cioe' 13..20
+	for (int i = 1; i <= 20; i++) history_record(NULL, CITY_BARI, 0, (float)i);
+	history_aggregate(NULL, CITY_BARI, 0, 0, 0, &s);
+	CHECKF(s.count == 8, "%u campioni", s.count);
+	CHECKF(near(s.min, 13) && near(s.max, 20), "min %.2f max %.2f", s.min, s.max);
+	CHECKF(near(s.mean, 16.5f), "media %.3f", s.mean);
+	CHECKF(near(s.stddev, sqrtf(5.25f)), "deviazione %.3f", s.stddev);
+
+	// ultimi 3: 18, 19, 20
+	history_aggregate(NULL, CITY_BARI, 0, 3, 0, &s);
+	CHECKF(s.count == 3 && near(s.min, 18) && near(s.max, 20) && near(s.mean, 19), "%u campioni, media %.3f",
+			s.count, s.mean);
+	CHECKF(near(s.stddev, sqrtf(2.0f / 3.0f)), "deviazione %.3f", s.stddev);
+	history_aggregate(NULL, CITY_BARI, 0, 1000, 0, &s);
+	CHECK(s.count == 8);
+
+	// le altre coppie non vedono questi campioni
+	history_aggregate(NULL, CITY_BARI, 1, 0, 0, &s);
+	CHECK(s.count == 0);
+	history_aggregate(NULL, CITY_ROMA, 0, 0, 0, &s);
+	CHECK(s.count == 0);
+
+	// finestra di tempo: solo il campione registrato dopo l'attesa
+	sleep_ms(60);
+	history_record(NULL, CITY_BARI, 0, 100.0f);
+	history_aggregate(NULL, CITY_BARI, 0, 0, 30, &s);
+	CHECKF(s.count == 1 && near(s.min, 100) && near(s.stddev, 0), "%u campioni", s.count);
+	history_aggregate(NULL, CITY_BARI, 0, 0, 10000, &s);
+	CHECK(s.count == 8 && near(s.max, 100) && near(s.min, 14));
+
+	// id fuori dalla tabella: ignorati
+	history_record(NULL, CITY_COUNT, 0, 1.0f);
+	history_record(NULL, -1, 0, 1.0f);
+	history_aggregate(NULL, CITY_COUNT, 0, 0, 0, &s);
+	CHECK(s.count == 0);
+
+	// scrittori concorrenti: gli aggregati letti intanto contengono solo
+	// valori interi tra 1 e WRITERS
+	pthread_t th[WRITERS];
+	for (long i = 0; i < WRITERS; i++) pthread_create(&th[i], NULL, writer_main, (void *)(i + 1));
+	long reads = 0;
+	while (atomic_load(&writers_done) < WRITERS) {
+		history_aggregate(NULL, CITY_NAPOLI, 3, 0, 0, &s);
+		if (s.count == 0) continue;
+		reads++;
+		CHECKF(s.count <= 8 && s.min >= 1 && s.max <= WRITERS && s.min == floorf(s.min) &&
+				s.max == floorf(s.max), "%u campioni, min %.3f, max %.3f", s.count, s.min, s.max);
+		if (test_failures > 10) break;
+	}
+	for (int i = 0; i < WRITERS; i++) pthread_join(th[i], NULL);
+	CHECKF(reads > 0, "nessun aggregato durante le scritture");
+	// uno slot scritto per ultimo da uno scrittore rimasto indietro di un
+	// giro viene scartato; un giro intero da un solo thread li rinnova tutti
+	for (int i = 0; i < 8; i++) history_record(NULL, CITY_NAPOLI, 3, 5.0f);
+	history_aggregate(NULL, CITY_NAPOLI, 3, 0, 0, &s);
+	CHECKF(s.count == 8 && s.min == 5 && s.max == 5, "%u campioni dopo gli scrittori", s.count);
+	return test_done("unita/history");
+}
@@ -0,0 +1,139 @@
+/*
+ * test_pipeline.c
+ *
+ * Test di regressione del pipelining: su una sola connessione invia
+ * molti frame batch piccoli (una voce ciascuno) senza attendere le
+ * risposte e verifica che arrivino tutte, in ordine, entro un tempo
+ * massimo. Le risposte superano il buffer di uscita del server, che
+ * deve riprendere il parsing dei frame rimasti nel buffer di ingresso
+ * dopo ogni svuotamento invece di fermarsi finche' il client non manda
+ * altri byte.
+ *
+ * Uso: test_pipeline <porta> <frame> <nome>
+ * run_tests.sh lo esegue contro ogni backend di I/O del server.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "test.h"
+#include "protocol.h"
+
+#define TIMEOUT_MS 5000
+#define FRAME_MAX  (BATCH_HEADER_SIZE + 2 + BATCH_CITY_MAX)
+#define REPLY_SIZE (BATCH_HEADER_SIZE + RESPONSE_SIZE)
+
+// Città della tabella interna e una inesistente, che deve rispondere
+// con il proprio status nella stessa posizione
+static const char *const cities[] = { "bari", "Milano", "ROMA", "atlantide", "napoli" };
+static const char types[] = { 't', 'h', 'w', 'p' };
+
+static long now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+static size_t encode_frame(unsigned char *out, long i) {
+	const char *city = cities[i % 5];
+	size_t len = strlen(city);
+	out[0] = BATCH_MAGIC;
+	out[1] = 0;
+	out[2] = 1;
+	out[3] = (unsigned char)types[i % 4];
+	out[4] = (unsigned char)len;
+	memcpy(&out[5], city, len);
+	return 5 + len;
+}
+
+static void check_reply(const unsigned char *r, long i) {
+	uint32_t status;
+	memcpy(&status, &r[BATCH_HEADER_SIZE], 4);
+	status = ntohl(status);
+	CHECKF(r[0] == BATCH_MAGIC && r[1] == 0 && r[2] == 1, "frame %ld: intestazione %02x %02x %02x",
+			i, r[0], r[1], r[2]);
+	if (i % 5 == 3) {
+		CHECKF(status == STATUS_CITY_NOT_AVAILABLE, "frame %ld: status %u", i, status);
+	} else {
+		CHECKF(status == STATUS_SUCCESS, "frame %ld: status %u", i, status);
+		CHECKF(r[BATCH_HEADER_SIZE + 4] == (unsigned char)types[i % 4], "frame %ld: tipo %c", i,
+				r[BATCH_HEADER_SIZE + 4]);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 4) {
+		fprintf(stderr, "uso: %s <porta> <frame> <nome>\n", argv[0]);
+		return 2;
+	}
+	int port = atoi(argv[1]);
+	long frames = atol(argv[2]);
+
+	unsigned char *out = malloc((size_t)frames * FRAME_MAX);
+	unsigned char *in = malloc((size_t)frames * REPLY_SIZE);
+	if (!out || !in) {
+		perror("malloc");
+		return 2;
+	}
+	size_t out_len = 0;
+	for (long i = 0; i < frames; i++) {
+		out_len += encode_frame(out + out_len, i);
+	}
+	size_t in_want = (size_t)frames * REPLY_SIZE;
+
+	int sock = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((uint16_t)port);
+	addr.sin_addr.s_addr = inet_addr(SERVER_IP);
+	if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("connect");
+		return 2;
+	}
+	fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+
+	// Scrive e legge insieme: il client non deve bloccare il server
+	// lasciando piene le proprie code
+	size_t sent = 0, got = 0;
+	long deadline = now_ms() + TIMEOUT_MS;
+	while (got < in_want) {
+		long left = deadline - now_ms();
+		if (left <= 0) break;
+		struct pollfd p = { .fd = sock, .events = POLLIN | (sent < out_len ? POLLOUT : 0) };
+		if (poll(&p, 1, (int)left) < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		if ((p.revents & POLLOUT) && sent < out_len) {
+			ssize_t n = send(sock, out + sent, out_len - sent, MSG_NOSIGNAL);
+			if (n > 0) sent += (size_t)n;
+			else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) break;
+		}
+		if (p.revents & (POLLIN | POLLHUP | POLLERR)) {
+			ssize_t n = recv(sock, in + got, in_want - got, 0);
+			if (n > 0) got += (size_t)n;
+			else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) break;
+		}
+	}
+	close(sock);
+
+	CHECKF(sent == out_len, "inviati %zu byte su %zu", sent, out_len);
+	CHECKF(got == in_want, "ricevuti %zu byte su %zu", got, in_want);
+	for (long i = 0; i < (long)(got / REPLY_SIZE); i++) {
+		check_reply(in + (size_t)i * REPLY_SIZE, i);
+		if (test_failures > 10) break;
+	}
+	free(out);
+	free(in);
+	return test_done(argv[3]);
+}
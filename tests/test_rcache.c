@@ -0,0 +1,176 @@
+/*
+ * test_rcache.c
+ *
+ * Test della cache persistente del client (rcache.h):
+ *  - una risposta registrata si ritrova con la stessa chiave, anche con
+ *    tipo e città in maiuscolo, e non con un altro server, porta o tipo
+ *  - la scadenza (ttl), le risposte di errore ignorate e la persistenza
+ *    dopo una riapertura del file; un file di formato diverso e' rifiutato
+ *  - processi concorrenti che riscrivono la stessa voce: un lettore vede
+ *    sempre valore e IP scritti insieme, mai una voce a meta'
+ *
+ * Uso: test_rcache <file di cache>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "test.h"
+#include "rcache.h"
+
+#define WRITERS 2
+#define WRITES  50000
+#define TTL_MS  60000
+
+static const char *path;
+static struct sockaddr_in server;
+
+static weather_request_t request(char type, const char *city) {
+	weather_request_t req;
+	memset(&req, 0, sizeof(req));
+	req.type = type;
+	snprintf(req.city, sizeof(req.city), "%s", city);
+	return req;
+}
+
+static void put(rcache_t *c, const struct sockaddr_in *srv, char type, const char *city, float value,
+		const char *peer) {
+	weather_request_t req = request(type, city);
+	weather_response_t r = { STATUS_SUCCESS, type, value };
+	rcache_put(c, srv, &req, &r, peer);
+}
+
+static int get(rcache_t *c, const struct sockaddr_in *srv, char type, const char *city, int ttl_ms,
+		weather_response_t *out, char *peer) {
+	weather_request_t req = request(type, city);
+	return rcache_get(c, srv, &req, ttl_ms, out, peer, 16);
+}
+
+// Ogni scrittore riscrive la stessa voce con valori propri e con il
+// valore stesso come IP, cosi' il lettore riconosce una voce mescolata
+static void writer_main(int id) {
+	rcache_t *c = rcache_open(path);
+	if (!c) _exit(2);
+	for (int i = 0; i < WRITES; i++) {
+		char peer[16];
+		int v = id * 1000000 + i;
+		snprintf(peer, sizeof(peer), "%d", v);
+		put(c, &server, 'h', "torino", (float)v, peer);
+	}
+	rcache_close(c);
+	_exit(0);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 2) {
+		fprintf(stderr, "uso: %s <file di cache>\n", argv[0]);
+		return 2;
+	}
+	path = argv[1];
+	unlink(path);
+	server.sin_family = AF_INET;
+	server.sin_port = htons(SERVER_PORT);
+	server.sin_addr.s_addr = inet_addr(SERVER_IP);
+	struct sockaddr_in other_port = server, other_addr = server;
+	other_port.sin_port = htons(SERVER_PORT + 1);
+	other_addr.sin_addr.s_addr = inet_addr("127.0.0.2");
+
+	rcache_t *c = rcache_open(path);
+	CHECK(c != NULL);
+	if (!c) return test_done("unita/rcache");
+	weather_response_t r;
+	char peer[16];
+	CHECK(get(c, &server, 't', "bari", TTL_MS, &r, peer) == -1);
+
+	put(c, &server, 't', "Bari", 21.5f, "127.0.0.1");
+	CHECK(get(c, &server, 't', "bari", TTL_MS, &r, peer) == 0);
+	CHECK(r.status == STATUS_SUCCESS && r.type == 't' && r.value == 21.5f && strcmp(peer, "127.0.0.1") == 0);
+	// il server non distingue maiuscole e minuscole in tipo e città
+	CHECK(get(c, &server, 'T', "BARI", TTL_MS, &r, peer) == 0);
+	CHECK(r.type == 't' && r.value == 21.5f);
+	CHECK(get(c, &server, 'h', "bari", TTL_MS, &r, peer) == -1);
+	CHECK(get(c, &other_port, 't', "bari", TTL_MS, &r, peer) == -1);
+	CHECK(get(c, &other_addr, 't', "bari", TTL_MS, &r, peer) == -1);
+	CHECK(get(c, &server, 't', "bari", 0, &r, peer) == -1);
+
+	// una nuova risposta sostituisce la precedente
+	put(c, &server, 'T', "bari", 22.0f, "127.0.0.3");
+	CHECK(get(c, &server, 't', "bari", TTL_MS, &r, peer) == 0);
+	CHECK(r.value == 22.0f && strcmp(peer, "127.0.0.3") == 0);
+
+	// le risposte di errore non vanno in cache
+	weather_request_t req = request('p', "atlantide");
+	weather_response_t err = { STATUS_CITY_NOT_AVAILABLE, '\0', 0.0f };
+	rcache_put(c, &server, &req, &err, "127.0.0.1");
+	CHECK(get(c, &server, 'p', "atlantide", TTL_MS, &r, peer) == -1);
+
+	// molte città diverse restano tutte
+	for (int i = 0; i < 200; i++) {
+		char city[32];
+		snprintf(city, sizeof(city), "citta %d", i);
+		put(c, &server, 'w', city, (float)i, "127.0.0.1");
+	}
+	int missing = 0;
+	for (int i = 0; i < 200; i++) {
+		char city[32];
+		snprintf(city, sizeof(city), "citta %d", i);
+		missing += get(c, &server, 'w', city, TTL_MS, &r, peer) != 0 || r.value != (float)i;
+	}
+	CHECKF(missing == 0, "%d città su 200 assenti", missing);
+
+	// la cache sopravvive alla riapertura
+	rcache_close(c);
+	c = rcache_open(path);
+	CHECK(c != NULL);
+	if (!c) return test_done("unita/rcache");
+	CHECK(get(c, &server, 't', "bari", TTL_MS, &r, peer) == 0 && r.value == 22.0f);
+
+	// scrittori concorrenti sulla stessa voce
+	pid_t pids[WRITERS];
+	for (int i = 0; i < WRITERS; i++) {
+		pids[i] = fork();
+		if (pids[i] == 0) writer_main(i + 1);
+	}
+	long reads = 0, mixed = 0;
+	for (;;) {
+		int running = 0;
+		for (int i = 0; i < WRITERS; i++) running += pids[i] > 0 && waitpid(pids[i], NULL, WNOHANG) == 0;
+		for (int k = 0; k < 1000; k++) {
+			if (get(c, &server, 'h', "torino", TTL_MS, &r, peer) != 0) continue;
+			reads++;
+			if ((float)atoi(peer) != r.value && mixed++ < 5) {
+				fprintf(stderr, "voce mescolata: valore %.0f, IP %s\n", r.value, peer);
+			}
+		}
+		if (!running) break;
+	}
+	CHECKF(mixed == 0, "%ld letture mescolate su %ld", mixed, reads);
+	CHECK(reads > 0);
+	CHECK(get(c, &server, 'h', "torino", TTL_MS, &r, peer) == 0);
+	// l'ultima scrittura di uno degli scrittori
+	CHECKF((int)r.value % 1000000 == WRITES - 1 && (int)r.value / 1000000 >= 1 &&
+			(int)r.value / 1000000 <= WRITERS, "valore finale %.0f", r.value);
+	rcache_close(c);
+
+	// un file di formato diverso non viene usato
+	char junk[4096];
+	memset(junk, 'x', sizeof(junk));
+	int fd = open(path, O_WRONLY | O_TRUNC);
+	CHECK(fd >= 0 && write(fd, junk, sizeof(junk)) == (ssize_t)sizeof(junk));
+	close(fd);
+	int saved = dup(STDERR_FILENO);
+	if (!freopen("/dev/null", "w", stderr)) return 2;
+	c = rcache_open(path);
+	fflush(stderr);
+	dup2(saved, STDERR_FILENO);
+	close(saved);
+	CHECK(c == NULL);
+	unlink(path);
+	return test_done("unita/rcache");
+}
@@ -0,0 +1,159 @@
+/*
+ * test_snapshot.c
+ *
+ * Test della tabella snapshot (snapshot.h) sotto ricaricamenti del
+ * dataset: il thread di aggiornamento rigenera la tabella ogni
+ * millisecondo mentre il main alterna due dataset con intervalli
+ * disgiunti (valori positivi nel primo, negativi nel secondo) e alcuni
+ * thread leggono in continuazione. Ogni valore che snapshot_read
+ * accetta per una versione del dataset deve cadere nell'intervallo di
+ * quella versione: un lettore che mescolasse la sorgente di un buffer
+ * con i valori dell'altro lo vedrebbe fuori intervallo.
+ *
+ * Uso: test_snapshot <dataset> <primo.wxd> <secondo.wxd>
+ * I due file sono generati da run_tests.sh con CITIES città; il primo
+ * viene copiato sul percorso del dataset all'avvio.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "dataset.h"
+#include "snapshot.h"
+#include "rng.h"
+
+#define CITIES   300
+#define READERS  3
+#define RELOADS  40
+#define EPSILON  0.01f
+
+static const char *live, *files[2];
+static atomic_int stop;
+static atomic_long hits, misses, wrong;
+
+static void sleep_ms(long ms) {
+	struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+	nanosleep(&ts, NULL);
+}
+
+// Copia src accanto a live e la rinomina, come fa mkdataset
+static int install(const char *src) {
+	char tmp[512];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", live);
+	FILE *in = fopen(src, "rb"), *out = fopen(tmp, "wb");
+	if (!in || !out) {
+		if (in) fclose(in);
+		if (out) fclose(out);
+		return -1;
+	}
+	char buf[65536];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), in)) > 0) fwrite(buf, 1, n, out);
+	fclose(in);
+	if (fclose(out) != 0) return -1;
+	return rename(tmp, live);
+}
+
+// Intervallo di (città, tipo) nel dataset della versione indicata: le
+// versioni dispari sono il primo file, le pari il secondo
+static void range_of(unsigned int version, int city, int type, float *lo, float *hi) {
+	float base = (float)(city * 10 + type);
+	if (version & 1) {
+		*lo = base;
+		*hi = base + 0.5f;
+	} else {
+		*lo = -base - 0.5f;
+		*hi = -base;
+	}
+}
+
+static void *reader_main(void *arg) {
+	rng_seed_thread((uint64_t)(uintptr_t)arg + 1);
+	rng_t *r = rng_thread();
+	while (!atomic_load(&stop)) {
+		int city = (int)rng_range(r, CITIES);
+		int type = (int)rng_range(r, WEATHER_TYPES);
+		dataset_read_begin();
+		unsigned int version = dataset_version(dataset_current());
+		float v;
+		if (snapshot_read(version, city, type, &v) == 0) {
+			float lo, hi;
+			range_of(version, city, type, &lo, &hi);
+			if (v < lo - EPSILON || v > hi + EPSILON) {
+				if (atomic_fetch_add(&wrong, 1) < 5) {
+					fprintf(stderr, "versione %u, città %d, tipo %d: %.2f fuori da [%.2f, %.2f]\n",
+							version, city, type, v, lo, hi);
+				}
+			}
+			atomic_fetch_add(&hits, 1);
+		} else {
+			atomic_fetch_add(&misses, 1);
+		}
+		dataset_read_end();
+	}
+	return NULL;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 4) {
+		fprintf(stderr, "uso: %s <dataset> <primo.wxd> <secondo.wxd>\n", argv[0]);
+		return 2;
+	}
+	live = argv[1];
+	files[0] = argv[2];
+	files[1] = argv[3];
+	// i messaggi di caricamento del dataset non servono nell'esito
+	int saved = dup(STDOUT_FILENO);
+	if (!freopen("/dev/null", "w", stdout)) return 2;
+	if (install(files[0]) != 0 || dataset_open(live) != 0) {
+		fprintf(stderr, "dataset %s non valido\n", files[0]);
+		return 2;
+	}
+	CHECK(dataset_city_count(dataset_current()) == CITIES);
+	CHECK(snapshot_start(1) == 0);
+	CHECK(snapshot_enabled());
+
+	// prima del ricaricamento la tabella e' gia' valida
+	float v, lo, hi;
+	CHECK(snapshot_read(1, 7, 2, &v) == 0);
+	range_of(1, 7, 2, &lo, &hi);
+	CHECKF(v >= lo - EPSILON && v <= hi + EPSILON, "%.2f", v);
+	// una versione diversa da quella della tabella ripiega sul generatore
+	CHECK(snapshot_read(2, 7, 2, &v) == -1);
+
+	unsigned int gen = snapshot_generation();
+	pthread_t th[READERS];
+	for (long i = 0; i < READERS; i++) pthread_create(&th[i], NULL, reader_main, (void *)i);
+	for (int i = 1; i <= RELOADS; i++) {
+		sleep_ms(5);
+		CHECK(install(files[i & 1]) == 0);
+		CHECK(dataset_reload() == 0);
+	}
+	sleep_ms(20);
+	atomic_store(&stop, 1);
+	for (int i = 0; i < READERS; i++) pthread_join(th[i], NULL);
+
+	CHECKF(atomic_load(&wrong) == 0, "%ld letture fuori intervallo", atomic_load(&wrong));
+	CHECKF(atomic_load(&hits) > 0, "nessuna lettura dalla tabella (%ld ripieghi)", atomic_load(&misses));
+	CHECK(snapshot_generation() != gen);
+
+	// a tabella rigenerata la versione corrente torna leggibile
+	dataset_read_begin();
+	unsigned int version = dataset_version(dataset_current());
+	CHECK(version == RELOADS + 1);
+	CHECK(snapshot_read(version, CITIES - 1, 3, &v) == 0);
+	range_of(version, CITIES - 1, 3, &lo, &hi);
+	CHECKF(v >= lo - EPSILON && v <= hi + EPSILON, "%.2f", v);
+	dataset_read_end();
+
+	fflush(stdout);
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+	return test_done("unita/snapshot");
+}
@@ -0,0 +1,90 @@
+/*
+ * test_timer.c
+ *
+ * Test della ruota temporale (timer.h) contro un modello a forza bruta:
+ * una sequenza casuale di armamenti, spostamenti (anche oltre un giro
+ * della ruota), annullamenti e avanzamenti del tempo. A ogni avanzamento
+ * timer_expired deve estrarre esattamente le voci armate e scadute, una
+ * sola volta; timer_visit deve vedere tutte e sole le voci armate.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "test.h"
+#include "timer.h"
+#include "rng.h"
+
+#define ENTRIES 2000
+#define STEPS   200000
+#define SPAN_MS (3 * TIMER_SLOTS * TIMER_TICK_MS) // scadenze fino a tre giri
+
+static timer_entry_t entries[ENTRIES];
+static int armed[ENTRIES];
+static uint64_t expire[ENTRIES];
+static int visited[ENTRIES];
+
+static void visit(timer_entry_t *e, void *arg) {
+	(void)arg;
+	visited[e - entries]++;
+}
+
+static void check_visit(timer_wheel_t *w) {
+	memset(visited, 0, sizeof(visited));
+	timer_visit(w, visit, NULL);
+	unsigned int n = 0;
+	for (int k = 0; k < ENTRIES; k++) {
+		CHECKF(visited[k] == armed[k], "voce %d visitata %d volte (armata %d)", k, visited[k], armed[k]);
+		n += (unsigned int)armed[k];
+	}
+	CHECKF(w->count == n, "%u voci contate, %u armate", w->count, n);
+}
+
+int main(void) {
+	static timer_wheel_t w;
+	uint64_t now = 1000;
+	timer_init(&w, now);
+	CHECK(timer_timeout_ms(&w) == -1);
+	CHECK(timer_expired(&w, now) == NULL);
+
+	rng_seed_thread(1);
+	rng_t *r = rng_thread();
+	long fired = 0;
+	for (int step = 0; step < STEPS && test_failures < 10; step++) {
+		int i = (int)rng_range(r, ENTRIES);
+		switch (rng_range(r, 4)) {
+			case 0:
+			case 1:
+				expire[i] = now + rng_range(r, SPAN_MS);
+				timer_set(&w, &entries[i], expire[i]);
+				armed[i] = 1;
+				break;
+			case 2:
+				timer_cancel(&w, &entries[i]);
+				armed[i] = 0;
+				break;
+			default: {
+				now += rng_range(r, 50);
+				timer_entry_t *e;
+				while ((e = timer_expired(&w, now)) != NULL) {
+					int k = (int)(e - entries);
+					CHECKF(armed[k] && expire[k] <= now, "voce %d estratta (armata %d, scadenza %llu, ora %llu)",
+							k, armed[k], (unsigned long long)expire[k], (unsigned long long)now);
+					CHECK(e->next == NULL);
+					armed[k] = 0;
+					fired++;
+				}
+				for (int k = 0; k < ENTRIES; k++) {
+					CHECKF(!armed[k] || expire[k] > now, "voce %d scaduta a %llu non estratta alle %llu", k,
+							(unsigned long long)expire[k], (unsigned long long)now);
+				}
+				break;
+			}
+		}
+		if (step % 10000 == 0) check_visit(&w);
+	}
+	check_visit(&w);
+	CHECKF(fired > STEPS / 10, "solo %ld scadenze", fired);
+	CHECK(w.count == 0 || timer_timeout_ms(&w) == TIMER_TICK_MS);
+	return test_done("unita/timer");
+}